@@ -30,3 +30,24 @@ AC_DEFUN(TCLSDL_SDL_CONFIG, [
     AC_SUBST(SDL_CFLAGS)
     AC_SUBST(SDL_LIBS)
 ])
+
+#-------------------------------------------------------------------------
+# TCLSDL_ZLIB
+#
+#	Decode PNG images if we can link against zlib
+#
+#-------------------------------------------------------------------------
+
+AC_DEFUN(TCLSDL_ZLIB, [
+    AC_MSG_CHECKING([for zlib])
+    tclsdl_save_LIBS=$LIBS
+    LIBS="$LIBS -lz"
+    AC_TRY_LINK([#include <zlib.h>], [inflateEnd(0);],
+        [tclsdl_zlib=yes], [tclsdl_zlib=no])
+    LIBS=$tclsdl_save_LIBS
+    AC_MSG_RESULT([$tclsdl_zlib])
+    if test "$tclsdl_zlib" = "yes" ; then
+        AC_DEFINE(HAVE_ZLIB, 1, [Decode PNG images with zlib])
+        SDL_LIBS="$SDL_LIBS -lz"
+    fi
+])
@@ -10,9 +10,7 @@ if {[file exists [file join Release tclsdl.dll]]} {
 
 package require Tclsdl
 
-namespace eval App {
-    variable uid 0
-}
+namespace eval App {}
 
 proc ::sdl::onEvent {type args} {
     variable ::App::App
@@ -25,6 +23,7 @@ proc ::sdl::onEvent {type args} {
             set App(width) $w
             set App(height) $h
             $App(screen) configure -width $w -height $h
+            $App(sprites) configure -bounds [list 0 0 $w $h]
         }
         Motion {}
         Enter {}
@@ -51,86 +50,53 @@ proc App::Paint {} {
     variable App
     #$App(bg) blit $App(screen) 0 0
     $App(screen) fill 0x00c0c0c0
-    foreach Sprite $App(sprites) {
-        upvar #0 $Sprite sprite
-        $sprite(surface) blit $App(screen) $sprite(pos_x) $sprite(pos_y) \
-            [lindex $sprite(regions) $sprite(region_index)]
-    }
+    $App(sprites) render $App(screen)
     $App(screen) flip
     return
 }
 
+# Movement and wall bouncing happen inside the sprite set. We only
+# need to react to the sprites that hit a wall on this step.
 proc App::Update {} {
     variable App
-    foreach Sprite $App(sprites) {
-        upvar #0 $Sprite sprite
-        foreach {dx dy} $sprite(vector) break
-        incr sprite(pos_x) $dx
-        incr sprite(pos_y) $dy
-        set ow 0
-        if {$sprite(pos_x) < 1} {
-            set sprite(vector) [list $sprite(speed) $dy]
-            set ow 1
-        } elseif {$sprite(pos_x) > ($App(width) - 82)} {
-            set sprite(vector) [list -$sprite(speed) $dy]
-            set ow 1
-        }
-        if {$sprite(pos_y) < 1} {
-            set sprite(vector) [list $dx $sprite(speed)]
-            set ow 1
-        } elseif {$sprite(pos_y) > ($App(height) - 82)} {
-            set sprite(vector) [list $dx -$sprite(speed)]
-            set ow 1
+    foreach id [$App(sprites) step 1] {
+        if {[info exists App(aid,$id)]} {
+            after cancel $App(aid,$id)
         }
-        if {$ow} {
-            if {$sprite(aid) ne {}} {
-                after cancel $sprite(aid)
-            }
-            set sprite(region_index) 4
-            set sprite(aid) [after 150 \
-                                 [list [namespace origin UpdateFace] $Sprite]]
-            sdl::event "<<Bump>>" [clock clicks -milliseconds]
-            if {[info exists App(beep)]} {
-                #if {[$App(beep) playing]} { $App(beep) halt }
-                $App(beep) play -channel 1
-            }
+        $App(sprites) sprite $id -region 4
+        set App(aid,$id) [after 150 [list [namespace origin UpdateFace] $id]]
+        sdl::event "<<Bump>>" [clock clicks -milliseconds]
+        if {[info exists App(beep)]} {
+            #if {[$App(beep) playing]} { $App(beep) halt }
+            $App(beep) play -channel 1
         }
     }
     Paint
     after 30 [list [namespace origin Update]]
 }
 
-proc App::UpdateFace {Sprite} {
-    upvar #0 $Sprite sprite
-    foreach {dx dy} $sprite(vector) break
+proc App::UpdateFace {id} {
+    variable App
+    unset -nocomplain App(aid,$id)
+    set dx [$App(sprites) sprite $id -vx]
+    set dy [$App(sprites) sprite $id -vy]
     if {$dx < 0} {
-        set sprite(region_index) [expr {($dy < 0) ? 1 : 2}]
+        set region [expr {($dy < 0) ? 1 : 2}]
     } else {
-        set sprite(region_index) [expr {($dy < 0) ? 0 : 3}]
+        set region [expr {($dy < 0) ? 0 : 3}]
     }
-    set sprite(aid) {}
+    $App(sprites) sprite $id -region $region
 }        
     
-proc App::CreateSprite {surface} {
-    variable uid
-    set Sprite [namespace current]::sprite[incr uid]
-    upvar #0 $Sprite sprite
-    array set sprite {aid {}}
-    set sprite(surface) $surface
-    set sprite(pos_x) [expr {int(rand() * 32) * 20}]
-    set sprite(pos_y) [expr {int(rand() * 24) * 10}]
-    set sprite(speed) [expr {int(rand() * 12) + 3}]
-    set dir [expr {(rand() < 0.5) ? 1 : -1}]
-    set sprite(vector) [list [expr {$dir * $sprite(speed)}] $sprite(speed)]
-    set sprite(region_index) 0
-    set sprite(regions) [list {0 0 93 82} {94 0 84 82} {179 0 82 82} \
-                             {262 0 86 82} { 348 0 89 82}]
-    return $Sprite
-}
-
 proc App::AddSprite {} {
     variable App
-    lappend App(sprites) [CreateSprite $App(faces)]
+    set speed [expr {int(rand() * 12) + 3}]
+    set dir [expr {(rand() < 0.5) ? 1 : -1}]
+    $App(sprites) spawn [$App(atlas) surface] \
+        -x [expr {int(rand() * 32) * 20}] \
+        -y [expr {int(rand() * 24) * 10}] \
+        -vx [expr {$dir * $speed}] -vy $speed \
+        -regions $App(regions)
 }
 
 proc App::Main {} {
@@ -141,8 +107,18 @@ proc App::Main {} {
     set App(screen) [sdl::surface -resizable \
                          -width $App(width) -height $App(height)]
     #set App(bg) [sdl::surface -bitmap [file join $dir images ball_bg.bmp]]
-    set App(faces) [sdl::surface -bitmap [file join $dir images faces.bmp]]
-    $App(faces) setcolorkey 0x00ff00ff
+    set faces [sdl::surface -bitmap [file join $dir images faces.bmp]]
+    $faces setcolorkey 0x00ff00ff
+
+    # Pack the faces into an atlas, the colour key becomes transparency
+    set App(atlas) [sdl::atlas create -width 512 -height 128 -padding 1]
+    set App(regions) {}
+    foreach face {upright upleft downleft downright bump} \
+        rect {{0 0 93 82} {94 0 84 82} {179 0 82 82}
+            {262 0 86 82} {348 0 89 82}} {
+        lappend App(regions) [$App(atlas) add $face $faces $rect]
+    }
+    $faces delete
 
     if {0} {
         sdl::mixer init -frequency 11025
@@ -152,7 +128,8 @@ proc App::Main {} {
     }
 
     set App(forever) 0
-    set App(sprites) {}
+    set App(sprites) [sdl::spriteset -bounds \
+                          [list 0 0 $App(width) $App(height)]]
     for {set n 0} {$n < 1} {incr n} { AddSprite }
     Paint
     after 20 [list [namespace origin Update]]
@@ -0,0 +1,26 @@
+# Benchmark: composite a full screen layer onto the screen with each
+# blend mode and report the achieved throughput.
+#
+#   tclsh blend.tcl ?width? ?height? ?iterations?
+
+package require Tclsdl
+
+set width  [expr {[llength $argv] > 0 ? [lindex $argv 0] : 640}]
+set height [expr {[llength $argv] > 1 ? [lindex $argv 1] : 480}]
+set iters  [expr {[llength $argv] > 2 ? [lindex $argv 2] : 100}]
+
+set screen [sdl::surface -width $width -height $height -bpp 32]
+set layer [sdl::surface -width $width -height $height -bpp 32]
+$screen generate {x ^ y} {x * 2} {y * 2}
+$layer generate {255 - x} {t} {x ^ y}
+
+foreach mode {avg add sub mul screen alpha} {
+    $layer blend $screen 0 0 -mode $mode -alpha 128
+    set usec [lindex [time {
+        $layer blend $screen 0 0 -mode $mode -alpha 128
+    } $iters] 0]
+    # each pixel is read from both surfaces and written back once
+    set mbytes [expr {$width * $height * 4 * 3 / 1048576.0}]
+    puts [format "%-8s %10.1f us/frame %8.1f MB/s" \
+              $mode $usec [expr {$mbytes / ($usec / 1e6)}]]
+}
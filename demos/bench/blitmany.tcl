@@ -0,0 +1,48 @@
+# Benchmark: compare drawing N sprites with one "blit" call per sprite
+# against a single "blitmany" call using the list and packed forms.
+#
+#   tclsh blitmany.tcl ?sprites? ?iterations?
+
+package require Tclsdl
+
+set count [expr {[llength $argv] > 0 ? [lindex $argv 0] : 500}]
+set iters [expr {[llength $argv] > 1 ? [lindex $argv 1] : 50}]
+
+set dir [file dirname [info script]]
+set screen [sdl::surface -width 640 -height 480]
+set faces [sdl::surface -bitmap [file join $dir .. ball images faces.bmp]]
+$faces setcolorkey 0x00ff00ff
+set regions {{0 0 93 82} {94 0 84 82} {179 0 82 82} {262 0 86 82} {348 0 89 82}}
+
+set sprites {}
+set records {}
+set packed {}
+for {set n 0} {$n < $count} {incr n} {
+    set x [expr {int(rand() * 560)}]
+    set y [expr {int(rand() * 400)}]
+    set rect [lindex $regions [expr {$n % 5}]]
+    lappend sprites [list $x $y $rect]
+    lappend records $faces $x $y $rect
+    lappend packed $x $y {*}$rect
+}
+set packed [binary format s* $packed]
+
+proc per_call {} {
+    foreach sprite $::sprites {
+        lassign $sprite x y rect
+        $::faces blit $::screen $x $y $rect
+    }
+}
+proc batched {} {
+    $::screen blitmany $::records
+}
+proc packed {} {
+    $::screen blitmany -packed $::faces $::packed
+}
+
+foreach test {per_call batched packed} {
+    $test
+    set usec [lindex [time $test $iters] 0]
+    puts [format "%-10s %10.1f us/frame %8.3f us/sprite" \
+              $test $usec [expr {double($usec) / $count}]]
+}
@@ -0,0 +1,81 @@
+# Benchmark: time loading a set of BMP assets at start-up without the
+# image cache, with an empty cache and with a warm cache. Each start is
+# a separate process so nothing is carried over in memory.
+#
+#   tclsh cache.tcl ?images? ?size? ?starts?
+
+package require Tclsdl
+
+# One start: load every image once and report the time and cache stats.
+if {[lindex $argv 0] eq "-start"} {
+    lassign $argv - cachedir imagedir
+    set screen [sdl::surface -width 640 -height 480]
+    sdl::config -cachedir $cachedir
+    set files [lsort [glob -directory $imagedir *.bmp]]
+    set usec [lindex [time {
+        foreach file $files {
+            [sdl::surface -bitmap $file] delete
+        }
+    }] 0]
+    puts [list $usec [sdl::cache stats]]
+    exit 0
+}
+
+set count [expr {[llength $argv] > 0 ? [lindex $argv 0] : 100}]
+set size [expr {[llength $argv] > 1 ? [lindex $argv 1] : 256}]
+set starts [expr {[llength $argv] > 2 ? [lindex $argv 2] : 3}]
+
+if {[info exists env(TMP)]} {
+    set tmp $env(TMP)
+} else {
+    set tmp /tmp
+}
+set root [file join $tmp tclsdl-cache-bench-[pid]]
+set imagedir [file join $root images]
+set cachedir [file join $root cache]
+file mkdir $imagedir $cachedir
+
+# Write 24 bpp bottom-up BMP files, the form every BMP reader accepts.
+proc writebmp {file surface w h} {
+    set bgr [regsub -all {(...).} [$surface export -format bgra8888] {\1}]
+    set pad [string repeat \0 [expr {(4 - ($w * 3) % 4) % 4}]]
+    set rowBytes [expr {$w * 3}]
+    set pixels {}
+    for {set y [expr {$h - 1}]} {$y >= 0} {incr y -1} {
+        append pixels [string range $bgr [expr {$y * $rowBytes}] \
+                           [expr {($y + 1) * $rowBytes - 1}]] $pad
+    }
+    set f [open $file wb]
+    puts -nonewline $f [binary format a2issiiiissiiiiii \
+        BM [expr {54 + [string length $pixels]}] 0 0 54 \
+        40 $w $h 1 24 0 [string length $pixels] 2835 2835 0 0]
+    puts -nonewline $f $pixels
+    close $f
+}
+set src [sdl::surface -width $size -height $size -bpp 32]
+for {set n 0} {$n < $count} {incr n} {
+    $src generate "(x * $n + y) & 255" "(x ^ y) & 255" "(y * 3 + $n) & 255"
+    writebmp [file join $imagedir [format img%04d.bmp $n]] $src $size $size
+}
+$src delete
+
+proc start {cachedir} {
+    global imagedir
+    return [exec [info nameofexecutable] [info script] -start \
+                $cachedir $imagedir]
+}
+
+proc report {name result} {
+    global count
+    lassign $result usec stats
+    puts [format "%-8s %10.0f us  %7.0f us/image  %s" $name $usec \
+              [expr {double($usec) / $count}] $stats]
+}
+
+puts "$count images of ${size}x${size}"
+report nocache [start {}]
+report cold [start $cachedir]
+for {set n 0} {$n < $starts} {incr n} {
+    report warm [start $cachedir]
+}
+file delete -force $root
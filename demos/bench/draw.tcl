@@ -0,0 +1,76 @@
+# Benchmark: draw many random shapes of each kind with one packed call
+# and compare circles against plotting the same discs one pixel at a
+# time from Tcl.
+#
+#   tclsh draw.tcl ?count? ?iterations?
+
+package require Tclsdl
+
+set count [expr {[llength $argv] > 0 ? [lindex $argv 0] : 2000}]
+set iters [expr {[llength $argv] > 1 ? [lindex $argv 1] : 20}]
+
+set screen [sdl::surface -width 640 -height 480 -bpp 32]
+expr {srand(1)}
+
+proc rnd {n} { expr {int(rand() * $n)} }
+
+foreach {shape args} {
+    line     {640 480 640 480}
+    hline    {640 640 480}
+    rect     {640 480 64 48}
+    circle   {640 480 24}
+    ellipse  {640 480 32 16}
+    triangle {640 480 640 480 640 480}
+} {
+    set values {}
+    set colors {}
+    for {set i 0} {$i < $count} {incr i} {
+        foreach n $args { lappend values [rnd $n] }
+        lappend colors [rnd 0x1000000]
+    }
+    set coords [binary format s* $values]
+    set colors [binary format n* $colors]
+    foreach fill {{} -fill} {
+        if {$fill ne "" && $shape in {line hline}} continue
+        set usec [lindex [time {
+            $screen $shape {*}$fill -packed -colors $colors 0 $coords
+        } $iters] 0]
+        puts [format "%-8s %-5s %10.1f us/call %8.2f us/shape" \
+                  $shape $fill $usec [expr {double($usec) / $count}]]
+    }
+}
+
+# the same discs plotted per pixel, as the demos used to
+set usec [lindex [time {
+    for {set i 0} {$i < 20} {incr i} {
+        set cx [expr {8 + [rnd 624]}]; set cy [expr {8 + [rnd 464]}]
+        for {set y -8} {$y <= 8} {incr y} {
+            for {set x -8} {$x <= 8} {incr x} {
+                if {$x * $x + $y * $y <= 72} {
+                    $screen pixel [expr {$cx+$x}] [expr {$cy+$y}] {255 0 0}
+                }
+            }
+        }
+    }
+}] 0]
+puts [format "%-14s %10.2f us/shape" "pixel circle" [expr {$usec / 20.0}]]
+set usec [lindex [time {
+    $screen circle -fill {255 0 0} {320 240 8}
+} 1000] 0]
+puts [format "%-14s %10.2f us/shape" "circle" $usec]
+
+# single pixels: one packed plot and sample against the pixel command
+set coords {}
+for {set i 0} {$i < $count} {incr i} {
+    lappend coords [rnd 640] [rnd 480]
+}
+set packed [binary format s* $coords]
+set color [binary format n 0xff8000]
+set usec [lindex [time {$screen plot $packed $color} $iters] 0]
+puts [format "%-14s %10.3f us/pixel" "plot" [expr {double($usec) / $count}]]
+set usec [lindex [time {$screen sample $packed} $iters] 0]
+puts [format "%-14s %10.3f us/pixel" "sample" [expr {double($usec) / $count}]]
+set usec [lindex [time {
+    foreach {x y} $coords { $screen pixel $x $y {255 128 0} }
+}] 0]
+puts [format "%-14s %10.3f us/pixel" "pixel" [expr {double($usec) / $count}]]
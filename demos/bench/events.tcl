@@ -0,0 +1,84 @@
+# Benchmark: events dispatched per second in each event mode, through
+# the generic sdl::onEvent handler, through a direct sdl::bind binding,
+# through an sdl::batch handler and with the event kind unbound.
+# Events are queued with sdl::event in batches that fit in the SDL
+# event queue.
+#
+#   tclsh events.tcl ?events? ?batch?
+
+package require Tclsdl
+
+set total [expr {[llength $argv] > 0 ? [lindex $argv 0] : 100000}]
+set batch [expr {[llength $argv] > 1 ? [lindex $argv 1] : 100}]
+
+set count 0
+proc ::sdl::onEvent {type args} {
+    switch -exact -- $type {
+        Motion - ButtonPress - ButtonRelease {}
+        User { incr ::count }
+    }
+}
+proc user {name value} {
+    incr ::count
+}
+proc batch {events} {
+    incr ::count [expr {[llength $events] / 6}]
+}
+
+# Queue total events and wait until the handler has seen them all.
+proc run {} {
+    global total batch count
+    set count 0
+    set usec [lindex [time {
+        for {set n 0} {$n < $total} {incr n $batch} {
+            for {set i 0} {$i < $batch} {incr i} {
+                sdl::event tick $i
+            }
+            set want [expr {$n + $batch}]
+            while {$count < $want} {
+                update
+            }
+        }
+    }] 0]
+    return [expr {$total * 1e6 / $usec}]
+}
+
+# Unbound events are never seen by Tcl. In poll mode a single update
+# drains the SDL queue, so that is the end of each batch.
+proc unbound {} {
+    global total batch
+    set usec [lindex [time {
+        for {set n 0} {$n < $total} {incr n $batch} {
+            for {set i 0} {$i < $batch} {incr i} {
+                sdl::event tick $i
+            }
+            update
+        }
+    }] 0]
+    return [expr {$total * 1e6 / $usec}]
+}
+
+puts [format "%-8s %12s %12s %12s %12s" mode onEvent bind batch unbound]
+foreach mode {poll thread} {
+    if {[catch {sdl::config -eventmode $mode} err]} {
+        puts [format "%-8s %s" $mode $err]
+        continue
+    }
+    sdl::bind User {sdl::onEvent User}
+    set generic [run]
+    sdl::bind User user
+    set direct [run]
+    sdl::batch batch
+    set batched [run]
+    sdl::batch {}
+    if {$mode eq "poll"} {
+        sdl::bind User {}
+        set skipped [format %12.0f [unbound]]
+    } else {
+        set skipped [format %12s -]
+    }
+    puts [format "%-8s %12.0f %12.0f %12.0f %12s  events/s" \
+              $mode $generic $direct $batched $skipped]
+}
+sdl::config -eventmode poll
+sdl::bind User {sdl::onEvent User}
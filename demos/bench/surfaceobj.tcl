@@ -0,0 +1,38 @@
+# Benchmark: cost of resolving a surface argument. "cached" passes the
+# same destination object on every call so the surface handle is looked
+# up once; "lookup" passes a fresh string each time which forces a
+# command table lookup per call.
+#
+#   tclsh surfaceobj.tcl ?calls? ?iterations?
+
+package require Tclsdl
+
+set count [expr {[llength $argv] > 0 ? [lindex $argv 0] : 1000}]
+set iters [expr {[llength $argv] > 1 ? [lindex $argv 1] : 50}]
+
+set screen [sdl::surface -width 640 -height 480]
+set tile [sdl::surface -width 1 -height 1]
+
+proc cached {} {
+    set dst $::screen
+    for {set n 0} {$n < $::count} {incr n} {
+        $::tile blit $dst 0 0
+    }
+}
+proc lookup {} {
+    for {set n 0} {$n < $::count} {incr n} {
+        $::tile blit [string range $::screen 0 end] 0 0
+    }
+}
+proc baseline {} {
+    for {set n 0} {$n < $::count} {incr n} {
+        string range $::screen 0 end
+    }
+}
+
+foreach test {cached lookup baseline} {
+    $test
+    set usec [lindex [time $test $iters] 0]
+    puts [format "%-10s %10.1f us/iter %8.3f us/call" \
+              $test $usec [expr {double($usec) / $count}]]
+}
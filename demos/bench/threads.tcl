@@ -0,0 +1,92 @@
+# Benchmark: time the banded software rendering paths with 1 .. n
+# render threads and check that each thread count produces exactly the
+# pixels of the single threaded run.
+#
+#   tclsh threads.tcl ?maxthreads? ?width? ?height? ?iterations?
+
+package require Tclsdl
+
+set maxthreads [expr {[llength $argv] > 0 ? [lindex $argv 0] : 0}]
+set W [expr {[llength $argv] > 1 ? [lindex $argv 1] : 1920}]
+set H [expr {[llength $argv] > 2 ? [lindex $argv 2] : 1080}]
+set iters [expr {[llength $argv] > 3 ? [lindex $argv 3] : 10}]
+
+# the default thread count is one per processor
+if {$maxthreads <= 0} {
+    sdl::config -threads 0
+    set maxthreads [sdl::config -threads]
+}
+
+# Once the screen exists every new surface takes the display format, so
+# the 8 bpp surface for the palette import path is loaded from an 8 bpp
+# bitmap before the screen is made.
+proc bitmap8 {w h} {
+    set row [expr {($w + 3) & ~3}]
+    set offset [expr {14 + 40 + 256 * 4}]
+    set fd [file tempfile path .bmp]
+    fconfigure $fd -translation binary
+    puts -nonewline $fd [binary format a2issi \
+        BM [expr {$offset + $row * $h}] 0 0 $offset]
+    puts -nonewline $fd [binary format iiissiiiiii \
+        40 $w $h 1 8 0 [expr {$row * $h}] 2835 2835 256 0]
+    for {set i 0} {$i < 256} {incr i} {
+        puts -nonewline $fd [binary format cccc $i $i $i 0]
+    }
+    puts -nonewline $fd [binary format x[expr {$row * $h}]]
+    close $fd
+    set surface [sdl::surface -bitmap $path]
+    file delete $path
+    return $surface
+}
+
+set pal [bitmap8 $W $H]
+set src [sdl::surface -width $W -height $H -bpp 32]
+set dst [sdl::surface -width $W -height $H -bpp 32]
+if {[$pal configure -bpp] != 8} {
+    puts "could not make an 8 bpp surface"
+    exit 1
+}
+$src generate {x ^ y} {x * 3} {y * 5} {(x + y) & 255}
+set rgba [$src export]
+
+set tests {
+    fill       {$dst fill 0x336699 {7 5 1900 1070}}
+    blend      {$src blend $dst 3 2 -mode alpha}
+    export     {$src export -format rgb565}
+    import     {$dst import $rgba}
+    import8    {$pal import $rgba}
+    generate   {$dst generate -time 1.5 {sin(x/9.0)*127+128} {y & 255} {x*y & 255}}
+}
+
+proc run {name script} {
+    global iters
+    set usec [lindex [uplevel #0 [list time $script $iters]] 0]
+    return [expr {double($usec)}]
+}
+
+set base {}
+set reference {}
+for {set n 1} {$n <= $maxthreads} {incr n} {
+    sdl::config -threads $n
+    set line [format "%2d thread%s" $n [expr {$n == 1 ? " " : "s"}]]
+    foreach {name script} $tests {
+        $dst fill 0
+        $pal fill 0
+        set usec [run $name $script]
+        if {$name eq "export"} {
+            set result [uplevel #0 $script]
+        } else {
+            set result [list [$dst export] [$pal export]]
+        }
+        if {$n == 1} {
+            dict set base $name $usec
+            dict set reference $name $result
+        } elseif {$result ne [dict get $reference $name]} {
+            puts "$name: $n threads differ from 1 thread"
+            exit 1
+        }
+        append line [format "  %s %8.0f us x%.2f" $name $usec \
+                         [expr {[dict get $base $name] / $usec}]]
+    }
+    puts $line
+}
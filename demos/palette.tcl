@@ -40,26 +40,15 @@ wm title . $title
 
 proc init_buffer {screen} {
     global VIDEOX VIDEOY TONES
-    for {set y 0} {$y < $VIDEOY} {incr y} {
-        set row {}
-        for {set x 0} {$x < $VIDEOX} {incr x} {
-            set c1 [expr {int((sin(sqrt($y**2+$x**2)/8)+1)/2*$TONES)}]
-            set c2 [expr {int((sin(sqrt($y**2+($VIDEOX-$x)**2)/8)+1)/2*$TONES)}]
-            set c3 [expr {int((sin(sqrt(($VIDEOY-$y)**2+$x**2)/8)+1)/2*$TONES)}]
-            set c4 [expr {int((sin(sqrt(($VIDEOY-$y)**2+($VIDEOX-$x)**2)/8)+1)/2*$TONES)}]
-            $screen pixel $x $y [expr {($c1+$c2+$c3+$c4)/2}] 
-        }
+    $screen generate {
+        (int((sin(sqrt($y**2+$x**2)/8)+1)/2*$TONES)
+         + int((sin(sqrt($y**2+($VIDEOX-$x)**2)/8)+1)/2*$TONES)
+         + int((sin(sqrt(($VIDEOY-$y)**2+$x**2)/8)+1)/2*$TONES)
+         + int((sin(sqrt(($VIDEOY-$y)**2+($VIDEOX-$x)**2)/8)+1)/2*$TONES)) / 2
     }
 }
 
 
-proc rotate_palette {} {
-    global palette
-    set head [lindex $palette 0]
-    set palette [lrange $palette 1 end]
-    lappend palette $head
-}
-
 proc loop {speedvar body} {
     upvar 1 $speedvar speed
     uplevel 1 $body
@@ -67,7 +56,7 @@ proc loop {speedvar body} {
 }
 
 proc draw {screen} {
-    $screen setcolors [rotate_palette] 0
+    $screen palette cycle 0 256 1
     $screen flip
 }
 
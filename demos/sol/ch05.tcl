@@ -20,17 +20,23 @@ set sprite {
 0 0 0 0 0 0 1 1 1 1 0 0 0 0 0 0
 }
 
+# the sprite as horizontal runs {x0 x1 y} so it can be drawn in one call
+set runs {}
+for {set y 0} {$y < 16} {incr y} {
+    set row [lrange $sprite [expr {$y*16}] [expr {$y*16+15}]]
+    set ones [lsearch -all $row 1]
+    if {[llength $ones]} {
+        lappend runs [lindex $ones 0] [lindex $ones end] $y
+    }
+}
+
 proc draw_sprite {screen x y color} {
-    global sprite
-    set idx 0
-    foreach el $sprite {
-        set ax [expr {$x+($idx%16)}]
-        set ay [expr {$y+($idx/16)}]
-        if {$el} {
-            $screen pixel $ax $ay $color
-        }
-        incr idx
+    global runs
+    set coords {}
+    foreach {x0 x1 ry} $runs {
+        lappend coords [expr {$x+$x0}] [expr {$x+$x1}] [expr {$y+$ry}]
     }
+    $screen hline $color $coords
 }
 
 
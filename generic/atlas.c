@@ -0,0 +1,528 @@
+/*
+ * set atlas [sdl::atlas create -width W -height H ?-padding n?]
+ * $atlas add name surface ?rect?      ;# copy a surface or part of one
+ * $atlas add name -file filename ?rect?
+ * $atlas rect name                    ;# the region holding an image
+ * $atlas names ?pattern?
+ * $atlas surface                      ;# the surface holding the pixels
+ * $atlas delete
+ *
+ * Pack many small images into one large surface. Each image added is
+ * copied, alpha channel and colour key transparency included, into a
+ * free region of the atlas surface and is afterwards known by name. The
+ * region is returned as a rect object that is created once and then
+ * handed out again on every lookup, so blitting from the atlas
+ *
+ *   [$atlas surface] blit $screen $x $y [$atlas rect ball]
+ *
+ * never parses a rect. Regions are placed with a skyline bottom left
+ * packer: the free space is kept as the height of the used area across
+ * the atlas and an image goes where its top edge ends lowest.
+ *
+ * The atlas surface is an ordinary surface command that is deleted with
+ * the atlas, whatever it has been renamed to.
+ */
+
+#include "tclsdlInt.h"
+
+/*
+ * One horizontal segment of the skyline, the top of the used area
+ * between x and x + w.
+ */
+typedef struct SkylineNode {
+    int x, y, w;
+} SkylineNode;
+
+typedef struct AtlasRegion {
+    SDL_Rect  rect;
+    Tcl_Obj  *rectObj;          /* shared rect object for rect */
+} AtlasRegion;
+
+typedef struct Atlas {
+    Tcl_Command   token;
+    Tcl_Interp   *interp;
+    SurfaceData  *surfaceData;  /* the atlas surface, preserved */
+    int           width, height;
+    int           padding;      /* gap left right of and below images */
+    SkylineNode  *skyline;
+    int           nnodes;
+    int           size;         /* allocated skyline nodes */
+    Tcl_HashTable regions;      /* name -> AtlasRegion */
+} Atlas;
+
+/* ----------------------------------------------------------------------
+ * Skyline packer
+ *
+ * The packer works on a bin one padding wider and taller than the atlas
+ * so that images on the right and bottom edges need no gap.
+ */
+
+/*
+ * Find where a w x h box fits with the lowest top edge, preferring the
+ * narrowest segment on ties. Returns the skyline node to place it on or
+ * -1 if it does not fit.
+ */
+static int
+FindPosition(Atlas *atlasPtr, int w, int h, int *xPtr, int *yPtr)
+{
+    int binWidth = atlasPtr->width + atlasPtr->padding;
+    int binHeight = atlasPtr->height + atlasPtr->padding;
+    int best = -1, bestTop = binHeight + 1, bestWidth = 0;
+    int n, j, x, y, remaining;
+
+    for (n = 0; n < atlasPtr->nnodes; n++) {
+        x = atlasPtr->skyline[n].x;
+        if (x + w > binWidth) {
+            break;
+        }
+        y = 0;
+        for (j = n, remaining = w; remaining > 0; j++) {
+            if (atlasPtr->skyline[j].y > y) {
+                y = atlasPtr->skyline[j].y;
+            }
+            remaining -= atlasPtr->skyline[j].w;
+        }
+        if (y + h > binHeight) {
+            continue;
+        }
+        if (y + h < bestTop
+            || (y + h == bestTop && atlasPtr->skyline[n].w < bestWidth)) {
+            best = n;
+            bestTop = y + h;
+            bestWidth = atlasPtr->skyline[n].w;
+            *xPtr = x;
+            *yPtr = y;
+        }
+    }
+    return best;
+}
+
+/*
+ * Raise the skyline over a box placed at skyline node n.
+ */
+static void
+AddSkylineLevel(Atlas *atlasPtr, int n, int x, int y, int w, int h)
+{
+    SkylineNode *nodes;
+    int i;
+
+    if (atlasPtr->nnodes == atlasPtr->size) {
+        atlasPtr->size *= 2;
+        atlasPtr->skyline = (SkylineNode *)ckrealloc(
+            (char *)atlasPtr->skyline, atlasPtr->size * sizeof(SkylineNode));
+    }
+    nodes = atlasPtr->skyline;
+    memmove(nodes + n + 1, nodes + n,
+            (atlasPtr->nnodes - n) * sizeof(SkylineNode));
+    nodes[n].x = x;
+    nodes[n].y = y + h;
+    nodes[n].w = w;
+    atlasPtr->nnodes++;
+
+    /* trim or drop the segments now underneath the box */
+    for (i = n + 1; i < atlasPtr->nnodes; ) {
+        int shrink = x + w - nodes[i].x;
+
+        if (shrink <= 0) {
+            break;
+        }
+        if (nodes[i].w > shrink) {
+            nodes[i].x += shrink;
+            nodes[i].w -= shrink;
+            break;
+        }
+        memmove(nodes + i, nodes + i + 1,
+                (atlasPtr->nnodes - i - 1) * sizeof(SkylineNode));
+        atlasPtr->nnodes--;
+    }
+
+    /* join neighbours at the same height */
+    for (i = 0; i + 1 < atlasPtr->nnodes; ) {
+        if (nodes[i].y == nodes[i + 1].y) {
+            nodes[i].w += nodes[i + 1].w;
+            memmove(nodes + i + 1, nodes + i + 2,
+                    (atlasPtr->nnodes - i - 2) * sizeof(SkylineNode));
+            atlasPtr->nnodes--;
+        } else {
+            i++;
+        }
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+
+/*
+ * Copy the pixels of src, alpha channel included, into the atlas at
+ * rectPtr. Per pixel alpha sources are copied rather than blended by
+ * clearing SDL_SRCALPHA for the blit. Colour keyed pixels are skipped
+ * and so stay transparent in the atlas.
+ */
+static int
+CopyImage(SDL_Surface *src, SDL_Rect *srcRectPtr, SDL_Surface *dst,
+          SDL_Rect *rectPtr)
+{
+    Uint32 flags = src->flags & (SDL_SRCALPHA | SDL_RLEACCEL);
+    Uint8 alpha = src->format->alpha;
+    SDL_Rect dstRect = *rectPtr;
+    int r;
+
+    if (flags & SDL_SRCALPHA) {
+        SDL_SetAlpha(src, 0, alpha);
+    }
+    r = SDL_BlitSurface(src, srcRectPtr, dst, &dstRect);
+    if (flags & SDL_SRCALPHA) {
+        SDL_SetAlpha(src, flags, alpha);
+    }
+    return r;
+}
+
+static AtlasRegion *
+FindRegion(Tcl_Interp *interp, Atlas *atlasPtr, Tcl_Obj *nameObj)
+{
+    Tcl_HashEntry *entryPtr;
+
+    entryPtr = Tcl_FindHashEntry(&atlasPtr->regions, Tcl_GetString(nameObj));
+    if (entryPtr == NULL) {
+        Tcl_AppendResult(interp, "no region \"", Tcl_GetString(nameObj),
+                         "\" in atlas", NULL);
+        return NULL;
+    }
+    return (AtlasRegion *)Tcl_GetHashValue(entryPtr);
+}
+
+/*
+ * $atlas add name surface ?rect?
+ * $atlas add name -file filename ?rect?
+ *
+ * Returns the rect of the new region.
+ */
+static int
+AtlasAddCmd(ClientData clientData, Tcl_Interp *interp,
+            int objc, Tcl_Obj *const objv[])
+{
+    Atlas *atlasPtr = clientData;
+    SurfaceData *atlasData, *srcPtr;
+    SDL_Surface *src, *loaded = NULL;
+    SDL_Rect srcRect, rect;
+    AtlasRegion *regionPtr;
+    Tcl_HashEntry *entryPtr;
+    int n = 3, node, x, y, isNew;
+
+    if (objc > 3 && strcmp(Tcl_GetString(objv[3]), "-file") == 0) {
+        n++;
+    }
+    if (objc < n + 1 || objc > n + 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "name surface|-file filename ?rect?");
+        return TCL_ERROR;
+    }
+    if (Tcl_FindHashEntry(&atlasPtr->regions, Tcl_GetString(objv[2]))) {
+        Tcl_AppendResult(interp, "region \"", Tcl_GetString(objv[2]),
+                         "\" already exists", NULL);
+        return TCL_ERROR;
+    }
+    atlasData = atlasPtr->surfaceData;
+    if (atlasData->deleted) {
+        Tcl_AppendResult(interp, "the atlas surface has been deleted", NULL);
+        return TCL_ERROR;
+    }
+
+    if (n == 4) {
+        TclsdlDisplay display;
+
+        TclsdlGetDisplay(&display);
+        src = loaded = TclsdlLoadImage(Tcl_GetString(objv[4]), &display);
+        if (src == NULL) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+            return TCL_ERROR;
+        }
+    } else {
+        if (TclsdlGetSurfaceFromObj(interp, objv[3], &srcPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        src = srcPtr->surface;
+    }
+
+    srcRect.x = srcRect.y = 0;
+    srcRect.w = src->w;
+    srcRect.h = src->h;
+    if (objc == n + 2) {
+        SDL_Rect r;
+
+        if (TclsdlGetRectFromObj(interp, objv[n + 1], &r) != TCL_OK) {
+            goto error;
+        }
+        if (r.x < 0 || r.y < 0 || r.w == 0 || r.h == 0
+            || r.x + r.w > src->w || r.y + r.h > src->h) {
+            Tcl_AppendResult(interp, "rect must lie within the source image",
+                             NULL);
+            goto error;
+        }
+        srcRect = r;
+    }
+
+    node = FindPosition(atlasPtr, srcRect.w + atlasPtr->padding,
+                        srcRect.h + atlasPtr->padding, &x, &y);
+    if (node < 0) {
+        Tcl_AppendResult(interp, "no room in atlas for \"",
+                         Tcl_GetString(objv[2]), "\"", NULL);
+        goto error;
+    }
+    rect.x = (Sint16)x;
+    rect.y = (Sint16)y;
+    rect.w = srcRect.w;
+    rect.h = srcRect.h;
+    if (CopyImage(src, &srcRect, atlasData->surface, &rect) < 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+        goto error;
+    }
+    AddSkylineLevel(atlasPtr, node, x, y, srcRect.w + atlasPtr->padding,
+                    srcRect.h + atlasPtr->padding);
+    TclsdlSurfaceDamage(atlasData, &rect);
+    if (loaded) {
+        TclsdlFreeSurface(loaded);
+    }
+
+    regionPtr = (AtlasRegion *)ckalloc(sizeof(AtlasRegion));
+    regionPtr->rect = rect;
+    regionPtr->rectObj = TclsdlNewRectObj(&rect);
+    Tcl_IncrRefCount(regionPtr->rectObj);
+    entryPtr = Tcl_CreateHashEntry(&atlasPtr->regions,
+                                   Tcl_GetString(objv[2]), &isNew);
+    Tcl_SetHashValue(entryPtr, regionPtr);
+    Tcl_SetObjResult(interp, regionPtr->rectObj);
+    return TCL_OK;
+
+ error:
+    if (loaded) {
+        TclsdlFreeSurface(loaded);
+    }
+    return TCL_ERROR;
+}
+
+static int
+AtlasRectCmd(ClientData clientData, Tcl_Interp *interp,
+             int objc, Tcl_Obj *const objv[])
+{
+    Atlas *atlasPtr = clientData;
+    AtlasRegion *regionPtr;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "name");
+        return TCL_ERROR;
+    }
+    regionPtr = FindRegion(interp, atlasPtr, objv[2]);
+    if (regionPtr == NULL) {
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, regionPtr->rectObj);
+    return TCL_OK;
+}
+
+static int
+AtlasNamesCmd(ClientData clientData, Tcl_Interp *interp,
+              int objc, Tcl_Obj *const objv[])
+{
+    Atlas *atlasPtr = clientData;
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+    Tcl_Obj *listObj;
+    const char *pattern = NULL, *name;
+
+    if (objc < 2 || objc > 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?pattern?");
+        return TCL_ERROR;
+    }
+    if (objc == 3) {
+        pattern = Tcl_GetString(objv[2]);
+    }
+    listObj = Tcl_NewListObj(0, NULL);
+    for (entryPtr = Tcl_FirstHashEntry(&atlasPtr->regions, &search);
+         entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+        name = Tcl_GetHashKey(&atlasPtr->regions, entryPtr);
+        if (pattern == NULL || Tcl_StringMatch(name, pattern)) {
+            Tcl_ListObjAppendElement(interp, listObj,
+                                     Tcl_NewStringObj(name, -1));
+        }
+    }
+    Tcl_SetObjResult(interp, listObj);
+    return TCL_OK;
+}
+
+static int
+AtlasSurfaceCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    Atlas *atlasPtr = clientData;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "");
+        return TCL_ERROR;
+    }
+    if (!atlasPtr->surfaceData->deleted) {
+        Tcl_Obj *nameObj = Tcl_NewObj();
+        const char *name;
+
+        /* the name as created unless it was renamed into a namespace */
+        Tcl_GetCommandFullName(interp, atlasPtr->surfaceData->token, nameObj);
+        name = Tcl_GetString(nameObj);
+        if (strstr(name + 2, "::") == NULL) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj(name + 2, -1));
+            Tcl_DecrRefCount(nameObj);
+        } else {
+            Tcl_SetObjResult(interp, nameObj);
+        }
+    }
+    return TCL_OK;
+}
+
+static int
+AtlasDeleteCmd(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    Atlas *atlasPtr = clientData;
+    Tcl_DeleteCommandFromToken(interp, atlasPtr->token);
+    return TCL_OK;
+}
+
+struct Ensemble atlasEnsemble[] = {
+    { "add", AtlasAddCmd, NULL },
+    { "rect", AtlasRectCmd, NULL },
+    { "names", AtlasNamesCmd, NULL },
+    { "surface", AtlasSurfaceCmd, NULL },
+    { "delete", AtlasDeleteCmd, NULL },
+    { NULL, NULL, NULL },
+};
+
+static int
+AtlasEnsemble(ClientData clientData, Tcl_Interp *interp,
+              int objc, Tcl_Obj *const objv[])
+{
+    struct Ensemble *ensemble = atlasEnsemble;
+    int option = 1, index;
+
+    while (option < objc) {
+        if (Tcl_GetIndexFromObjStruct(interp, objv[option],
+                ensemble, sizeof(ensemble[0]), "command", 0, &index) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+
+        if (ensemble[index].command) {
+            return ensemble[index].command(clientData, interp, objc, objv);
+        }
+        ensemble = ensemble[index].ensemble;
+        ++option;
+    }
+    Tcl_WrongNumArgs(interp, option, objv, "command ?arg arg...?");
+    return TCL_ERROR;
+}
+
+static void
+AtlasCleanup(ClientData clientData)
+{
+    Atlas *atlasPtr = clientData;
+    Tcl_HashEntry *entryPtr;
+    Tcl_HashSearch search;
+    AtlasRegion *regionPtr;
+
+    for (entryPtr = Tcl_FirstHashEntry(&atlasPtr->regions, &search);
+         entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+        regionPtr = (AtlasRegion *)Tcl_GetHashValue(entryPtr);
+        Tcl_DecrRefCount(regionPtr->rectObj);
+        ckfree((char *)regionPtr);
+    }
+    Tcl_DeleteHashTable(&atlasPtr->regions);
+    if (!Tcl_InterpDeleted(atlasPtr->interp)
+        && !atlasPtr->surfaceData->deleted) {
+        Tcl_DeleteCommandFromToken(atlasPtr->interp,
+                                   atlasPtr->surfaceData->token);
+    }
+    Tcl_Release(atlasPtr->surfaceData);
+    ckfree((char *)atlasPtr->skyline);
+    ckfree((char *)atlasPtr);
+}
+
+/*
+ * sdl::atlas create -width W -height H ?-padding n?
+ */
+/*export*/ int
+AtlasObjCmd(ClientData clientData, Tcl_Interp *interp,
+            int objc, Tcl_Obj *const objv[])
+{
+    static const char *options[] = {
+        "-width", "-height", "-padding", NULL
+    };
+    enum { OPT_WIDTH, OPT_HEIGHT, OPT_PADDING };
+    static int uid = 0;
+    char name[8 + TCL_INTEGER_SPACE];
+    int values[3] = {0, 0, 0};
+    SDL_Surface *surface;
+    Atlas *atlasPtr;
+    int n, index;
+
+    if (objc < 2 || (objc % 2) != 0) {
+        Tcl_WrongNumArgs(interp, 1, objv,
+                         "create -width w -height h ?-padding n?");
+        return TCL_ERROR;
+    }
+    if (strcmp(Tcl_GetString(objv[1]), "create") != 0) {
+        Tcl_AppendResult(interp, "bad command \"", Tcl_GetString(objv[1]),
+                         "\": must be create", NULL);
+        return TCL_ERROR;
+    }
+    for (n = 2; n < objc; n += 2) {
+        if (Tcl_GetIndexFromObj(interp, objv[n], options, "option", 0,
+                                &index) != TCL_OK
+            || Tcl_GetIntFromObj(interp, objv[n+1], &values[index]) != TCL_OK) {
+            return TCL_ERROR;
+        }
+    }
+    if (values[OPT_WIDTH] <= 0 || values[OPT_HEIGHT] <= 0) {
+        Tcl_AppendResult(interp, "atlas -width and -height must be given"
+                         " and greater than 0", NULL);
+        return TCL_ERROR;
+    }
+    if (values[OPT_PADDING] < 0) {
+        Tcl_AppendResult(interp, "atlas -padding must not be negative", NULL);
+        return TCL_ERROR;
+    }
+
+    surface = TclsdlNewImageSurface(values[OPT_WIDTH], values[OPT_HEIGHT], 1);
+    if (surface == NULL) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+        return TCL_ERROR;
+    }
+
+    atlasPtr = (Atlas *)ckalloc(sizeof(Atlas));
+    memset(atlasPtr, 0, sizeof(Atlas));
+    atlasPtr->interp = interp;
+    atlasPtr->width = values[OPT_WIDTH];
+    atlasPtr->height = values[OPT_HEIGHT];
+    atlasPtr->padding = values[OPT_PADDING];
+    atlasPtr->size = 16;
+    atlasPtr->skyline = (SkylineNode *)
+        ckalloc(atlasPtr->size * sizeof(SkylineNode));
+    atlasPtr->skyline[0].x = 0;
+    atlasPtr->skyline[0].y = 0;
+    atlasPtr->skyline[0].w = atlasPtr->width + atlasPtr->padding;
+    atlasPtr->nnodes = 1;
+    Tcl_InitHashTable(&atlasPtr->regions, TCL_STRING_KEYS);
+
+    atlasPtr->surfaceData = TclsdlNewSurfaceCommand(interp, surface, 0);
+    Tcl_Preserve(atlasPtr->surfaceData);
+
+    sprintf(name, "sdlatlas%u", uid++);
+    atlasPtr->token = Tcl_CreateObjCommand(interp, name, AtlasEnsemble,
+                                           atlasPtr, AtlasCleanup);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+    return TCL_OK;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
@@ -30,6 +30,7 @@ Tclsdl_BackgroundEvalObjv(Tcl_Interp *interp,
 {
     Tcl_DString errorInfo, errorCode;
     Tcl_SavedResult state;
+    const char *value;
     int r = TCL_OK;
     
     Tcl_DStringInit(&errorInfo);
@@ -40,10 +41,10 @@ Tclsdl_BackgroundEvalObjv(Tcl_Interp *interp,
      */
 
     Tcl_SaveResult(interp, &state);
-    Tcl_DStringAppend(&errorInfo, 
-	Tcl_GetVar(interp, "errorInfo", TCL_GLOBAL_ONLY), -1);
-    Tcl_DStringAppend(&errorCode, 
-	Tcl_GetVar(interp, "errorCode", TCL_GLOBAL_ONLY), -1);
+    value = Tcl_GetVar(interp, "errorInfo", TCL_GLOBAL_ONLY);
+    Tcl_DStringAppend(&errorInfo, value ? value : "", -1);
+    value = Tcl_GetVar(interp, "errorCode", TCL_GLOBAL_ONLY);
+    Tcl_DStringAppend(&errorCode, value ? value : "", -1);
     
     /*
      * Evaluate the command and handle any error.
@@ -0,0 +1,518 @@
+/*
+ * $src blend $dst x y ?rect? ?-mode mode? ?-alpha a?
+ *
+ * Composite a source surface onto a destination, channel by channel.
+ * The modes are:
+ *
+ *   avg     (s + d + 1) / 2
+ *   add     s + d, saturated
+ *   sub     d - s, saturated
+ *   mul     s * d / 255
+ *   screen  255 - (255 - s) * (255 - d) / 255
+ *   alpha   s * a / 255 + d * (255 - a) / 255     (the default)
+ *
+ * In alpha mode a is the source pixel alpha when the source has an
+ * alpha channel, otherwise the -alpha value, which defaults to the
+ * per-surface alpha. Destination bits outside the colour channels are
+ * left alone.
+ *
+ * 32 bpp surfaces with matching colour channels are blended a row at a
+ * time using AVX2 or SSE2 where the processor has them; all other
+ * combinations of 8, 16, 24 and 32 bpp go through a per-pixel path.
+ * Large blends are split into bands of rows for the render pool.
+ */
+
+#include "tclsdlInt.h"
+#include "tclsdlSimd.h"
+
+enum {
+    BLEND_AVG, BLEND_ADD, BLEND_SUB, BLEND_MUL, BLEND_SCREEN, BLEND_ALPHA
+};
+
+static const char *blendModes[] = {
+    "avg", "add", "sub", "mul", "screen", "alpha", NULL
+};
+
+typedef struct BlendOp {
+    int    mode;
+    int    ashift;              /* source alpha shift or -1 for constant */
+    Uint32 alpha;               /* constant alpha */
+    Uint32 keep;                /* destination bits to preserve */
+} BlendOp;
+
+typedef void (BlendRowProc)(Uint32 *dst, const Uint32 *src, int n,
+                            const BlendOp *opPtr);
+
+/* ----------------------------------------------------------------------
+ * Scalar
+ */
+
+/*
+ * Exact rounded division by 255 for 0 <= t <= 255 * 255. The vector
+ * paths use the same sequence so all paths produce identical pixels.
+ */
+#define DIV255(t) ((((t) + 128) + (((t) + 128) >> 8)) >> 8)
+
+static Uint32
+BlendChannel(int mode, Uint32 s, Uint32 d, Uint32 a)
+{
+    switch (mode) {
+        case BLEND_AVG:    return (s + d + 1) >> 1;
+        case BLEND_ADD:    return (s + d > 255) ? 255 : s + d;
+        case BLEND_SUB:    return (d > s) ? d - s : 0;
+        case BLEND_MUL:    return DIV255(s * d);
+        case BLEND_SCREEN: return 255 - DIV255((255 - s) * (255 - d));
+        case BLEND_ALPHA:  return DIV255(s * a + d * (255 - a));
+    }
+    return d;
+}
+
+static void
+BlendRowScalar(Uint32 *dst, const Uint32 *src, int n, const BlendOp *opPtr)
+{
+    int i, shift;
+
+    for (i = 0; i < n; i++) {
+        Uint32 s = src[i], d = dst[i], r = 0;
+        Uint32 a = (opPtr->ashift < 0)
+            ? opPtr->alpha : (s >> opPtr->ashift) & 0xff;
+
+        for (shift = 0; shift < 32; shift += 8) {
+            r |= BlendChannel(opPtr->mode, (s >> shift) & 0xff,
+                              (d >> shift) & 0xff, a) << shift;
+        }
+        dst[i] = (r & ~opPtr->keep) | (d & opPtr->keep);
+    }
+}
+
+#ifdef TCLSDL_X86
+
+/* ----------------------------------------------------------------------
+ * SSE2, four pixels at a time
+ */
+
+static TCLSDL_TARGET("sse2") __m128i
+Div255x8(__m128i t)
+{
+    t = _mm_add_epi16(t, _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+static TCLSDL_TARGET("sse2") __m128i
+Mul128(__m128i s, __m128i d)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero),
+                                 _mm_unpacklo_epi8(d, zero));
+    __m128i hi = _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero),
+                                 _mm_unpackhi_epi8(d, zero));
+    return _mm_packus_epi16(Div255x8(lo), Div255x8(hi));
+}
+
+static TCLSDL_TARGET("sse2") __m128i
+Alpha128(__m128i s, __m128i d, const BlendOp *opPtr)
+{
+    __m128i zero = _mm_setzero_si128(), full = _mm_set1_epi16(255);
+    __m128i alo, ahi, lo, hi;
+
+    if (opPtr->ashift < 0) {
+        alo = ahi = _mm_set1_epi16((short)opPtr->alpha);
+    } else {
+        /* each pixel's alpha in both halves of its 32 bit lane */
+        __m128i a = _mm_and_si128(
+            _mm_srl_epi32(s, _mm_cvtsi32_si128(opPtr->ashift)),
+            _mm_set1_epi32(0xff));
+        a = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+        alo = _mm_unpacklo_epi32(a, a);
+        ahi = _mm_unpackhi_epi32(a, a);
+    }
+    lo = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), alo),
+        _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(full, alo)));
+    hi = _mm_add_epi16(
+        _mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), ahi),
+        _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(full, ahi)));
+    return _mm_packus_epi16(Div255x8(lo), Div255x8(hi));
+}
+
+#define SSE2_LOOP(EXPR)                                                 \
+    for (; i + 4 <= n; i += 4) {                                        \
+        __m128i s = _mm_loadu_si128((const __m128i *)(src + i));        \
+        __m128i d = _mm_loadu_si128((const __m128i *)(dst + i));        \
+        __m128i r = (EXPR);                                             \
+        r = _mm_or_si128(_mm_andnot_si128(keep, r), _mm_and_si128(keep, d)); \
+        _mm_storeu_si128((__m128i *)(dst + i), r);                      \
+    }
+
+static TCLSDL_TARGET("sse2") void
+BlendRowSSE2(Uint32 *dst, const Uint32 *src, int n, const BlendOp *opPtr)
+{
+    __m128i keep = _mm_set1_epi32((int)opPtr->keep);
+    __m128i ones = _mm_set1_epi32(-1);
+    int i = 0;
+
+    switch (opPtr->mode) {
+        case BLEND_AVG:    SSE2_LOOP(_mm_avg_epu8(s, d)); break;
+        case BLEND_ADD:    SSE2_LOOP(_mm_adds_epu8(d, s)); break;
+        case BLEND_SUB:    SSE2_LOOP(_mm_subs_epu8(d, s)); break;
+        case BLEND_MUL:    SSE2_LOOP(Mul128(s, d)); break;
+        case BLEND_SCREEN:
+            SSE2_LOOP(_mm_xor_si128(ones, Mul128(_mm_xor_si128(ones, s),
+                                                 _mm_xor_si128(ones, d))));
+            break;
+        case BLEND_ALPHA:  SSE2_LOOP(Alpha128(s, d, opPtr)); break;
+    }
+    BlendRowScalar(dst + i, src + i, n - i, opPtr);
+}
+
+/* ----------------------------------------------------------------------
+ * AVX2, eight pixels at a time. The unpack and pack instructions work
+ * within each 128 bit half so the pixel order is preserved.
+ */
+
+static TCLSDL_TARGET("avx2") __m256i
+Div255x16(__m256i t)
+{
+    t = _mm256_add_epi16(t, _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+static TCLSDL_TARGET("avx2") __m256i
+Mul256(__m256i s, __m256i d)
+{
+    __m256i zero = _mm256_setzero_si256();
+    __m256i lo = _mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero),
+                                    _mm256_unpacklo_epi8(d, zero));
+    __m256i hi = _mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero),
+                                    _mm256_unpackhi_epi8(d, zero));
+    return _mm256_packus_epi16(Div255x16(lo), Div255x16(hi));
+}
+
+static TCLSDL_TARGET("avx2") __m256i
+Alpha256(__m256i s, __m256i d, const BlendOp *opPtr)
+{
+    __m256i zero = _mm256_setzero_si256(), full = _mm256_set1_epi16(255);
+    __m256i alo, ahi, lo, hi;
+
+    if (opPtr->ashift < 0) {
+        alo = ahi = _mm256_set1_epi16((short)opPtr->alpha);
+    } else {
+        __m256i a = _mm256_and_si256(
+            _mm256_srl_epi32(s, _mm_cvtsi32_si128(opPtr->ashift)),
+            _mm256_set1_epi32(0xff));
+        a = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+        alo = _mm256_unpacklo_epi32(a, a);
+        ahi = _mm256_unpackhi_epi32(a, a);
+    }
+    lo = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), alo),
+        _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero),
+                           _mm256_sub_epi16(full, alo)));
+    hi = _mm256_add_epi16(
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), ahi),
+        _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero),
+                           _mm256_sub_epi16(full, ahi)));
+    return _mm256_packus_epi16(Div255x16(lo), Div255x16(hi));
+}
+
+#define AVX2_LOOP(EXPR)                                                 \
+    for (; i + 8 <= n; i += 8) {                                        \
+        __m256i s = _mm256_loadu_si256((const __m256i *)(src + i));     \
+        __m256i d = _mm256_loadu_si256((const __m256i *)(dst + i));     \
+        __m256i r = (EXPR);                                             \
+        r = _mm256_or_si256(_mm256_andnot_si256(keep, r),               \
+                            _mm256_and_si256(keep, d));                 \
+        _mm256_storeu_si256((__m256i *)(dst + i), r);                   \
+    }
+
+static TCLSDL_TARGET("avx2") void
+BlendRowAVX2(Uint32 *dst, const Uint32 *src, int n, const BlendOp *opPtr)
+{
+    __m256i keep = _mm256_set1_epi32((int)opPtr->keep);
+    __m256i ones = _mm256_set1_epi32(-1);
+    int i = 0;
+
+    switch (opPtr->mode) {
+        case BLEND_AVG:    AVX2_LOOP(_mm256_avg_epu8(s, d)); break;
+        case BLEND_ADD:    AVX2_LOOP(_mm256_adds_epu8(d, s)); break;
+        case BLEND_SUB:    AVX2_LOOP(_mm256_subs_epu8(d, s)); break;
+        case BLEND_MUL:    AVX2_LOOP(Mul256(s, d)); break;
+        case BLEND_SCREEN:
+            AVX2_LOOP(_mm256_xor_si256(ones,
+                Mul256(_mm256_xor_si256(ones, s), _mm256_xor_si256(ones, d))));
+            break;
+        case BLEND_ALPHA:  AVX2_LOOP(Alpha256(s, d, opPtr)); break;
+    }
+    BlendRowSSE2(dst + i, src + i, n - i, opPtr);
+}
+
+#endif /* TCLSDL_X86 */
+
+static BlendRowProc *
+GetBlendRowProc(void)
+{
+    static BlendRowProc *procPtr = NULL;
+
+    if (procPtr == NULL) {
+        procPtr = BlendRowScalar;
+#ifdef TCLSDL_X86
+        if (TclsdlCpuFeatures() & TCLSDL_CPU_AVX2) {
+            procPtr = BlendRowAVX2;
+        } else if (TclsdlCpuFeatures() & TCLSDL_CPU_SSE2) {
+            procPtr = BlendRowSSE2;
+        }
+#endif
+    }
+    return procPtr;
+}
+
+/* ----------------------------------------------------------------------
+ * Per-pixel path for everything else
+ */
+
+static void
+BlendPixels(SDL_Surface *src, const SDL_Rect *srcRect,
+            SDL_Surface *dst, int dx, int dy, const BlendOp *opPtr)
+{
+    SDL_PixelFormat *sf = src->format, *df = dst->format;
+    int sbpp = sf->BytesPerPixel, dbpp = df->BytesPerPixel;
+    int x, y, srcAlpha = (opPtr->ashift >= 0);
+    Uint32 keep = df->palette ? 0 : ~(df->Rmask | df->Gmask | df->Bmask);
+    MapCache *cachePtr = NULL;
+
+    if (df->palette) {
+        cachePtr = (MapCache *)ckalloc(sizeof(MapCache));
+        TclsdlInitMapCache(cachePtr);
+    }
+    for (y = 0; y < srcRect->h; y++) {
+        const Uint8 *sp = (Uint8 *)src->pixels
+            + (srcRect->y + y) * src->pitch + srcRect->x * sbpp;
+        Uint8 *dp = (Uint8 *)dst->pixels + (dy + y) * dst->pitch + dx * dbpp;
+
+        for (x = 0; x < srcRect->w; x++, sp += sbpp, dp += dbpp) {
+            Uint32 d = TclsdlReadPixel(dp, dbpp), sc[4], dc[4], a;
+
+            TclsdlUnpackPixel(sf, TclsdlReadPixel(sp, sbpp), sc);
+            TclsdlUnpackPixel(df, d, dc);
+            a = srcAlpha ? sc[3] : opPtr->alpha;
+            TclsdlWritePixel(dp, dbpp, (d & keep) | TclsdlMapColor(df,
+                cachePtr, BlendChannel(opPtr->mode, sc[0], dc[0], a),
+                BlendChannel(opPtr->mode, sc[1], dc[1], a),
+                BlendChannel(opPtr->mode, sc[2], dc[2], a)));
+        }
+    }
+    if (cachePtr) {
+        ckfree((char *)cachePtr);
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+
+typedef struct BlendJob {
+    SDL_Surface  *src, *dst;
+    SDL_Rect      srcRect;
+    int           dx, dy;
+    BlendOp       op;
+    BlendRowProc *rowProc;      /* NULL for the per-pixel path */
+} BlendJob;
+
+/*
+ * Blend rows y0 .. y1-1 of the job. Bands are independent so the render
+ * pool may run them in any order.
+ */
+static void
+BlendRows(ClientData clientData, int y0, int y1)
+{
+    BlendJob *jobPtr = clientData;
+    SDL_Surface *src = jobPtr->src, *dst = jobPtr->dst;
+    SDL_Rect band = jobPtr->srcRect;
+    int row;
+
+    band.y = (Sint16)(jobPtr->srcRect.y + y0);
+    band.h = (Uint16)(y1 - y0);
+    if (jobPtr->rowProc == NULL) {
+        BlendPixels(src, &band, dst, jobPtr->dx, jobPtr->dy + y0,
+                    &jobPtr->op);
+        return;
+    }
+    for (row = y0; row < y1; row++) {
+        Uint32 *sp = (Uint32 *)((Uint8 *)src->pixels
+            + (jobPtr->srcRect.y + row) * src->pitch) + band.x;
+        Uint32 *dp = (Uint32 *)((Uint8 *)dst->pixels
+            + (jobPtr->dy + row) * dst->pitch) + jobPtr->dx;
+        jobPtr->rowProc(dp, sp, band.w, &jobPtr->op);
+    }
+}
+
+/*
+ * Clip the source rectangle against the source surface and its
+ * placement at dx,dy against the destination clip rectangle.
+ */
+static int
+ClipBlend(SDL_Surface *src, SDL_Rect *srcRect, SDL_Surface *dst,
+          int *dxPtr, int *dyPtr)
+{
+    int sx = srcRect->x, sy = srcRect->y, w = srcRect->w, h = srcRect->h;
+    int dx = *dxPtr, dy = *dyPtr, d;
+    SDL_Rect *clip = &dst->clip_rect;
+
+    if (sx < 0) { w += sx; dx -= sx; sx = 0; }
+    if (sy < 0) { h += sy; dy -= sy; sy = 0; }
+    if (sx + w > src->w) w = src->w - sx;
+    if (sy + h > src->h) h = src->h - sy;
+
+    if ((d = clip->x - dx) > 0) { w -= d; sx += d; dx += d; }
+    if ((d = clip->y - dy) > 0) { h -= d; sy += d; dy += d; }
+    if ((d = dx + w - (clip->x + clip->w)) > 0) w -= d;
+    if ((d = dy + h - (clip->y + clip->h)) > 0) h -= d;
+
+    if (w <= 0 || h <= 0) {
+        return 0;
+    }
+    srcRect->x = sx;
+    srcRect->y = sy;
+    srcRect->w = w;
+    srcRect->h = h;
+    *dxPtr = dx;
+    *dyPtr = dy;
+    return 1;
+}
+
+int
+TclsdlSurfaceBlendCmd(ClientData clientData, Tcl_Interp *interp,
+                      int objc, Tcl_Obj *const objv[])
+{
+    static const char *options[] = { "-alpha", "-mode", NULL };
+    enum { OPT_ALPHA, OPT_MODE };
+    SurfaceData *srcPtr = clientData, *dstPtr;
+    SDL_Surface *src = srcPtr->surface, *dst;
+    SDL_Rect srcRect;
+    BlendOp op;
+    BlendJob job;
+    int x, y, opt = 5, index, alpha = -1;
+
+    if (objc < 5) {
+        Tcl_WrongNumArgs(interp, 2, objv,
+            "surface x y ?rect? ?-mode mode? ?-alpha alpha?");
+        return TCL_ERROR;
+    }
+    if (TclsdlGetSurfaceFromObj(interp, objv[2], &dstPtr) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[3], &x) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[4], &y) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    dst = dstPtr->surface;
+
+    srcRect.x = srcRect.y = 0;
+    srcRect.w = src->w;
+    srcRect.h = src->h;
+    /* anything that is not an option is the rect, which may start with - */
+    if (opt < objc && Tcl_GetIndexFromObj(NULL, objv[opt], options,
+                                          "option", 0, &index) != TCL_OK) {
+        if (TclsdlGetRectFromObj(interp, objv[opt], &srcRect) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        ++opt;
+    }
+
+    memset(&op, 0, sizeof(op));
+    op.mode = BLEND_ALPHA;
+    for (; opt < objc; opt += 2) {
+        if (Tcl_GetIndexFromObj(interp, objv[opt], options, "option", 0,
+                                &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (opt + 1 >= objc) {
+            Tcl_AppendResult(interp, "value for \"", Tcl_GetString(objv[opt]),
+                             "\" missing", NULL);
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case OPT_ALPHA:
+                if (Tcl_GetIntFromObj(interp, objv[opt+1], &alpha) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                if (alpha < 0 || alpha > 255) {
+                    Tcl_SetResult(interp, "alpha must be between 0 and 255",
+                                  TCL_STATIC);
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_MODE:
+                if (Tcl_GetIndexFromObj(interp, objv[opt+1], blendModes,
+                        "mode", 0, &op.mode) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                break;
+        }
+    }
+
+    if (src->format->Amask) {
+        op.ashift = src->format->Ashift;
+    } else {
+        op.ashift = -1;
+        if (alpha >= 0) {
+            op.alpha = (Uint32)alpha;
+        } else {
+            op.alpha = (src->flags & SDL_SRCALPHA) ? src->format->alpha : 255;
+        }
+    }
+
+    if (!ClipBlend(src, &srcRect, dst, &x, &y)) {
+        return TCL_OK;
+    }
+
+    if (TclsdlLockSurface(interp, srcPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (dstPtr != srcPtr && TclsdlLockSurface(interp, dstPtr) != TCL_OK) {
+        TclsdlUnlockSurface(srcPtr);
+        return TCL_ERROR;
+    }
+
+    job.src = src;
+    job.dst = dst;
+    job.srcRect = srcRect;
+    job.dx = x;
+    job.dy = y;
+    job.rowProc = NULL;
+    if (src->format->BytesPerPixel == 4 && dst->format->BytesPerPixel == 4
+        && !dst->format->palette
+        && src->format->Rmask == dst->format->Rmask
+        && src->format->Gmask == dst->format->Gmask
+        && src->format->Bmask == dst->format->Bmask) {
+        job.rowProc = GetBlendRowProc();
+        op.keep = ~(dst->format->Rmask | dst->format->Gmask
+                    | dst->format->Bmask);
+    }
+    job.op = op;
+
+    /*
+     * A surface blended onto itself may read rows that an earlier row
+     * has written, so that is kept serial to give the same pixels.
+     */
+    if (dstPtr == srcPtr) {
+        BlendRows(&job, 0, srcRect.h);
+    } else {
+        TclsdlParallelRows(srcRect.h, srcRect.w * 4, BlendRows, &job);
+    }
+
+    if (dstPtr != srcPtr) {
+        TclsdlUnlockSurface(dstPtr);
+    }
+    TclsdlUnlockSurface(srcPtr);
+
+    srcRect.x = x;
+    srcRect.y = y;
+    TclsdlSurfaceDamage(dstPtr, &srcRect);
+    return TCL_OK;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
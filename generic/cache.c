@@ -0,0 +1,503 @@
+/*
+ * sdl::config -cachedir directory
+ * sdl::cache stats
+ *
+ * An optional on-disk cache of loaded images. With a cache directory
+ * set, every image file loaded is also written there as raw pixels in
+ * the format it was decoded to, and later loads of the same file map the
+ * cached pixels straight into a surface instead of decoding again. The
+ * mapping is copy on write so the surface can be drawn on as usual.
+ *
+ * A cache file is keyed by the full path of the image, its size and
+ * modification time and the display format, which decides the pixel
+ * format of the decoded surface. The file name comes from a hash of the
+ * path and display format, so an image that changes or is loaded for a
+ * different display replaces its old cache file. Each file is a header
+ * holding the whole key, padded to a page, followed by the pixel rows
+ * exactly as the surface holds them.
+ *
+ * "sdl::cache stats" returns the number of hits, misses and cache files
+ * written, the bytes of pixels mapped from the cache and the bytes still
+ * mapped by live surfaces.
+ *
+ * The cache files are native endian and only meant to be read on the
+ * machine that wrote them.
+ */
+
+#include "tclsdlInt.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#include <limits.h>
+#endif
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+#ifndef S_ISDIR
+#define S_ISDIR(m) (((m) & S_IFMT) == S_IFDIR)
+#endif
+
+#define CACHE_MAGIC      "TSDLC001"
+#define CACHE_PAGE       4096
+#define CACHE_MAX_WIDTH  16383
+#define CACHE_MAX_HEIGHT 32767
+
+/*
+ * Everything the cached pixels depend on.
+ */
+typedef struct CacheKey {
+    Tcl_WideInt mtime;
+    Tcl_WideInt size;
+    Uint32      display[6];     /* bpp, masks and palette hash or zeros */
+} CacheKey;
+
+typedef struct CacheHeader {
+    char      magic[8];
+    Uint32    headerSize;       /* offset of the pixels, page aligned */
+    Uint32    pathLength;       /* path follows the palette */
+    CacheKey  key;
+    Uint32    w, h, pitch;
+    Uint32    bpp, rmask, gmask, bmask, amask;
+    Uint32    flags;            /* SDL_SRCALPHA */
+    Uint32    ncolors;          /* palette follows the header */
+} CacheHeader;
+
+typedef struct CacheStats {
+    Tcl_WideInt hits, misses, writes;
+    Tcl_WideInt mapped;         /* bytes of pixels mapped by hits */
+    Tcl_WideInt live;           /* bytes mapped by surfaces not yet freed */
+} CacheStats;
+
+static char         *cacheDir = NULL;
+static CacheStats    stats;
+static Tcl_HashTable mappings;  /* surface -> TclsdlMappedFile */
+static int           mappingsInit = 0;
+static Tcl_Mutex     cacheMutex;        /* protects all of the above */
+
+/* ---------------------------------------------------------------------- */
+
+static Uint32
+Fnv1a(Uint32 hash, const void *data, size_t size)
+{
+    const Uint8 *p = data;
+
+    while (size-- > 0) {
+        hash = (hash ^ *p++) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Describe the format images are decoded to. Paletted displays include
+ * the palette, which decides the colours chosen for every pixel.
+ */
+static void
+DisplayKey(const TclsdlDisplay *dispPtr, Uint32 display[6])
+{
+    SDL_PixelFormat *fmt = dispPtr->format;
+
+    memset(display, 0, 6 * sizeof(Uint32));
+    if (fmt == NULL) {
+        return;
+    }
+    display[0] = fmt->BitsPerPixel;
+    display[1] = fmt->Rmask;
+    display[2] = fmt->Gmask;
+    display[3] = fmt->Bmask;
+    display[4] = fmt->Amask;
+    if (fmt->palette) {
+        display[5] = Fnv1a(2166136261u, fmt->palette->colors,
+                           fmt->palette->ncolors * sizeof(SDL_Color));
+    }
+}
+
+/*
+ * Find the full path and key of an image file and the name of its cache
+ * file. Returns -1 if the image cannot be cached.
+ */
+static int
+MakeKey(const char *dir, const char *path, const TclsdlDisplay *dispPtr,
+        char *fullPath, CacheKey *keyPtr, char *cachePath)
+{
+    struct stat st;
+    Uint32 hash[2];
+
+#ifdef _WIN32
+    if (GetFullPathNameA(path, PATH_MAX, fullPath, NULL) == 0) {
+        return -1;
+    }
+#else
+    if (realpath(path, fullPath) == NULL) {
+        return -1;
+    }
+#endif
+    if (stat(fullPath, &st) != 0) {
+        return -1;
+    }
+    memset(keyPtr, 0, sizeof(CacheKey));
+    keyPtr->mtime = (Tcl_WideInt)st.st_mtime;
+    keyPtr->size = (Tcl_WideInt)st.st_size;
+    DisplayKey(dispPtr, keyPtr->display);
+
+    hash[0] = Fnv1a(2166136261u, fullPath, strlen(fullPath));
+    hash[1] = Fnv1a(hash[0] ^ 0x5bd1e995, keyPtr->display,
+                    sizeof(keyPtr->display));
+    if (strlen(dir) + 32 >= PATH_MAX) {
+        return -1;
+    }
+    sprintf(cachePath, "%s/%08x%08x.tsc", dir, (unsigned)hash[0],
+            (unsigned)hash[1]);
+    return 0;
+}
+
+/*
+ * Map a cache file and wrap its pixels in a surface if it holds the
+ * image for this key.
+ */
+static SDL_Surface *
+MapCached(const char *cachePath, const char *fullPath, CacheKey *keyPtr)
+{
+    TclsdlMappedFile map, *mapPtr;
+    CacheHeader hdr;
+    SDL_Surface *surface;
+    Tcl_HashEntry *entryPtr;
+    size_t pathLength = strlen(fullPath);
+    int isNew;
+
+    if (TclsdlMapFile(cachePath, 1, &map) != 0) {
+        return NULL;
+    }
+    if (map.size < sizeof(CacheHeader)) {
+        goto stale;
+    }
+    memcpy(&hdr, map.data, sizeof(CacheHeader));
+    if (memcmp(hdr.magic, CACHE_MAGIC, 8) != 0
+        || memcmp(&hdr.key, keyPtr, sizeof(CacheKey)) != 0
+        || hdr.pathLength != pathLength
+        || hdr.w == 0 || hdr.h == 0
+        || hdr.w > CACHE_MAX_WIDTH || hdr.h > CACHE_MAX_HEIGHT
+        || hdr.bpp == 0 || hdr.bpp > 32 || hdr.ncolors > 256
+        || hdr.pitch < (hdr.w * hdr.bpp + 7) / 8 || hdr.pitch > 0xffff
+        || hdr.headerSize % CACHE_PAGE != 0
+        || hdr.headerSize < sizeof(CacheHeader)
+               + hdr.ncolors * sizeof(SDL_Color) + pathLength
+        || map.size < hdr.headerSize + (size_t)hdr.pitch * hdr.h
+        || memcmp(map.data + sizeof(CacheHeader)
+                  + hdr.ncolors * sizeof(SDL_Color),
+                  fullPath, pathLength) != 0) {
+        goto stale;
+    }
+
+    surface = SDL_CreateRGBSurfaceFrom((void *)(map.data + hdr.headerSize),
+        (int)hdr.w, (int)hdr.h, (int)hdr.bpp, (int)hdr.pitch,
+        hdr.rmask, hdr.gmask, hdr.bmask, hdr.amask);
+    if (surface == NULL) {
+        goto stale;
+    }
+    if (hdr.ncolors && surface->format->palette) {
+        SDL_SetColors(surface,
+            (SDL_Color *)(map.data + sizeof(CacheHeader)), 0, hdr.ncolors);
+    }
+    if (hdr.flags & SDL_SRCALPHA) {
+        SDL_SetAlpha(surface, SDL_SRCALPHA, SDL_ALPHA_OPAQUE);
+    }
+
+    mapPtr = (TclsdlMappedFile *)ckalloc(sizeof(TclsdlMappedFile));
+    *mapPtr = map;
+    Tcl_MutexLock(&cacheMutex);
+    if (!mappingsInit) {
+        Tcl_InitHashTable(&mappings, TCL_ONE_WORD_KEYS);
+        mappingsInit = 1;
+    }
+    entryPtr = Tcl_CreateHashEntry(&mappings, (char *)surface, &isNew);
+    Tcl_SetHashValue(entryPtr, mapPtr);
+    stats.hits++;
+    stats.mapped += (Tcl_WideInt)hdr.pitch * hdr.h;
+    stats.live += (Tcl_WideInt)map.size;
+    Tcl_MutexUnlock(&cacheMutex);
+    return surface;
+
+ stale:
+    TclsdlUnmapFile(&map);
+    return NULL;
+}
+
+/*
+ * Write the pixels of a decoded image to its cache file. The file is
+ * written under a temporary name and renamed into place so that other
+ * threads and processes never map a partly written file.
+ */
+static void
+StoreCached(const char *cachePath, const char *fullPath, CacheKey *keyPtr,
+            SDL_Surface *surface)
+{
+    SDL_PixelFormat *fmt = surface->format;
+    char tmpPath[PATH_MAX + 80];
+    CacheHeader hdr;
+    size_t pathLength = strlen(fullPath), used;
+    char *page;
+    FILE *f;
+    int y, ok;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, CACHE_MAGIC, 8);
+    hdr.pathLength = (Uint32)pathLength;
+    hdr.key = *keyPtr;
+    hdr.w = surface->w;
+    hdr.h = surface->h;
+    hdr.pitch = surface->pitch;
+    hdr.bpp = fmt->BitsPerPixel;
+    hdr.rmask = fmt->Rmask;
+    hdr.gmask = fmt->Gmask;
+    hdr.bmask = fmt->Bmask;
+    hdr.amask = fmt->Amask;
+    hdr.flags = surface->flags & SDL_SRCALPHA;
+    hdr.ncolors = fmt->palette ? fmt->palette->ncolors : 0;
+    used = sizeof(hdr) + hdr.ncolors * sizeof(SDL_Color) + pathLength;
+    hdr.headerSize = (Uint32)((used + CACHE_PAGE - 1) / CACHE_PAGE
+                              * CACHE_PAGE);
+
+    page = ckalloc(hdr.headerSize);
+    memset(page, 0, hdr.headerSize);
+    memcpy(page, &hdr, sizeof(hdr));
+    if (hdr.ncolors) {
+        memcpy(page + sizeof(hdr), fmt->palette->colors,
+               hdr.ncolors * sizeof(SDL_Color));
+    }
+    memcpy(page + sizeof(hdr) + hdr.ncolors * sizeof(SDL_Color),
+           fullPath, pathLength);
+
+#ifdef _WIN32
+    sprintf(tmpPath, "%s.%d.%p", cachePath, _getpid(),
+            (void *)Tcl_GetCurrentThread());
+#else
+    sprintf(tmpPath, "%s.%d.%p", cachePath, (int)getpid(),
+            (void *)Tcl_GetCurrentThread());
+#endif
+    f = fopen(tmpPath, "wb");
+    if (f == NULL) {
+        ckfree(page);
+        return;
+    }
+    ok = fwrite(page, hdr.headerSize, 1, f) == 1;
+    ckfree(page);
+    if (SDL_LockSurface(surface) == 0) {
+        for (y = 0; ok && y < surface->h; y++) {
+            ok = fwrite((Uint8 *)surface->pixels + y * surface->pitch,
+                        surface->pitch, 1, f) == 1;
+        }
+        SDL_UnlockSurface(surface);
+    } else {
+        ok = 0;
+    }
+    ok = (fclose(f) == 0) && ok;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tmpPath, cachePath, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmpPath, cachePath) == 0;
+#endif
+    if (!ok) {
+        remove(tmpPath);
+        return;
+    }
+    Tcl_MutexLock(&cacheMutex);
+    stats.writes++;
+    Tcl_MutexUnlock(&cacheMutex);
+}
+
+/* ---------------------------------------------------------------------- */
+
+int
+TclsdlCacheEnabled(void)
+{
+    return cacheDir != NULL;
+}
+
+/*
+ * Load an image through the cache. Falls back to decoding the file
+ * whenever the cache cannot be used.
+ */
+SDL_Surface *
+TclsdlCacheLoadImage(const char *path, const TclsdlDisplay *dispPtr)
+{
+    char dir[PATH_MAX], fullPath[PATH_MAX], cachePath[PATH_MAX + 32];
+    TclsdlMappedFile map;
+    SDL_Surface *surface;
+    CacheKey key;
+    int cacheable;
+
+    Tcl_MutexLock(&cacheMutex);
+    cacheable = cacheDir != NULL;
+    if (cacheable) {
+        strcpy(dir, cacheDir);
+    }
+    Tcl_MutexUnlock(&cacheMutex);
+
+    cacheable = cacheable
+        && MakeKey(dir, path, dispPtr, fullPath, &key, cachePath) == 0;
+    if (cacheable) {
+        surface = MapCached(cachePath, fullPath, &key);
+        if (surface) {
+            return surface;
+        }
+        Tcl_MutexLock(&cacheMutex);
+        stats.misses++;
+        Tcl_MutexUnlock(&cacheMutex);
+    }
+
+    if (TclsdlMapFile(path, 0, &map) != 0) {
+        return NULL;
+    }
+    surface = TclsdlDecodeImage(map.data, map.size, dispPtr);
+    TclsdlUnmapFile(&map);
+    if (surface && cacheable) {
+        StoreCached(cachePath, fullPath, &key, surface);
+    }
+    return surface;
+}
+
+/*
+ * Free a surface, unmapping its pixels if they came from the cache and
+ * otherwise offering it to the surface pool. The mapping is looked up
+ * before the surface is freed, as another thread may be given the same
+ * address as soon as it is.
+ */
+void
+TclsdlFreeSurface(SDL_Surface *surface)
+{
+    TclsdlMappedFile *mapPtr = NULL;
+    Tcl_HashEntry *entryPtr;
+
+    if (surface == NULL) {
+        return;
+    }
+    Tcl_MutexLock(&cacheMutex);
+    if (mappingsInit) {
+        entryPtr = Tcl_FindHashEntry(&mappings, (char *)surface);
+        if (entryPtr) {
+            mapPtr = (TclsdlMappedFile *)Tcl_GetHashValue(entryPtr);
+            Tcl_DeleteHashEntry(entryPtr);
+            stats.live -= (Tcl_WideInt)mapPtr->size;
+        }
+    }
+    Tcl_MutexUnlock(&cacheMutex);
+
+    if (mapPtr == NULL) {
+        TclsdlRecycleSurface(surface);
+        return;
+    }
+    SDL_FreeSurface(surface);
+    TclsdlUnmapFile(mapPtr);
+    ckfree((char *)mapPtr);
+}
+
+const char *
+TclsdlCacheDir(void)
+{
+    return cacheDir ? cacheDir : "";
+}
+
+/*
+ * Set the cache directory, an empty path turning the cache off.
+ */
+int
+TclsdlSetCacheDir(Tcl_Interp *interp, const char *dir)
+{
+    struct stat st;
+    char *copy = NULL;
+    size_t length = strlen(dir);
+
+    if (length > 0) {
+        if (length + 32 >= PATH_MAX) {
+            Tcl_AppendResult(interp, "cache directory name is too long", NULL);
+            return TCL_ERROR;
+        }
+        if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+            Tcl_AppendResult(interp, "cache directory \"", dir,
+                             "\" does not exist", NULL);
+            return TCL_ERROR;
+        }
+        copy = ckalloc(length + 1);
+        strcpy(copy, dir);
+    }
+    Tcl_MutexLock(&cacheMutex);
+    if (cacheDir) {
+        ckfree(cacheDir);
+    }
+    cacheDir = copy;
+    Tcl_MutexUnlock(&cacheMutex);
+    return TCL_OK;
+}
+
+static int
+CacheStatsCmd(ClientData clientData, Tcl_Interp *interp,
+              int objc, Tcl_Obj *const objv[])
+{
+    CacheStats s;
+    Tcl_Obj *resultObj;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "");
+        return TCL_ERROR;
+    }
+    Tcl_MutexLock(&cacheMutex);
+    s = stats;
+    Tcl_MutexUnlock(&cacheMutex);
+
+    resultObj = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("hits", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(s.hits));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("misses", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(s.misses));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("writes", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(s.writes));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("mapped", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(s.mapped));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("live", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(s.live));
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+struct Ensemble cacheEnsemble[] = {
+    { "stats", CacheStatsCmd, NULL },
+    { NULL, NULL, NULL },
+};
+
+/*export*/ int
+CacheObjCmd(ClientData clientData, Tcl_Interp *interp,
+            int objc, Tcl_Obj *const objv[])
+{
+    struct Ensemble *ensemble = cacheEnsemble;
+    int option = 1, index;
+
+    while (option < objc) {
+        if (Tcl_GetIndexFromObjStruct(interp, objv[option],
+                ensemble, sizeof(ensemble[0]), "command", 0, &index) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+
+        if (ensemble[index].command) {
+            return ensemble[index].command(clientData, interp, objc, objv);
+        }
+        ensemble = ensemble[index].ensemble;
+        ++option;
+    }
+    Tcl_WrongNumArgs(interp, option, objv, "command ?arg arg...?");
+    return TCL_ERROR;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
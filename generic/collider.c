@@ -0,0 +1,681 @@
+/*
+ * set c [sdl::collider ?-cellsize n?]
+ * $c add id x y w h ?-surface surface? ?-rect rect?
+ * $c move id x y
+ * $c remove id
+ * $c load ?-first id? ?-surface surface? bytes  ;# packed blit records
+ * $c pairs ?-precise?           ;# flat list of overlapping id pairs
+ * $c ids
+ * $c configure ?-cellsize ?n??
+ * $c delete
+ *
+ * Broadphase collision detection. Boxes are binned into a uniform grid
+ * through a spatial hash each time pairs are requested so only boxes
+ * sharing a cell are compared. With -precise, boxes that carry a
+ * surface are confirmed against the surface collision masks. A box
+ * whose surface has since been deleted counts as solid.
+ */
+
+#include "tclsdlInt.h"
+#include <limits.h>
+
+/*
+ * Most grid cell entries a pairs call will build, to keep a huge box
+ * with a small cell size from taking all the memory.
+ */
+#define COLLIDER_MAX_ENTRIES (1 << 22)
+
+typedef struct Box {
+    int      id;
+    int      x, y, w, h;
+    int      image;            /* index into Collider.images or -1 */
+    SDL_Rect src;              /* source region within the image */
+} Box;
+
+typedef struct CellEntry {
+    int cx, cy;
+    int box;
+    int next;
+} CellEntry;
+
+typedef struct Collider {
+    Tcl_Command   token;
+    int           cellsize;
+    Box          *boxes;
+    int           count;
+    int           size;
+    SurfaceData **images;      /* preserved surfaces used by boxes */
+    int           nimages;
+    Tcl_HashTable imageIndex;  /* surface -> position in images */
+    Tcl_HashTable index;       /* box id -> position in boxes */
+    CellEntry    *entries;     /* spatial hash scratch space */
+    int           nentries;
+    int           entrySize;
+    int          *buckets;
+    int           nbuckets;
+} Collider;
+
+/* ---------------------------------------------------------------------- */
+
+static int
+FloorDiv(int a, int b)
+{
+    return (a >= 0) ? a / b : -((b - 1 - a) / b);
+}
+
+/*
+ * Boxes must end within the int range so edge arithmetic cannot
+ * overflow.
+ */
+static int
+CheckBoxExtent(Tcl_Interp *interp, int x, int y, int w, int h)
+{
+    if ((Tcl_WideInt)x + w > INT_MAX || (Tcl_WideInt)y + h > INT_MAX) {
+        Tcl_SetResult(interp, "box extends beyond the coordinate range",
+                      TCL_STATIC);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ * Return the image slot for a surface, adding it if necessary. The
+ * surface is kept by its data rather than its name so the boxes still
+ * find it after a rename.
+ */
+static int
+GetImage(Collider *colPtr, SurfaceData *dataPtr)
+{
+    Tcl_HashEntry *entryPtr;
+    int isNew;
+
+    entryPtr = Tcl_CreateHashEntry(&colPtr->imageIndex, (char *)dataPtr,
+                                   &isNew);
+    if (!isNew) {
+        return PTR2INT(Tcl_GetHashValue(entryPtr));
+    }
+    colPtr->images = (SurfaceData **)ckrealloc((char *)colPtr->images,
+        (colPtr->nimages + 1) * sizeof(SurfaceData *));
+    colPtr->images[colPtr->nimages] = dataPtr;
+    Tcl_Preserve(dataPtr);
+    Tcl_SetHashValue(entryPtr, INT2PTR(colPtr->nimages));
+    return colPtr->nimages++;
+}
+
+static Box *
+FindBox(Tcl_Interp *interp, Collider *colPtr, Tcl_Obj *idObj)
+{
+    Tcl_HashEntry *entryPtr;
+    int id;
+
+    if (Tcl_GetIntFromObj(interp, idObj, &id) != TCL_OK) {
+        return NULL;
+    }
+    entryPtr = Tcl_FindHashEntry(&colPtr->index, INT2PTR(id));
+    if (entryPtr == NULL) {
+        Tcl_AppendResult(interp, "no box \"", Tcl_GetString(idObj), "\"",
+                         NULL);
+        return NULL;
+    }
+    return &colPtr->boxes[PTR2INT(Tcl_GetHashValue(entryPtr))];
+}
+
+/*
+ * Return the box for id, creating it if necessary.
+ */
+static Box *
+SetBox(Collider *colPtr, int id)
+{
+    Tcl_HashEntry *entryPtr;
+    Box *boxPtr;
+    int isNew;
+
+    entryPtr = Tcl_CreateHashEntry(&colPtr->index, INT2PTR(id), &isNew);
+    if (!isNew) {
+        return &colPtr->boxes[PTR2INT(Tcl_GetHashValue(entryPtr))];
+    }
+    if (colPtr->count == colPtr->size) {
+        colPtr->size = colPtr->size ? colPtr->size * 2 : 64;
+        colPtr->boxes = (Box *)ckrealloc((char *)colPtr->boxes,
+                                         colPtr->size * sizeof(Box));
+    }
+    Tcl_SetHashValue(entryPtr, INT2PTR(colPtr->count));
+    boxPtr = &colPtr->boxes[colPtr->count++];
+    memset(boxPtr, 0, sizeof(Box));
+    boxPtr->id = id;
+    boxPtr->image = -1;
+    return boxPtr;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static int
+ColliderAddCmd(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    Collider *colPtr = clientData;
+    Box box, *boxPtr;
+    SurfaceData *dataPtr = NULL;
+    int id, opt, index;
+    enum { OPT_SURFACE, OPT_RECT };
+    const char *options[] = { "-surface", "-rect", NULL };
+
+    if (objc < 7 || (objc & 1) == 0) {
+        Tcl_WrongNumArgs(interp, 2, objv,
+                         "id x y w h ?-surface surface? ?-rect rect?");
+        return TCL_ERROR;
+    }
+    memset(&box, 0, sizeof(box));
+    box.image = -1;
+    if (Tcl_GetIntFromObj(interp, objv[2], &id) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[3], &box.x) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[4], &box.y) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[5], &box.w) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[6], &box.h) != TCL_OK
+        || CheckBoxExtent(interp, box.x, box.y, box.w, box.h) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    box.src.w = (Uint16)box.w;
+    box.src.h = (Uint16)box.h;
+    for (opt = 7; opt < objc; opt += 2) {
+        if (Tcl_GetIndexFromObj(interp, objv[opt], options,
+                                "option", 0, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case OPT_SURFACE:
+                if (TclsdlGetSurfaceFromObj(interp, objv[opt+1],
+                                            &dataPtr) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                break;
+            case OPT_RECT:
+                if (TclsdlGetRectFromObj(interp, objv[opt+1],
+                                         &box.src) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                break;
+        }
+    }
+    if (dataPtr) {
+        box.image = GetImage(colPtr, dataPtr);
+    }
+
+    boxPtr = SetBox(colPtr, id);
+    box.id = id;
+    *boxPtr = box;
+    return TCL_OK;
+}
+
+static int
+ColliderMoveCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    Collider *colPtr = clientData;
+    Box *boxPtr;
+    int x, y;
+
+    if (objc != 5) {
+        Tcl_WrongNumArgs(interp, 2, objv, "id x y");
+        return TCL_ERROR;
+    }
+    boxPtr = FindBox(interp, colPtr, objv[2]);
+    if (boxPtr == NULL
+        || Tcl_GetIntFromObj(interp, objv[3], &x) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[4], &y) != TCL_OK
+        || CheckBoxExtent(interp, x, y, boxPtr->w, boxPtr->h) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    boxPtr->x = x;
+    boxPtr->y = y;
+    return TCL_OK;
+}
+
+static int
+ColliderRemoveCmd(ClientData clientData, Tcl_Interp *interp,
+                  int objc, Tcl_Obj *const objv[])
+{
+    Collider *colPtr = clientData;
+    Tcl_HashEntry *entryPtr;
+    Box *boxPtr;
+    int pos;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "id");
+        return TCL_ERROR;
+    }
+    boxPtr = FindBox(interp, colPtr, objv[2]);
+    if (boxPtr == NULL) {
+        return TCL_ERROR;
+    }
+    pos = boxPtr - colPtr->boxes;
+    entryPtr = Tcl_FindHashEntry(&colPtr->index, INT2PTR(boxPtr->id));
+    Tcl_DeleteHashEntry(entryPtr);
+    if (--colPtr->count != pos) {
+        *boxPtr = colPtr->boxes[colPtr->count];
+        entryPtr = Tcl_FindHashEntry(&colPtr->index, INT2PTR(boxPtr->id));
+        Tcl_SetHashValue(entryPtr, INT2PTR(pos));
+    }
+    return TCL_OK;
+}
+
+/*
+ * $c load ?-first id? ?-surface surface? bytes
+ *
+ * Set the boxes for ids first, first+1, ... from the same packed
+ * BlitRecords used by "blitmany -packed". The destination position
+ * gives the box origin and the source rectangle its size and, when a
+ * surface is given, the region used for precise tests.
+ */
+static int
+ColliderLoadCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    Collider *colPtr = clientData;
+    SurfaceData *dataPtr = NULL;
+    const unsigned char *bytes;
+    BlitRecord rec;
+    Box *boxPtr;
+    int first = 0, image = -1, opt, index, len, n;
+    enum { OPT_FIRST, OPT_SURFACE };
+    const char *options[] = { "-first", "-surface", NULL };
+
+    if (objc < 3 || (objc & 1) == 0) {
+        Tcl_WrongNumArgs(interp, 2, objv,
+                         "?-first id? ?-surface surface? bytes");
+        return TCL_ERROR;
+    }
+    for (opt = 2; opt < objc - 1; opt += 2) {
+        if (Tcl_GetIndexFromObj(interp, objv[opt], options,
+                                "option", 0, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case OPT_FIRST:
+                if (Tcl_GetIntFromObj(interp, objv[opt+1], &first) != TCL_OK)
+                    return TCL_ERROR;
+                break;
+            case OPT_SURFACE:
+                if (TclsdlGetSurfaceFromObj(interp, objv[opt+1],
+                                            &dataPtr) != TCL_OK)
+                    return TCL_ERROR;
+                image = GetImage(colPtr, dataPtr);
+                break;
+        }
+    }
+
+    bytes = Tcl_GetByteArrayFromObj(objv[objc-1], &len);
+    if (len % sizeof(BlitRecord) != 0) {
+        Tcl_AppendResult(interp, "packed blit data must be a multiple"
+                         " of 12 bytes", NULL);
+        return TCL_ERROR;
+    }
+    for (n = 0; n < len; n += sizeof(BlitRecord)) {
+        memcpy(&rec, bytes + n, sizeof(BlitRecord));
+        boxPtr = SetBox(colPtr, first++);
+        boxPtr->x = rec.x;
+        boxPtr->y = rec.y;
+        boxPtr->image = image;
+        boxPtr->src.x = rec.sx;
+        boxPtr->src.y = rec.sy;
+        boxPtr->src.w = rec.sw;
+        boxPtr->src.h = rec.sh;
+        if (rec.sw == 0 && rec.sh == 0 && dataPtr) {
+            boxPtr->src.w = (Uint16)dataPtr->surface->w;
+            boxPtr->src.h = (Uint16)dataPtr->surface->h;
+        }
+        boxPtr->w = boxPtr->src.w;
+        boxPtr->h = boxPtr->src.h;
+    }
+    return TCL_OK;
+}
+
+/*
+ * Bin every box into each grid cell it covers. Fails if the boxes cover
+ * more than COLLIDER_MAX_ENTRIES cells between them.
+ */
+static int
+BuildGrid(Tcl_Interp *interp, Collider *colPtr)
+{
+    Box *boxPtr;
+    Tcl_WideInt cells = 0;
+    int n, cx, cy, cx1, cy1, cx2, cy2, total, bucket;
+    unsigned int hash;
+
+    for (n = 0; n < colPtr->count; n++) {
+        boxPtr = &colPtr->boxes[n];
+        if (boxPtr->w <= 0 || boxPtr->h <= 0) {
+            continue;
+        }
+        cells += (Tcl_WideInt)(FloorDiv(boxPtr->x + boxPtr->w - 1,
+                                        colPtr->cellsize)
+                               - FloorDiv(boxPtr->x, colPtr->cellsize) + 1)
+            * (FloorDiv(boxPtr->y + boxPtr->h - 1, colPtr->cellsize)
+               - FloorDiv(boxPtr->y, colPtr->cellsize) + 1);
+        if (cells > COLLIDER_MAX_ENTRIES) {
+            char buf[TCL_INTEGER_SPACE];
+
+            sprintf(buf, "%d", boxPtr->id);
+            Tcl_AppendResult(interp, "too many grid cells at box ", buf,
+                             ": use a larger -cellsize", NULL);
+            return TCL_ERROR;
+        }
+    }
+    total = (int)cells;
+    if (total > colPtr->entrySize) {
+        colPtr->entrySize = total;
+        colPtr->entries = (CellEntry *)ckrealloc((char *)colPtr->entries,
+            total * sizeof(CellEntry));
+    }
+    if (colPtr->nbuckets < total) {
+        while (colPtr->nbuckets < total) {
+            colPtr->nbuckets = colPtr->nbuckets ? colPtr->nbuckets * 2 : 256;
+        }
+        colPtr->buckets = (int *)ckrealloc((char *)colPtr->buckets,
+            colPtr->nbuckets * sizeof(int));
+    }
+    for (n = 0; n < colPtr->nbuckets; n++) {
+        colPtr->buckets[n] = -1;
+    }
+
+    colPtr->nentries = 0;
+    for (n = 0; n < colPtr->count; n++) {
+        boxPtr = &colPtr->boxes[n];
+        if (boxPtr->w <= 0 || boxPtr->h <= 0) {
+            continue;
+        }
+        cx1 = FloorDiv(boxPtr->x, colPtr->cellsize);
+        cy1 = FloorDiv(boxPtr->y, colPtr->cellsize);
+        cx2 = FloorDiv(boxPtr->x + boxPtr->w - 1, colPtr->cellsize);
+        cy2 = FloorDiv(boxPtr->y + boxPtr->h - 1, colPtr->cellsize);
+        for (cy = cy1; cy <= cy2; cy++) {
+            for (cx = cx1; cx <= cx2; cx++) {
+                CellEntry *entryPtr = &colPtr->entries[colPtr->nentries];
+                hash = (unsigned int)cx * 73856093u
+                    ^ (unsigned int)cy * 19349663u;
+                bucket = (int)(hash & (colPtr->nbuckets - 1));
+                entryPtr->cx = cx;
+                entryPtr->cy = cy;
+                entryPtr->box = n;
+                entryPtr->next = colPtr->buckets[bucket];
+                colPtr->buckets[bucket] = colPtr->nentries++;
+            }
+        }
+    }
+    return TCL_OK;
+}
+
+/*
+ * $c pairs ?-precise?
+ *
+ * Each overlapping pair is reported once, from the cell holding the
+ * top left corner of the intersection of the two boxes. It is an error
+ * if a collision mask cannot be built for a precise test.
+ */
+static int
+ColliderPairsCmd(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    Collider *colPtr = clientData;
+    SurfaceData **surfaces = NULL;
+    CellEntry *e, *f;
+    Box *a, *b;
+    Tcl_Obj *listObj;
+    int precise = 0, n, ix, iy, hit, code = TCL_OK;
+
+    if (objc == 3 && strcmp(Tcl_GetString(objv[2]), "-precise") == 0) {
+        precise = 1;
+    } else if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-precise?");
+        return TCL_ERROR;
+    }
+
+    if (precise) {
+        surfaces = (SurfaceData **)ckalloc((colPtr->nimages + 1)
+                                           * sizeof(SurfaceData *));
+        for (n = 0; n < colPtr->nimages; n++) {
+            surfaces[n] = colPtr->images[n]->deleted
+                ? NULL : colPtr->images[n];
+        }
+    }
+
+    if (BuildGrid(interp, colPtr) != TCL_OK) {
+        if (surfaces) {
+            ckfree((char *)surfaces);
+        }
+        return TCL_ERROR;
+    }
+    listObj = Tcl_NewListObj(0, NULL);
+    for (n = 0; n < colPtr->nbuckets && code == TCL_OK; n++) {
+        if (colPtr->buckets[n] < 0) {
+            continue;
+        }
+        for (e = &colPtr->entries[colPtr->buckets[n]]; ;
+             e = &colPtr->entries[e->next]) {
+            a = &colPtr->boxes[e->box];
+            for (f = e; f->next >= 0; ) {
+                f = &colPtr->entries[f->next];
+                if (f->cx != e->cx || f->cy != e->cy) {
+                    continue;
+                }
+                b = &colPtr->boxes[f->box];
+                if (a->x >= b->x + b->w || b->x >= a->x + a->w
+                    || a->y >= b->y + b->h || b->y >= a->y + a->h) {
+                    continue;
+                }
+                ix = (a->x > b->x) ? a->x : b->x;
+                iy = (a->y > b->y) ? a->y : b->y;
+                if (FloorDiv(ix, colPtr->cellsize) != e->cx
+                    || FloorDiv(iy, colPtr->cellsize) != e->cy) {
+                    continue;
+                }
+                hit = 1;
+                if (precise && a->image >= 0 && b->image >= 0
+                    && surfaces[a->image] && surfaces[b->image]) {
+                    hit = TclsdlMaskOverlap(surfaces[a->image], &a->src,
+                        surfaces[b->image], &b->src, b->x - a->x, b->y - a->y);
+                    if (hit < 0) {
+                        code = TCL_ERROR;
+                        break;
+                    }
+                }
+                if (hit) {
+                    Tcl_ListObjAppendElement(interp, listObj,
+                                             Tcl_NewIntObj(a->id));
+                    Tcl_ListObjAppendElement(interp, listObj,
+                                             Tcl_NewIntObj(b->id));
+                }
+            }
+            if (e->next < 0 || code != TCL_OK) {
+                break;
+            }
+        }
+    }
+    if (surfaces) {
+        ckfree((char *)surfaces);
+    }
+    if (code != TCL_OK) {
+        Tcl_DecrRefCount(listObj);
+        Tcl_AppendResult(interp, "couldn't build collision mask: ",
+                         SDL_GetError(), NULL);
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, listObj);
+    return TCL_OK;
+}
+
+static int
+ColliderIdsCmd(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    Collider *colPtr = clientData;
+    Tcl_Obj *listObj;
+    int n;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, NULL);
+        return TCL_ERROR;
+    }
+    listObj = Tcl_NewListObj(0, NULL);
+    for (n = 0; n < colPtr->count; n++) {
+        Tcl_ListObjAppendElement(interp, listObj,
+                                 Tcl_NewIntObj(colPtr->boxes[n].id));
+    }
+    Tcl_SetObjResult(interp, listObj);
+    return TCL_OK;
+}
+
+static int
+ColliderConfigureCmd(ClientData clientData, Tcl_Interp *interp,
+                     int objc, Tcl_Obj *const objv[])
+{
+    Collider *colPtr = clientData;
+    Tcl_Obj *listObj;
+    int index, size;
+    enum { OPT_CELLSIZE };
+    const char *options[] = { "-cellsize", NULL };
+
+    if (objc != 2 && objc != 3 && objc != 4) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-cellsize ?n??");
+        return TCL_ERROR;
+    }
+    if (objc > 2 && Tcl_GetIndexFromObj(interp, objv[2], options,
+                                        "option", 0, &index) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (objc == 4) {
+        if (Tcl_GetIntFromObj(interp, objv[3], &size) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (size < 1) {
+            Tcl_AppendResult(interp, "cell size must be positive", NULL);
+            return TCL_ERROR;
+        }
+        colPtr->cellsize = size;
+        return TCL_OK;
+    }
+    if (objc == 3) {
+        Tcl_SetObjResult(interp, Tcl_NewIntObj(colPtr->cellsize));
+        return TCL_OK;
+    }
+    listObj = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(interp, listObj,
+                             Tcl_NewStringObj(options[OPT_CELLSIZE], -1));
+    Tcl_ListObjAppendElement(interp, listObj, Tcl_NewIntObj(colPtr->cellsize));
+    Tcl_SetObjResult(interp, listObj);
+    return TCL_OK;
+}
+
+static int
+ColliderDeleteCmd(ClientData clientData, Tcl_Interp *interp,
+                  int objc, Tcl_Obj *const objv[])
+{
+    Collider *colPtr = clientData;
+    Tcl_DeleteCommandFromToken(interp, colPtr->token);
+    return TCL_OK;
+}
+
+struct Ensemble colliderEnsemble[] = {
+    { "add", ColliderAddCmd, NULL },
+    { "move", ColliderMoveCmd, NULL },
+    { "remove", ColliderRemoveCmd, NULL },
+    { "load", ColliderLoadCmd, NULL },
+    { "pairs", ColliderPairsCmd, NULL },
+    { "ids", ColliderIdsCmd, NULL },
+    { "configure", ColliderConfigureCmd, NULL },
+    { "delete", ColliderDeleteCmd, NULL },
+    { NULL, NULL, NULL },
+};
+
+static int
+ColliderEnsemble(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    struct Ensemble *ensemble = colliderEnsemble;
+    int option = 1, index;
+
+    while (option < objc) {
+        if (Tcl_GetIndexFromObjStruct(interp, objv[option],
+		ensemble, sizeof(ensemble[0]), "command", 0, &index) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+
+        if (ensemble[index].command) {
+            return ensemble[index].command(clientData, interp, objc, objv);
+        }
+        ensemble = ensemble[index].ensemble;
+        ++option;
+    }
+    Tcl_WrongNumArgs(interp, option, objv, "command ?arg arg...?");
+    return TCL_ERROR;
+}
+
+static void
+ColliderCleanup(ClientData clientData)
+{
+    Collider *colPtr = clientData;
+    int n;
+
+    for (n = 0; n < colPtr->nimages; n++) {
+        Tcl_Release(colPtr->images[n]);
+    }
+    if (colPtr->images)
+        ckfree((char *)colPtr->images);
+    if (colPtr->boxes)
+        ckfree((char *)colPtr->boxes);
+    if (colPtr->entries)
+        ckfree((char *)colPtr->entries);
+    if (colPtr->buckets)
+        ckfree((char *)colPtr->buckets);
+    Tcl_DeleteHashTable(&colPtr->index);
+    Tcl_DeleteHashTable(&colPtr->imageIndex);
+    ckfree((char *)colPtr);
+}
+
+/*export*/ int
+ColliderObjCmd(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    Collider *colPtr;
+    int cellsize = 64;
+    static int uid = 0;
+    char name[11 + TCL_INTEGER_SPACE];
+
+    if (objc != 1 && objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-cellsize n?");
+        return TCL_ERROR;
+    }
+    if (objc == 3) {
+        if (strcmp(Tcl_GetString(objv[1]), "-cellsize") != 0) {
+            Tcl_AppendResult(interp, "bad option \"", Tcl_GetString(objv[1]),
+                             "\": must be -cellsize", NULL);
+            return TCL_ERROR;
+        }
+        if (Tcl_GetIntFromObj(interp, objv[2], &cellsize) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (cellsize < 1) {
+            Tcl_AppendResult(interp, "cell size must be positive", NULL);
+            return TCL_ERROR;
+        }
+    }
+
+    colPtr = (Collider *)ckalloc(sizeof(Collider));
+    memset(colPtr, 0, sizeof(Collider));
+    colPtr->cellsize = cellsize;
+    Tcl_InitHashTable(&colPtr->index, TCL_ONE_WORD_KEYS);
+    Tcl_InitHashTable(&colPtr->imageIndex, TCL_ONE_WORD_KEYS);
+    sprintf(name, "sdlcollider%u", uid++);
+    colPtr->token = Tcl_CreateObjCommand(interp, name, ColliderEnsemble,
+                                         colPtr, ColliderCleanup);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+    return TCL_OK;
+}
+
+/*
+ * Local variables:
+ *   indent-tabs-mode: t
+ *   tab-width: 8
+ * End:
+ */
@@ -0,0 +1,678 @@
+/*
+ * $surface export ?-format fmt? ?rect?
+ * $surface import ?-format fmt? bytes ?rect?
+ *
+ * Move pixels in and out of a surface as a packed byte array in one of
+ * a few fixed formats, whatever the surface's own pixel format:
+ *
+ *   rgba8888  four bytes per pixel in the order red, green, blue, alpha
+ *   bgra8888  four bytes per pixel in the order blue, green, red, alpha
+ *   rgb565    two bytes per pixel, a little endian 5:6:5 word
+ *   gray8     one byte of luma per pixel
+ *
+ * The default format is rgba8888. Exported alpha comes from the surface
+ * alpha channel; without one pixels are opaque except those matching
+ * an active colorkey. Rows are converted one at a time, first to
+ * rgba8888 and then to the target, except that 32 bpp surfaces with
+ * byte aligned channels are swizzled straight to and from the 8888
+ * formats. The swizzles use SSSE3 or AVX2 byte shuffles and the gray8
+ * and rgb565 packing uses SSE2 where available. Large rectangles are
+ * converted in bands of rows by the render pool.
+ */
+
+#include "tclsdlInt.h"
+#include "tclsdlSimd.h"
+
+enum { FMT_RGBA8888, FMT_BGRA8888, FMT_RGB565, FMT_GRAY8 };
+
+static const char *formatNames[] = {
+    "rgba8888", "bgra8888", "rgb565", "gray8", NULL
+};
+
+static const int formatBytes[] = { 4, 4, 2, 1 };
+
+/*
+ * For each packed byte k, the rgba8888 byte it holds.
+ */
+static const Uint8 packedOrder[2][4] = {
+    { 0, 1, 2, 3 },             /* rgba8888 */
+    { 2, 1, 0, 3 },             /* bgra8888 */
+};
+
+/* ----------------------------------------------------------------------
+ * Pixel helpers shared with the other per-pixel code paths
+ */
+
+Uint32
+TclsdlReadPixel(const Uint8 *p, int bpp)
+{
+    switch (bpp) {
+        case 1: return *p;
+        case 2: return *(const Uint16 *)p;
+        case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+            return (p[0] << 16) | (p[1] << 8) | p[2];
+#else
+            return p[0] | (p[1] << 8) | (p[2] << 16);
+#endif
+        case 4: return *(const Uint32 *)p;
+    }
+    return 0;
+}
+
+void
+TclsdlWritePixel(Uint8 *p, int bpp, Uint32 pixel)
+{
+    switch (bpp) {
+        case 1: *p = (Uint8)pixel; break;
+        case 2: *(Uint16 *)p = (Uint16)pixel; break;
+        case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+            p[0] = (pixel >> 16) & 0xff;
+            p[1] = (pixel >> 8) & 0xff;
+            p[2] = pixel & 0xff;
+#else
+            p[0] = pixel & 0xff;
+            p[1] = (pixel >> 8) & 0xff;
+            p[2] = (pixel >> 16) & 0xff;
+#endif
+            break;
+        case 4: *(Uint32 *)p = pixel; break;
+    }
+}
+
+/*
+ * Split a pixel into 8 bit red, green, blue and alpha.
+ */
+void
+TclsdlUnpackPixel(SDL_PixelFormat *fmt, Uint32 pixel, Uint32 c[4])
+{
+    if (fmt->palette) {
+        SDL_Color *colorPtr = &fmt->palette->colors[pixel & 0xff];
+        c[0] = colorPtr->r;
+        c[1] = colorPtr->g;
+        c[2] = colorPtr->b;
+        c[3] = 255;
+    } else {
+        c[0] = ((pixel & fmt->Rmask) >> fmt->Rshift) << fmt->Rloss;
+        c[1] = ((pixel & fmt->Gmask) >> fmt->Gshift) << fmt->Gloss;
+        c[2] = ((pixel & fmt->Bmask) >> fmt->Bshift) << fmt->Bloss;
+        c[3] = fmt->Amask
+            ? ((pixel & fmt->Amask) >> fmt->Ashift) << fmt->Aloss : 255;
+    }
+}
+
+void
+TclsdlInitMapCache(MapCache *cachePtr)
+{
+    memset(cachePtr->rgb, 0xff, sizeof(cachePtr->rgb));
+}
+
+/*
+ * Map a colour to a pixel value without any alpha bits. Mapping to a
+ * palette is a nearest colour search so results are cached.
+ */
+Uint32
+TclsdlMapColor(SDL_PixelFormat *fmt, MapCache *cachePtr,
+               Uint32 r, Uint32 g, Uint32 b)
+{
+    if (fmt->palette) {
+        Uint32 rgb = (r << 16) | (g << 8) | b;
+        Uint32 slot = ((rgb >> 12) ^ rgb) & (TCLSDL_MAPCACHE_SIZE - 1);
+        if (cachePtr->rgb[slot] != rgb) {
+            cachePtr->rgb[slot] = rgb;
+            cachePtr->index[slot] = (Uint8)SDL_MapRGB(fmt, (Uint8)r,
+                                                      (Uint8)g, (Uint8)b);
+        }
+        return cachePtr->index[slot];
+    }
+    return ((r >> fmt->Rloss) << fmt->Rshift)
+        | ((g >> fmt->Gloss) << fmt->Gshift)
+        | ((b >> fmt->Bloss) << fmt->Bshift);
+}
+
+/* ----------------------------------------------------------------------
+ * Byte swizzles between 32 bit layouts
+ */
+
+typedef struct Swizzle {
+    Uint8 map[4];               /* source byte for each output byte */
+    Uint8 fill[4];              /* value used where map is 0xff */
+} Swizzle;
+
+typedef void (SwizzleRowProc)(Uint8 *dst, const Uint8 *src, int n,
+                              const Swizzle *swPtr);
+
+static void
+SwizzleRowScalar(Uint8 *dst, const Uint8 *src, int n, const Swizzle *swPtr)
+{
+    int i, k;
+
+    for (i = 0; i < n; i++, dst += 4, src += 4) {
+        for (k = 0; k < 4; k++) {
+            dst[k] = (swPtr->map[k] == 0xff)
+                ? swPtr->fill[k] : src[swPtr->map[k]];
+        }
+    }
+}
+
+#ifdef TCLSDL_X86
+
+static TCLSDL_TARGET("ssse3") void
+SwizzleRowSSSE3(Uint8 *dst, const Uint8 *src, int n, const Swizzle *swPtr)
+{
+    Uint8 mask[16], fill[16];
+    __m128i vmask, vfill;
+    int i, k;
+
+    for (i = 0; i < 16; i++) {
+        k = i & 3;
+        mask[i] = (swPtr->map[k] == 0xff) ? 0x80 : (i & ~3) + swPtr->map[k];
+        fill[i] = (swPtr->map[k] == 0xff) ? swPtr->fill[k] : 0;
+    }
+    vmask = _mm_loadu_si128((const __m128i *)mask);
+    vfill = _mm_loadu_si128((const __m128i *)fill);
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 4 * i));
+        v = _mm_or_si128(_mm_shuffle_epi8(v, vmask), vfill);
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), v);
+    }
+    SwizzleRowScalar(dst + 4 * i, src + 4 * i, n - i, swPtr);
+}
+
+static TCLSDL_TARGET("avx2") void
+SwizzleRowAVX2(Uint8 *dst, const Uint8 *src, int n, const Swizzle *swPtr)
+{
+    Uint8 mask[32], fill[32];
+    __m256i vmask, vfill;
+    int i, k;
+
+    /* vpshufb shuffles within each 16 byte half */
+    for (i = 0; i < 32; i++) {
+        k = i & 3;
+        mask[i] = (swPtr->map[k] == 0xff)
+            ? 0x80 : (i & 12) + swPtr->map[k];
+        fill[i] = (swPtr->map[k] == 0xff) ? swPtr->fill[k] : 0;
+    }
+    vmask = _mm256_loadu_si256((const __m256i *)mask);
+    vfill = _mm256_loadu_si256((const __m256i *)fill);
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + 4 * i));
+        v = _mm256_or_si256(_mm256_shuffle_epi8(v, vmask), vfill);
+        _mm256_storeu_si256((__m256i *)(dst + 4 * i), v);
+    }
+    SwizzleRowSSSE3(dst + 4 * i, src + 4 * i, n - i, swPtr);
+}
+
+#endif /* TCLSDL_X86 */
+
+static SwizzleRowProc *
+GetSwizzleRowProc(void)
+{
+    static SwizzleRowProc *procPtr = NULL;
+
+    if (procPtr == NULL) {
+        procPtr = SwizzleRowScalar;
+#ifdef TCLSDL_X86
+        if (TclsdlCpuFeatures() & TCLSDL_CPU_AVX2) {
+            procPtr = SwizzleRowAVX2;
+        } else if (TclsdlCpuFeatures() & TCLSDL_CPU_SSSE3) {
+            procPtr = SwizzleRowSSSE3;
+        }
+#endif
+    }
+    return procPtr;
+}
+
+/*
+ * Find the byte holding each of red, green, blue and alpha within a
+ * pixel of a 32 bpp surface. Returns 0 unless every channel present is
+ * a whole byte; alpha is -1 when the surface has none.
+ */
+static int
+ChannelBytes(SDL_PixelFormat *fmt, int bytes[4])
+{
+    Uint8 shift[4];
+    Uint32 mask[4];
+    int k;
+
+    if (fmt->BytesPerPixel != 4 || fmt->palette) {
+        return 0;
+    }
+    mask[0] = fmt->Rmask; shift[0] = fmt->Rshift;
+    mask[1] = fmt->Gmask; shift[1] = fmt->Gshift;
+    mask[2] = fmt->Bmask; shift[2] = fmt->Bshift;
+    mask[3] = fmt->Amask; shift[3] = fmt->Ashift;
+    for (k = 0; k < 4; k++) {
+        if (mask[k] == 0 && k == 3) {
+            bytes[k] = -1;
+            continue;
+        }
+        if ((shift[k] & 7) || mask[k] != ((Uint32)0xff << shift[k])) {
+            return 0;
+        }
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+        bytes[k] = 3 - shift[k] / 8;
+#else
+        bytes[k] = shift[k] / 8;
+#endif
+    }
+    return 1;
+}
+
+/*
+ * Build the swizzles between a 32 bpp surface and one of the packed
+ * 8888 formats, in both directions.
+ */
+static int
+SurfaceSwizzles(SDL_PixelFormat *fmt, const Uint8 order[4],
+                Swizzle *exportPtr, Swizzle *importPtr)
+{
+    int bytes[4], k;
+
+    if (!ChannelBytes(fmt, bytes)) {
+        return 0;
+    }
+    memset(importPtr->map, 0xff, 4);
+    memset(importPtr->fill, 0, 4);
+    for (k = 0; k < 4; k++) {
+        int channel = order[k];
+        exportPtr->fill[k] = 0xff;
+        exportPtr->map[k] = (bytes[channel] < 0) ? 0xff : bytes[channel];
+        if (bytes[channel] >= 0) {
+            importPtr->map[bytes[channel]] = (Uint8)k;
+        }
+    }
+    return 1;
+}
+
+/* ----------------------------------------------------------------------
+ * Packing rgba8888 rows into the narrower formats and back
+ */
+
+#define GRAY(r, g, b) ((77 * (r) + 150 * (g) + 29 * (b) + 128) >> 8)
+
+static void
+RGBAToGrayScalar(Uint8 *dst, const Uint8 *rgba, int n)
+{
+    int i;
+    for (i = 0; i < n; i++, rgba += 4) {
+        dst[i] = (Uint8)GRAY(rgba[0], rgba[1], rgba[2]);
+    }
+}
+
+static void
+RGBATo565Scalar(Uint8 *dst, const Uint8 *rgba, int n)
+{
+    int i;
+    for (i = 0; i < n; i++, rgba += 4, dst += 2) {
+        Uint32 v = ((rgba[0] & 0xf8) << 8) | ((rgba[1] & 0xfc) << 3)
+            | (rgba[2] >> 3);
+        dst[0] = v & 0xff;
+        dst[1] = (v >> 8) & 0xff;
+    }
+}
+
+#if defined(TCLSDL_X86) && SDL_BYTEORDER == SDL_LIL_ENDIAN
+
+static TCLSDL_TARGET("sse2") void
+RGBAToGraySSE2(Uint8 *dst, const Uint8 *rgba, int n)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i weights = _mm_set_epi16(0, 29, 150, 77, 0, 29, 150, 77);
+    __m128i round = _mm_set1_epi32(128);
+    int i;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(rgba + 4 * i));
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(v, zero), weights);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(v, zero), weights);
+        __m128i sum;
+        int packed;
+
+        /* add r*77+g*150 to b*29 within each pixel */
+        lo = _mm_add_epi32(lo, _mm_srli_epi64(lo, 32));
+        hi = _mm_add_epi32(hi, _mm_srli_epi64(hi, 32));
+        sum = _mm_unpacklo_epi64(_mm_shuffle_epi32(lo, _MM_SHUFFLE(3,3,2,0)),
+                                 _mm_shuffle_epi32(hi, _MM_SHUFFLE(3,3,2,0)));
+        sum = _mm_srli_epi32(_mm_add_epi32(sum, round), 8);
+        sum = _mm_packs_epi32(sum, sum);
+        packed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+        memcpy(dst + i, &packed, 4);
+    }
+    RGBAToGrayScalar(dst + i, rgba + 4 * i, n - i);
+}
+
+static TCLSDL_TARGET("sse2") void
+RGBATo565SSE2(Uint8 *dst, const Uint8 *rgba, int n)
+{
+    __m128i bias = _mm_set1_epi32(0x8000);
+    int i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(rgba + 4 * i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(rgba + 4 * i + 16));
+        __m128i ra, rb;
+
+        ra = _mm_or_si128(_mm_or_si128(
+                _mm_slli_epi32(_mm_and_si128(a, _mm_set1_epi32(0xf8)), 8),
+                _mm_and_si128(_mm_srli_epi32(a, 5), _mm_set1_epi32(0x7e0))),
+                _mm_and_si128(_mm_srli_epi32(a, 19), _mm_set1_epi32(0x1f)));
+        rb = _mm_or_si128(_mm_or_si128(
+                _mm_slli_epi32(_mm_and_si128(b, _mm_set1_epi32(0xf8)), 8),
+                _mm_and_si128(_mm_srli_epi32(b, 5), _mm_set1_epi32(0x7e0))),
+                _mm_and_si128(_mm_srli_epi32(b, 19), _mm_set1_epi32(0x1f)));
+        /* there is no unsigned 32 to 16 bit pack in SSE2 */
+        ra = _mm_packs_epi32(_mm_sub_epi32(ra, bias), _mm_sub_epi32(rb, bias));
+        ra = _mm_xor_si128(ra, _mm_set1_epi16((short)0x8000));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), ra);
+    }
+    RGBATo565Scalar(dst + 2 * i, rgba + 4 * i, n - i);
+}
+
+#define RGBAToGray (TclsdlCpuFeatures() & TCLSDL_CPU_SSE2 \
+    ? RGBAToGraySSE2 : RGBAToGrayScalar)
+#define RGBATo565  (TclsdlCpuFeatures() & TCLSDL_CPU_SSE2 \
+    ? RGBATo565SSE2 : RGBATo565Scalar)
+#else
+#define RGBAToGray RGBAToGrayScalar
+#define RGBATo565  RGBATo565Scalar
+#endif
+
+static void
+GrayToRGBA(Uint8 *rgba, const Uint8 *src, int n)
+{
+    int i;
+    for (i = 0; i < n; i++, rgba += 4) {
+        rgba[0] = rgba[1] = rgba[2] = src[i];
+        rgba[3] = 0xff;
+    }
+}
+
+static void
+RGB565ToRGBA(Uint8 *rgba, const Uint8 *src, int n)
+{
+    int i;
+    for (i = 0; i < n; i++, rgba += 4, src += 2) {
+        Uint32 v = src[0] | (src[1] << 8);
+        Uint32 r = v >> 11, g = (v >> 5) & 0x3f, b = v & 0x1f;
+        rgba[0] = (Uint8)((r << 3) | (r >> 2));
+        rgba[1] = (Uint8)((g << 2) | (g >> 4));
+        rgba[2] = (Uint8)((b << 3) | (b >> 2));
+        rgba[3] = 0xff;
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Surface rows to and from rgba8888
+ */
+
+static void
+SurfaceRowToRGBA(SDL_Surface *surface, const Uint8 *row, int n, Uint8 *rgba)
+{
+    SDL_PixelFormat *fmt = surface->format;
+    int i, bpp = fmt->BytesPerPixel;
+    int keyed = (surface->flags & SDL_SRCCOLORKEY) != 0;
+
+    for (i = 0; i < n; i++, row += bpp, rgba += 4) {
+        Uint32 pixel = TclsdlReadPixel(row, bpp), c[4];
+
+        TclsdlUnpackPixel(fmt, pixel, c);
+        rgba[0] = (Uint8)c[0];
+        rgba[1] = (Uint8)c[1];
+        rgba[2] = (Uint8)c[2];
+        rgba[3] = (keyed && pixel == fmt->colorkey) ? 0 : (Uint8)c[3];
+    }
+}
+
+static void
+RGBAToSurfaceRow(SDL_Surface *surface, const Uint8 *rgba, int n, Uint8 *row,
+                 MapCache *cachePtr)
+{
+    SDL_PixelFormat *fmt = surface->format;
+    int i, bpp = fmt->BytesPerPixel;
+
+    for (i = 0; i < n; i++, row += bpp, rgba += 4) {
+        Uint32 pixel = TclsdlMapColor(fmt, cachePtr, rgba[0], rgba[1], rgba[2]);
+        if (fmt->Amask) {
+            pixel |= ((Uint32)(rgba[3] >> fmt->Aloss) << fmt->Ashift)
+                & fmt->Amask;
+        }
+        TclsdlWritePixel(row, bpp, pixel);
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+
+/*
+ * Parse "?-format fmt? ?arg? ?rect?". The rectangle must lie within the
+ * surface, so that the packed data always has exactly its rows. The
+ * position of the first non-option argument is returned through argPtr.
+ */
+static int
+ParseArgs(Tcl_Interp *interp, SDL_Surface *surface, int objc,
+          Tcl_Obj *const objv[], int nargs, const char *usage,
+          int *formatPtr, int *argPtr, SDL_Rect *rectPtr)
+{
+    int opt = 2;
+
+    *formatPtr = FMT_RGBA8888;
+    if (opt + 1 < objc && strcmp(Tcl_GetString(objv[opt]), "-format") == 0) {
+        if (Tcl_GetIndexFromObj(interp, objv[opt+1], formatNames, "format",
+                                0, formatPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        opt += 2;
+    }
+    if (objc - opt < nargs || objc - opt > nargs + 1) {
+        Tcl_WrongNumArgs(interp, 2, objv, usage);
+        return TCL_ERROR;
+    }
+    *argPtr = opt;
+
+    rectPtr->x = rectPtr->y = 0;
+    rectPtr->w = surface->w;
+    rectPtr->h = surface->h;
+    if (objc - opt == nargs + 1) {
+        if (TclsdlGetRectFromObj(interp, objv[objc-1], rectPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (rectPtr->x < 0 || rectPtr->y < 0
+            || rectPtr->x + rectPtr->w > surface->w
+            || rectPtr->y + rectPtr->h > surface->h) {
+            Tcl_AppendResult(interp, "rectangle lies outside the surface",
+                             NULL);
+            return TCL_ERROR;
+        }
+    }
+    return TCL_OK;
+}
+
+/*
+ * Export and import work on bands of rows which the render pool may run
+ * in any order, so each band has its own scratch row and colour cache.
+ */
+typedef struct Transfer {
+    SDL_Surface    *surface;
+    SDL_Rect        rect;
+    int             format;
+    int             direct;     /* swizzle straight to or from packed */
+    Swizzle         toPacked, fromPacked;
+    SwizzleRowProc *swizzleProc;
+    Uint8          *data;       /* packed pixels */
+    int             pitch;      /* bytes per packed row */
+} Transfer;
+
+static void
+ExportRows(ClientData clientData, int y0, int y1)
+{
+    Transfer *tPtr = clientData;
+    SDL_Surface *surface = tPtr->surface;
+    SDL_Rect *rectPtr = &tPtr->rect;
+    int y, bpp = surface->format->BytesPerPixel;
+    Uint8 *rgba = NULL;
+
+    if (!tPtr->direct) {
+        rgba = (Uint8 *)ckalloc(4 * rectPtr->w + 1);
+    }
+    for (y = y0; y < y1; y++) {
+        const Uint8 *row = (Uint8 *)surface->pixels
+            + (rectPtr->y + y) * surface->pitch + rectPtr->x * bpp;
+        Uint8 *dst = tPtr->data + y * tPtr->pitch;
+
+        if (tPtr->direct) {
+            tPtr->swizzleProc(dst, row, rectPtr->w, &tPtr->toPacked);
+            continue;
+        }
+        SurfaceRowToRGBA(surface, row, rectPtr->w,
+                         (tPtr->format == FMT_RGBA8888) ? dst : rgba);
+        switch (tPtr->format) {
+            case FMT_BGRA8888: {
+                static const Swizzle bgra = {{2, 1, 0, 3}, {0, 0, 0, 0}};
+                tPtr->swizzleProc(dst, rgba, rectPtr->w, &bgra);
+                break;
+            }
+            case FMT_RGB565: RGBATo565(dst, rgba, rectPtr->w); break;
+            case FMT_GRAY8:  RGBAToGray(dst, rgba, rectPtr->w); break;
+        }
+    }
+    if (rgba) {
+        ckfree((char *)rgba);
+    }
+}
+
+static void
+ImportRows(ClientData clientData, int y0, int y1)
+{
+    Transfer *tPtr = clientData;
+    SDL_Surface *surface = tPtr->surface;
+    SDL_Rect *rectPtr = &tPtr->rect;
+    int y, bpp = surface->format->BytesPerPixel;
+    MapCache *cachePtr = NULL;
+    Uint8 *rgba = NULL;
+
+    if (!tPtr->direct) {
+        rgba = (Uint8 *)ckalloc(4 * rectPtr->w + 1);
+        if (surface->format->palette) {
+            cachePtr = (MapCache *)ckalloc(sizeof(MapCache));
+            TclsdlInitMapCache(cachePtr);
+        }
+    }
+    for (y = y0; y < y1; y++) {
+        Uint8 *row = (Uint8 *)surface->pixels
+            + (rectPtr->y + y) * surface->pitch + rectPtr->x * bpp;
+        const Uint8 *src = tPtr->data + y * tPtr->pitch;
+
+        if (tPtr->direct) {
+            tPtr->swizzleProc(row, src, rectPtr->w, &tPtr->fromPacked);
+            continue;
+        }
+        switch (tPtr->format) {
+            case FMT_RGBA8888:
+                memcpy(rgba, src, 4 * rectPtr->w);
+                break;
+            case FMT_BGRA8888: {
+                static const Swizzle bgra = {{2, 1, 0, 3}, {0, 0, 0, 0}};
+                tPtr->swizzleProc(rgba, src, rectPtr->w, &bgra);
+                break;
+            }
+            case FMT_RGB565: RGB565ToRGBA(rgba, src, rectPtr->w); break;
+            case FMT_GRAY8:  GrayToRGBA(rgba, src, rectPtr->w); break;
+        }
+        RGBAToSurfaceRow(surface, rgba, rectPtr->w, row, cachePtr);
+    }
+    if (rgba) {
+        ckfree((char *)rgba);
+    }
+    if (cachePtr) {
+        ckfree((char *)cachePtr);
+    }
+}
+
+/*
+ * $surface export ?-format fmt? ?rect?
+ */
+int
+TclsdlSurfaceExportCmd(ClientData clientData, Tcl_Interp *interp,
+                       int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    SDL_Surface *surface = dataPtr->surface;
+    Transfer t;
+    Tcl_Obj *resultObj;
+    int arg;
+
+    memset(&t, 0, sizeof(t));
+    if (ParseArgs(interp, surface, objc, objv, 0, "?-format fmt? ?rect?",
+                  &t.format, &arg, &t.rect) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    t.surface = surface;
+    t.swizzleProc = GetSwizzleRowProc();
+    t.pitch = t.rect.w * formatBytes[t.format];
+
+    resultObj = Tcl_NewObj();
+    t.data = Tcl_SetByteArrayLength(resultObj, t.pitch * t.rect.h);
+
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        Tcl_DecrRefCount(resultObj);
+        return TCL_ERROR;
+    }
+    if (t.format <= FMT_BGRA8888 && !(surface->flags & SDL_SRCCOLORKEY)) {
+        t.direct = SurfaceSwizzles(surface->format, packedOrder[t.format],
+                                   &t.toPacked, &t.fromPacked);
+    }
+    TclsdlParallelRows(t.rect.h, t.rect.w * 4, ExportRows, &t);
+    TclsdlUnlockSurface(dataPtr);
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+/*
+ * $surface import ?-format fmt? bytes ?rect?
+ */
+int
+TclsdlSurfaceImportCmd(ClientData clientData, Tcl_Interp *interp,
+                       int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    SDL_Surface *surface = dataPtr->surface;
+    Transfer t;
+    int arg, length;
+
+    memset(&t, 0, sizeof(t));
+    if (ParseArgs(interp, surface, objc, objv, 1,
+                  "?-format fmt? bytes ?rect?", &t.format, &arg, &t.rect)
+        != TCL_OK) {
+        return TCL_ERROR;
+    }
+    t.surface = surface;
+    t.swizzleProc = GetSwizzleRowProc();
+    t.pitch = t.rect.w * formatBytes[t.format];
+    t.data = Tcl_GetByteArrayFromObj(objv[arg], &length);
+    if (length < t.pitch * t.rect.h) {
+        Tcl_AppendResult(interp, "not enough data for the rectangle", NULL);
+        return TCL_ERROR;
+    }
+
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (t.format <= FMT_BGRA8888) {
+        t.direct = SurfaceSwizzles(surface->format, packedOrder[t.format],
+                                   &t.toPacked, &t.fromPacked);
+    }
+    TclsdlParallelRows(t.rect.h, t.rect.w * 4, ImportRows, &t);
+    TclsdlUnlockSurface(dataPtr);
+    TclsdlSurfaceDamage(dataPtr, &t.rect);
+    return TCL_OK;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
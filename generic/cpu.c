@@ -0,0 +1,84 @@
+/*
+ * Run time detection of the processor features used by the vector
+ * code paths and of the number of processors.
+ */
+
+#include "tclsdlInt.h"
+#include "tclsdlSimd.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef TCLSDL_X86
+static int
+DetectFeatures(void)
+{
+    int features = 0;
+#if defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))  features |= TCLSDL_CPU_SSE2;
+    if (__builtin_cpu_supports("ssse3")) features |= TCLSDL_CPU_SSSE3;
+    if (__builtin_cpu_supports("avx2"))  features |= TCLSDL_CPU_AVX2;
+#else
+    int info[4];
+
+    __cpuid(info, 1);
+    if (info[3] & (1 << 26)) features |= TCLSDL_CPU_SSE2;
+    if (info[2] & (1 << 9))  features |= TCLSDL_CPU_SSSE3;
+    /* AVX2 also needs the OS to save the ymm registers */
+    if ((info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) features |= TCLSDL_CPU_AVX2;
+    }
+#endif
+    return features;
+}
+#endif /* TCLSDL_X86 */
+
+int
+TclsdlCpuFeatures(void)
+{
+    static int features = -1;
+
+    if (features < 0) {
+#ifdef TCLSDL_X86
+        features = DetectFeatures();
+#else
+        features = 0;
+#endif
+    }
+    return features;
+}
+
+int
+TclsdlCpuCount(void)
+{
+    static int count = 0;
+
+    if (count == 0) {
+#if defined(_WIN32)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        count = (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+        count = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+        if (count < 1) {
+            count = 1;
+        } else if (count > TCLSDL_MAX_THREADS) {
+            count = TCLSDL_MAX_THREADS;
+        }
+    }
+    return count;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,994 @@
+/*
+ * $surface line ?options? color {x0 y0 x1 y1 ...}
+ * $surface hline ?options? color {x0 x1 y ...}
+ * $surface rect ?options? color {x y w h ...}
+ * $surface circle ?options? color {cx cy r ...}
+ * $surface ellipse ?options? color {cx cy rx ry ...}
+ * $surface triangle ?options? color {x0 y0 x1 y1 x2 y2 ...}
+ * $surface polygon ?options? color {x0 y0 x1 y1 x2 y2 ...}
+ * $surface plot coords colors
+ * $surface sample coords
+ *
+ * Options:
+ *   -fill              fill the shape rather than draw its outline
+ *   -packed            coords is a byte array of native int16 values
+ *   -colors bytes      one uint32 0xRRGGBB per shape, overriding color
+ *
+ * Each list of coordinates may hold any number of shapes, except that
+ * a polygon list is the points of a single polygon. Packed polygon
+ * data is a series of records each made of a point count n followed by
+ * n x,y pairs. All drawing is clipped to the surface clip rectangle.
+ *
+ * Shapes are rasterized as horizontal spans which are written a whole
+ * run at a time. Polygons are filled even-odd, sampling pixel centres,
+ * and outlines of circles and ellipses are the edge pixels of the same
+ * region that -fill would cover.
+ *
+ * plot and sample move individual pixels in bulk. coords is a byte
+ * array of native int16 x,y pairs and colours are native uint32
+ * 0xRRGGBB values, either one per point or a single one for all of
+ * them. The bounding box of the points is checked once per call; plot
+ * only tests each point against the clip rectangle when that box is not
+ * wholly inside it, and sample requires every point to be on the
+ * surface.
+ */
+
+#include "tclsdlInt.h"
+#include "tclsdlSimd.h"
+#include <stdlib.h>
+#include <math.h>
+#include <limits.h>
+
+typedef struct Canvas {
+    SDL_Surface *surface;
+    int    bpp;
+    int    simd;                /* use SSE2 stores */
+    int    x0, y0, x1, y1;      /* clip rectangle, x1 and y1 exclusive */
+    Uint32 pixel;
+    int    dx0, dy0, dx1, dy1;  /* bounds of the pixels written */
+} Canvas;
+
+typedef void (DrawProc)(Canvas *cPtr, const int *v, int fill);
+
+typedef struct Shape {
+    const char *name;
+    int         nargs;          /* values per shape, 0 for polygons */
+    int         closed;         /* can be filled */
+    DrawProc   *drawProc;
+} Shape;
+
+/* ----------------------------------------------------------------------
+ * Spans
+ */
+
+#ifdef TCLSDL_X86
+static TCLSDL_TARGET("sse2") void
+FillPatternSSE2(Uint8 *p, int nbytes, Uint32 pattern)
+{
+    __m128i v = _mm_set1_epi32((int)pattern);
+
+    for (; nbytes >= 16; p += 16, nbytes -= 16) {
+        _mm_storeu_si128((__m128i *)p, v);
+    }
+    /* x86 is little endian so the pattern starts with a whole pixel */
+    for (; nbytes >= 4; p += 4, nbytes -= 4) {
+        memcpy(p, &pattern, 4);
+    }
+    if (nbytes) {
+        memcpy(p, &pattern, nbytes);
+    }
+}
+#endif /* TCLSDL_X86 */
+
+static void
+FillRun(Canvas *cPtr, Uint8 *p, int n)
+{
+    Uint32 pixel = cPtr->pixel;
+    int i;
+
+    switch (cPtr->bpp) {
+        case 1:
+            memset(p, (int)pixel, n);
+            return;
+        case 2:
+            if ((pixel & 0xff) == ((pixel >> 8) & 0xff)) {
+                memset(p, (int)(pixel & 0xff), 2 * n);
+                return;
+            }
+#ifdef TCLSDL_X86
+            if (cPtr->simd && n >= 8) {
+                FillPatternSSE2(p, 2 * n, (pixel & 0xffff) | (pixel << 16));
+                return;
+            }
+#endif
+            for (i = 0; i < n; i++) {
+                ((Uint16 *)p)[i] = (Uint16)pixel;
+            }
+            return;
+        case 3:
+            for (i = 0; i < n; i++, p += 3) {
+                TclsdlWritePixel(p, 3, pixel);
+            }
+            return;
+        case 4:
+            if (pixel == 0 || pixel == 0xffffffff) {
+                memset(p, (int)(pixel & 0xff), 4 * n);
+                return;
+            }
+#ifdef TCLSDL_X86
+            if (cPtr->simd && n >= 4) {
+                FillPatternSSE2(p, 4 * n, pixel);
+                return;
+            }
+#endif
+            for (i = 0; i < n; i++) {
+                ((Uint32 *)p)[i] = pixel;
+            }
+            return;
+    }
+}
+
+typedef struct FillJob {
+    Canvas   canvas;
+    SDL_Rect rect;
+} FillJob;
+
+static void
+FillRows(ClientData clientData, int y0, int y1)
+{
+    FillJob *jobPtr = clientData;
+    SDL_Surface *surface = jobPtr->canvas.surface;
+    Uint8 *p = (Uint8 *)surface->pixels + jobPtr->rect.y * surface->pitch
+        + jobPtr->rect.x * jobPtr->canvas.bpp;
+    int y;
+
+    for (y = y0; y < y1; y++) {
+        FillRun(&jobPtr->canvas, p + y * surface->pitch, jobPtr->rect.w);
+    }
+}
+
+/*
+ * Fill a rectangle of a locked software surface, sharing the rows out
+ * across the render pool. The rectangle must already be clipped.
+ */
+void
+TclsdlFillRect(SDL_Surface *surface, const SDL_Rect *rectPtr, Uint32 pixel)
+{
+    FillJob job;
+
+    memset(&job, 0, sizeof(job));
+    job.canvas.surface = surface;
+    job.canvas.bpp = surface->format->BytesPerPixel;
+    job.canvas.simd = (TclsdlCpuFeatures() & TCLSDL_CPU_SSE2) != 0;
+    job.canvas.pixel = pixel;
+    job.rect = *rectPtr;
+    TclsdlParallelRows(rectPtr->h, rectPtr->w * job.canvas.bpp, FillRows,
+                       &job);
+}
+
+static void
+Touch(Canvas *cPtr, int x0, int y0, int x1, int y1)
+{
+    if (x0 < cPtr->dx0) cPtr->dx0 = x0;
+    if (y0 < cPtr->dy0) cPtr->dy0 = y0;
+    if (x1 > cPtr->dx1) cPtr->dx1 = x1;
+    if (y1 > cPtr->dy1) cPtr->dy1 = y1;
+}
+
+/*
+ * Fill pixels x0..x1 inclusive of row y.
+ */
+static void
+Span(Canvas *cPtr, int x0, int x1, int y)
+{
+    SDL_Surface *surface = cPtr->surface;
+
+    if (y < cPtr->y0 || y >= cPtr->y1) {
+        return;
+    }
+    if (x0 < cPtr->x0) x0 = cPtr->x0;
+    if (x1 >= cPtr->x1) x1 = cPtr->x1 - 1;
+    if (x0 > x1) {
+        return;
+    }
+    FillRun(cPtr, (Uint8 *)surface->pixels + y * surface->pitch
+            + x0 * cPtr->bpp, x1 - x0 + 1);
+    Touch(cPtr, x0, y, x1 + 1, y + 1);
+}
+
+static void
+VSpan(Canvas *cPtr, int x, int y0, int y1)
+{
+    SDL_Surface *surface = cPtr->surface;
+    Uint8 *p;
+
+    if (x < cPtr->x0 || x >= cPtr->x1) {
+        return;
+    }
+    if (y0 < cPtr->y0) y0 = cPtr->y0;
+    if (y1 >= cPtr->y1) y1 = cPtr->y1 - 1;
+    if (y0 > y1) {
+        return;
+    }
+    p = (Uint8 *)surface->pixels + y0 * surface->pitch + x * cPtr->bpp;
+    Touch(cPtr, x, y0, x + 1, y1 + 1);
+    for (; y0 <= y1; y0++, p += surface->pitch) {
+        TclsdlWritePixel(p, cPtr->bpp, cPtr->pixel);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Lines
+ *
+ * Pixel k along the major axis is offset on the minor axis by
+ * floor((2k * minor + major) / (2 * major)), which is what Bresenham's
+ * algorithm produces. Because that can be computed for any k directly
+ * only the part of the major axis inside the clip rectangle is walked.
+ */
+
+static void
+Line(Canvas *cPtr, int x0, int y0, int x1, int y1)
+{
+    SDL_Surface *surface = cPtr->surface;
+    Tcl_WideInt dx = (x1 < x0) ? (Tcl_WideInt)x0 - x1 : (Tcl_WideInt)x1 - x0;
+    Tcl_WideInt dy = (y1 < y0) ? (Tcl_WideInt)y0 - y1 : (Tcl_WideInt)y1 - y0;
+    Tcl_WideInt major, minor, k, kend, lo, hi, u, v, den, q, r;
+    int sx = (x1 < x0) ? -1 : 1, sy = (y1 < y0) ? -1 : 1, steep = (dy > dx);
+    int u0, v0, su, sv, ulo, uhi, vlo, vhi;
+
+    if (dy == 0) {
+        Span(cPtr, (x0 < x1) ? x0 : x1, (x0 < x1) ? x1 : x0, y0);
+        return;
+    }
+    if (dx == 0) {
+        VSpan(cPtr, x0, (y0 < y1) ? y0 : y1, (y0 < y1) ? y1 : y0);
+        return;
+    }
+
+    if (steep) {
+        major = dy; minor = dx;
+        u0 = y0; su = sy; ulo = cPtr->y0; uhi = cPtr->y1 - 1;
+        v0 = x0; sv = sx; vlo = cPtr->x0; vhi = cPtr->x1 - 1;
+    } else {
+        major = dx; minor = dy;
+        u0 = x0; su = sx; ulo = cPtr->x0; uhi = cPtr->x1 - 1;
+        v0 = y0; sv = sy; vlo = cPtr->y0; vhi = cPtr->y1 - 1;
+    }
+
+    /* steps k for which the major coordinate is inside the clip */
+    if (su > 0) {
+        lo = (Tcl_WideInt)ulo - u0; hi = (Tcl_WideInt)uhi - u0;
+    } else {
+        lo = (Tcl_WideInt)u0 - uhi; hi = (Tcl_WideInt)u0 - ulo;
+    }
+    k = (lo > 0) ? lo : 0;
+    kend = (hi < major) ? hi : major;
+    if (k > kend) {
+        return;
+    }
+
+    /*
+     * The numerator can need more than 64 bits. Its quotient is near
+     * enough in double precision and the remainder, which is small, is
+     * exact in wrapping unsigned arithmetic.
+     */
+    den = 2 * major;
+    q = (Tcl_WideInt)((2.0 * (double)k * (double)minor + (double)major)
+                      / (double)den);
+    r = (Tcl_WideInt)(2 * (Tcl_WideUInt)k * (Tcl_WideUInt)minor
+                      + (Tcl_WideUInt)major - (Tcl_WideUInt)q * den);
+    while (r < 0) {
+        q--;
+        r += den;
+    }
+    while (r >= den) {
+        q++;
+        r -= den;
+    }
+    for (; k <= kend; k++) {
+        u = u0 + su * k;
+        v = v0 + sv * q;
+        if (v >= vlo && v <= vhi) {
+            int x = (int)(steep ? v : u), y = (int)(steep ? u : v);
+            TclsdlWritePixel((Uint8 *)surface->pixels + y * surface->pitch
+                             + x * cPtr->bpp, cPtr->bpp, cPtr->pixel);
+            Touch(cPtr, x, y, x + 1, y + 1);
+        } else if ((sv > 0) ? v > vhi : v < vlo) {
+            break;              /* left the clip and will not return */
+        }
+        r += 2 * minor;
+        if (r >= den) {
+            r -= den;
+            q++;
+        }
+    }
+}
+
+static void
+DrawLine(Canvas *cPtr, const int *v, int fill)
+{
+    Line(cPtr, v[0], v[1], v[2], v[3]);
+}
+
+static void
+DrawHLine(Canvas *cPtr, const int *v, int fill)
+{
+    Span(cPtr, (v[0] < v[1]) ? v[0] : v[1], (v[0] < v[1]) ? v[1] : v[0],
+         v[2]);
+}
+
+/*
+ * Last pixel of a run of n from a, limited to the int range. Anything
+ * past the limit is outside every clip rectangle.
+ */
+static int
+RunEnd(int a, int n)
+{
+    Tcl_WideInt end = (Tcl_WideInt)a + n - 1;
+    return (end > INT_MAX) ? INT_MAX : (int)end;
+}
+
+static void
+DrawRect(Canvas *cPtr, const int *v, int fill)
+{
+    int x = v[0], y = v[1], w = v[2], h = v[3], row, x1, y1;
+
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+    x1 = RunEnd(x, w);
+    y1 = RunEnd(y, h);
+    if (fill) {
+        int ylo = (y < cPtr->y0) ? cPtr->y0 : y;
+        int yhi = (y1 >= cPtr->y1) ? cPtr->y1 - 1 : y1;
+        for (row = ylo; row <= yhi; row++) {
+            Span(cPtr, x, x1, row);
+        }
+        return;
+    }
+    Span(cPtr, x, x1, y);
+    if (h > 1) {
+        Span(cPtr, x, x1, y1);
+    }
+    if (h > 2) {
+        VSpan(cPtr, x, y + 1, y1 - 1);
+        if (w > 1) {
+            VSpan(cPtr, x1, y + 1, y1 - 1);
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Circles and ellipses
+ *
+ * A pixel is inside when its centre is within the ellipse with radii
+ * rx + 1/2 and ry + 1/2. HalfWidth gives the furthest such pixel from
+ * the centre line on row dy, or -1 past the top and bottom. Only rows
+ * inside the clip rectangle are visited, so the cost does not depend
+ * on the radii.
+ */
+
+static Tcl_WideInt
+HalfWidth(double a2, double b2, Tcl_WideInt dy)
+{
+    double limit = a2 * b2, yterm = 4.0 * (double)dy * dy * a2, t;
+    Tcl_WideInt x;
+
+    t = (limit - yterm) / (4.0 * b2);
+    if (t < 0) {
+        return -1;
+    }
+    /* sqrt gives the answer to within rounding; settle it exactly */
+    x = (Tcl_WideInt)sqrt(t);
+    while (x >= 0 && 4.0 * (double)x * x * b2 + yterm > limit) {
+        x--;
+    }
+    while (4.0 * (double)(x + 1) * (x + 1) * b2 + yterm <= limit) {
+        x++;
+    }
+    return x;
+}
+
+/*
+ * Fill pixels cx + a to cx + b of row y, where the ends may lie outside
+ * the int range.
+ */
+static void
+OffsetSpan(Canvas *cPtr, int cx, Tcl_WideInt a, Tcl_WideInt b, int y)
+{
+    Tcl_WideInt x0 = cx + a, x1 = cx + b;
+
+    if (x0 < cPtr->x0) x0 = cPtr->x0;
+    if (x1 >= cPtr->x1) x1 = cPtr->x1 - 1;
+    if (x0 <= x1) {
+        Span(cPtr, (int)x0, (int)x1, y);
+    }
+}
+
+static void
+Ellipse(Canvas *cPtr, int cx, int cy, int rx, int ry, int fill)
+{
+    double a2 = (2.0 * rx + 1) * (2.0 * rx + 1);
+    double b2 = (2.0 * ry + 1) * (2.0 * ry + 1);
+    Tcl_WideInt top = (Tcl_WideInt)cy - ry, bottom = (Tcl_WideInt)cy + ry;
+    Tcl_WideInt dy, x, next, inner;
+    int y;
+
+    if (rx < 0 || ry < 0 || top >= cPtr->y1 || bottom < cPtr->y0
+        || (Tcl_WideInt)cx - rx >= cPtr->x1
+        || (Tcl_WideInt)cx + rx < cPtr->x0) {
+        return;
+    }
+    if (top < cPtr->y0) top = cPtr->y0;
+    if (bottom >= cPtr->y1) bottom = cPtr->y1 - 1;
+    for (y = (int)top; y <= bottom; y++) {
+        dy = (y < cy) ? (Tcl_WideInt)cy - y : (Tcl_WideInt)y - cy;
+        x = HalfWidth(a2, b2, dy);
+        if (fill) {
+            OffsetSpan(cPtr, cx, -x, x, y);
+        } else {
+            /* the pixels of this row not covered by the row outside it */
+            next = HalfWidth(a2, b2, dy + 1);
+            inner = (next + 1 < x) ? next + 1 : x;
+            OffsetSpan(cPtr, cx, inner, x, y);
+            OffsetSpan(cPtr, cx, -x, -inner, y);
+        }
+    }
+}
+
+static void
+DrawCircle(Canvas *cPtr, const int *v, int fill)
+{
+    Ellipse(cPtr, v[0], v[1], v[2], v[2], fill);
+}
+
+static void
+DrawEllipse(Canvas *cPtr, const int *v, int fill)
+{
+    Ellipse(cPtr, v[0], v[1], v[2], v[3], fill);
+}
+
+/* ----------------------------------------------------------------------
+ * Polygons
+ */
+
+static void
+Polygon(Canvas *cPtr, int n, const int *pts, int fill)
+{
+    double xs[64], *xsPtr = xs;
+    int i, j, k, y, ymin, ymax, count;
+
+    if (n < 1) {
+        return;
+    }
+    if (!fill || n < 3) {
+        for (i = 0; i < n; i++) {
+            j = (i + 1) % n;
+            Line(cPtr, pts[2*i], pts[2*i+1], pts[2*j], pts[2*j+1]);
+        }
+        return;
+    }
+
+    ymin = ymax = pts[1];
+    for (i = 1; i < n; i++) {
+        if (pts[2*i+1] < ymin) ymin = pts[2*i+1];
+        if (pts[2*i+1] > ymax) ymax = pts[2*i+1];
+    }
+    if (ymin < cPtr->y0) ymin = cPtr->y0;
+    if (ymax > cPtr->y1) ymax = cPtr->y1;
+    if (n > 64) {
+        xsPtr = (double *)ckalloc(n * sizeof(double));
+    }
+
+    for (y = ymin; y < ymax; y++) {
+        double yc = y + 0.5;
+
+        /* crossings of the row centre, kept sorted */
+        for (count = 0, i = 0; i < n; i++) {
+            double xa = pts[2*i], ya = pts[2*i+1], x;
+            double xb, yb;
+
+            j = (i + 1) % n;
+            xb = pts[2*j];
+            yb = pts[2*j+1];
+            if ((ya <= yc) == (yb <= yc)) {
+                continue;
+            }
+            x = xa + (yc - ya) * (xb - xa) / (yb - ya);
+            for (k = count++; k > 0 && xsPtr[k-1] > x; k--) {
+                xsPtr[k] = xsPtr[k-1];
+            }
+            xsPtr[k] = x;
+        }
+        for (k = 0; k + 1 < count; k += 2) {
+            Span(cPtr, (int)ceil(xsPtr[k] - 0.5),
+                 (int)ceil(xsPtr[k+1] - 0.5) - 1, y);
+        }
+    }
+
+    if (xsPtr != xs) {
+        ckfree((char *)xsPtr);
+    }
+}
+
+static void
+DrawTriangle(Canvas *cPtr, const int *v, int fill)
+{
+    Polygon(cPtr, 3, v, fill);
+}
+
+static void
+DrawPolygon(Canvas *cPtr, const int *v, int fill)
+{
+    Polygon(cPtr, v[0], v + 1, fill);
+}
+
+/* ---------------------------------------------------------------------- */
+
+static const Shape shapes[] = {
+    { "line",     4, 0, DrawLine },
+    { "hline",    3, 0, DrawHLine },
+    { "rect",     4, 1, DrawRect },
+    { "circle",   3, 1, DrawCircle },
+    { "ellipse",  4, 1, DrawEllipse },
+    { "triangle", 6, 1, DrawTriangle },
+    { "polygon",  0, 1, DrawPolygon },
+};
+
+/*
+ * Read the coordinates into an array of ints. Polygons are stored as a
+ * point count followed by the points, however they were given. The
+ * number of shapes is returned in *countPtr.
+ */
+static int
+GetCoords(Tcl_Interp *interp, const Shape *shapePtr, Tcl_Obj *objPtr,
+          int packed, int **valuesPtr, int *lengthPtr, int *countPtr)
+{
+    int *values, n, i, len, count = 0, offset = 0;
+
+    if (packed) {
+        const unsigned char *bytes = Tcl_GetByteArrayFromObj(objPtr, &len);
+        Sint16 s;
+
+        if (len % 2 != 0) {
+            Tcl_AppendResult(interp, "packed coordinates must be a multiple"
+                             " of 2 bytes", NULL);
+            return TCL_ERROR;
+        }
+        n = len / 2;
+        values = (int *)ckalloc((n + 1) * sizeof(int));
+        for (i = 0; i < n; i++) {
+            memcpy(&s, bytes + 2 * i, 2);
+            values[i] = s;
+        }
+    } else {
+        Tcl_Obj **listv;
+
+        if (Tcl_ListObjGetElements(interp, objPtr, &n, &listv) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        offset = (shapePtr->nargs == 0);
+        values = (int *)ckalloc((n + 2) * sizeof(int));
+        for (i = 0; i < n; i++) {
+            if (Tcl_GetIntFromObj(interp, listv[i], &values[i + offset])
+                != TCL_OK) {
+                ckfree((char *)values);
+                return TCL_ERROR;
+            }
+        }
+        if (offset) {
+            values[0] = n / 2;
+            if (n % 2 != 0) {
+                goto badLength;
+            }
+            n++;
+        }
+    }
+
+    if (shapePtr->nargs) {
+        if (n % shapePtr->nargs != 0) {
+            goto badLength;
+        }
+        count = n / shapePtr->nargs;
+    } else {
+        for (i = 0; i < n; i += 1 + 2 * values[i], count++) {
+            if (values[i] < 0 || i + 1 + 2 * values[i] > n) {
+                goto badLength;
+            }
+        }
+    }
+    *valuesPtr = values;
+    *lengthPtr = n;
+    *countPtr = count;
+    return TCL_OK;
+
+  badLength:
+    ckfree((char *)values);
+    Tcl_AppendResult(interp, "wrong number of coordinates for ",
+                     shapePtr->name, NULL);
+    return TCL_ERROR;
+}
+
+static int
+DrawShapes(const Shape *shapePtr, SurfaceData *dataPtr, Tcl_Interp *interp,
+           int objc, Tcl_Obj *const objv[])
+{
+    static const char *options[] = { "-colors", "-fill", "-packed", NULL };
+    enum { OPT_COLORS, OPT_FILL, OPT_PACKED };
+    SDL_Surface *surface = dataPtr->surface;
+    SDL_PixelFormat *fmt = surface->format;
+    const unsigned char *colors = NULL;
+    MapCache *cachePtr = NULL;
+    Canvas canvas;
+    int *values, opt, index, fill = 0, packed = 0, len, count, n, i;
+
+    for (opt = 2; opt < objc - 2; opt++) {
+        if (Tcl_GetIndexFromObj(interp, objv[opt], options, "option", 0,
+                                &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case OPT_COLORS:
+                if (++opt >= objc - 2) {
+                    Tcl_AppendResult(interp, "value for \"-colors\" missing",
+                                     NULL);
+                    return TCL_ERROR;
+                }
+                colors = Tcl_GetByteArrayFromObj(objv[opt], &len);
+                break;
+            case OPT_FILL:
+                if (!shapePtr->closed) {
+                    Tcl_AppendResult(interp, "a ", shapePtr->name,
+                                     " cannot be filled", NULL);
+                    return TCL_ERROR;
+                }
+                fill = 1;
+                break;
+            case OPT_PACKED:
+                packed = 1;
+                break;
+        }
+    }
+    if (objc - opt != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv,
+                         "?-fill? ?-packed? ?-colors bytes? color coords");
+        return TCL_ERROR;
+    }
+
+    memset(&canvas, 0, sizeof(canvas));
+    if (TclsdlGetColorFromObj(interp, surface, objv[opt], &canvas.pixel)
+        != TCL_OK
+        || GetCoords(interp, shapePtr, objv[opt+1], packed, &values, &n,
+                     &count) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (colors && len != 4 * count) {
+        ckfree((char *)values);
+        Tcl_AppendResult(interp, "-colors must hold one uint32 per shape",
+                         NULL);
+        return TCL_ERROR;
+    }
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        ckfree((char *)values);
+        return TCL_ERROR;
+    }
+    if (colors && fmt->palette) {
+        cachePtr = (MapCache *)ckalloc(sizeof(MapCache));
+        TclsdlInitMapCache(cachePtr);
+    }
+
+    canvas.surface = surface;
+    canvas.bpp = fmt->BytesPerPixel;
+    canvas.simd = (TclsdlCpuFeatures() & TCLSDL_CPU_SSE2) != 0;
+    canvas.x0 = surface->clip_rect.x;
+    canvas.y0 = surface->clip_rect.y;
+    canvas.x1 = surface->clip_rect.x + surface->clip_rect.w;
+    canvas.y1 = surface->clip_rect.y + surface->clip_rect.h;
+    canvas.dx0 = canvas.x1;
+    canvas.dy0 = canvas.y1;
+    canvas.dx1 = canvas.x0;
+    canvas.dy1 = canvas.y0;
+
+    for (i = 0, index = 0; i < n; index++) {
+        if (colors) {
+            Uint32 rgb;
+            memcpy(&rgb, colors + 4 * index, 4);
+            canvas.pixel = TclsdlMapColor(fmt, cachePtr, (rgb >> 16) & 0xff,
+                                          (rgb >> 8) & 0xff, rgb & 0xff);
+            if (!fmt->palette) {
+                canvas.pixel |= fmt->Amask;
+            }
+        }
+        shapePtr->drawProc(&canvas, values + i, fill);
+        i += shapePtr->nargs ? shapePtr->nargs : 1 + 2 * values[i];
+    }
+
+    TclsdlUnlockSurface(dataPtr);
+    if (cachePtr) {
+        ckfree((char *)cachePtr);
+    }
+    ckfree((char *)values);
+
+    if (canvas.dx1 > canvas.dx0 && canvas.dy1 > canvas.dy0) {
+        SDL_Rect rect;
+        rect.x = (Sint16)canvas.dx0;
+        rect.y = (Sint16)canvas.dy0;
+        rect.w = (Uint16)(canvas.dx1 - canvas.dx0);
+        rect.h = (Uint16)(canvas.dy1 - canvas.dy0);
+        TclsdlSurfaceDamage(dataPtr, &rect);
+    }
+    return TCL_OK;
+}
+
+int
+TclsdlSurfaceLineCmd(ClientData clientData, Tcl_Interp *interp,
+                     int objc, Tcl_Obj *const objv[])
+{
+    return DrawShapes(&shapes[0], clientData, interp, objc, objv);
+}
+
+int
+TclsdlSurfaceHLineCmd(ClientData clientData, Tcl_Interp *interp,
+                      int objc, Tcl_Obj *const objv[])
+{
+    return DrawShapes(&shapes[1], clientData, interp, objc, objv);
+}
+
+int
+TclsdlSurfaceRectCmd(ClientData clientData, Tcl_Interp *interp,
+                     int objc, Tcl_Obj *const objv[])
+{
+    return DrawShapes(&shapes[2], clientData, interp, objc, objv);
+}
+
+int
+TclsdlSurfaceCircleCmd(ClientData clientData, Tcl_Interp *interp,
+                       int objc, Tcl_Obj *const objv[])
+{
+    return DrawShapes(&shapes[3], clientData, interp, objc, objv);
+}
+
+int
+TclsdlSurfaceEllipseCmd(ClientData clientData, Tcl_Interp *interp,
+                        int objc, Tcl_Obj *const objv[])
+{
+    return DrawShapes(&shapes[4], clientData, interp, objc, objv);
+}
+
+int
+TclsdlSurfaceTriangleCmd(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *const objv[])
+{
+    return DrawShapes(&shapes[5], clientData, interp, objc, objv);
+}
+
+int
+TclsdlSurfacePolygonCmd(ClientData clientData, Tcl_Interp *interp,
+                        int objc, Tcl_Obj *const objv[])
+{
+    return DrawShapes(&shapes[6], clientData, interp, objc, objv);
+}
+
+/* ----------------------------------------------------------------------
+ * Points
+ */
+
+/*
+ * Find the bounding box of a packed array of int16 pairs.
+ */
+static void
+PointBounds(const Sint16 *pts, int n, int *box)
+{
+    int i, x0 = 0, y0 = 0, x1 = -1, y1 = -1;
+
+    if (n > 0) {
+        x0 = x1 = pts[0];
+        y0 = y1 = pts[1];
+    }
+    for (i = 1; i < n; i++) {
+        int x = pts[2*i], y = pts[2*i+1];
+        x0 = (x < x0) ? x : x0;
+        x1 = (x > x1) ? x : x1;
+        y0 = (y < y0) ? y : y0;
+        y1 = (y > y1) ? y : y1;
+    }
+    box[0] = x0; box[1] = y0; box[2] = x1; box[3] = y1;
+}
+
+/*
+ * Return the points of a packed coordinate array, aligned for reading
+ * as Sint16. An unaligned array is copied into *copyPtr which the
+ * caller frees.
+ */
+static const Sint16 *
+GetPoints(Tcl_Interp *interp, Tcl_Obj *objPtr, int *countPtr,
+          Sint16 **copyPtr)
+{
+    int len;
+    unsigned char *bytes = Tcl_GetByteArrayFromObj(objPtr, &len);
+
+    *copyPtr = NULL;
+    if (len % 4 != 0) {
+        Tcl_AppendResult(interp, "packed coordinates must be a multiple"
+                         " of 4 bytes", NULL);
+        return NULL;
+    }
+    *countPtr = len / 4;
+    if (((size_t)bytes & 1) == 0) {
+        return (const Sint16 *)bytes;
+    }
+    *copyPtr = (Sint16 *)ckalloc(len + 4);
+    memcpy(*copyPtr, bytes, len);
+    return *copyPtr;
+}
+
+int
+TclsdlSurfacePlotCmd(ClientData clientData, Tcl_Interp *interp,
+                     int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    SDL_Surface *surface = dataPtr->surface;
+    SDL_PixelFormat *fmt = surface->format;
+    SDL_Rect *clip = &surface->clip_rect;
+    const unsigned char *colors;
+    const Sint16 *pts;
+    Sint16 *copy;
+    MapCache *cachePtr = NULL;
+    Uint8 *pixels;
+    Uint32 pixel = 0, rgb, amask;
+    int i, n, len, box[4], inside, step, bpp = fmt->BytesPerPixel;
+
+    if (objc != 4) {
+        Tcl_WrongNumArgs(interp, 2, objv, "coords colors");
+        return TCL_ERROR;
+    }
+    if ((pts = GetPoints(interp, objv[2], &n, &copy)) == NULL) {
+        return TCL_ERROR;
+    }
+    colors = Tcl_GetByteArrayFromObj(objv[3], &len);
+    if (len != 4 && len != 4 * n) {
+        if (copy) {
+            ckfree((char *)copy);
+        }
+        Tcl_AppendResult(interp, "colors must hold one uint32 or one per"
+                         " point", NULL);
+        return TCL_ERROR;
+    }
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        if (copy) {
+            ckfree((char *)copy);
+        }
+        return TCL_ERROR;
+    }
+
+    PointBounds(pts, n, box);
+    inside = (box[0] >= clip->x && box[1] >= clip->y
+              && box[2] < clip->x + clip->w && box[3] < clip->y + clip->h);
+    if (fmt->palette) {
+        cachePtr = (MapCache *)ckalloc(sizeof(MapCache));
+        TclsdlInitMapCache(cachePtr);
+    }
+    amask = fmt->palette ? 0 : fmt->Amask;
+    step = (len == 4) ? 0 : 4;
+    pixels = (Uint8 *)surface->pixels;
+    if (n > 0) {
+        memcpy(&rgb, colors, 4);
+        pixel = TclsdlMapColor(fmt, cachePtr, (rgb >> 16) & 0xff,
+                               (rgb >> 8) & 0xff, rgb & 0xff) | amask;
+    }
+
+    for (i = 0; i < n; i++, colors += step) {
+        int x = pts[2*i], y = pts[2*i+1];
+
+        if (!inside && (x < clip->x || y < clip->y || x >= clip->x + clip->w
+                        || y >= clip->y + clip->h)) {
+            continue;
+        }
+        if (step) {
+            memcpy(&rgb, colors, 4);
+            pixel = TclsdlMapColor(fmt, cachePtr, (rgb >> 16) & 0xff,
+                                   (rgb >> 8) & 0xff, rgb & 0xff) | amask;
+        }
+        TclsdlWritePixel(pixels + y * surface->pitch + x * bpp, bpp, pixel);
+    }
+
+    TclsdlUnlockSurface(dataPtr);
+    if (cachePtr) {
+        ckfree((char *)cachePtr);
+    }
+    if (copy) {
+        ckfree((char *)copy);
+    }
+
+    /* damage the part of the bounding box inside the clip */
+    if (!inside) {
+        if (box[0] < clip->x) box[0] = clip->x;
+        if (box[1] < clip->y) box[1] = clip->y;
+        if (box[2] >= clip->x + clip->w) box[2] = clip->x + clip->w - 1;
+        if (box[3] >= clip->y + clip->h) box[3] = clip->y + clip->h - 1;
+    }
+    if (box[2] >= box[0] && box[3] >= box[1]) {
+        SDL_Rect rect;
+        rect.x = (Sint16)box[0];
+        rect.y = (Sint16)box[1];
+        rect.w = (Uint16)(box[2] - box[0] + 1);
+        rect.h = (Uint16)(box[3] - box[1] + 1);
+        TclsdlSurfaceDamage(dataPtr, &rect);
+    }
+    return TCL_OK;
+}
+
+int
+TclsdlSurfaceSampleCmd(ClientData clientData, Tcl_Interp *interp,
+                       int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    SDL_Surface *surface = dataPtr->surface;
+    SDL_PixelFormat *fmt = surface->format;
+    const Sint16 *pts;
+    Sint16 *copy;
+    Tcl_Obj *resultObj;
+    Uint32 *out, c[4];
+    Uint8 *pixels;
+    int i, n, box[4], bpp = fmt->BytesPerPixel;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "coords");
+        return TCL_ERROR;
+    }
+    if ((pts = GetPoints(interp, objv[2], &n, &copy)) == NULL) {
+        return TCL_ERROR;
+    }
+    PointBounds(pts, n, box);
+    if (n > 0 && (box[0] < 0 || box[1] < 0
+                  || box[2] >= surface->w || box[3] >= surface->h)) {
+        if (copy) {
+            ckfree((char *)copy);
+        }
+        Tcl_AppendResult(interp, "coordinates outside the surface", NULL);
+        return TCL_ERROR;
+    }
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        if (copy) {
+            ckfree((char *)copy);
+        }
+        return TCL_ERROR;
+    }
+
+    resultObj = Tcl_NewByteArrayObj(NULL, 0);
+    out = (Uint32 *)Tcl_SetByteArrayLength(resultObj, 4 * n);
+    pixels = (Uint8 *)surface->pixels;
+    if (bpp == 4 && !fmt->palette && fmt->Rloss == 0 && fmt->Gloss == 0
+        && fmt->Bloss == 0) {
+        int rs = fmt->Rshift, gs = fmt->Gshift, bs = fmt->Bshift;
+
+        for (i = 0; i < n; i++) {
+            Uint32 p = *(Uint32 *)(pixels + pts[2*i+1] * surface->pitch
+                                   + pts[2*i] * 4);
+            out[i] = (((p >> rs) & 0xff) << 16) | (((p >> gs) & 0xff) << 8)
+                | ((p >> bs) & 0xff);
+        }
+    } else {
+        for (i = 0; i < n; i++) {
+            TclsdlUnpackPixel(fmt, TclsdlReadPixel(pixels
+                + pts[2*i+1] * surface->pitch + pts[2*i] * bpp, bpp), c);
+            out[i] = (c[0] << 16) | (c[1] << 8) | c[2];
+        }
+    }
+
+    TclsdlUnlockSurface(dataPtr);
+    if (copy) {
+        ckfree((char *)copy);
+    }
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,1112 @@
+/*
+ * sdl::event eventname ?value?        ;# queue a User event
+ * sdl::bind ?Kind? ?prefix?           ;# handler for a kind of event
+ * sdl::batch ?-format f? ?prefix?     ;# one handler for all events
+ * sdl::coalesce policy Kind ?policy?  ;# thin out Motion and Configure
+ * sdl::coalesce stats
+ * sdl::config -eventmode poll|thread
+ *
+ * SDL events are passed to their bindings from the Tcl event loop. By
+ * default every kind of event is bound to sdl::onEvent, which is called
+ * with the kind and the event details:
+ *
+ *   sdl::bind Motion {}                ;# ignore mouse motion
+ *   sdl::bind Motion {track mouse}     ;# track mouse state x y xrel yrel
+ *   sdl::bind Motion {sdl::onEvent Motion}
+ *
+ * A batch handler instead gets every event of a pass of the event loop
+ * in one call, saving an evaluation per event:
+ *
+ *   proc input {events} {
+ *       foreach {kind a b c d e} $events { ... }
+ *   }
+ *   sdl::batch input
+ *
+ * How the event loop learns that SDL has events depends on the event mode.
+ *
+ * In poll mode, the default, an event source checks the SDL queue each
+ * time round the event loop and, when it is empty, has the notifier
+ * wake again after 10ms to look once more.
+ *
+ * In thread mode SDL reads the window system on its own event thread
+ * (SDL_INIT_EVENTTHREAD). An event filter run there wakes the thread
+ * that chose the mode with Tcl_ThreadAlert as each event is queued, so
+ * that thread sleeps until there is an event and then sees it at once.
+ * SDL 1.2 has no blocking wait though: its event thread polls the
+ * window system every millisecond, so thread mode costs more idle CPU
+ * than poll mode and is only worth it for the lower latency. SDL starts
+ * its event thread with the video subsystem, so thread mode must be
+ * chosen before the first surface is made, and SDL refuses it where
+ * events cannot be read off the main thread, as on Windows. Going back
+ * to poll mode leaves SDL's event thread running. Events added with
+ * SDL_PushEvent by code other than sdl::event skip the filter and wait
+ * for the next event that does not.
+ */
+
+#include "tclsdlInt.h"
+
+#define TCLSDLEVENT (SDL_NUMEVENTS - 2)
+
+enum { EVENTMODE_POLL, EVENTMODE_THREAD };
+static const char *eventModes[] = { "poll", "thread", NULL };
+
+typedef struct Tclsdl_Event {
+    struct Tcl_Event ev;
+    Tcl_Interp *interp;
+} Tclsdl_Event;
+
+static int eventMode = EVENTMODE_POLL;
+
+#ifdef TCL_THREADS
+static int           sdlEventThread = 0; /* SDL reads events on a thread */
+static Tcl_ThreadId  eventOwner;        /* thread the events go to */
+static Tcl_Interp   *eventInterp;       /* NULL unless in thread mode */
+static int           queued = 0;        /* a Tcl event is on its way */
+static Tcl_Mutex     eventMutex;        /* protects the three above */
+#endif
+
+/*
+ * Each kind of event passed to Tcl has a binding, a command prefix that
+ * is called with the event details appended. Initially every kind is
+ * bound to "sdl::onEvent Kind". Kinds bound to nothing are skipped
+ * before any Tcl_Obj is made for them.
+ */
+
+enum {
+    BIND_ACTIVATE, BIND_BUTTONPRESS, BIND_BUTTONRELEASE, BIND_CONFIGURE,
+    BIND_DEACTIVATE, BIND_ENTER, BIND_FOCUSIN, BIND_FOCUSOUT, BIND_LEAVE,
+    BIND_MOTION, BIND_QUIT, BIND_USER, BIND_KEYPRESS, BIND_KEYRELEASE,
+    BIND_JOYAXIS, BIND_JOYBALL, BIND_JOYHAT, BIND_JOYBUTTONPRESS,
+    BIND_JOYBUTTONRELEASE, BIND_COUNT
+};
+static const char *bindNames[] = {
+    "Activate", "ButtonPress", "ButtonRelease", "Configure",
+    "Deactivate", "Enter", "FocusIn", "FocusOut", "Leave",
+    "Motion", "Quit", "User", "KeyPress", "KeyRelease",
+    "JoyAxis", "JoyBall", "JoyHat", "JoyButtonPress",
+    "JoyButtonRelease", NULL
+};
+
+/* How many of the record fields each kind passes on */
+static const int bindFields[BIND_COUNT] = {
+    0, 3, 3, 2, 0, 0, 0, 0, 0, 5, 0, 2, 4, 4, 3, 4, 3, 2, 2
+};
+
+/*
+ * One event as seen by Tcl. The kind is the index into bindNames, which
+ * is also the kind code in "sdl::batch -format packed" records, so new
+ * kinds go on the end. The fields are the details passed to the binding:
+ *
+ *   ButtonPress, ButtonRelease  button x y
+ *   Configure                   width height
+ *   KeyPress, KeyRelease        keysym modifiers unicode scancode
+ *   JoyAxis                     joystick axis value
+ *   JoyBall                     joystick ball xrel yrel
+ *   JoyHat                      joystick hat value
+ *   JoyButtonPress, JoyButtonRelease  joystick button
+ *   Motion                      state x y xrel yrel
+ *   User                        name value (in packed batches field 0
+ *                               indexes the list of name value pairs)
+ *
+ * Unused fields are zero, as is unicode for a key that gives no
+ * character and for key releases.
+ */
+typedef struct EventRecord {
+    Sint32 kind;
+    Sint32 field[5];
+} EventRecord;
+
+/*
+ * With a batch handler set all the events of one pass go to it in a
+ * single call instead of to their bindings.
+ */
+
+enum { BATCH_LIST, BATCH_PACKED };
+static const char *batchFormats[] = { "list", "packed", NULL };
+
+/*
+ * The bindings and batch handler belong to the interpreter, kept as its
+ * EVENT_ASSOC data, so that the Tcl_Objs are never shared by threads.
+ */
+
+#define EVENT_ASSOC "tclsdl::events"
+
+typedef struct EventState {
+    Tcl_Obj *bindings[BIND_COUNT];      /* prefix lists, NULL if unbound */
+    Tcl_Obj *batchPrefix;               /* NULL for per event dispatch */
+    int      batchFormat;
+    Tcl_Obj *kindObjs[BIND_COUNT];      /* kind names for list batches */
+    Tcl_Obj *zeroObj;
+} EventState;
+
+static EventState *
+GetEventState(Tcl_Interp *interp)
+{
+    return (EventState *)Tcl_GetAssocData(interp, EVENT_ASSOC, NULL);
+}
+
+static void
+BgEvalObjv(Tcl_Interp *interp, int objc, Tcl_Obj *const *objv)
+{
+    int n = 0;
+    for (n = 0; n < objc; n++)
+        Tcl_IncrRefCount(objv[n]);
+    Tclsdl_BackgroundEvalObjv(interp, objc, objv, 0);
+    for (n = 0; n < objc; n++)
+        Tcl_DecrRefCount(objv[n]);
+}
+
+/*
+ * Call a command prefix with objc arguments appended. The arguments
+ * have no references unless the caller holds one. The prefix is held
+ * while it runs as the handler may rebind itself.
+ */
+static void
+InvokePrefix(Tcl_Interp *interp, Tcl_Obj *prefixObj, int objc, Tcl_Obj **args)
+{
+    Tcl_Obj **elems, *staticv[16], **objv;
+    int nelems;
+
+    Tcl_IncrRefCount(prefixObj);
+    Tcl_ListObjGetElements(NULL, prefixObj, &nelems, &elems);
+    objv = staticv;
+    if (nelems + objc > (int)ARRAYSIZEOF(staticv)) {
+        objv = (Tcl_Obj **)ckalloc((nelems + objc) * sizeof(Tcl_Obj *));
+    }
+    memcpy(objv, elems, nelems * sizeof(Tcl_Obj *));
+    memcpy(objv + nelems, args, objc * sizeof(Tcl_Obj *));
+    BgEvalObjv(interp, nelems + objc, objv);
+    if (objv != staticv) {
+        ckfree((char *)objv);
+    }
+    Tcl_DecrRefCount(prefixObj);
+}
+
+/*
+ * Turn one SDL event into the records Tcl sees, returning how many.
+ * An activation event can carry up to three changes of state.
+ */
+static int
+EventRecords(SDL_Event *eventPtr, EventRecord *recs)
+{
+    int n = 0;
+
+    memset(recs, 0, 3 * sizeof(EventRecord));
+    switch (eventPtr->type) {
+        case SDL_QUIT:
+            recs[n++].kind = BIND_QUIT;
+            break;
+        case SDL_ACTIVEEVENT: {
+            SDL_ActiveEvent *e = (SDL_ActiveEvent *)eventPtr;
+            if (e->state & SDL_APPACTIVE) {
+                recs[n++].kind = e->gain ? BIND_ACTIVATE : BIND_DEACTIVATE;
+            }
+            if (e->state & SDL_APPMOUSEFOCUS) {
+                recs[n++].kind = e->gain ? BIND_ENTER : BIND_LEAVE;
+            }
+            if (e->state & SDL_APPINPUTFOCUS) {
+                recs[n++].kind = e->gain ? BIND_FOCUSIN : BIND_FOCUSOUT;
+            }
+            break;
+        }
+        case SDL_VIDEORESIZE: {
+            SDL_ResizeEvent *e = (SDL_ResizeEvent *)eventPtr;
+            recs[n].kind = BIND_CONFIGURE;
+            recs[n].field[0] = e->w;
+            recs[n++].field[1] = e->h;
+            break;
+        }
+        case SDL_MOUSEBUTTONUP:
+        case SDL_MOUSEBUTTONDOWN: {
+            SDL_MouseButtonEvent *e = (SDL_MouseButtonEvent *)eventPtr;
+            recs[n].kind = (e->state == SDL_PRESSED)
+                ? BIND_BUTTONPRESS : BIND_BUTTONRELEASE;
+            recs[n].field[0] = e->button;
+            recs[n].field[1] = e->x;
+            recs[n++].field[2] = e->y;
+            break;
+        }
+        case SDL_MOUSEMOTION: {
+            SDL_MouseMotionEvent *e = (SDL_MouseMotionEvent *)eventPtr;
+            recs[n].kind = BIND_MOTION;
+            recs[n].field[0] = e->state;
+            recs[n].field[1] = e->x;
+            recs[n].field[2] = e->y;
+            recs[n].field[3] = e->xrel;
+            recs[n++].field[4] = e->yrel;
+            break;
+        }
+        case SDL_KEYDOWN:
+        case SDL_KEYUP: {
+            SDL_KeyboardEvent *e = (SDL_KeyboardEvent *)eventPtr;
+            recs[n].kind = (e->state == SDL_PRESSED)
+                ? BIND_KEYPRESS : BIND_KEYRELEASE;
+            recs[n].field[0] = e->keysym.sym;
+            recs[n].field[1] = e->keysym.mod;
+            recs[n].field[2] = e->keysym.unicode;
+            recs[n++].field[3] = e->keysym.scancode;
+            break;
+        }
+        case SDL_JOYAXISMOTION: {
+            SDL_JoyAxisEvent *e = (SDL_JoyAxisEvent *)eventPtr;
+            recs[n].kind = BIND_JOYAXIS;
+            recs[n].field[0] = e->which;
+            recs[n].field[1] = e->axis;
+            recs[n++].field[2] = e->value;
+            break;
+        }
+        case SDL_JOYBALLMOTION: {
+            SDL_JoyBallEvent *e = (SDL_JoyBallEvent *)eventPtr;
+            recs[n].kind = BIND_JOYBALL;
+            recs[n].field[0] = e->which;
+            recs[n].field[1] = e->ball;
+            recs[n].field[2] = e->xrel;
+            recs[n++].field[3] = e->yrel;
+            break;
+        }
+        case SDL_JOYHATMOTION: {
+            SDL_JoyHatEvent *e = (SDL_JoyHatEvent *)eventPtr;
+            recs[n].kind = BIND_JOYHAT;
+            recs[n].field[0] = e->which;
+            recs[n].field[1] = e->hat;
+            recs[n++].field[2] = e->value;
+            break;
+        }
+        case SDL_JOYBUTTONDOWN:
+        case SDL_JOYBUTTONUP: {
+            SDL_JoyButtonEvent *e = (SDL_JoyButtonEvent *)eventPtr;
+            recs[n].kind = (e->state == SDL_PRESSED)
+                ? BIND_JOYBUTTONPRESS : BIND_JOYBUTTONRELEASE;
+            recs[n].field[0] = e->which;
+            recs[n++].field[1] = e->button;
+            break;
+        }
+        case TCLSDLEVENT:
+            recs[n++].kind = BIND_USER;
+            break;
+    }
+    return n;
+}
+
+/*
+ * Pass one SDL event to its bindings.
+ */
+static void
+DispatchEvent(Tcl_Interp *interp, EventState *statePtr, SDL_Event *eventPtr)
+{
+    Tcl_Obj **bindings = statePtr->bindings;
+    EventRecord recs[3];
+    Tcl_Obj *objv[5];
+    int n, i, nrecs, kind;
+
+    nrecs = EventRecords(eventPtr, recs);
+    for (n = 0; n < nrecs; n++) {
+        kind = recs[n].kind;
+        if (bindings[kind] == NULL) {
+            continue;
+        }
+        if (kind == BIND_USER) {
+            objv[0] = (Tcl_Obj *)eventPtr->user.data1;
+            objv[1] = (Tcl_Obj *)eventPtr->user.data2;
+        } else {
+            for (i = 0; i < bindFields[kind]; i++) {
+                objv[i] = Tcl_NewIntObj(recs[n].field[i]);
+            }
+        }
+        InvokePrefix(interp, bindings[kind], bindFields[kind], objv);
+    }
+    if (eventPtr->type == TCLSDLEVENT) {
+        Tcl_DecrRefCount((Tcl_Obj *)eventPtr->user.data1);
+        Tcl_DecrRefCount((Tcl_Obj *)eventPtr->user.data2);
+    }
+}
+
+/*
+ * Pass the events of one pass to the batch handler. Kinds that are not
+ * bound are left out. A list batch holds six elements per event, the
+ * kind name and five fields; a packed batch holds an EventRecord per
+ * event and is followed by a list of the User event names and values.
+ */
+static void
+DispatchBatch(Tcl_Interp *interp, EventState *statePtr, SDL_Event *events,
+              int count)
+{
+    Tcl_Obj **bindings = statePtr->bindings;
+    EventRecord recs[3], *packed = NULL;
+    Tcl_Obj *listObj = NULL, *usersObj = NULL, *objv[2];
+    int n, r, i, nrecs, kind, objc, total = 0, nusers = 0;
+
+    if (statePtr->batchFormat == BATCH_PACKED) {
+        packed = (EventRecord *)ckalloc(3 * count * sizeof(EventRecord) + 1);
+        usersObj = Tcl_NewListObj(0, NULL);
+    } else {
+        listObj = Tcl_NewListObj(0, NULL);
+    }
+    for (n = 0; n < count; n++) {
+        SDL_Event *eventPtr = &events[n];
+
+        nrecs = EventRecords(eventPtr, recs);
+        for (r = 0; r < nrecs; r++) {
+            kind = recs[r].kind;
+            if (bindings[kind] == NULL) {
+                continue;
+            }
+            if (packed != NULL) {
+                if (kind == BIND_USER) {
+                    recs[r].field[0] = nusers++;
+                    Tcl_ListObjAppendElement(NULL, usersObj,
+                        (Tcl_Obj *)eventPtr->user.data1);
+                    Tcl_ListObjAppendElement(NULL, usersObj,
+                        (Tcl_Obj *)eventPtr->user.data2);
+                }
+                packed[total] = recs[r];
+            } else {
+                Tcl_ListObjAppendElement(NULL, listObj,
+                                         statePtr->kindObjs[kind]);
+                i = 0;
+                if (kind == BIND_USER) {
+                    Tcl_ListObjAppendElement(NULL, listObj,
+                        (Tcl_Obj *)eventPtr->user.data1);
+                    Tcl_ListObjAppendElement(NULL, listObj,
+                        (Tcl_Obj *)eventPtr->user.data2);
+                    i = 2;
+                }
+                for (; i < 5; i++) {
+                    Tcl_ListObjAppendElement(NULL, listObj,
+                        i < bindFields[kind]
+                        ? Tcl_NewIntObj(recs[r].field[i]) : statePtr->zeroObj);
+                }
+            }
+            ++total;
+        }
+        if (eventPtr->type == TCLSDLEVENT) {
+            Tcl_DecrRefCount((Tcl_Obj *)eventPtr->user.data1);
+            Tcl_DecrRefCount((Tcl_Obj *)eventPtr->user.data2);
+        }
+    }
+
+    if (packed != NULL) {
+        objv[0] = Tcl_NewByteArrayObj((unsigned char *)packed,
+                                      total * sizeof(EventRecord));
+        objv[1] = usersObj;
+        ckfree((char *)packed);
+    } else {
+        objv[0] = listObj;
+    }
+    objc = (packed != NULL) ? 2 : 1;
+    for (n = 0; n < objc; n++) {
+        Tcl_IncrRefCount(objv[n]);
+    }
+    if (total > 0) {
+        InvokePrefix(interp, statePtr->batchPrefix, objc, objv);
+    }
+    for (n = 0; n < objc; n++) {
+        Tcl_DecrRefCount(objv[n]);
+    }
+}
+
+/*
+ * Coalescing. The events collected in one pass of the event loop are
+ * thinned before dispatch according to a policy for each coalescable
+ * kind of event:
+ *
+ *   none   every event is dispatched
+ *   merge  runs of consecutive events of the kind become one
+ *   last   only the last event of the kind is dispatched
+ *
+ * A merged Motion event has the latest position and button state and
+ * the sum of the relative motion; a merged Configure has the latest
+ * size. Resizes default to last, as each one leads to a SetVideoMode,
+ * and motion to none as a drawing program may want every point.
+ */
+
+enum { COALESCE_NONE, COALESCE_MERGE, COALESCE_LAST };
+static const char *coalescePolicies[] = { "none", "merge", "last", NULL };
+
+enum { COALESCE_CONFIGURE, COALESCE_MOTION, COALESCE_COUNT };
+static const char *coalesceKinds[] = { "Configure", "Motion", NULL };
+static const Uint8 coalesceTypes[COALESCE_COUNT] = {
+    SDL_VIDEORESIZE, SDL_MOUSEMOTION
+};
+static int coalescePolicy[COALESCE_COUNT] = { COALESCE_LAST, COALESCE_NONE };
+static Tcl_WideInt coalesceMerged[COALESCE_COUNT];
+
+static int
+CoalesceKind(Uint8 type)
+{
+    int kind;
+
+    for (kind = 0; kind < COALESCE_COUNT; kind++) {
+        if (coalesceTypes[kind] == type) {
+            return coalescePolicy[kind] == COALESCE_NONE ? -1 : kind;
+        }
+    }
+    return -1;
+}
+
+static Sint16
+AddRel(Sint16 a, Sint16 b)
+{
+    int sum = a + b;
+    return (Sint16)(sum > 32767 ? 32767 : sum < -32768 ? -32768 : sum);
+}
+
+/*
+ * Fold an earlier event of the same type into a later one.
+ */
+static void
+Accumulate(SDL_Event *laterPtr, const SDL_Event *earlierPtr)
+{
+    if (laterPtr->type == SDL_MOUSEMOTION) {
+        laterPtr->motion.xrel =
+            AddRel(laterPtr->motion.xrel, earlierPtr->motion.xrel);
+        laterPtr->motion.yrel =
+            AddRel(laterPtr->motion.yrel, earlierPtr->motion.yrel);
+    }
+}
+
+/*
+ * Thin out events in place, returning how many are left.
+ */
+static int
+CoalesceEvents(SDL_Event *events, int count)
+{
+    int n, out = 0, kind, last[COALESCE_COUNT];
+
+    for (kind = 0; kind < COALESCE_COUNT; kind++) {
+        last[kind] = -1;
+    }
+    for (n = 0; n < count; n++) {
+        kind = CoalesceKind(events[n].type);
+        if (kind >= 0) {
+            last[kind] = n;
+        }
+    }
+    for (n = 0; n < count; n++) {
+        kind = CoalesceKind(events[n].type);
+        if (kind >= 0 && coalescePolicy[kind] == COALESCE_LAST
+            && n != last[kind]) {
+            Accumulate(&events[last[kind]], &events[n]);
+            ++coalesceMerged[kind];
+            continue;
+        }
+        if (kind >= 0 && coalescePolicy[kind] == COALESCE_MERGE
+            && out > 0 && events[out - 1].type == events[n].type) {
+            Accumulate(&events[n], &events[out - 1]);
+            events[out - 1] = events[n];
+            ++coalesceMerged[kind];
+            continue;
+        }
+        if (out != n) {
+            events[out] = events[n];
+        }
+        ++out;
+    }
+    return out;
+}
+
+/*
+ * Coalesce and dispatch the events collected in one pass.
+ */
+static void
+DispatchEvents(Tcl_Interp *interp, SDL_Event *events, int count)
+{
+    EventState *statePtr = GetEventState(interp);
+    int n;
+
+    count = CoalesceEvents(events, count);
+    if (statePtr->batchPrefix != NULL) {
+        DispatchBatch(interp, statePtr, events, count);
+        return;
+    }
+    for (n = 0; n < count; n++) {
+        DispatchEvent(interp, statePtr, &events[n]);
+    }
+}
+
+/*
+ * Drop an event that will never be dispatched.
+ */
+static void
+DiscardEvent(SDL_Event *eventPtr)
+{
+    if (eventPtr->type == TCLSDLEVENT) {
+        Tcl_DecrRefCount((Tcl_Obj *)eventPtr->user.data1);
+        Tcl_DecrRefCount((Tcl_Obj *)eventPtr->user.data2);
+    }
+}
+
+/*
+ * Read the window system and dispatch everything SDL has queued. Only
+ * called from the thread that set the video mode.
+ */
+static void
+PumpEvents(Tcl_Interp *interp)
+{
+    SDL_Event staticEvents[64], *events = staticEvents;
+    int count = 0, size = ARRAYSIZEOF(staticEvents);
+
+    while (SDL_PollEvent(&events[count])) {
+        if (++count == size) {
+            size *= 2;
+            if (events == staticEvents) {
+                events = (SDL_Event *)ckalloc(size * sizeof(SDL_Event));
+                memcpy(events, staticEvents, sizeof(staticEvents));
+            } else {
+                events = (SDL_Event *)ckrealloc((char *)events,
+                    size * sizeof(SDL_Event));
+            }
+        }
+    }
+    DispatchEvents(interp, events, count);
+    if (events != staticEvents) {
+        ckfree((char *)events);
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Poll mode
+ */
+
+static int
+EventProc(Tcl_Event *eventPtr, int flags)
+{
+    Tclsdl_Event *evPtr = (Tclsdl_Event *)eventPtr;
+
+    if (!(flags & TCL_WINDOW_EVENTS)) {
+        return 0;
+    }
+    if (eventMode == EVENTMODE_POLL) {
+        PumpEvents(evPtr->interp);
+    }
+    return 1;
+}
+
+static void
+SetupProc(ClientData clientData, int flags) {
+    Tcl_Time block_time = {0, 0};
+    if (!(flags & TCL_WINDOW_EVENTS) || eventMode != EVENTMODE_POLL) {
+        return;
+    }
+    /* If there are no events to process then set a wait */
+    if (!SDL_PollEvent(NULL)) {
+        block_time.usec = 10000;
+    }
+    Tcl_SetMaxBlockTime(&block_time);
+    return;
+}
+
+static void
+CheckProc(ClientData clientData, int flags) {
+    if (!(flags & TCL_WINDOW_EVENTS) || eventMode != EVENTMODE_POLL) {
+        return;
+    }
+    /* if there are SDL events, fire a Tk event to get them processed */
+    if (SDL_PollEvent(NULL)) {
+        Tclsdl_Event *event = (Tclsdl_Event *)ckalloc(sizeof(Tclsdl_Event));
+        event->ev.proc = EventProc;
+        event->interp = (Tcl_Interp *)clientData;
+        Tcl_QueueEvent((Tcl_Event *)event, TCL_QUEUE_TAIL);
+    }
+    return;
+}
+
+/* ----------------------------------------------------------------------
+ * Thread mode
+ */
+
+#ifdef TCL_THREADS
+
+/*
+ * Pump and dispatch on being woken from SDL's event thread. Runs in the
+ * thread that chose thread mode.
+ */
+static int
+ThreadEventProc(Tcl_Event *eventPtr, int flags)
+{
+    Tcl_Interp *interp;
+
+    if (!(flags & TCL_WINDOW_EVENTS)) {
+        return 0;
+    }
+    Tcl_MutexLock(&eventMutex);
+    queued = 0;
+    interp = eventInterp;
+    Tcl_MutexUnlock(&eventMutex);
+    if (interp != NULL) {
+        PumpEvents(interp);
+    }
+    return 1;
+}
+
+/*
+ * Have the thread that chose thread mode pump and dispatch, unless it
+ * has already been asked to. May be called from any thread.
+ */
+static void
+WakeOwner(void)
+{
+    Tcl_MutexLock(&eventMutex);
+    if (!queued && eventInterp != NULL) {
+        Tcl_Event *evPtr = (Tcl_Event *)ckalloc(sizeof(Tcl_Event));
+
+        evPtr->proc = ThreadEventProc;
+        Tcl_ThreadQueueEvent(eventOwner, evPtr, TCL_QUEUE_TAIL);
+        Tcl_ThreadAlert(eventOwner);
+        queued = 1;
+    }
+    Tcl_MutexUnlock(&eventMutex);
+}
+
+/*
+ * SDL calls the filter on its event thread for each event it reads.
+ * The event is queued here rather than by SDL so that it is already in
+ * the queue when the woken thread pumps.
+ */
+static int SDLCALL
+EventFilter(const SDL_Event *eventPtr)
+{
+    SDL_Event event = *eventPtr;
+
+    if (SDL_PeepEvents(&event, 1, SDL_ADDEVENT, 0) > 0) {
+        WakeOwner();
+    }
+    return 0;
+}
+
+/*
+ * Restart the video subsystem with SDL's event thread, keeping the
+ * events already queued. Only possible before a video mode is set.
+ */
+static int
+StartSDLEventThread(Tcl_Interp *interp)
+{
+    SDL_Event *events = NULL;
+    int count = 0, size = 0, n, code = TCL_OK;
+
+    if (sdlEventThread) {
+        return TCL_OK;
+    }
+    if (SDL_GetVideoSurface() != NULL) {
+        Tcl_SetResult(interp, "thread event mode must be chosen before"
+                      " the first surface is made", TCL_STATIC);
+        return TCL_ERROR;
+    }
+    for (;;) {
+        if (count == size) {
+            size = size ? size * 2 : 64;
+            events = (SDL_Event *)ckrealloc((char *)events,
+                                            size * sizeof(SDL_Event));
+        }
+        if (SDL_PeepEvents(&events[count], 1, SDL_GETEVENT,
+                           SDL_ALLEVENTS) <= 0) {
+            break;
+        }
+        count++;
+    }
+
+    SDL_QuitSubSystem(SDL_INIT_VIDEO);
+    if (SDL_InitSubSystem(SDL_INIT_VIDEO | SDL_INIT_EVENTTHREAD) < 0) {
+        Tcl_AppendResult(interp, "couldn't start the SDL event thread: ",
+                         SDL_GetError(), NULL);
+        SDL_InitSubSystem(SDL_INIT_VIDEO);
+        code = TCL_ERROR;
+    } else {
+        sdlEventThread = 1;
+    }
+    /* starting video again turned unicode translation off */
+    SDL_EnableUNICODE(1);
+
+    for (n = 0; n < count; n++) {
+        if (SDL_PeepEvents(&events[n], 1, SDL_ADDEVENT, 0) <= 0) {
+            DiscardEvent(&events[n]);
+        }
+    }
+    ckfree((char *)events);
+    return code;
+}
+
+static void
+StopThreadMode(void)
+{
+    SDL_SetEventFilter(NULL);
+    Tcl_MutexLock(&eventMutex);
+    eventInterp = NULL;
+    Tcl_MutexUnlock(&eventMutex);
+    eventMode = EVENTMODE_POLL;
+}
+
+#endif /* TCL_THREADS */
+
+const char *
+TclsdlGetEventMode(void)
+{
+    return eventModes[eventMode];
+}
+
+int
+TclsdlSetEventMode(Tcl_Interp *interp, Tcl_Obj *modeObj)
+{
+    int mode;
+
+    if (Tcl_GetIndexFromObj(interp, modeObj, eventModes, "event mode", 0,
+                            &mode) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (mode == eventMode) {
+        return TCL_OK;
+    }
+#ifdef TCL_THREADS
+    if (mode == EVENTMODE_POLL) {
+        StopThreadMode();
+    } else {
+        SDL_Event event;
+
+        if (StartSDLEventThread(interp) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        Tcl_MutexLock(&eventMutex);
+        eventOwner = Tcl_GetCurrentThread();
+        eventInterp = interp;
+        queued = 0;
+        Tcl_MutexUnlock(&eventMutex);
+        SDL_SetEventFilter(EventFilter);
+        eventMode = EVENTMODE_THREAD;
+
+        /* anything queued before the filter was set */
+        if (SDL_PeepEvents(&event, 1, SDL_PEEKEVENT, SDL_ALLEVENTS) > 0) {
+            WakeOwner();
+        }
+    }
+    return TCL_OK;
+#else
+    Tcl_SetResult(interp, "thread event mode needs a threaded Tcl",
+                  TCL_STATIC);
+    return TCL_ERROR;
+#endif
+}
+
+static int
+DeleteInterpEvents(Tcl_Event *eventPtr, ClientData clientData)
+{
+    return eventPtr->proc == EventProc
+        && ((Tclsdl_Event *)eventPtr)->interp == (Tcl_Interp *)clientData;
+}
+
+/*
+ * Called as the interpreter is deleted, before SDL is shut down. Events
+ * still in the SDL queue are dropped with it.
+ */
+void
+TclsdlStopEvents(Tcl_Interp *interp)
+{
+    SDL_Event event;
+
+#ifdef TCL_THREADS
+    if (eventInterp == interp) {
+        StopThreadMode();
+    }
+    sdlEventThread = 0;
+#endif
+    Tcl_DeleteEventSource(SetupProc, CheckProc, interp);
+    Tcl_DeleteEvents(DeleteInterpEvents, interp);
+    while (SDL_PeepEvents(&event, 1, SDL_GETEVENT, SDL_ALLEVENTS) > 0) {
+        DiscardEvent(&event);
+    }
+}
+
+/* ---------------------------------------------------------------------- */
+
+int
+EventObjCmd(ClientData clientData, Tcl_Interp *interp,
+                  int objc, Tcl_Obj *const objv[])
+{
+    SDL_UserEvent event;
+    Tcl_Obj *tmpObj = NULL;
+
+    if (objc < 2 || objc > 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "eventname ?value?");
+        return TCL_ERROR;
+    }
+
+    event.type = TCLSDLEVENT;
+    event.code = (int)0;
+    event.data2 = NULL;
+
+    /* copy objv[1] into the event */
+    tmpObj = objv[1];
+    if (Tcl_IsShared(tmpObj)) {
+        tmpObj = Tcl_DuplicateObj(tmpObj);
+    }
+    Tcl_IncrRefCount(tmpObj);
+    event.data1 = (void *)tmpObj;
+
+    tmpObj = (objc == 3) ? objv[2] : Tcl_NewStringObj("", -1);
+    if (Tcl_IsShared(tmpObj)) {
+        tmpObj = Tcl_DuplicateObj(tmpObj);
+    }
+    Tcl_IncrRefCount(tmpObj);
+    event.data2 = (void *)tmpObj;
+
+    SDL_PushEvent((SDL_Event *)&event);
+#ifdef TCL_THREADS
+    /* SDL_PushEvent does not run the filter */
+    WakeOwner();
+#endif
+    return TCL_OK;
+}
+
+/*
+ * sdl::bind ?Kind? ?prefix?
+ *
+ * With no arguments returns the kinds of event that are bound. With a
+ * kind returns its binding and with a prefix too sets it. An empty
+ * prefix removes the binding so that kind of event is ignored.
+ */
+int
+BindObjCmd(ClientData clientData, Tcl_Interp *interp,
+           int objc, Tcl_Obj *const objv[])
+{
+    Tcl_Obj **bindings = GetEventState(interp)->bindings;
+    Tcl_Obj *resultObj;
+    int kind, length;
+
+    if (objc > 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?eventKind? ?prefix?");
+        return TCL_ERROR;
+    }
+    if (objc == 1) {
+        resultObj = Tcl_NewListObj(0, NULL);
+        for (kind = 0; kind < BIND_COUNT; kind++) {
+            if (bindings[kind] != NULL) {
+                Tcl_ListObjAppendElement(interp, resultObj,
+                    Tcl_NewStringObj(bindNames[kind], -1));
+            }
+        }
+        Tcl_SetObjResult(interp, resultObj);
+        return TCL_OK;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[1], bindNames, "event kind", 0,
+                            &kind) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (objc == 2) {
+        if (bindings[kind] != NULL) {
+            Tcl_SetObjResult(interp, bindings[kind]);
+        }
+        return TCL_OK;
+    }
+    if (Tcl_ListObjLength(interp, objv[2], &length) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (bindings[kind] != NULL) {
+        Tcl_DecrRefCount(bindings[kind]);
+        bindings[kind] = NULL;
+    }
+    if (length > 0) {
+        bindings[kind] = objv[2];
+        Tcl_IncrRefCount(bindings[kind]);
+        if (kind == BIND_KEYPRESS || kind == BIND_KEYRELEASE) {
+            SDL_EnableUNICODE(1);
+        }
+    }
+    return TCL_OK;
+}
+
+/*
+ * sdl::batch ?-format list|packed? ?prefix?
+ *
+ * With no arguments returns the batch handler. With a prefix sets it,
+ * and from then on the events of each pass of the event loop go to it
+ * in one call, as a flat list or packed into a byte array. An empty
+ * prefix goes back to calling the binding for each event.
+ */
+int
+BatchObjCmd(ClientData clientData, Tcl_Interp *interp,
+            int objc, Tcl_Obj *const objv[])
+{
+    EventState *statePtr = GetEventState(interp);
+    int format = BATCH_LIST, length, n = 1;
+
+    if (objc == 1) {
+        if (statePtr->batchPrefix != NULL) {
+            Tcl_SetObjResult(interp, statePtr->batchPrefix);
+        }
+        return TCL_OK;
+    }
+    if (objc == 4 && strcmp(Tcl_GetString(objv[1]), "-format") == 0) {
+        if (Tcl_GetIndexFromObj(interp, objv[2], batchFormats, "format", 0,
+                                &format) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        n = 3;
+    } else if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-format list|packed? ?prefix?");
+        return TCL_ERROR;
+    }
+    if (Tcl_ListObjLength(interp, objv[n], &length) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (statePtr->batchPrefix != NULL) {
+        Tcl_DecrRefCount(statePtr->batchPrefix);
+        statePtr->batchPrefix = NULL;
+    }
+    if (length > 0) {
+        statePtr->batchPrefix = objv[n];
+        Tcl_IncrRefCount(statePtr->batchPrefix);
+    }
+    statePtr->batchFormat = format;
+    return TCL_OK;
+}
+
+/*
+ * sdl::coalesce policy Kind ?none|merge|last?
+ * sdl::coalesce stats
+ */
+
+static int
+CoalescePolicyCmd(ClientData clientData, Tcl_Interp *interp,
+                  int objc, Tcl_Obj *const objv[])
+{
+    int kind, policy;
+
+    if (objc < 3 || objc > 4) {
+        Tcl_WrongNumArgs(interp, 2, objv, "eventKind ?policy?");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetIndexFromObj(interp, objv[2], coalesceKinds, "event kind", 0,
+                            &kind) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (objc == 4) {
+        if (Tcl_GetIndexFromObj(interp, objv[3], coalescePolicies, "policy",
+                                0, &policy) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        coalescePolicy[kind] = policy;
+    }
+    Tcl_SetObjResult(interp,
+        Tcl_NewStringObj(coalescePolicies[coalescePolicy[kind]], -1));
+    return TCL_OK;
+}
+
+static int
+CoalesceStatsCmd(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    Tcl_Obj *resultObj;
+    Tcl_WideInt total = 0;
+    int kind;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "");
+        return TCL_ERROR;
+    }
+    for (kind = 0; kind < COALESCE_COUNT; kind++) {
+        total += coalesceMerged[kind];
+    }
+    resultObj = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("merged", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(total));
+    for (kind = 0; kind < COALESCE_COUNT; kind++) {
+        Tcl_ListObjAppendElement(interp, resultObj,
+            Tcl_NewStringObj(coalesceKinds[kind], -1));
+        Tcl_ListObjAppendElement(interp, resultObj,
+            Tcl_NewWideIntObj(coalesceMerged[kind]));
+    }
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+struct Ensemble coalesceEnsemble[] = {
+    { "policy", CoalescePolicyCmd, NULL },
+    { "stats", CoalesceStatsCmd, NULL },
+    { NULL, NULL, NULL },
+};
+
+/*export*/ int
+CoalesceObjCmd(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    struct Ensemble *ensemble = coalesceEnsemble;
+    int option = 1, index;
+
+    while (option < objc) {
+        if (Tcl_GetIndexFromObjStruct(interp, objv[option],
+                ensemble, sizeof(ensemble[0]), "command", 0, &index) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+
+        if (ensemble[index].command) {
+            return ensemble[index].command(clientData, interp, objc, objv);
+        }
+        ensemble = ensemble[index].ensemble;
+        ++option;
+    }
+    Tcl_WrongNumArgs(interp, option, objv, "command ?arg arg...?");
+    return TCL_ERROR;
+}
+
+static void
+EventStateDeleteProc(ClientData clientData, Tcl_Interp *interp)
+{
+    EventState *statePtr = clientData;
+    int kind;
+
+    for (kind = 0; kind < BIND_COUNT; kind++) {
+        if (statePtr->bindings[kind] != NULL) {
+            Tcl_DecrRefCount(statePtr->bindings[kind]);
+        }
+        Tcl_DecrRefCount(statePtr->kindObjs[kind]);
+    }
+    if (statePtr->batchPrefix != NULL) {
+        Tcl_DecrRefCount(statePtr->batchPrefix);
+    }
+    Tcl_DecrRefCount(statePtr->zeroObj);
+    ckfree((char *)statePtr);
+}
+
+/*
+ * Register the poll mode event source for the interpreter and bind
+ * every kind of event to sdl::onEvent. The command and kind names are
+ * made once here rather than for each event.
+ */
+void
+TclsdlInitEvents(Tcl_Interp *interp)
+{
+    EventState *statePtr;
+    Tcl_Obj *elems[2];
+    int kind;
+
+    if (GetEventState(interp) != NULL) {
+        return;
+    }
+    statePtr = (EventState *)ckalloc(sizeof(EventState));
+    memset(statePtr, 0, sizeof(EventState));
+    elems[0] = Tcl_NewStringObj("sdl::onEvent", -1);
+    for (kind = 0; kind < BIND_COUNT; kind++) {
+        elems[1] = statePtr->kindObjs[kind]
+            = Tcl_NewStringObj(bindNames[kind], -1);
+        Tcl_IncrRefCount(statePtr->kindObjs[kind]);
+        statePtr->bindings[kind] = Tcl_NewListObj(2, elems);
+        Tcl_IncrRefCount(statePtr->bindings[kind]);
+    }
+    statePtr->zeroObj = Tcl_NewIntObj(0);
+    Tcl_IncrRefCount(statePtr->zeroObj);
+    statePtr->batchFormat = BATCH_LIST;
+
+    /* key events are bound, so have SDL fill in their unicode field */
+    SDL_EnableUNICODE(1);
+    Tcl_SetAssocData(interp, EVENT_ASSOC, EventStateDeleteProc, statePtr);
+    Tcl_CreateEventSource(SetupProc, CheckProc, interp);
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
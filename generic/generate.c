@@ -0,0 +1,849 @@
+/*
+ * $surface generate ?-time t? ?-rect rect? expr
+ * $surface generate ?-time t? ?-rect rect? rexpr gexpr bexpr ?aexpr?
+ *
+ * Fill a surface from per-pixel expressions. Each expression is written
+ * in a subset of the Tcl expr language and is compiled once into a small
+ * stack program that is then run over the surface in C. The variables
+ * x, y (pixel position), w, h (surface size) and t (the -time value) are
+ * available either bare or as $x etc. Any other $name is read from the
+ * calling scope once, when the expression is compiled.
+ *
+ * With a single expression its value is stored as the raw pixel value
+ * (a palette index on 8 bit surfaces). With three or four expressions
+ * they give the red, green, blue and alpha components in 0..255.
+ *
+ * All arithmetic is done in double precision so "/" always divides
+ * exactly; use int() where Tcl integer division is wanted. Both arms of
+ * ?:, && and || are evaluated.
+ */
+
+#include "tclsdlInt.h"
+#include <math.h>
+#include <ctype.h>
+
+/*
+ * Pixels are evaluated GEN_CHUNK at a time so each instruction is
+ * dispatched once per chunk rather than once per pixel. Rows are
+ * shared out across the render pool in bands of GEN_BAND.
+ */
+#define GEN_CHUNK 64
+#define GEN_BAND  8
+
+enum {
+    OP_CONST, OP_X, OP_Y, OP_W, OP_H, OP_T,
+    /* unary */
+    OP_NEG, OP_NOT, OP_BITNOT,
+    OP_ABS, OP_ACOS, OP_ASIN, OP_ATAN, OP_CEIL, OP_COS, OP_COSH, OP_EXP,
+    OP_FLOOR, OP_INT, OP_LOG, OP_LOG10, OP_ROUND, OP_SIN, OP_SINH,
+    OP_SQRT, OP_TAN, OP_TANH, OP_DOUBLE,
+    /* binary */
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW,
+    OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+    OP_BITAND, OP_BITXOR, OP_BITOR, OP_AND, OP_OR, OP_SHL, OP_SHR,
+    OP_ATAN2, OP_FMOD, OP_HYPOT, OP_MIN, OP_MAX,
+    /* ternary */
+    OP_SELECT
+};
+
+#define OP_FIRST_UNARY  OP_NEG
+#define OP_FIRST_BINARY OP_ADD
+
+typedef struct Instr {
+    int    op;
+    double value;               /* OP_CONST only */
+} Instr;
+
+typedef struct Program {
+    Instr *code;
+    int    ncode;
+    int    size;
+    int    depth;               /* stack slots needed */
+} Program;
+
+typedef struct Parser {
+    Tcl_Interp *interp;
+    const char *expr;
+    const char *p;
+    Program    *progPtr;
+    int         sp;
+} Parser;
+
+static const struct {
+    const char *name;
+    int         op;
+    int         nargs;
+} mathFuncs[] = {
+    { "abs", OP_ABS, 1 },     { "acos", OP_ACOS, 1 },   { "asin", OP_ASIN, 1 },
+    { "atan", OP_ATAN, 1 },   { "atan2", OP_ATAN2, 2 }, { "ceil", OP_CEIL, 1 },
+    { "cos", OP_COS, 1 },     { "cosh", OP_COSH, 1 },   { "double", OP_DOUBLE, 1 },
+    { "entier", OP_INT, 1 },  { "exp", OP_EXP, 1 },     { "floor", OP_FLOOR, 1 },
+    { "fmod", OP_FMOD, 2 },   { "hypot", OP_HYPOT, 2 }, { "int", OP_INT, 1 },
+    { "log", OP_LOG, 1 },     { "log10", OP_LOG10, 1 }, { "max", OP_MAX, 2 },
+    { "min", OP_MIN, 2 },     { "pow", OP_POW, 2 },     { "round", OP_ROUND, 1 },
+    { "sin", OP_SIN, 1 },     { "sinh", OP_SINH, 1 },   { "sqrt", OP_SQRT, 1 },
+    { "tan", OP_TAN, 1 },     { "tanh", OP_TANH, 1 },   { "wide", OP_INT, 1 },
+    { NULL, 0, 0 }
+};
+
+/* ----------------------------------------------------------------------
+ * Evaluation
+ */
+
+static double
+Round(double v)
+{
+    return (v < 0) ? -floor(-v + 0.5) : floor(v + 0.5);
+}
+
+static Tcl_WideInt
+ToWide(double v)
+{
+    if (!(v > -9.2e18 && v < 9.2e18)) {
+        return 0;
+    }
+    return (Tcl_WideInt)v;
+}
+
+static double
+Mod(double a, double b)
+{
+    Tcl_WideInt ia = ToWide(a), ib = ToWide(b), r;
+
+    if (ib == 0) {
+        return 0;
+    }
+    r = ia % ib;
+    if (r != 0 && ((r < 0) != (ib < 0))) {
+        r += ib;
+    }
+    return (double)r;
+}
+
+static double
+Shift(double a, double b, int left)
+{
+    Tcl_WideInt ia = ToWide(a), ib = ToWide(b);
+
+    if (ib < 0 || ib > 63) {
+        return (left || ia >= 0) ? 0 : -1;
+    }
+    return (double)(left ? (ia << ib) : (ia >> ib));
+}
+
+static double
+Unary(int op, double a)
+{
+    switch (op) {
+        case OP_NEG:    return -a;
+        case OP_NOT:    return a == 0;
+        case OP_BITNOT: return (double)~ToWide(a);
+        case OP_ABS:    return fabs(a);
+        case OP_ACOS:   return acos(a);
+        case OP_ASIN:   return asin(a);
+        case OP_ATAN:   return atan(a);
+        case OP_CEIL:   return ceil(a);
+        case OP_COS:    return cos(a);
+        case OP_COSH:   return cosh(a);
+        case OP_EXP:    return exp(a);
+        case OP_FLOOR:  return floor(a);
+        case OP_INT:    return (double)ToWide(a);
+        case OP_LOG:    return log(a);
+        case OP_LOG10:  return log10(a);
+        case OP_ROUND:  return Round(a);
+        case OP_SIN:    return sin(a);
+        case OP_SINH:   return sinh(a);
+        case OP_SQRT:   return sqrt(a);
+        case OP_TAN:    return tan(a);
+        case OP_TANH:   return tanh(a);
+        case OP_DOUBLE: return a;
+    }
+    return 0;
+}
+
+static double
+Binary(int op, double a, double b)
+{
+    switch (op) {
+        case OP_ADD:    return a + b;
+        case OP_SUB:    return a - b;
+        case OP_MUL:    return a * b;
+        case OP_DIV:    return a / b;
+        case OP_MOD:    return Mod(a, b);
+        case OP_POW:    return pow(a, b);
+        case OP_LT:     return a < b;
+        case OP_LE:     return a <= b;
+        case OP_GT:     return a > b;
+        case OP_GE:     return a >= b;
+        case OP_EQ:     return a == b;
+        case OP_NE:     return a != b;
+        case OP_BITAND: return (double)(ToWide(a) & ToWide(b));
+        case OP_BITXOR: return (double)(ToWide(a) ^ ToWide(b));
+        case OP_BITOR:  return (double)(ToWide(a) | ToWide(b));
+        case OP_AND:    return a != 0 && b != 0;
+        case OP_OR:     return a != 0 || b != 0;
+        case OP_SHL:    return Shift(a, b, 1);
+        case OP_SHR:    return Shift(a, b, 0);
+        case OP_ATAN2:  return atan2(a, b);
+        case OP_FMOD:   return fmod(a, b);
+        case OP_HYPOT:  return hypot(a, b);
+        case OP_MIN:    return (a < b) ? a : b;
+        case OP_MAX:    return (a > b) ? a : b;
+    }
+    return 0;
+}
+
+/*
+ * Run a program over n pixels of one row starting at x. The result is
+ * left in stack[0]. The common arithmetic and the functions used for
+ * procedural textures get tight loops; everything else goes through
+ * Unary and Binary.
+ */
+static void
+RunProgram(const Program *progPtr, double *stack, int n,
+           double x, double y, double w, double h, double t)
+{
+    const Instr *ip = progPtr->code, *end = ip + progPtr->ncode;
+    double *top = stack - GEN_CHUNK, *a, *b;
+    int i;
+
+    for (; ip < end; ip++) {
+        int op = ip->op;
+
+        if (op < OP_FIRST_UNARY) {
+            double v = 0;
+
+            top += GEN_CHUNK;
+            switch (op) {
+                case OP_CONST: v = ip->value; break;
+                case OP_X:
+                    for (i = 0; i < n; i++) top[i] = x + i;
+                    continue;
+                case OP_Y: v = y; break;
+                case OP_W: v = w; break;
+                case OP_H: v = h; break;
+                case OP_T: v = t; break;
+            }
+            for (i = 0; i < n; i++) top[i] = v;
+        } else if (op < OP_FIRST_BINARY) {
+            a = top;
+            switch (op) {
+                case OP_NEG:  for (i = 0; i < n; i++) a[i] = -a[i]; break;
+                case OP_SIN:  for (i = 0; i < n; i++) a[i] = sin(a[i]); break;
+                case OP_COS:  for (i = 0; i < n; i++) a[i] = cos(a[i]); break;
+                case OP_SQRT: for (i = 0; i < n; i++) a[i] = sqrt(a[i]); break;
+                case OP_INT:
+                    for (i = 0; i < n; i++) a[i] = (double)ToWide(a[i]);
+                    break;
+                default:
+                    for (i = 0; i < n; i++) a[i] = Unary(op, a[i]);
+            }
+        } else if (op < OP_SELECT) {
+            a = top - GEN_CHUNK;
+            b = top;
+            top = a;
+            switch (op) {
+                case OP_ADD: for (i = 0; i < n; i++) a[i] += b[i]; break;
+                case OP_SUB: for (i = 0; i < n; i++) a[i] -= b[i]; break;
+                case OP_MUL: for (i = 0; i < n; i++) a[i] *= b[i]; break;
+                case OP_DIV: for (i = 0; i < n; i++) a[i] /= b[i]; break;
+                default:
+                    for (i = 0; i < n; i++) a[i] = Binary(op, a[i], b[i]);
+            }
+        } else {
+            double *c = top;
+
+            b = top - GEN_CHUNK;
+            a = b - GEN_CHUNK;
+            top = a;
+            for (i = 0; i < n; i++) a[i] = (a[i] != 0) ? b[i] : c[i];
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------
+ * Compiler
+ *
+ * A recursive descent parser following the Tcl expr precedence rules,
+ * emitting postfix code. Operations whose operands are all constants
+ * are folded as they are emitted.
+ */
+
+static void
+Emit(Parser *psPtr, int op, double value)
+{
+    Program *progPtr = psPtr->progPtr;
+    Instr *code;
+    int nargs;
+
+    if (op < OP_FIRST_UNARY) {
+        nargs = 0;
+    } else if (op < OP_FIRST_BINARY) {
+        nargs = 1;
+    } else if (op < OP_SELECT) {
+        nargs = 2;
+    } else {
+        nargs = 3;
+    }
+
+    code = progPtr->code + progPtr->ncode;
+    if (nargs > 0 && progPtr->ncode >= nargs) {
+        int i, folded = 1;
+        for (i = 1; i <= nargs; i++) {
+            if (code[-i].op != OP_CONST) {
+                folded = 0;
+            }
+        }
+        if (folded) {
+            switch (nargs) {
+                case 1: value = Unary(op, code[-1].value); break;
+                case 2: value = Binary(op, code[-2].value, code[-1].value);
+                    break;
+                case 3: value = (code[-3].value != 0)
+                            ? code[-2].value : code[-1].value;
+                    break;
+            }
+            progPtr->ncode -= nargs;
+            psPtr->sp -= nargs;
+            op = OP_CONST;
+            nargs = 0;
+        }
+    }
+
+    if (progPtr->ncode == progPtr->size) {
+        progPtr->size = progPtr->size ? progPtr->size * 2 : 32;
+        progPtr->code = (Instr *)ckrealloc((char *)progPtr->code,
+                                           progPtr->size * sizeof(Instr));
+    }
+    progPtr->code[progPtr->ncode].op = op;
+    progPtr->code[progPtr->ncode].value = value;
+    progPtr->ncode++;
+    psPtr->sp += 1 - nargs;
+    if (psPtr->sp > progPtr->depth) {
+        progPtr->depth = psPtr->sp;
+    }
+}
+
+static int
+SyntaxError(Parser *psPtr, const char *msg)
+{
+    char pos[TCL_INTEGER_SPACE];
+
+    sprintf(pos, "%d", (int)(psPtr->p - psPtr->expr));
+    Tcl_ResetResult(psPtr->interp);
+    Tcl_AppendResult(psPtr->interp, msg, " at position ", pos,
+                     " in expression \"", psPtr->expr, "\"", NULL);
+    return TCL_ERROR;
+}
+
+static void
+SkipSpace(Parser *psPtr)
+{
+    while (isspace((unsigned char)*psPtr->p)) {
+        psPtr->p++;
+    }
+}
+
+/*
+ * Match an operator token, taking care not to match a prefix of a
+ * longer operator (eg: "<" against "<<" or "<=").
+ */
+static int
+Accept(Parser *psPtr, const char *tok)
+{
+    size_t len = strlen(tok);
+
+    SkipSpace(psPtr);
+    if (strncmp(psPtr->p, tok, len) != 0) {
+        return 0;
+    }
+    if (len == 1 && strchr("<>=!&|*", tok[0]) && psPtr->p[1] != '\0') {
+        char next = psPtr->p[1];
+        if ((tok[0] == '<' || tok[0] == '>') && (next == tok[0] || next == '=')) {
+            return 0;
+        }
+        if ((tok[0] == '&' || tok[0] == '|' || tok[0] == '*') && next == tok[0]) {
+            return 0;
+        }
+        if (tok[0] == '!' && next == '=') {
+            return 0;
+        }
+    }
+    psPtr->p += len;
+    return 1;
+}
+
+static int ParseTernary(Parser *psPtr);
+
+static int
+ParseName(Parser *psPtr, Tcl_DString *namePtr)
+{
+    const char *start = psPtr->p;
+
+    while (isalnum((unsigned char)*psPtr->p) || *psPtr->p == '_'
+           || (psPtr->p[0] == ':' && psPtr->p[1] == ':')) {
+        psPtr->p += (*psPtr->p == ':') ? 2 : 1;
+    }
+    Tcl_DStringAppend(namePtr, start, (int)(psPtr->p - start));
+    return (psPtr->p > start);
+}
+
+static int
+ParseVariable(Parser *psPtr, const char *name, int dollar)
+{
+    static const char *const pixelVars[] = { "x", "y", "w", "h", "t", NULL };
+    static const int pixelOps[] = { OP_X, OP_Y, OP_W, OP_H, OP_T };
+    Tcl_Obj *valueObj;
+    double value;
+    int n;
+
+    for (n = 0; pixelVars[n]; n++) {
+        if (strcmp(name, pixelVars[n]) == 0) {
+            Emit(psPtr, pixelOps[n], 0);
+            return TCL_OK;
+        }
+    }
+    if (!dollar) {
+        return SyntaxError(psPtr, "unknown name");
+    }
+    valueObj = Tcl_GetVar2Ex(psPtr->interp, name, NULL, TCL_LEAVE_ERR_MSG);
+    if (valueObj == NULL
+        || Tcl_GetDoubleFromObj(psPtr->interp, valueObj, &value) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    Emit(psPtr, OP_CONST, value);
+    return TCL_OK;
+}
+
+static int
+ParsePrimary(Parser *psPtr)
+{
+    Tcl_DString name;
+    int r = TCL_OK;
+
+    SkipSpace(psPtr);
+    if (Accept(psPtr, "(")) {
+        if (ParseTernary(psPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (!Accept(psPtr, ")")) {
+            return SyntaxError(psPtr, "missing close parenthesis");
+        }
+        return TCL_OK;
+    }
+
+    if (isdigit((unsigned char)*psPtr->p) || *psPtr->p == '.') {
+        char *end;
+        double value = strtod(psPtr->p, &end);
+        if (end == psPtr->p) {
+            return SyntaxError(psPtr, "bad number");
+        }
+        psPtr->p = end;
+        Emit(psPtr, OP_CONST, value);
+        return TCL_OK;
+    }
+
+    Tcl_DStringInit(&name);
+    if (*psPtr->p == '$') {
+        psPtr->p++;
+        if (*psPtr->p == '{') {
+            const char *close = strchr(++psPtr->p, '}');
+            if (close == NULL) {
+                Tcl_DStringFree(&name);
+                return SyntaxError(psPtr, "missing close brace");
+            }
+            Tcl_DStringAppend(&name, psPtr->p, (int)(close - psPtr->p));
+            psPtr->p = close + 1;
+        } else if (!ParseName(psPtr, &name)) {
+            Tcl_DStringFree(&name);
+            return SyntaxError(psPtr, "missing variable name");
+        }
+        r = ParseVariable(psPtr, Tcl_DStringValue(&name), 1);
+    } else if (ParseName(psPtr, &name)) {
+        SkipSpace(psPtr);
+        if (*psPtr->p == '(') {
+            int n, nargs = 0;
+
+            psPtr->p++;
+            for (n = 0; mathFuncs[n].name; n++) {
+                if (strcmp(mathFuncs[n].name, Tcl_DStringValue(&name)) == 0) {
+                    break;
+                }
+            }
+            if (mathFuncs[n].name == NULL) {
+                Tcl_DStringFree(&name);
+                return SyntaxError(psPtr, "unknown math function");
+            }
+            if (!Accept(psPtr, ")")) {
+                do {
+                    if (ParseTernary(psPtr) != TCL_OK) {
+                        Tcl_DStringFree(&name);
+                        return TCL_ERROR;
+                    }
+                    nargs++;
+                } while (Accept(psPtr, ","));
+                if (!Accept(psPtr, ")")) {
+                    Tcl_DStringFree(&name);
+                    return SyntaxError(psPtr, "missing close parenthesis");
+                }
+            }
+            if (nargs != mathFuncs[n].nargs) {
+                Tcl_DStringFree(&name);
+                return SyntaxError(psPtr, "wrong number of arguments");
+            }
+            Emit(psPtr, mathFuncs[n].op, 0);
+        } else {
+            r = ParseVariable(psPtr, Tcl_DStringValue(&name), 0);
+        }
+    } else {
+        r = SyntaxError(psPtr, (*psPtr->p) ? "unexpected character"
+                        : "missing operand");
+    }
+    Tcl_DStringFree(&name);
+    return r;
+}
+
+/*
+ * As in Tcl, the unary operators bind tighter than "**", which is
+ * right associative.
+ */
+static int
+ParseUnary(Parser *psPtr)
+{
+    int op = -1;
+
+    if (Accept(psPtr, "-")) {
+        op = OP_NEG;
+    } else if (Accept(psPtr, "!")) {
+        op = OP_NOT;
+    } else if (Accept(psPtr, "~")) {
+        op = OP_BITNOT;
+    } else if (Accept(psPtr, "+")) {
+        return ParseUnary(psPtr);
+    }
+    if (op < 0) {
+        return ParsePrimary(psPtr);
+    }
+    if (ParseUnary(psPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    Emit(psPtr, op, 0);
+    return TCL_OK;
+}
+
+static int
+ParsePower(Parser *psPtr)
+{
+    if (ParseUnary(psPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (Accept(psPtr, "**")) {
+        if (ParsePower(psPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        Emit(psPtr, OP_POW, 0);
+    }
+    return TCL_OK;
+}
+
+/*
+ * Left associative binary operators, lowest precedence first.
+ */
+static const struct {
+    const char *tok;
+    int         op;
+} binaryOps[][4] = {
+    { { "||", OP_OR } },
+    { { "&&", OP_AND } },
+    { { "|", OP_BITOR } },
+    { { "^", OP_BITXOR } },
+    { { "&", OP_BITAND } },
+    { { "==", OP_EQ }, { "!=", OP_NE } },
+    { { "<=", OP_LE }, { ">=", OP_GE }, { "<", OP_LT }, { ">", OP_GT } },
+    { { "<<", OP_SHL }, { ">>", OP_SHR } },
+    { { "+", OP_ADD }, { "-", OP_SUB } },
+    { { "*", OP_MUL }, { "/", OP_DIV }, { "%", OP_MOD } },
+};
+
+#define NUM_LEVELS ((int)(sizeof(binaryOps) / sizeof(binaryOps[0])))
+
+static int
+ParseBinary(Parser *psPtr, int level)
+{
+    int n, matched;
+
+    if (level == NUM_LEVELS) {
+        return ParsePower(psPtr);
+    }
+    if (ParseBinary(psPtr, level + 1) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    do {
+        matched = 0;
+        for (n = 0; n < 4 && binaryOps[level][n].tok; n++) {
+            if (Accept(psPtr, binaryOps[level][n].tok)) {
+                if (ParseBinary(psPtr, level + 1) != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                Emit(psPtr, binaryOps[level][n].op, 0);
+                matched = 1;
+                break;
+            }
+        }
+    } while (matched);
+    return TCL_OK;
+}
+
+static int
+ParseTernary(Parser *psPtr)
+{
+    if (ParseBinary(psPtr, 0) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (Accept(psPtr, "?")) {
+        if (ParseTernary(psPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (!Accept(psPtr, ":")) {
+            return SyntaxError(psPtr, "missing \":\" in ternary");
+        }
+        if (ParseTernary(psPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        Emit(psPtr, OP_SELECT, 0);
+    }
+    return TCL_OK;
+}
+
+static int
+CompileExpr(Tcl_Interp *interp, Tcl_Obj *exprObj, Program *progPtr)
+{
+    Parser ps;
+
+    memset(progPtr, 0, sizeof(Program));
+    ps.interp = interp;
+    ps.expr = ps.p = Tcl_GetString(exprObj);
+    ps.progPtr = progPtr;
+    ps.sp = 0;
+    if (ParseTernary(&ps) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    SkipSpace(&ps);
+    if (*ps.p != '\0') {
+        return SyntaxError(&ps, "unexpected character");
+    }
+    return TCL_OK;
+}
+
+/* ----------------------------------------------------------------------
+ * Rendering
+ */
+
+typedef struct Kernel {
+    SDL_Surface *surface;
+    Program      prog[4];
+    int          nprog;
+    int          depth;
+    SDL_Rect     rect;
+    double       t;
+} Kernel;
+
+static Uint32
+Channel(double v)
+{
+    if (!(v > 0)) {
+        return 0;
+    }
+    return (v >= 255) ? 255 : (Uint32)v;
+}
+
+static void
+StorePixels(SDL_Surface *surface, int nprog, double *results[], int n,
+            Uint8 *dst)
+{
+    SDL_PixelFormat *fmt = surface->format;
+    int i, bpp = fmt->BytesPerPixel;
+
+    for (i = 0; i < n; i++, dst += bpp) {
+        Uint32 pixel;
+
+        if (nprog == 1) {
+            pixel = (Uint32)ToWide(results[0][i]);
+        } else if (fmt->palette) {
+            pixel = SDL_MapRGB(fmt, (Uint8)Channel(results[0][i]),
+                (Uint8)Channel(results[1][i]), (Uint8)Channel(results[2][i]));
+        } else {
+            Uint32 a = (nprog == 4) ? Channel(results[3][i]) : 255;
+            pixel = ((Channel(results[0][i]) >> fmt->Rloss) << fmt->Rshift)
+                | ((Channel(results[1][i]) >> fmt->Gloss) << fmt->Gshift)
+                | ((Channel(results[2][i]) >> fmt->Bloss) << fmt->Bshift)
+                | (((a >> fmt->Aloss) << fmt->Ashift) & fmt->Amask);
+        }
+        switch (bpp) {
+            case 1: *dst = (Uint8)pixel; break;
+            case 2: *(Uint16 *)dst = (Uint16)pixel; break;
+            case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+                dst[0] = (pixel >> 16) & 0xff;
+                dst[1] = (pixel >> 8) & 0xff;
+                dst[2] = pixel & 0xff;
+#else
+                dst[0] = pixel & 0xff;
+                dst[1] = (pixel >> 8) & 0xff;
+                dst[2] = (pixel >> 16) & 0xff;
+#endif
+                break;
+            case 4: *(Uint32 *)dst = pixel; break;
+        }
+    }
+}
+
+/*
+ * Render one band of GEN_BAND rows.
+ */
+static void
+RenderBand(ClientData clientData, int band)
+{
+    Kernel *kPtr = clientData;
+    SDL_Surface *surface = kPtr->surface;
+    double *stack, *results[4];
+    int y, x, n, p, bpp = surface->format->BytesPerPixel;
+    int y0 = kPtr->rect.y + band * GEN_BAND, y1 = y0 + GEN_BAND;
+
+    stack = (double *)ckalloc(kPtr->nprog * kPtr->depth * GEN_CHUNK
+                              * sizeof(double));
+    for (p = 0; p < kPtr->nprog; p++) {
+        results[p] = stack + p * kPtr->depth * GEN_CHUNK;
+    }
+
+    if (y1 > kPtr->rect.y + kPtr->rect.h) {
+        y1 = kPtr->rect.y + kPtr->rect.h;
+    }
+    for (y = y0; y < y1; y++) {
+        Uint8 *row = (Uint8 *)surface->pixels + y * surface->pitch;
+        for (x = kPtr->rect.x; x < kPtr->rect.x + kPtr->rect.w; x += n) {
+            n = kPtr->rect.x + kPtr->rect.w - x;
+            if (n > GEN_CHUNK) {
+                n = GEN_CHUNK;
+            }
+            for (p = 0; p < kPtr->nprog; p++) {
+                RunProgram(&kPtr->prog[p], results[p], n, x, y,
+                           surface->w, surface->h, kPtr->t);
+            }
+            StorePixels(surface, kPtr->nprog, results, n, row + x * bpp);
+        }
+    }
+    ckfree((char *)stack);
+}
+
+/*
+ * Run the kernel over its rectangle, sharing the bands out across the
+ * render pool.
+ */
+static void
+Render(Kernel *kPtr)
+{
+    TclsdlParallelFor((kPtr->rect.h + GEN_BAND - 1) / GEN_BAND, RenderBand,
+                      kPtr);
+}
+
+/*
+ * $surface generate ?-time t? ?-rect rect? expr ?expr expr ?expr??
+ */
+int
+TclsdlSurfaceGenerateCmd(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *const objv[])
+{
+    static const char *options[] = { "-rect", "-time", NULL };
+    enum { OPT_RECT, OPT_TIME };
+    SurfaceData *dataPtr = clientData;
+    SDL_Surface *surface = dataPtr->surface;
+    Kernel kernel;
+    int opt = 2, index, n, nexpr, r = TCL_OK;
+
+    memset(&kernel, 0, sizeof(kernel));
+    kernel.surface = surface;
+    kernel.rect = surface->clip_rect;
+
+    while (opt < objc && Tcl_GetString(objv[opt])[0] == '-'
+           && objc - opt > 1) {
+        if (Tcl_GetIndexFromObj(interp, objv[opt], options, "option", 0,
+                                &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case OPT_RECT: {
+                SDL_Rect rect;
+                int x0, y0, x1, y1;
+                if (TclsdlGetRectFromObj(interp, objv[opt+1], &rect)
+                    != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                x0 = (rect.x > surface->clip_rect.x)
+                    ? rect.x : surface->clip_rect.x;
+                y0 = (rect.y > surface->clip_rect.y)
+                    ? rect.y : surface->clip_rect.y;
+                x1 = rect.x + rect.w;
+                y1 = rect.y + rect.h;
+                if (x1 > surface->clip_rect.x + surface->clip_rect.w) {
+                    x1 = surface->clip_rect.x + surface->clip_rect.w;
+                }
+                if (y1 > surface->clip_rect.y + surface->clip_rect.h) {
+                    y1 = surface->clip_rect.y + surface->clip_rect.h;
+                }
+                kernel.rect.x = x0;
+                kernel.rect.y = y0;
+                kernel.rect.w = (x1 > x0) ? x1 - x0 : 0;
+                kernel.rect.h = (y1 > y0) ? y1 - y0 : 0;
+                break;
+            }
+            case OPT_TIME:
+                if (Tcl_GetDoubleFromObj(interp, objv[opt+1], &kernel.t)
+                    != TCL_OK) {
+                    return TCL_ERROR;
+                }
+                break;
+        }
+        opt += 2;
+    }
+
+    nexpr = objc - opt;
+    if (nexpr != 1 && nexpr != 3 && nexpr != 4) {
+        Tcl_WrongNumArgs(interp, 2, objv,
+            "?-time t? ?-rect rect? expr | rexpr gexpr bexpr ?aexpr?");
+        return TCL_ERROR;
+    }
+
+    for (n = 0; r == TCL_OK && n < nexpr; n++) {
+        r = CompileExpr(interp, objv[opt + n], &kernel.prog[n]);
+        kernel.nprog = n + 1;
+        if (kernel.prog[n].depth > kernel.depth) {
+            kernel.depth = kernel.prog[n].depth;
+        }
+    }
+
+    if (r == TCL_OK && kernel.rect.w > 0 && kernel.rect.h > 0) {
+        r = TclsdlLockSurface(interp, dataPtr);
+        if (r == TCL_OK) {
+            Render(&kernel);
+            TclsdlUnlockSurface(dataPtr);
+            TclsdlSurfaceDamage(dataPtr, &kernel.rect);
+        }
+    }
+
+    for (n = 0; n < kernel.nprog; n++) {
+        if (kernel.prog[n].code) {
+            ckfree((char *)kernel.prog[n].code);
+        }
+    }
+    return r;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,937 @@
+/*
+ * sdl::surface -bitmap filename
+ *
+ * Image files are read through a memory mapping and decoded straight
+ * into a new surface in the display format, so there is no intermediate
+ * surface and no second copy of the pixels. The format is found from the
+ * contents of the file:
+ *
+ *   QOI   any file
+ *   PNG   any colour type and bit depth except interlaced images; only
+ *         when built with zlib (HAVE_ZLIB)
+ *   BMP   through SDL_LoadBMP_RW, then converted to the display format
+ *   TGA   uncompressed or RLE true colour, grey and colour mapped images
+ *
+ * Images with an alpha channel, including PNG transparency chunks, get
+ * a 32 bpp surface with per-pixel alpha and the display's channel order,
+ * as SDL_DisplayFormatAlpha would give. Before a video mode is set the
+ * surface is 32 bpp with bytes in the order red, green, blue, alpha.
+ *
+ * None of this needs an interpreter, and the display format is taken
+ * beforehand by TclsdlGetDisplay, so images may be decoded on any
+ * thread. Errors are left in SDL_GetError.
+ */
+
+#include "tclsdlInt.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/*
+ * SDL 1.2 keeps the pitch in 16 bits.
+ */
+#define IMAGE_MAX_WIDTH  16383
+#define IMAGE_MAX_HEIGHT 32767
+
+/* ----------------------------------------------------------------------
+ * Memory mapped files
+ */
+
+/*
+ * Map a whole file for reading. A copy on write mapping may also be
+ * written to without the changes reaching the file.
+ */
+int
+TclsdlMapFile(const char *path, int copyOnWrite, TclsdlMappedFile *mapPtr)
+{
+#ifdef _WIN32
+    HANDLE file, mapping;
+    DWORD high, low;
+
+    memset(mapPtr, 0, sizeof(*mapPtr));
+    file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        SDL_SetError("couldn't open \"%s\"", path);
+        return -1;
+    }
+    low = GetFileSize(file, &high);
+    if (high != 0 || low == 0) {
+        CloseHandle(file);
+        SDL_SetError("\"%s\" is %s", path, low ? "too large" : "empty");
+        return -1;
+    }
+    mapping = CreateFileMappingA(file, NULL,
+        copyOnWrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (mapping == NULL) {
+        SDL_SetError("couldn't map \"%s\"", path);
+        return -1;
+    }
+    mapPtr->data = MapViewOfFile(mapping,
+        copyOnWrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+    if (mapPtr->data == NULL) {
+        CloseHandle(mapping);
+        SDL_SetError("couldn't map \"%s\"", path);
+        return -1;
+    }
+    mapPtr->size = low;
+    mapPtr->handle = mapping;
+    return 0;
+#else
+    struct stat st;
+    void *data;
+    int fd;
+
+    memset(mapPtr, 0, sizeof(*mapPtr));
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        SDL_SetError("couldn't open \"%s\"", path);
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        close(fd);
+        SDL_SetError("\"%s\" is not a file with data in it", path);
+        return -1;
+    }
+    data = mmap(NULL, (size_t)st.st_size,
+                copyOnWrite ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        SDL_SetError("couldn't map \"%s\"", path);
+        return -1;
+    }
+    mapPtr->data = data;
+    mapPtr->size = (size_t)st.st_size;
+    return 0;
+#endif
+}
+
+void
+TclsdlUnmapFile(TclsdlMappedFile *mapPtr)
+{
+    if (mapPtr->data == NULL) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile((LPCVOID)mapPtr->data);
+    CloseHandle((HANDLE)mapPtr->handle);
+#else
+    munmap((void *)mapPtr->data, mapPtr->size);
+#endif
+    mapPtr->data = NULL;
+    mapPtr->size = 0;
+}
+
+/* ----------------------------------------------------------------------
+ * Destination surfaces
+ */
+
+typedef struct Image {
+    SDL_Surface *surface;
+    int          bpp;
+    int          direct;        /* 32 bpp with 8 bit channels */
+    MapCache    *cachePtr;      /* for paletted displays */
+} Image;
+
+/*
+ * Create the surface for a w x h image, in the display format or, if the
+ * image has alpha, the format SDL_DisplayFormatAlpha would choose.
+ */
+static int
+NewImage(Image *imgPtr, const TclsdlDisplay *dispPtr, int w, int h,
+         int alpha)
+{
+    SDL_PixelFormat *sf = dispPtr->format;
+    SDL_Surface *surface;
+    Uint32 rmask, gmask, bmask, amask;
+    int depth = 32;
+
+    if (w <= 0 || h <= 0 || w > IMAGE_MAX_WIDTH || h > IMAGE_MAX_HEIGHT) {
+        SDL_SetError("image size %dx%d is not supported", w, h);
+        return -1;
+    }
+    if (sf == NULL) {
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+        rmask = 0xff000000; gmask = 0x00ff0000; bmask = 0x0000ff00;
+        amask = 0x000000ff;
+#else
+        rmask = 0x000000ff; gmask = 0x0000ff00; bmask = 0x00ff0000;
+        amask = 0xff000000;
+#endif
+        if (!alpha) {
+            amask = 0;
+        }
+    } else if (!alpha) {
+        depth = sf->BitsPerPixel;
+        rmask = sf->Rmask; gmask = sf->Gmask; bmask = sf->Bmask;
+        amask = 0;
+    } else if (sf->BytesPerPixel == 4 && sf->Gmask == 0xff00
+               && ((sf->Rmask == 0xff && sf->Bmask == 0xff0000)
+                   || (sf->Rmask == 0xff0000 && sf->Bmask == 0xff))) {
+        rmask = sf->Rmask; gmask = sf->Gmask; bmask = sf->Bmask;
+        amask = ~(rmask | gmask | bmask);
+    } else {
+        rmask = 0x00ff0000; gmask = 0x0000ff00; bmask = 0x000000ff;
+        amask = 0xff000000;
+    }
+
+    surface = TclsdlAcquireSurface(SDL_SWSURFACE, w, h, depth,
+                                   rmask, gmask, bmask, amask);
+    if (surface == NULL) {
+        return -1;
+    }
+    if (surface->format->palette && sf && sf->palette) {
+        SDL_SetColors(surface, sf->palette->colors, 0, sf->palette->ncolors);
+    }
+    if (amask) {
+        SDL_SetAlpha(surface, SDL_SRCALPHA, SDL_ALPHA_OPAQUE);
+    }
+
+    memset(imgPtr, 0, sizeof(*imgPtr));
+    imgPtr->surface = surface;
+    imgPtr->bpp = surface->format->BytesPerPixel;
+    imgPtr->direct = imgPtr->bpp == 4 && surface->format->Rloss == 0
+        && surface->format->Gloss == 0 && surface->format->Bloss == 0
+        && (amask == 0 || surface->format->Aloss == 0);
+    if (surface->format->palette) {
+        imgPtr->cachePtr = (MapCache *)ckalloc(sizeof(MapCache));
+        TclsdlInitMapCache(imgPtr->cachePtr);
+    }
+    return 0;
+}
+
+static SDL_Surface *
+FinishImage(Image *imgPtr, int ok)
+{
+    SDL_Surface *surface = imgPtr->surface;
+
+    if (imgPtr->cachePtr) {
+        ckfree((char *)imgPtr->cachePtr);
+    }
+    if (!ok && surface) {
+        TclsdlFreeSurface(surface);
+        surface = NULL;
+    }
+    return surface;
+}
+
+/*
+ * Create an empty surface in the format a loaded image would have.
+ */
+SDL_Surface *
+TclsdlNewImageSurface(int w, int h, int alpha)
+{
+    TclsdlDisplay display;
+    Image img;
+
+    TclsdlGetDisplay(&display);
+    if (NewImage(&img, &display, w, h, alpha) != 0) {
+        return NULL;
+    }
+    return FinishImage(&img, 1);
+}
+
+static void
+StorePixel(Image *imgPtr, Uint8 *p, Uint32 r, Uint32 g, Uint32 b, Uint32 a)
+{
+    SDL_PixelFormat *fmt = imgPtr->surface->format;
+    Uint32 pixel;
+
+    if (imgPtr->direct) {
+        *(Uint32 *)p = (r << fmt->Rshift) | (g << fmt->Gshift)
+            | (b << fmt->Bshift) | ((a << fmt->Ashift) & fmt->Amask);
+        return;
+    }
+    pixel = TclsdlMapColor(fmt, imgPtr->cachePtr, r, g, b);
+    if (fmt->Amask) {
+        pixel |= ((a >> fmt->Aloss) << fmt->Ashift) & fmt->Amask;
+    }
+    TclsdlWritePixel(p, imgPtr->bpp, pixel);
+}
+
+#define ROW(imgPtr, y) \
+    ((Uint8 *)(imgPtr)->surface->pixels + (y) * (imgPtr)->surface->pitch)
+
+static Uint32
+GetBE32(const Uint8 *p)
+{
+    return ((Uint32)p[0] << 24) | ((Uint32)p[1] << 16)
+        | ((Uint32)p[2] << 8) | p[3];
+}
+
+/* ----------------------------------------------------------------------
+ * QOI
+ */
+
+#define QOI_HEADER  14
+#define QOI_PADDING 8
+
+static SDL_Surface *
+DecodeQOI(const Uint8 *data, size_t size, const TclsdlDisplay *dispPtr)
+{
+    Uint8 index[64][4], px[4] = {0, 0, 0, 255};
+    size_t pos = QOI_HEADER, end;
+    Image img;
+    int x, y, run = 0;
+
+    if (size < QOI_HEADER + QOI_PADDING || GetBE32(data + 4) > 0x7fffffff
+        || GetBE32(data + 8) > 0x7fffffff
+        || (data[12] != 3 && data[12] != 4)) {
+        SDL_SetError("invalid QOI header");
+        return NULL;
+    }
+    if (NewImage(&img, dispPtr, (int)GetBE32(data + 4),
+                 (int)GetBE32(data + 8), data[12] == 4) != 0) {
+        return NULL;
+    }
+    memset(index, 0, sizeof(index));
+    end = size - QOI_PADDING;
+
+    /*
+     * Every op is at most five bytes, so reading one that starts before
+     * the padding cannot run off the end of the data.
+     */
+    for (y = 0; y < img.surface->h; y++) {
+        Uint8 *p = ROW(&img, y);
+
+        for (x = 0; x < img.surface->w; x++, p += img.bpp) {
+            if (run > 0) {
+                --run;
+            } else if (pos >= end) {
+                SDL_SetError("truncated QOI image data");
+                return FinishImage(&img, 0);
+            } else {
+                int b1 = data[pos++];
+
+                if (b1 == 0xfe) {
+                    px[0] = data[pos++];
+                    px[1] = data[pos++];
+                    px[2] = data[pos++];
+                } else if (b1 == 0xff) {
+                    px[0] = data[pos++];
+                    px[1] = data[pos++];
+                    px[2] = data[pos++];
+                    px[3] = data[pos++];
+                } else if ((b1 & 0xc0) == 0x00) {
+                    memcpy(px, index[b1], 4);
+                } else if ((b1 & 0xc0) == 0x40) {
+                    px[0] += ((b1 >> 4) & 3) - 2;
+                    px[1] += ((b1 >> 2) & 3) - 2;
+                    px[2] += (b1 & 3) - 2;
+                } else if ((b1 & 0xc0) == 0x80) {
+                    int b2 = data[pos++], vg = (b1 & 0x3f) - 32;
+                    px[0] += vg - 8 + ((b2 >> 4) & 0x0f);
+                    px[1] += vg;
+                    px[2] += vg - 8 + (b2 & 0x0f);
+                } else {
+                    run = b1 & 0x3f;
+                }
+                memcpy(index[(px[0] * 3 + px[1] * 5 + px[2] * 7
+                              + px[3] * 11) % 64], px, 4);
+            }
+            StorePixel(&img, p, px[0], px[1], px[2], px[3]);
+        }
+    }
+    return FinishImage(&img, 1);
+}
+
+/* ----------------------------------------------------------------------
+ * TGA
+ */
+
+#define TGA_HEADER 18
+
+typedef struct TgaReader {
+    const Uint8 *data;
+    size_t       pos, size;
+    int          pixelBytes;
+    int          rle;
+    int          count;         /* pixels left in the current packet */
+    int          repeat;        /* the current packet is a run */
+} TgaReader;
+
+/*
+ * Return the bytes of the next pixel or NULL if the data runs out.
+ */
+static const Uint8 *
+TgaNextPixel(TgaReader *rPtr)
+{
+    const Uint8 *p;
+
+    if (rPtr->rle) {
+        if (rPtr->count == 0) {
+            if (rPtr->pos >= rPtr->size) {
+                return NULL;
+            }
+            rPtr->repeat = (rPtr->data[rPtr->pos] & 0x80) != 0;
+            rPtr->count = (rPtr->data[rPtr->pos] & 0x7f) + 1;
+            rPtr->pos++;
+            if (rPtr->repeat) {
+                if (rPtr->pos + rPtr->pixelBytes > rPtr->size) {
+                    return NULL;
+                }
+                rPtr->pos += rPtr->pixelBytes;
+            }
+        }
+        --rPtr->count;
+        if (rPtr->repeat) {
+            return rPtr->data + rPtr->pos - rPtr->pixelBytes;
+        }
+    }
+    if (rPtr->pos + rPtr->pixelBytes > rPtr->size) {
+        return NULL;
+    }
+    p = rPtr->data + rPtr->pos;
+    rPtr->pos += rPtr->pixelBytes;
+    return p;
+}
+
+/*
+ * Unpack a 15, 16, 24 or 32 bit little endian BGR(A) value.
+ */
+static void
+TgaColor(const Uint8 *p, int bits, int alpha16, Uint8 c[4])
+{
+    if (bits <= 16) {
+        Uint32 v = p[0] | (p[1] << 8);
+        Uint32 r = (v >> 10) & 0x1f, g = (v >> 5) & 0x1f, b = v & 0x1f;
+        c[0] = (Uint8)((r << 3) | (r >> 2));
+        c[1] = (Uint8)((g << 3) | (g >> 2));
+        c[2] = (Uint8)((b << 3) | (b >> 2));
+        c[3] = (!alpha16 || (v & 0x8000)) ? 255 : 0;
+    } else {
+        c[0] = p[2];
+        c[1] = p[1];
+        c[2] = p[0];
+        c[3] = (bits == 32) ? p[3] : 255;
+    }
+}
+
+/*
+ * TGA files have no signature so the header is checked for sense.
+ */
+static int
+IsTGA(const Uint8 *data, size_t size)
+{
+    int cmapType, type, bits, cmapBits;
+
+    if (size < TGA_HEADER) {
+        return 0;
+    }
+    cmapType = data[1];
+    type = data[2] & ~8;
+    bits = data[16];
+    cmapBits = data[7];
+    if (cmapType > 1 || (data[2] & ~(1|2|3|8)) != 0 || type == 0
+        || (data[12] | data[13]) == 0 || (data[14] | data[15]) == 0) {
+        return 0;
+    }
+    switch (type) {
+        case 1:
+            return cmapType == 1 && (bits == 8 || bits == 16)
+                && (cmapBits == 15 || cmapBits == 16
+                    || cmapBits == 24 || cmapBits == 32);
+        case 2:
+            return bits == 15 || bits == 16 || bits == 24 || bits == 32;
+        case 3:
+            return bits == 8;
+    }
+    return 0;
+}
+
+static SDL_Surface *
+DecodeTGA(const Uint8 *data, size_t size, const TclsdlDisplay *dispPtr)
+{
+    int type = data[2] & ~8, bits = data[16], desc = data[17];
+    int cmapFirst = data[3] | (data[4] << 8);
+    int cmapLen = data[5] | (data[6] << 8), cmapBits = data[7];
+    int w = data[12] | (data[13] << 8), h = data[14] | (data[15] << 8);
+    int alphaBits = desc & 0x0f, alpha, x, y, ok = 1;
+    int cmapBytes = (cmapBits + 7) / 8;
+    Uint8 (*cmap)[4] = NULL;
+    TgaReader reader;
+    Image img;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.data = data;
+    reader.size = size;
+    reader.pos = TGA_HEADER + data[0];
+    reader.pixelBytes = (bits + 7) / 8;
+    reader.rle = (data[2] & 8) != 0;
+
+    if (data[1] == 1) {
+        size_t mapSize = (size_t)cmapLen * cmapBytes;
+
+        if (reader.pos + mapSize > size) {
+            SDL_SetError("truncated TGA colour map");
+            return NULL;
+        }
+        if (type == 1) {
+            cmap = (Uint8 (*)[4])ckalloc(4 * cmapLen + 4);
+            for (x = 0; x < cmapLen; x++) {
+                TgaColor(data + reader.pos + x * cmapBytes, cmapBits,
+                         alphaBits == 1, cmap[x]);
+            }
+        }
+        reader.pos += mapSize;
+    }
+    if (type == 1) {
+        alpha = cmapBits == 32 || (cmapBits == 16 && alphaBits == 1);
+    } else {
+        alpha = bits == 32 || (bits == 16 && alphaBits == 1);
+    }
+
+    if (NewImage(&img, dispPtr, w, h, alpha) != 0) {
+        if (cmap) {
+            ckfree((char *)cmap);
+        }
+        return NULL;
+    }
+
+    /* rows are stored bottom up unless descriptor bit 5 is set */
+    for (y = 0; ok && y < h; y++) {
+        int row = (desc & 0x20) ? y : h - 1 - y;
+        int step = (desc & 0x10) ? -img.bpp : img.bpp;
+        Uint8 *p = ROW(&img, row) + ((desc & 0x10) ? (w - 1) * img.bpp : 0);
+
+        for (x = 0; x < w; x++, p += step) {
+            const Uint8 *src = TgaNextPixel(&reader);
+            Uint8 c[4];
+
+            if (src == NULL) {
+                SDL_SetError("truncated TGA image data");
+                ok = 0;
+                break;
+            }
+            if (type == 1) {
+                int i = (bits == 8 ? src[0] : src[0] | (src[1] << 8))
+                    - cmapFirst;
+                if (i < 0 || i >= cmapLen) {
+                    SDL_SetError("TGA colour index out of range");
+                    ok = 0;
+                    break;
+                }
+                memcpy(c, cmap[i], 4);
+            } else if (type == 3) {
+                c[0] = c[1] = c[2] = src[0];
+                c[3] = 255;
+            } else {
+                TgaColor(src, bits, alphaBits == 1, c);
+            }
+            StorePixel(&img, p, c[0], c[1], c[2], c[3]);
+        }
+    }
+    if (cmap) {
+        ckfree((char *)cmap);
+    }
+    return FinishImage(&img, ok);
+}
+
+/* ----------------------------------------------------------------------
+ * PNG
+ */
+
+static const Uint8 pngSignature[8] = {
+    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+};
+
+#ifdef HAVE_ZLIB
+
+typedef struct PngReader {
+    const Uint8 *data;
+    size_t       size;
+    size_t       next;          /* offset of the next chunk */
+    z_stream     zs;
+} PngReader;
+
+/*
+ * Point the inflater at the next IDAT chunk. Returns 0 at the end of
+ * the image data.
+ */
+static int
+PngNextIDAT(PngReader *rPtr)
+{
+    while (rPtr->next + 12 <= rPtr->size) {
+        const Uint8 *chunk = rPtr->data + rPtr->next;
+        Uint32 length = GetBE32(chunk);
+
+        if (length > rPtr->size - rPtr->next - 12) {
+            return 0;
+        }
+        rPtr->next += 12 + length;
+        if (memcmp(chunk + 4, "IDAT", 4) == 0) {
+            rPtr->zs.next_in = (Bytef *)(chunk + 8);
+            rPtr->zs.avail_in = length;
+            return 1;
+        }
+        if (memcmp(chunk + 4, "IEND", 4) == 0) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Inflate exactly n bytes of image data.
+ */
+static int
+PngInflate(PngReader *rPtr, Uint8 *out, int n)
+{
+    rPtr->zs.next_out = out;
+    rPtr->zs.avail_out = n;
+    while (rPtr->zs.avail_out > 0) {
+        int code;
+
+        if (rPtr->zs.avail_in == 0 && !PngNextIDAT(rPtr)) {
+            SDL_SetError("truncated PNG image data");
+            return -1;
+        }
+        code = inflate(&rPtr->zs, Z_NO_FLUSH);
+        if (code == Z_STREAM_END && rPtr->zs.avail_out > 0) {
+            SDL_SetError("truncated PNG image data");
+            return -1;
+        }
+        if (code != Z_OK && code != Z_STREAM_END && code != Z_BUF_ERROR) {
+            SDL_SetError("corrupt PNG image data");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+Paeth(int a, int b, int c)
+{
+    int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return (pb <= pc) ? b : c;
+}
+
+static int
+PngUnfilter(Uint8 *row, const Uint8 *prev, int n, int bpp, int filter)
+{
+    int i;
+
+    switch (filter) {
+        case 0:
+            break;
+        case 1:
+            for (i = bpp; i < n; i++) row[i] += row[i - bpp];
+            break;
+        case 2:
+            for (i = 0; i < n; i++) row[i] += prev[i];
+            break;
+        case 3:
+            for (i = 0; i < bpp; i++) row[i] += prev[i] >> 1;
+            for (; i < n; i++) row[i] += (row[i - bpp] + prev[i]) >> 1;
+            break;
+        case 4:
+            for (i = 0; i < bpp; i++) row[i] += prev[i];
+            for (; i < n; i++) {
+                row[i] += Paeth(row[i - bpp], prev[i], prev[i - bpp]);
+            }
+            break;
+        default:
+            SDL_SetError("invalid PNG filter type %d", filter);
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Sample i of a row of depth bit samples.
+ */
+static Uint32
+PngSample(const Uint8 *row, int i, int depth)
+{
+    switch (depth) {
+        case 8:  return row[i];
+        case 16: return (row[2 * i] << 8) | row[2 * i + 1];
+        default: {
+            int bit = i * depth;
+            return (row[bit >> 3] >> (8 - depth - (bit & 7)))
+                & ((1 << depth) - 1);
+        }
+    }
+}
+
+static SDL_Surface *
+DecodePNG(const Uint8 *data, size_t size, const TclsdlDisplay *dispPtr)
+{
+    static const int channelCount[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    PngReader reader;
+    Image img;
+    Uint8 palette[256][4], key[6];
+    const Uint8 *ihdr = NULL;
+    Uint8 *rows = NULL, *row, *prev;
+    int w, h, depth, colorType, channels, rowBytes, bpp, x, y;
+    int npalette = 0, hasKey = 0, trns = 0, ok = 0, maxval;
+    size_t pos = 8;
+
+    /* read the header chunks up to the first IDAT */
+    while (pos + 12 <= size) {
+        Uint32 length = GetBE32(data + pos);
+        const Uint8 *type = data + pos + 4, *body = data + pos + 8;
+
+        if (length > size - pos - 12) {
+            break;
+        }
+        if (memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+            ihdr = body;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            npalette = length / 3 > 256 ? 256 : length / 3;
+            for (x = 0; x < npalette; x++) {
+                palette[x][0] = body[3 * x];
+                palette[x][1] = body[3 * x + 1];
+                palette[x][2] = body[3 * x + 2];
+                palette[x][3] = 255;
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            trns = 1;
+            if (length <= 256) {
+                for (x = 0; x < (int)length && x < npalette; x++) {
+                    palette[x][3] = body[x];
+                }
+            }
+            if (length == 2 || length == 6) {
+                memcpy(key, body, length);
+                hasKey = 1;
+            }
+        } else if (memcmp(type, "IDAT", 4) == 0
+                   || memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+        pos += 12 + length;
+    }
+    if (ihdr == NULL) {
+        SDL_SetError("PNG image has no header");
+        return NULL;
+    }
+    if (GetBE32(ihdr) > IMAGE_MAX_WIDTH
+        || GetBE32(ihdr + 4) > IMAGE_MAX_HEIGHT) {
+        SDL_SetError("PNG image is too large");
+        return NULL;
+    }
+    w = (int)GetBE32(ihdr);
+    h = (int)GetBE32(ihdr + 4);
+    depth = ihdr[8];
+    colorType = ihdr[9];
+    channels = colorType < 7 ? channelCount[colorType] : 0;
+    if (channels == 0 || (depth != 1 && depth != 2 && depth != 4
+                          && depth != 8 && depth != 16)
+        || (depth < 8 && colorType != 0 && colorType != 3)
+        || (depth == 16 && colorType == 3)
+        || ihdr[10] != 0 || ihdr[11] != 0) {
+        SDL_SetError("unsupported PNG format");
+        return NULL;
+    }
+    if (ihdr[12] != 0) {
+        SDL_SetError("interlaced PNG images are not supported");
+        return NULL;
+    }
+    if (colorType == 3 && npalette == 0) {
+        SDL_SetError("PNG image has no palette");
+        return NULL;
+    }
+    hasKey = hasKey && (colorType == 0 || colorType == 2);
+    if (NewImage(&img, dispPtr, w, h, colorType == 4 || colorType == 6
+                 || (colorType == 3 && trns) || hasKey) != 0) {
+        return NULL;
+    }
+
+    memset(&reader, 0, sizeof(reader));
+    reader.data = data;
+    reader.size = size;
+    reader.next = pos;
+    if (inflateInit(&reader.zs) != Z_OK) {
+        SDL_SetError("couldn't initialise zlib");
+        return FinishImage(&img, 0);
+    }
+
+    /*
+     * Each row is a filter byte and rowBytes of samples, filtered against
+     * the row above. The row above the first is all zero.
+     */
+    rowBytes = (w * channels * depth + 7) / 8;
+    bpp = (channels * depth + 7) / 8;
+    rows = (Uint8 *)ckalloc(2 * rowBytes);
+    memset(rows, 0, 2 * rowBytes);
+    prev = rows;
+    row = rows + rowBytes;
+    maxval = (1 << (depth > 8 ? 8 : depth)) - 1;
+
+    for (y = 0; y < h; y++) {
+        Uint8 *p = ROW(&img, y), filter, *tmp;
+
+        if (PngInflate(&reader, &filter, 1) != 0
+            || PngInflate(&reader, row, rowBytes) != 0
+            || PngUnfilter(row, prev, rowBytes, bpp, filter) != 0) {
+            goto done;
+        }
+        for (x = 0; x < w; x++, p += img.bpp) {
+            Uint32 c[4];
+            int i;
+
+            if (colorType == 3) {
+                Uint32 index = PngSample(row, x, depth);
+                if ((int)index >= npalette) {
+                    index = 0;
+                }
+                StorePixel(&img, p, palette[index][0], palette[index][1],
+                           palette[index][2], palette[index][3]);
+                continue;
+            }
+            c[3] = 255;
+            for (i = 0; i < channels; i++) {
+                c[i] = PngSample(row, x * channels + i, depth);
+            }
+            if (hasKey) {
+                if (colorType == 0) {
+                    c[3] = (c[0] == (Uint32)((key[0] << 8) | key[1]))
+                        ? 0 : 255;
+                } else if (c[0] == (Uint32)((key[0] << 8) | key[1])
+                           && c[1] == (Uint32)((key[2] << 8) | key[3])
+                           && c[2] == (Uint32)((key[4] << 8) | key[5])) {
+                    c[3] = 0;
+                }
+            }
+            for (i = 0; i < channels; i++) {
+                c[i] = (depth == 16) ? c[i] >> 8
+                    : (depth == 8) ? c[i] : c[i] * 255 / maxval;
+            }
+            switch (colorType) {
+                case 0: StorePixel(&img, p, c[0], c[0], c[0], c[3]); break;
+                case 2: StorePixel(&img, p, c[0], c[1], c[2], c[3]); break;
+                case 4: StorePixel(&img, p, c[0], c[0], c[0], c[1]); break;
+                case 6: StorePixel(&img, p, c[0], c[1], c[2], c[3]); break;
+            }
+        }
+        tmp = prev;
+        prev = row;
+        row = tmp;
+    }
+    ok = 1;
+
+ done:
+    inflateEnd(&reader.zs);
+    ckfree((char *)rows);
+    return FinishImage(&img, ok);
+}
+
+#endif /* HAVE_ZLIB */
+
+/* ----------------------------------------------------------------------
+ * BMP
+ */
+
+static SDL_Surface *
+DecodeBMP(const Uint8 *data, size_t size, const TclsdlDisplay *dispPtr)
+{
+    SDL_Surface *tmp, *surface;
+
+    tmp = SDL_LoadBMP_RW(SDL_RWFromMem((void *)data, (int)size), 1);
+    if (tmp == NULL || dispPtr->format == NULL) {
+        return tmp;
+    }
+    surface = SDL_ConvertSurface(tmp, dispPtr->format, SDL_SWSURFACE);
+    SDL_FreeSurface(tmp);
+    return surface;
+}
+
+/* ---------------------------------------------------------------------- */
+
+/*
+ * Take the display format. Must be called on the thread that sets the
+ * video mode.
+ */
+void
+TclsdlGetDisplay(TclsdlDisplay *dispPtr)
+{
+    SDL_Surface *screen = SDL_GetVideoSurface();
+    SDL_Palette *palette;
+
+    memset(dispPtr, 0, sizeof(TclsdlDisplay));
+    if (screen == NULL) {
+        return;
+    }
+    dispPtr->pixelFormat = *screen->format;
+    dispPtr->format = &dispPtr->pixelFormat;
+    palette = screen->format->palette;
+    if (palette) {
+        dispPtr->palette.ncolors = (palette->ncolors < 256)
+            ? palette->ncolors : 256;
+        dispPtr->palette.colors = dispPtr->colors;
+        memcpy(dispPtr->colors, palette->colors,
+               dispPtr->palette.ncolors * sizeof(SDL_Color));
+        dispPtr->pixelFormat.palette = &dispPtr->palette;
+    }
+}
+
+/*
+ * Decode an image held in memory into a new surface in the display
+ * format.
+ */
+SDL_Surface *
+TclsdlDecodeImage(const Uint8 *data, size_t size,
+                  const TclsdlDisplay *dispPtr)
+{
+    if (size >= QOI_HEADER && memcmp(data, "qoif", 4) == 0) {
+        return DecodeQOI(data, size, dispPtr);
+    }
+    if (size >= 8 && memcmp(data, pngSignature, 8) == 0) {
+#ifdef HAVE_ZLIB
+        return DecodePNG(data, size, dispPtr);
+#else
+        SDL_SetError("PNG images need a build with zlib");
+        return NULL;
+#endif
+    }
+    if (size >= 2 && data[0] == 'B' && data[1] == 'M') {
+        return DecodeBMP(data, size, dispPtr);
+    }
+    if (IsTGA(data, size)) {
+        return DecodeTGA(data, size, dispPtr);
+    }
+    SDL_SetError("unknown image format");
+    return NULL;
+}
+
+SDL_Surface *
+TclsdlLoadImage(const char *path, const TclsdlDisplay *dispPtr)
+{
+    TclsdlMappedFile map;
+    SDL_Surface *surface;
+
+    if (TclsdlCacheEnabled()) {
+        return TclsdlCacheLoadImage(path, dispPtr);
+    }
+    if (TclsdlMapFile(path, 0, &map) != 0) {
+        return NULL;
+    }
+    surface = TclsdlDecodeImage(map.data, map.size, dispPtr);
+    TclsdlUnmapFile(&map);
+    return surface;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
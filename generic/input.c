@@ -0,0 +1,268 @@
+/*
+ * sdl::keystate
+ * sdl::joystick count
+ * sdl::joystick info index
+ * sdl::joystick open index
+ * sdl::joystick close index
+ * sdl::joystick state index
+ *
+ * Polled input state, for game loops that read all their input once a
+ * frame rather than follow it through event bindings. The state is as
+ * of the last time SDL read the window system, which the Tcl event loop
+ * does in either event mode.
+ *
+ * sdl::keystate returns SDL_GetKeyState as a byte array, one byte per
+ * keysym that is 1 while the key is down:
+ *
+ *   binary scan [sdl::keystate] @273c up     ;# SDLK_UP
+ *
+ * sdl::joystick state returns the axes of an open joystick as native
+ * 16 bit integers, followed by a byte for each hat and each button. The
+ * counts are given by sdl::joystick info:
+ *
+ *   array set info [sdl::joystick open 0]
+ *   binary scan [sdl::joystick state 0] t$info(axes)cu$info(hats)cu* \
+ *       axes hats buttons
+ *
+ * Opening a joystick also turns on its JoyAxis, JoyBall, JoyHat and
+ * JoyButton events.
+ */
+
+#include "tclsdlInt.h"
+
+static SDL_Joystick **joysticks = NULL; /* open joysticks by index */
+static int njoysticks = 0;
+
+/*export*/ int
+KeyStateObjCmd(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    Uint8 *keys;
+    int count = 0;
+
+    if (objc != 1) {
+        Tcl_WrongNumArgs(interp, 1, objv, "");
+        return TCL_ERROR;
+    }
+    keys = SDL_GetKeyState(&count);
+    Tcl_SetObjResult(interp, Tcl_NewByteArrayObj(keys, count));
+    return TCL_OK;
+}
+
+/*
+ * Get the joystick index from objPtr and, if open is set, the open
+ * joystick. Leaves an error in interp if there is no such joystick.
+ */
+static int
+GetJoystickFromObj(Tcl_Interp *interp, Tcl_Obj *objPtr, int open,
+                   int *indexPtr, SDL_Joystick **joyPtr)
+{
+    int index;
+
+    if (Tcl_GetIntFromObj(interp, objPtr, &index) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (index < 0 || index >= SDL_NumJoysticks()) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj("no joystick ", -1));
+        Tcl_AppendObjToObj(Tcl_GetObjResult(interp), objPtr);
+        return TCL_ERROR;
+    }
+    *indexPtr = index;
+    if (open) {
+        if (index >= njoysticks || joysticks[index] == NULL) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj("joystick ", -1));
+            Tcl_AppendObjToObj(Tcl_GetObjResult(interp), objPtr);
+            Tcl_AppendResult(interp, " is not open", NULL);
+            return TCL_ERROR;
+        }
+        *joyPtr = joysticks[index];
+    }
+    return TCL_OK;
+}
+
+static void
+AppendInfo(Tcl_Obj *listObj, const char *name, int value)
+{
+    Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewStringObj(name, -1));
+    Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewIntObj(value));
+}
+
+static int
+JoystickCountCmd(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "");
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(SDL_NumJoysticks()));
+    return TCL_OK;
+}
+
+static int
+JoystickInfoCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    SDL_Joystick *joy = NULL;
+    const char *name;
+    Tcl_Obj *resultObj;
+    int index;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "index");
+        return TCL_ERROR;
+    }
+    if (GetJoystickFromObj(interp, objv[2], 0, &index, NULL) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    name = SDL_JoystickName(index);
+    resultObj = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("name", -1));
+    Tcl_ListObjAppendElement(interp, resultObj,
+        Tcl_NewStringObj(name ? name : "", -1));
+    if (index < njoysticks) {
+        joy = joysticks[index];
+    }
+    AppendInfo(resultObj, "open", joy != NULL);
+    if (joy != NULL) {
+        AppendInfo(resultObj, "axes", SDL_JoystickNumAxes(joy));
+        AppendInfo(resultObj, "balls", SDL_JoystickNumBalls(joy));
+        AppendInfo(resultObj, "hats", SDL_JoystickNumHats(joy));
+        AppendInfo(resultObj, "buttons", SDL_JoystickNumButtons(joy));
+    }
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+static int
+JoystickOpenCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    int index;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "index");
+        return TCL_ERROR;
+    }
+    if (GetJoystickFromObj(interp, objv[2], 0, &index, NULL) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (index >= njoysticks) {
+        int n = SDL_NumJoysticks();
+
+        joysticks = (SDL_Joystick **)ckrealloc((char *)joysticks,
+            n * sizeof(SDL_Joystick *));
+        memset(joysticks + njoysticks, 0,
+               (n - njoysticks) * sizeof(SDL_Joystick *));
+        njoysticks = n;
+    }
+    if (joysticks[index] == NULL) {
+        joysticks[index] = SDL_JoystickOpen(index);
+        if (joysticks[index] == NULL) {
+            Tcl_AppendResult(interp, "couldn't open joystick: ",
+                             SDL_GetError(), NULL);
+            return TCL_ERROR;
+        }
+        SDL_JoystickEventState(SDL_ENABLE);
+    }
+    return JoystickInfoCmd(clientData, interp, objc, objv);
+}
+
+static int
+JoystickCloseCmd(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    SDL_Joystick *joy;
+    int index;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "index");
+        return TCL_ERROR;
+    }
+    if (GetJoystickFromObj(interp, objv[2], 1, &index, &joy) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    SDL_JoystickClose(joy);
+    joysticks[index] = NULL;
+    return TCL_OK;
+}
+
+static int
+JoystickStateCmd(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    SDL_Joystick *joy;
+    Tcl_Obj *resultObj;
+    unsigned char *p;
+    int index, naxes, nhats, nbuttons, n;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "index");
+        return TCL_ERROR;
+    }
+    if (GetJoystickFromObj(interp, objv[2], 1, &index, &joy) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    naxes = SDL_JoystickNumAxes(joy);
+    nhats = SDL_JoystickNumHats(joy);
+    nbuttons = SDL_JoystickNumButtons(joy);
+
+    resultObj = Tcl_NewObj();
+    p = Tcl_SetByteArrayLength(resultObj,
+                               naxes * sizeof(Sint16) + nhats + nbuttons);
+    for (n = 0; n < naxes; n++) {
+        Sint16 value = SDL_JoystickGetAxis(joy, n);
+        memcpy(p, &value, sizeof(value));
+        p += sizeof(value);
+    }
+    for (n = 0; n < nhats; n++) {
+        *p++ = SDL_JoystickGetHat(joy, n);
+    }
+    for (n = 0; n < nbuttons; n++) {
+        *p++ = SDL_JoystickGetButton(joy, n);
+    }
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+struct Ensemble joystickEnsemble[] = {
+    { "close", JoystickCloseCmd, NULL },
+    { "count", JoystickCountCmd, NULL },
+    { "info",  JoystickInfoCmd, NULL },
+    { "open",  JoystickOpenCmd, NULL },
+    { "state", JoystickStateCmd, NULL },
+    { NULL, NULL, NULL },
+};
+
+/*export*/ int
+JoystickObjCmd(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    struct Ensemble *ensemble = joystickEnsemble;
+    int option = 1, index;
+
+    while (option < objc) {
+        if (Tcl_GetIndexFromObjStruct(interp, objv[option],
+                ensemble, sizeof(ensemble[0]), "command", 0, &index) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+
+        if (ensemble[index].command) {
+            return ensemble[index].command(clientData, interp, objc, objv);
+        }
+        ensemble = ensemble[index].ensemble;
+        ++option;
+    }
+    Tcl_WrongNumArgs(interp, option, objv, "command ?arg arg...?");
+    return TCL_ERROR;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,349 @@
+/*
+ * sdl::surface load ?-async? ?-command script? filename
+ * sdl::config -loaders n
+ *
+ * Load an image file, in any of the formats image.c decodes, into a new
+ * surface. Without -async the new surface command is returned. With
+ * -async the file is decoded on a background thread and the finished
+ * surface is handed back to the interpreter's thread through the Tcl
+ * event queue. The surface command is created there and the script is
+ * called with two more arguments, either "ok" and the surface command or
+ * "error" and the reason the load failed.
+ *
+ * At most -loaders files are decoded at once, one per processor by
+ * default. Further loads wait in a queue and are started in the order
+ * they were asked for. Without thread support the file is decoded when
+ * its event is serviced.
+ */
+
+#include "tclsdlInt.h"
+
+typedef struct LoadRequest {
+    struct LoadRequest *nextPtr;
+    Tcl_Interp   *interp;
+    Tcl_ThreadId  owner;        /* thread that asked for the load */
+    Tcl_Obj      *commandObj;
+    char         *path;
+    TclsdlDisplay display;      /* taken when the load was asked for */
+    int           decoded;
+    SDL_Surface  *surface;      /* the decoded image */
+    char         *error;        /* or why it could not be loaded */
+} LoadRequest;
+
+typedef struct LoadEvent {
+    Tcl_Event    header;
+    LoadRequest *reqPtr;
+} LoadEvent;
+
+static int loaderLimit = 0;     /* 0 until configured or first used */
+
+#ifdef TCL_THREADS
+static LoadRequest  *queueHead = NULL, *queueTail = NULL;
+static int           running = 0;       /* loader threads alive */
+static int           loaderShutdown = 0;
+static Tcl_Mutex     loaderMutex;       /* protects the fields above */
+static Tcl_Condition exitCond;          /* a loader thread has finished */
+#endif
+
+int
+TclsdlLoaderLimit(void)
+{
+    if (loaderLimit == 0) {
+        loaderLimit = TclsdlCpuCount();
+    }
+    return loaderLimit;
+}
+
+/*
+ * Set the most images decoded at once, 0 meaning one per processor.
+ * Loader threads over a lowered limit stop after their current image.
+ */
+void
+TclsdlSetLoaderLimit(int limit)
+{
+    loaderLimit = (limit <= 0) ? TclsdlCpuCount() : limit;
+}
+
+static void
+Decode(LoadRequest *reqPtr)
+{
+    reqPtr->surface = TclsdlLoadImage(reqPtr->path, &reqPtr->display);
+    if (reqPtr->surface == NULL) {
+        const char *msg = SDL_GetError();
+        reqPtr->error = ckalloc(strlen(msg) + 1);
+        strcpy(reqPtr->error, msg);
+    }
+    reqPtr->decoded = 1;
+}
+
+static void
+FreeRequest(LoadRequest *reqPtr)
+{
+    if (reqPtr->surface) {
+        TclsdlFreeSurface(reqPtr->surface);
+    }
+    if (reqPtr->error) {
+        ckfree(reqPtr->error);
+    }
+    Tcl_DecrRefCount(reqPtr->commandObj);
+    ckfree(reqPtr->path);
+    ckfree((char *)reqPtr);
+}
+
+/*
+ * Create the surface command and call the script. Runs on the thread
+ * that asked for the load.
+ */
+static int
+LoadEventProc(Tcl_Event *eventPtr, int flags)
+{
+    LoadRequest *reqPtr = ((LoadEvent *)eventPtr)->reqPtr;
+    Tcl_Interp *interp = reqPtr->interp;
+    Tcl_Obj **words, **objv, *resultObj;
+    int nwords, n;
+
+    if (!(flags & TCL_FILE_EVENTS)) {
+        return 0;
+    }
+    if (!reqPtr->decoded) {
+        Decode(reqPtr);
+    }
+
+    if (!Tcl_InterpDeleted(interp)) {
+        Tcl_SavedResult state;
+
+        Tcl_SaveResult(interp, &state);
+        if (reqPtr->surface) {
+            TclsdlNewSurfaceCommand(interp, reqPtr->surface, 0);
+            reqPtr->surface = NULL;
+            resultObj = Tcl_GetObjResult(interp);
+        } else {
+            resultObj = Tcl_NewStringObj(reqPtr->error, -1);
+        }
+        Tcl_IncrRefCount(resultObj);
+        Tcl_RestoreResult(interp, &state);
+
+        Tcl_ListObjGetElements(NULL, reqPtr->commandObj, &nwords, &words);
+        objv = (Tcl_Obj **)ckalloc((nwords + 2) * sizeof(Tcl_Obj *));
+        for (n = 0; n < nwords; n++) {
+            objv[n] = words[n];
+        }
+        objv[n++] = Tcl_NewStringObj(reqPtr->error ? "error" : "ok", -1);
+        objv[n++] = resultObj;
+        for (n = 0; n < nwords + 2; n++) {
+            Tcl_IncrRefCount(objv[n]);
+        }
+        Tclsdl_BackgroundEvalObjv(interp, nwords + 2, objv, 0);
+        for (n = 0; n < nwords + 2; n++) {
+            Tcl_DecrRefCount(objv[n]);
+        }
+        ckfree((char *)objv);
+        Tcl_DecrRefCount(resultObj);
+    }
+    Tcl_Release(interp);
+    FreeRequest(reqPtr);
+    return 1;
+}
+
+static void
+Deliver(LoadRequest *reqPtr)
+{
+    LoadEvent *evPtr = (LoadEvent *)ckalloc(sizeof(LoadEvent));
+
+    evPtr->header.proc = LoadEventProc;
+    evPtr->reqPtr = reqPtr;
+#ifdef TCL_THREADS
+    Tcl_ThreadQueueEvent(reqPtr->owner, (Tcl_Event *)evPtr, TCL_QUEUE_TAIL);
+    Tcl_ThreadAlert(reqPtr->owner);
+#else
+    Tcl_QueueEvent((Tcl_Event *)evPtr, TCL_QUEUE_TAIL);
+#endif
+}
+
+#ifdef TCL_THREADS
+static Tcl_ThreadCreateType
+LoaderThread(ClientData clientData)
+{
+    LoadRequest *reqPtr;
+
+    Tcl_MutexLock(&loaderMutex);
+    while (!loaderShutdown && running <= TclsdlLoaderLimit()
+           && (reqPtr = queueHead) != NULL) {
+        queueHead = reqPtr->nextPtr;
+        if (queueHead == NULL) {
+            queueTail = NULL;
+        }
+        Tcl_MutexUnlock(&loaderMutex);
+        Decode(reqPtr);
+        Deliver(reqPtr);
+        Tcl_MutexLock(&loaderMutex);
+    }
+    --running;
+    Tcl_ConditionNotify(&exitCond);
+    Tcl_MutexUnlock(&loaderMutex);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+/*
+ * Wait for the loader threads to finish the images they are decoding.
+ * Loads still in the queue are dropped.
+ */
+static void
+LoaderExitHandler(ClientData clientData)
+{
+    LoadRequest *reqPtr;
+
+    Tcl_MutexLock(&loaderMutex);
+    loaderShutdown = 1;
+    while (running > 0) {
+        Tcl_ConditionWait(&exitCond, &loaderMutex, NULL);
+    }
+    while ((reqPtr = queueHead) != NULL) {
+        queueHead = reqPtr->nextPtr;
+        FreeRequest(reqPtr);
+    }
+    queueTail = NULL;
+    Tcl_MutexUnlock(&loaderMutex);
+}
+#endif /* TCL_THREADS */
+
+/*
+ * Queue a load and start another loader thread if the limit allows. If
+ * no thread can be started the queued loads are decoded by their events.
+ */
+static void
+Submit(LoadRequest *reqPtr)
+{
+#ifdef TCL_THREADS
+    static int exitHandler = 0;
+    Tcl_ThreadId id;
+    int start = 0;
+
+    Tcl_MutexLock(&loaderMutex);
+    if (!exitHandler) {
+        Tcl_CreateExitHandler(LoaderExitHandler, NULL);
+        exitHandler = 1;
+    }
+    if (queueTail) {
+        queueTail->nextPtr = reqPtr;
+    } else {
+        queueHead = reqPtr;
+    }
+    queueTail = reqPtr;
+    if (running < TclsdlLoaderLimit()) {
+        ++running;
+        start = 1;
+    }
+    Tcl_MutexUnlock(&loaderMutex);
+
+    if (start && Tcl_CreateThread(&id, LoaderThread, NULL,
+            TCL_THREAD_STACK_DEFAULT, TCL_THREAD_NOFLAGS) != TCL_OK) {
+        Tcl_MutexLock(&loaderMutex);
+        if (--running == 0) {
+            while ((reqPtr = queueHead) != NULL) {
+                queueHead = reqPtr->nextPtr;
+                Deliver(reqPtr);
+            }
+            queueTail = NULL;
+        }
+        Tcl_MutexUnlock(&loaderMutex);
+    }
+#else
+    Deliver(reqPtr);
+#endif
+}
+
+int
+TclsdlSurfaceLoadCmd(ClientData clientData, Tcl_Interp *interp,
+                     int objc, Tcl_Obj *const objv[])
+{
+    static const char *options[] = { "-async", "-command", NULL };
+    enum { OPT_ASYNC, OPT_COMMAND };
+    Tcl_Obj *commandObj = NULL;
+    LoadRequest *reqPtr;
+    const char *path = NULL;
+    int n, index, async = 0, length;
+
+    for (n = 2; n < objc; n++) {
+        const char *arg = Tcl_GetString(objv[n]);
+
+        if (arg[0] != '-') {
+            if (path != NULL) {
+                goto wrongArgs;
+            }
+            path = arg;
+            continue;
+        }
+        if (Tcl_GetIndexFromObj(interp, objv[n], options, "option", 0,
+                                &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case OPT_ASYNC:
+                async = 1;
+                break;
+            case OPT_COMMAND:
+                if (++n >= objc) {
+                    goto wrongArgs;
+                }
+                commandObj = objv[n];
+                break;
+        }
+    }
+    if (path == NULL) {
+        goto wrongArgs;
+    }
+
+    if (!async) {
+        TclsdlDisplay display;
+        SDL_Surface *surface;
+
+        if (commandObj) {
+            Tcl_SetResult(interp, "-command requires -async", TCL_STATIC);
+            return TCL_ERROR;
+        }
+        TclsdlGetDisplay(&display);
+        surface = TclsdlLoadImage(path, &display);
+        if (surface == NULL) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+            return TCL_ERROR;
+        }
+        TclsdlNewSurfaceCommand(interp, surface, 0);
+        return TCL_OK;
+    }
+
+    if (commandObj == NULL) {
+        Tcl_SetResult(interp, "-async requires -command", TCL_STATIC);
+        return TCL_ERROR;
+    }
+    if (Tcl_ListObjLength(interp, commandObj, &length) != TCL_OK) {
+        return TCL_ERROR;
+    }
+
+    reqPtr = (LoadRequest *)ckalloc(sizeof(LoadRequest));
+    memset(reqPtr, 0, sizeof(LoadRequest));
+    reqPtr->interp = interp;
+    reqPtr->owner = Tcl_GetCurrentThread();
+    reqPtr->commandObj = Tcl_DuplicateObj(commandObj);
+    Tcl_IncrRefCount(reqPtr->commandObj);
+    reqPtr->path = ckalloc(strlen(path) + 1);
+    strcpy(reqPtr->path, path);
+    TclsdlGetDisplay(&reqPtr->display);
+    Tcl_Preserve(interp);
+    Submit(reqPtr);
+    return TCL_OK;
+
+ wrongArgs:
+    Tcl_WrongNumArgs(interp, 2, objv,
+                     "?-async? ?-command script? filename");
+    return TCL_ERROR;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,648 @@
+/*
+ * $surface palette cycle first count step
+ * $surface palette get ?first count?
+ *
+ * set p [sdl::palette]
+ * $p define name colors         ;# store a palette of {r g b} entries
+ * $p colors name
+ * $p names
+ * $p cycle name first count step
+ * $p mix surface from to fraction
+ * $p sequence ?{name ms name ms ...}? ?-loop bool?
+ * $p apply surface ms           ;# show the sequence at time ms
+ * $p delete
+ *
+ * Palette effects for 8 bit surfaces. Cycling rotates a range of the
+ * surface palette in place. A palette object holds named palettes and
+ * can interpolate between them, either directly with mix or along a
+ * timeline of keyframes with apply. Only the range of entries that
+ * actually changed is passed to SDL_SetColors.
+ */
+
+#include "tclsdlInt.h"
+#include <math.h>
+
+typedef struct NamedPalette {
+    int       ncolors;
+    SDL_Color colors[256];
+} NamedPalette;
+
+typedef struct Keyframe {
+    NamedPalette *palettePtr;
+    double        time;
+} Keyframe;
+
+typedef struct PaletteAnim {
+    Tcl_Command   token;
+    Tcl_HashTable palettes;     /* name -> NamedPalette */
+    Keyframe     *keys;
+    Tcl_Obj     **keyNames;
+    int           nkeys;
+    int           loop;
+} PaletteAnim;
+
+/*
+ * Parse a list of {r g b} triples. The colours are returned in a newly
+ * allocated array which the caller must free.
+ */
+int
+TclsdlGetColorsFromObj(Tcl_Interp *interp, Tcl_Obj *listObj,
+                       SDL_Color **colorsPtr, int *countPtr)
+{
+    Tcl_Obj **listObjv, **colorObjv;
+    SDL_Color *colors;
+    int i, k, listObjc, colorObjc, c[3];
+
+    if (Tcl_ListObjGetElements(interp, listObj, &listObjc, &listObjv)
+        != TCL_OK) {
+        return TCL_ERROR;
+    }
+    colors = (SDL_Color *)ckalloc((listObjc + 1) * sizeof(SDL_Color));
+    for (i = 0; i < listObjc; i++) {
+        if (Tcl_ListObjGetElements(interp, listObjv[i], &colorObjc,
+                                   &colorObjv) != TCL_OK
+            || colorObjc != 3) {
+            Tcl_ResetResult(interp);
+            Tcl_AppendResult(interp, "invalid color \"",
+                             Tcl_GetString(listObjv[i]), "\"", NULL);
+            ckfree((char *)colors);
+            return TCL_ERROR;
+        }
+        for (k = 0; k < 3; k++) {
+            if (Tcl_GetIntFromObj(interp, colorObjv[k], &c[k]) != TCL_OK) {
+                ckfree((char *)colors);
+                return TCL_ERROR;
+            }
+        }
+        colors[i].r = (Uint8)c[0];
+        colors[i].g = (Uint8)c[1];
+        colors[i].b = (Uint8)c[2];
+        colors[i].unused = 0;
+    }
+    *colorsPtr = colors;
+    *countPtr = listObjc;
+    return TCL_OK;
+}
+
+static Tcl_Obj *
+NewColorsObj(const SDL_Color *colors, int count)
+{
+    Tcl_Obj *listObj = Tcl_NewListObj(0, NULL);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        Tcl_Obj *rgb[3];
+        rgb[0] = Tcl_NewIntObj(colors[i].r);
+        rgb[1] = Tcl_NewIntObj(colors[i].g);
+        rgb[2] = Tcl_NewIntObj(colors[i].b);
+        Tcl_ListObjAppendElement(NULL, listObj, Tcl_NewListObj(3, rgb));
+    }
+    return listObj;
+}
+
+static SDL_Palette *
+GetSurfacePalette(Tcl_Interp *interp, SDL_Surface *surface)
+{
+    if (surface->format->BitsPerPixel != 8 || !surface->format->palette) {
+        Tcl_AppendResult(interp, "surface is not paletted (8 bit)", NULL);
+        return NULL;
+    }
+    return surface->format->palette;
+}
+
+/*
+ * Give entries first..first+count-1 of the surface palette the new
+ * colours, passing only the span that differs to SDL.
+ */
+static int
+PushColors(Tcl_Interp *interp, SDL_Surface *surface, const SDL_Color *colors,
+           int first, int count)
+{
+    SDL_Palette *palettePtr = surface->format->palette;
+    int lo, hi;
+
+    if (first + count > palettePtr->ncolors) {
+        count = palettePtr->ncolors - first;
+    }
+    for (lo = 0; lo < count; lo++) {
+        const SDL_Color *c = &palettePtr->colors[first + lo];
+        if (c->r != colors[lo].r || c->g != colors[lo].g
+            || c->b != colors[lo].b) {
+            break;
+        }
+    }
+    for (hi = count - 1; hi > lo; hi--) {
+        const SDL_Color *c = &palettePtr->colors[first + hi];
+        if (c->r != colors[hi].r || c->g != colors[hi].g
+            || c->b != colors[hi].b) {
+            break;
+        }
+    }
+    if (lo < count
+        && SDL_SetColors(surface, (SDL_Color *)colors + lo, first + lo,
+                         hi - lo + 1) != 1) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/*
+ * Rotate count colours so that entry i takes the colour of entry
+ * i + step.
+ */
+static void
+RotateColors(const SDL_Color *src, SDL_Color *dst, int count, int step)
+{
+    int i;
+
+    step %= count;
+    if (step < 0) {
+        step += count;
+    }
+    for (i = 0; i < count; i++) {
+        dst[i] = src[(i + step) % count];
+    }
+}
+
+static int
+GetRange(Tcl_Interp *interp, Tcl_Obj *firstObj, Tcl_Obj *countObj,
+         int ncolors, int *firstPtr, int *countPtr)
+{
+    if (Tcl_GetIntFromObj(interp, firstObj, firstPtr) != TCL_OK
+        || Tcl_GetIntFromObj(interp, countObj, countPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (*firstPtr < 0 || *countPtr < 0 || *firstPtr + *countPtr > ncolors) {
+        Tcl_AppendResult(interp, "palette range out of bounds", NULL);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+/* ----------------------------------------------------------------------
+ * $surface palette ...
+ */
+
+static int
+SurfacePaletteCycleCmd(ClientData clientData, Tcl_Interp *interp,
+                       int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    SDL_Palette *palettePtr;
+    SDL_Color colors[256];
+    int first, count, step;
+
+    if (objc != 6) {
+        Tcl_WrongNumArgs(interp, 3, objv, "first count step");
+        return TCL_ERROR;
+    }
+    if ((palettePtr = GetSurfacePalette(interp, dataPtr->surface)) == NULL
+        || GetRange(interp, objv[3], objv[4], palettePtr->ncolors,
+                    &first, &count) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[5], &step) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (count == 0) {
+        return TCL_OK;
+    }
+    RotateColors(palettePtr->colors + first, colors, count, step);
+    return PushColors(interp, dataPtr->surface, colors, first, count);
+}
+
+static int
+SurfacePaletteGetCmd(ClientData clientData, Tcl_Interp *interp,
+                     int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    SDL_Palette *palettePtr;
+    int first = 0, count;
+
+    if (objc != 3 && objc != 5) {
+        Tcl_WrongNumArgs(interp, 3, objv, "?first count?");
+        return TCL_ERROR;
+    }
+    if ((palettePtr = GetSurfacePalette(interp, dataPtr->surface)) == NULL) {
+        return TCL_ERROR;
+    }
+    count = palettePtr->ncolors;
+    if (objc == 5 && GetRange(interp, objv[3], objv[4], palettePtr->ncolors,
+                              &first, &count) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, NewColorsObj(palettePtr->colors + first, count));
+    return TCL_OK;
+}
+
+struct Ensemble surfacePaletteEnsemble[] = {
+    { "cycle", SurfacePaletteCycleCmd, NULL },
+    { "get", SurfacePaletteGetCmd, NULL },
+    { NULL, NULL, NULL },
+};
+
+/* ----------------------------------------------------------------------
+ * Palette animation objects
+ */
+
+static NamedPalette *
+FindPalette(Tcl_Interp *interp, PaletteAnim *animPtr, Tcl_Obj *nameObj)
+{
+    Tcl_HashEntry *entryPtr;
+
+    entryPtr = Tcl_FindHashEntry(&animPtr->palettes, Tcl_GetString(nameObj));
+    if (entryPtr == NULL) {
+        Tcl_AppendResult(interp, "no palette named \"",
+                         Tcl_GetString(nameObj), "\"", NULL);
+        return NULL;
+    }
+    return (NamedPalette *)Tcl_GetHashValue(entryPtr);
+}
+
+/*
+ * Interpolate between two palettes, f running from 0 to 256.
+ */
+static int
+MixPalettes(const NamedPalette *aPtr, const NamedPalette *bPtr, int f,
+            SDL_Color *out)
+{
+    int i, count = (aPtr->ncolors < bPtr->ncolors)
+        ? aPtr->ncolors : bPtr->ncolors;
+
+    for (i = 0; i < count; i++) {
+        const SDL_Color *a = &aPtr->colors[i], *b = &bPtr->colors[i];
+        out[i].r = (Uint8)((a->r * (256 - f) + b->r * f + 128) >> 8);
+        out[i].g = (Uint8)((a->g * (256 - f) + b->g * f + 128) >> 8);
+        out[i].b = (Uint8)((a->b * (256 - f) + b->b * f + 128) >> 8);
+        out[i].unused = 0;
+    }
+    return count;
+}
+
+static int
+FractionToFixed(double t)
+{
+    if (!(t > 0)) {
+        return 0;
+    }
+    return (t >= 1) ? 256 : (int)(t * 256 + 0.5);
+}
+
+static int
+PaletteDefineCmd(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    PaletteAnim *animPtr = clientData;
+    NamedPalette *palettePtr;
+    Tcl_HashEntry *entryPtr;
+    SDL_Color *colors;
+    int count, isNew;
+
+    if (objc != 4) {
+        Tcl_WrongNumArgs(interp, 2, objv, "name colors");
+        return TCL_ERROR;
+    }
+    if (TclsdlGetColorsFromObj(interp, objv[3], &colors, &count) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (count > 256) {
+        ckfree((char *)colors);
+        Tcl_AppendResult(interp, "a palette has at most 256 colors", NULL);
+        return TCL_ERROR;
+    }
+    entryPtr = Tcl_CreateHashEntry(&animPtr->palettes,
+                                   Tcl_GetString(objv[2]), &isNew);
+    if (isNew) {
+        palettePtr = (NamedPalette *)ckalloc(sizeof(NamedPalette));
+        memset(palettePtr, 0, sizeof(NamedPalette));
+        Tcl_SetHashValue(entryPtr, palettePtr);
+    } else {
+        palettePtr = (NamedPalette *)Tcl_GetHashValue(entryPtr);
+    }
+    palettePtr->ncolors = count;
+    memcpy(palettePtr->colors, colors, count * sizeof(SDL_Color));
+    ckfree((char *)colors);
+    return TCL_OK;
+}
+
+static int
+PaletteColorsCmd(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    PaletteAnim *animPtr = clientData;
+    NamedPalette *palettePtr;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "name");
+        return TCL_ERROR;
+    }
+    if ((palettePtr = FindPalette(interp, animPtr, objv[2])) == NULL) {
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp,
+                     NewColorsObj(palettePtr->colors, palettePtr->ncolors));
+    return TCL_OK;
+}
+
+static int
+PaletteNamesCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    PaletteAnim *animPtr = clientData;
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entryPtr;
+    Tcl_Obj *listObj;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, NULL);
+        return TCL_ERROR;
+    }
+    listObj = Tcl_NewListObj(0, NULL);
+    for (entryPtr = Tcl_FirstHashEntry(&animPtr->palettes, &search);
+         entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+        Tcl_ListObjAppendElement(interp, listObj, Tcl_NewStringObj(
+            Tcl_GetHashKey(&animPtr->palettes, entryPtr), -1));
+    }
+    Tcl_SetObjResult(interp, listObj);
+    return TCL_OK;
+}
+
+static int
+PaletteCycleCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    PaletteAnim *animPtr = clientData;
+    NamedPalette *palettePtr;
+    SDL_Color colors[256];
+    int first, count, step;
+
+    if (objc != 6) {
+        Tcl_WrongNumArgs(interp, 2, objv, "name first count step");
+        return TCL_ERROR;
+    }
+    if ((palettePtr = FindPalette(interp, animPtr, objv[2])) == NULL
+        || GetRange(interp, objv[3], objv[4], palettePtr->ncolors,
+                    &first, &count) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[5], &step) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (count > 0) {
+        RotateColors(palettePtr->colors + first, colors, count, step);
+        memcpy(palettePtr->colors + first, colors, count * sizeof(SDL_Color));
+    }
+    return TCL_OK;
+}
+
+static int
+PaletteMixCmd(ClientData clientData, Tcl_Interp *interp,
+              int objc, Tcl_Obj *const objv[])
+{
+    PaletteAnim *animPtr = clientData;
+    NamedPalette *fromPtr, *toPtr;
+    SurfaceData *dataPtr;
+    SDL_Color colors[256];
+    double t;
+    int count;
+
+    if (objc != 6) {
+        Tcl_WrongNumArgs(interp, 2, objv, "surface from to fraction");
+        return TCL_ERROR;
+    }
+    if (TclsdlGetSurfaceFromObj(interp, objv[2], &dataPtr) != TCL_OK
+        || GetSurfacePalette(interp, dataPtr->surface) == NULL
+        || (fromPtr = FindPalette(interp, animPtr, objv[3])) == NULL
+        || (toPtr = FindPalette(interp, animPtr, objv[4])) == NULL
+        || Tcl_GetDoubleFromObj(interp, objv[5], &t) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    count = MixPalettes(fromPtr, toPtr, FractionToFixed(t), colors);
+    return PushColors(interp, dataPtr->surface, colors, 0, count);
+}
+
+static void
+FreeSequence(PaletteAnim *animPtr)
+{
+    int n;
+
+    for (n = 0; n < animPtr->nkeys; n++) {
+        Tcl_DecrRefCount(animPtr->keyNames[n]);
+    }
+    if (animPtr->keys) {
+        ckfree((char *)animPtr->keys);
+        ckfree((char *)animPtr->keyNames);
+    }
+    animPtr->keys = NULL;
+    animPtr->keyNames = NULL;
+    animPtr->nkeys = 0;
+}
+
+static int
+PaletteSequenceCmd(ClientData clientData, Tcl_Interp *interp,
+                   int objc, Tcl_Obj *const objv[])
+{
+    PaletteAnim *animPtr = clientData;
+    Tcl_Obj **listObjv, *listObj;
+    Keyframe *keys;
+    int n, listObjc, opt = 2;
+
+    if (opt < objc && Tcl_GetString(objv[opt])[0] != '-') {
+        if (Tcl_ListObjGetElements(interp, objv[opt], &listObjc, &listObjv)
+            != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (listObjc % 2) {
+            Tcl_AppendResult(interp, "sequence must be a list of name and "
+                             "time pairs", NULL);
+            return TCL_ERROR;
+        }
+        keys = (Keyframe *)ckalloc((listObjc / 2 + 1) * sizeof(Keyframe));
+        for (n = 0; n < listObjc / 2; n++) {
+            keys[n].palettePtr = FindPalette(interp, animPtr, listObjv[2*n]);
+            if (keys[n].palettePtr == NULL
+                || Tcl_GetDoubleFromObj(interp, listObjv[2*n+1],
+                                        &keys[n].time) != TCL_OK) {
+                ckfree((char *)keys);
+                return TCL_ERROR;
+            }
+            if (n > 0 && keys[n].time < keys[n-1].time) {
+                ckfree((char *)keys);
+                Tcl_AppendResult(interp, "keyframe times must not decrease",
+                                 NULL);
+                return TCL_ERROR;
+            }
+        }
+        FreeSequence(animPtr);
+        animPtr->keys = keys;
+        animPtr->nkeys = listObjc / 2;
+        animPtr->keyNames = (Tcl_Obj **)ckalloc(
+            (animPtr->nkeys + 1) * sizeof(Tcl_Obj *));
+        for (n = 0; n < animPtr->nkeys; n++) {
+            animPtr->keyNames[n] = listObjv[2*n];
+            Tcl_IncrRefCount(animPtr->keyNames[n]);
+        }
+        ++opt;
+    }
+    for (; opt < objc; opt += 2) {
+        if (strcmp(Tcl_GetString(objv[opt]), "-loop") != 0
+            || opt + 1 >= objc) {
+            Tcl_WrongNumArgs(interp, 2, objv, "?{name ms ...}? ?-loop bool?");
+            return TCL_ERROR;
+        }
+        if (Tcl_GetBooleanFromObj(interp, objv[opt+1], &animPtr->loop)
+            != TCL_OK) {
+            return TCL_ERROR;
+        }
+    }
+
+    listObj = Tcl_NewListObj(0, NULL);
+    for (n = 0; n < animPtr->nkeys; n++) {
+        Tcl_ListObjAppendElement(interp, listObj, animPtr->keyNames[n]);
+        Tcl_ListObjAppendElement(interp, listObj,
+                                 Tcl_NewDoubleObj(animPtr->keys[n].time));
+    }
+    Tcl_SetObjResult(interp, listObj);
+    return TCL_OK;
+}
+
+static int
+PaletteApplyCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    PaletteAnim *animPtr = clientData;
+    Keyframe *keys = animPtr->keys;
+    SurfaceData *dataPtr;
+    SDL_Color colors[256];
+    double ms, span;
+    int n, count, last = animPtr->nkeys - 1;
+
+    if (objc != 4) {
+        Tcl_WrongNumArgs(interp, 2, objv, "surface ms");
+        return TCL_ERROR;
+    }
+    if (TclsdlGetSurfaceFromObj(interp, objv[2], &dataPtr) != TCL_OK
+        || GetSurfacePalette(interp, dataPtr->surface) == NULL
+        || Tcl_GetDoubleFromObj(interp, objv[3], &ms) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (animPtr->nkeys == 0) {
+        Tcl_AppendResult(interp, "no sequence defined", NULL);
+        return TCL_ERROR;
+    }
+
+    span = keys[last].time - keys[0].time;
+    if (animPtr->loop && span > 0) {
+        ms = keys[0].time + fmod(ms - keys[0].time, span);
+        if (ms < keys[0].time) {
+            ms += span;
+        }
+    }
+    if (ms <= keys[0].time) {
+        count = MixPalettes(keys[0].palettePtr, keys[0].palettePtr, 0, colors);
+    } else if (ms >= keys[last].time) {
+        count = MixPalettes(keys[last].palettePtr, keys[last].palettePtr, 0,
+                            colors);
+    } else {
+        for (n = 0; keys[n+1].time <= ms; n++) {
+            /* find the segment containing ms */
+        }
+        count = MixPalettes(keys[n].palettePtr, keys[n+1].palettePtr,
+            FractionToFixed((ms - keys[n].time)
+                            / (keys[n+1].time - keys[n].time)), colors);
+    }
+    return PushColors(interp, dataPtr->surface, colors, 0, count);
+}
+
+static int
+PaletteDeleteCmd(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    PaletteAnim *animPtr = clientData;
+    Tcl_DeleteCommandFromToken(interp, animPtr->token);
+    return TCL_OK;
+}
+
+struct Ensemble paletteEnsemble[] = {
+    { "define", PaletteDefineCmd, NULL },
+    { "colors", PaletteColorsCmd, NULL },
+    { "names", PaletteNamesCmd, NULL },
+    { "cycle", PaletteCycleCmd, NULL },
+    { "mix", PaletteMixCmd, NULL },
+    { "sequence", PaletteSequenceCmd, NULL },
+    { "apply", PaletteApplyCmd, NULL },
+    { "delete", PaletteDeleteCmd, NULL },
+    { NULL, NULL, NULL },
+};
+
+static int
+PaletteEnsemble(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    struct Ensemble *ensemble = paletteEnsemble;
+    int option = 1, index;
+
+    while (option < objc) {
+        if (Tcl_GetIndexFromObjStruct(interp, objv[option],
+		ensemble, sizeof(ensemble[0]), "command", 0, &index) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+
+        if (ensemble[index].command) {
+            return ensemble[index].command(clientData, interp, objc, objv);
+        }
+        ensemble = ensemble[index].ensemble;
+        ++option;
+    }
+    Tcl_WrongNumArgs(interp, option, objv, "command ?arg arg...?");
+    return TCL_ERROR;
+}
+
+static void
+PaletteCleanup(ClientData clientData)
+{
+    PaletteAnim *animPtr = clientData;
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entryPtr;
+
+    for (entryPtr = Tcl_FirstHashEntry(&animPtr->palettes, &search);
+         entryPtr != NULL; entryPtr = Tcl_NextHashEntry(&search)) {
+        ckfree((char *)Tcl_GetHashValue(entryPtr));
+    }
+    Tcl_DeleteHashTable(&animPtr->palettes);
+    FreeSequence(animPtr);
+    ckfree((char *)animPtr);
+}
+
+/*
+ * sdl::palette
+ */
+int
+PaletteObjCmd(ClientData clientData, Tcl_Interp *interp,
+              int objc, Tcl_Obj *const objv[])
+{
+    PaletteAnim *animPtr;
+    static int uid = 0;
+    char name[10 + TCL_INTEGER_SPACE];
+
+    if (objc != 1) {
+        Tcl_WrongNumArgs(interp, 1, objv, NULL);
+        return TCL_ERROR;
+    }
+
+    animPtr = (PaletteAnim *)ckalloc(sizeof(PaletteAnim));
+    memset(animPtr, 0, sizeof(PaletteAnim));
+    Tcl_InitHashTable(&animPtr->palettes, TCL_STRING_KEYS);
+    sprintf(name, "sdlpalette%u", uid++);
+    animPtr->token = Tcl_CreateObjCommand(interp, name, PaletteEnsemble,
+                                          animPtr, PaletteCleanup);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+    return TCL_OK;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,329 @@
+/*
+ * set view [$surface view ?rect?]
+ * sdl::viewbytes view
+ *
+ * A pixel view is a Tcl value that refers directly to the memory of a
+ * rectangle of a surface. Extensions can get at the pixels through
+ * Tclsdl_GetPixelViewFromObj without any copy and "setrawbuffer" will
+ * copy straight from one surface to another when given a view.
+ *
+ * The view is live: it reflects whatever is in the surface at the time
+ * it is used. Scripts read it with sdl::viewbytes, which copies the
+ * rectangle out once as a byte array of tightly packed rows, the same
+ * cost as getrawbuffer. Using the view itself as a string or byte array
+ * also works but takes a snapshot through the string form, which costs
+ * more and is not refreshed while the value is shared. If the surface
+ * is deleted, or configured to a new video mode, while views of it
+ * remain they are given a private copy of their pixels first.
+ */
+
+#include "tclsdlInt.h"
+
+struct PixelView {
+    int          refCount;
+    SurfaceData *dataPtr;       /* NULL once the surface is deleted */
+    SDL_Rect     rect;
+    int          bpp;           /* bytes per pixel */
+    unsigned char *copy;        /* pixels saved when the surface went */
+    PixelView   *nextPtr;       /* other views of the same surface */
+};
+
+static void PixelView_FreeIntRep(Tcl_Obj *objPtr);
+static void PixelView_DupIntRep(Tcl_Obj *srcPtr, Tcl_Obj *dstPtr);
+static void PixelView_UpdateString(Tcl_Obj *objPtr);
+static int  PixelView_SetFromAny(Tcl_Interp *interp, Tcl_Obj *objPtr);
+
+static Tcl_ObjType sdlPixelViewType = {
+    "sdlpixelview",
+    PixelView_FreeIntRep,       /* freeIntRepProc */
+    PixelView_DupIntRep,        /* dupIntRepProc*/
+    PixelView_UpdateString,     /* updateStringProc */
+    PixelView_SetFromAny,       /* setFromAnyProc */
+};
+
+#define PIXELVIEW_INTREP(objPtr) \
+    ((PixelView *)(objPtr)->internalRep.otherValuePtr)
+
+static void
+ReleaseView(PixelView *viewPtr)
+{
+    if (--viewPtr->refCount > 0) {
+        return;
+    }
+    if (viewPtr->dataPtr) {
+        PixelView **linkPtr = &viewPtr->dataPtr->views;
+        while (*linkPtr != viewPtr) {
+            linkPtr = &(*linkPtr)->nextPtr;
+        }
+        *linkPtr = viewPtr->nextPtr;
+    }
+    if (viewPtr->copy) {
+        ckfree((char *)viewPtr->copy);
+    }
+    ckfree((char *)viewPtr);
+}
+
+static void
+PixelView_FreeIntRep(Tcl_Obj *objPtr)
+{
+    ReleaseView(PIXELVIEW_INTREP(objPtr));
+}
+
+static void
+PixelView_DupIntRep(Tcl_Obj *srcPtr, Tcl_Obj *dstPtr)
+{
+    PixelView *viewPtr = PIXELVIEW_INTREP(srcPtr);
+    viewPtr->refCount++;
+    dstPtr->internalRep.otherValuePtr = viewPtr;
+    dstPtr->typePtr = &sdlPixelViewType;
+}
+
+static int
+PixelView_SetFromAny(Tcl_Interp *interp, Tcl_Obj *objPtr)
+{
+    if (interp) {
+        Tcl_AppendResult(interp, "expected a pixel view", NULL);
+    }
+    return TCL_ERROR;
+}
+
+/*
+ * Fill in the public description of a view. The pixels belong to the
+ * surface unless it has been deleted.
+ */
+static void
+DescribeView(PixelView *viewPtr, Tclsdl_PixelView *descPtr)
+{
+    descPtr->width = viewPtr->rect.w;
+    descPtr->height = viewPtr->rect.h;
+    descPtr->bytesPerPixel = viewPtr->bpp;
+    if (viewPtr->dataPtr) {
+        SDL_Surface *surface = viewPtr->dataPtr->surface;
+        descPtr->pitch = surface->pitch;
+        descPtr->pixels = (unsigned char *)surface->pixels
+            + viewPtr->rect.y * surface->pitch + viewPtr->rect.x * viewPtr->bpp;
+    } else {
+        descPtr->pitch = viewPtr->rect.w * viewPtr->bpp;
+        descPtr->pixels = viewPtr->copy;
+    }
+}
+
+/*
+ * Copy the view rectangle out as packed rows.
+ */
+static void
+CopyViewPixels(PixelView *viewPtr, unsigned char *dst)
+{
+    Tclsdl_PixelView desc;
+    SurfaceData *dataPtr = viewPtr->dataPtr;
+    int y, locked = 0, rowBytes = viewPtr->rect.w * viewPtr->bpp;
+
+    if (dataPtr) {
+        locked = (TclsdlLockSurface(NULL, dataPtr) == TCL_OK);
+    }
+    DescribeView(viewPtr, &desc);
+    if (desc.pitch == rowBytes) {
+        memcpy(dst, desc.pixels, (size_t)rowBytes * desc.height);
+    } else {
+        for (y = 0; y < desc.height; y++) {
+            memcpy(dst + y * rowBytes, desc.pixels + y * desc.pitch,
+                   rowBytes);
+        }
+    }
+    if (locked) {
+        TclsdlUnlockSurface(dataPtr);
+    }
+}
+
+/*
+ * The string form is the byte array string form of the packed pixels,
+ * so that Tcl_GetByteArrayFromObj recovers the bytes exactly. It is
+ * encoded straight from the surface rows.
+ */
+static void
+PixelView_UpdateString(Tcl_Obj *objPtr)
+{
+    PixelView *viewPtr = PIXELVIEW_INTREP(objPtr);
+    SurfaceData *dataPtr = viewPtr->dataPtr;
+    Tclsdl_PixelView desc;
+    const unsigned char *src;
+    char *dst;
+    int x, y, locked = 0, rowBytes = viewPtr->rect.w * viewPtr->bpp;
+
+    if (dataPtr) {
+        locked = (TclsdlLockSurface(NULL, dataPtr) == TCL_OK);
+    }
+    DescribeView(viewPtr, &desc);
+    dst = objPtr->bytes = ckalloc(2 * rowBytes * desc.height + 1);
+    for (y = 0; y < desc.height; y++) {
+        src = desc.pixels + y * desc.pitch;
+        for (x = 0; x < rowBytes; x++) {
+            unsigned char c = src[x];
+            if (c > 0 && c < 0x80) {
+                *dst++ = (char)c;
+            } else {
+                *dst++ = (char)(0xC0 | (c >> 6));
+                *dst++ = (char)(0x80 | (c & 0x3F));
+            }
+        }
+    }
+    if (locked) {
+        TclsdlUnlockSurface(dataPtr);
+    }
+    *dst = '\0';
+    objPtr->length = (int)(dst - objPtr->bytes);
+}
+
+/*
+ * Called as a surface is deleted or its pixels are replaced so any
+ * views still around keep their contents.
+ */
+void
+TclsdlDetachPixelViews(SurfaceData *dataPtr)
+{
+    PixelView *viewPtr;
+
+    for (viewPtr = dataPtr->views; viewPtr; viewPtr = viewPtr->nextPtr) {
+        int length = viewPtr->rect.w * viewPtr->rect.h * viewPtr->bpp;
+        viewPtr->copy = (unsigned char *)ckalloc(length ? length : 1);
+        CopyViewPixels(viewPtr, viewPtr->copy);
+        viewPtr->dataPtr = NULL;
+    }
+    dataPtr->views = NULL;
+}
+
+/*
+ * Public access to the pixels behind a view. For surfaces that must be
+ * locked the caller is responsible for holding the lock while it uses
+ * the pixels. A live view is read as the surface is now, so a string
+ * form made earlier is dropped when no other reference can see it.
+ */
+PKGAPI int
+Tclsdl_GetPixelViewFromObj(Tcl_Interp *interp, Tcl_Obj *objPtr,
+                           Tclsdl_PixelView *viewPtr)
+{
+    PixelView *intPtr;
+
+    if (objPtr->typePtr != &sdlPixelViewType) {
+        return PixelView_SetFromAny(interp, objPtr);
+    }
+    intPtr = PIXELVIEW_INTREP(objPtr);
+    if (intPtr->dataPtr && !Tcl_IsShared(objPtr)) {
+        Tcl_InvalidateStringRep(objPtr);
+    }
+    DescribeView(intPtr, viewPtr);
+    return TCL_OK;
+}
+
+/*
+ * Lock the surface behind a live view and describe its pixels as they
+ * are while locked. *lockedPtr is set to the surface to hand to
+ * TclsdlUnlockSurface afterwards, or NULL for a detached view.
+ */
+int
+TclsdlLockPixelView(Tcl_Interp *interp, Tcl_Obj *objPtr,
+                    Tclsdl_PixelView *viewPtr, SurfaceData **lockedPtr)
+{
+    PixelView *intPtr;
+
+    if (objPtr->typePtr != &sdlPixelViewType) {
+        return PixelView_SetFromAny(interp, objPtr);
+    }
+    intPtr = PIXELVIEW_INTREP(objPtr);
+    *lockedPtr = intPtr->dataPtr;
+    if (intPtr->dataPtr
+        && TclsdlLockSurface(interp, intPtr->dataPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    DescribeView(intPtr, viewPtr);
+    return TCL_OK;
+}
+
+/*
+ * sdl::viewbytes view
+ *
+ * The pixels of a view as a byte array of packed rows.
+ */
+/*export*/ int
+ViewBytesObjCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    PixelView *viewPtr;
+    Tcl_Obj *resultObj;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 1, objv, "view");
+        return TCL_ERROR;
+    }
+    if (objv[1]->typePtr != &sdlPixelViewType) {
+        return PixelView_SetFromAny(interp, objv[1]);
+    }
+    viewPtr = PIXELVIEW_INTREP(objv[1]);
+    resultObj = Tcl_NewObj();
+    CopyViewPixels(viewPtr, Tcl_SetByteArrayLength(resultObj,
+        viewPtr->rect.w * viewPtr->rect.h * viewPtr->bpp));
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+/*
+ * $surface view ?rect?
+ */
+int
+TclsdlSurfaceViewCmd(ClientData clientData, Tcl_Interp *interp,
+                     int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    SDL_Surface *surface = dataPtr->surface;
+    SDL_Rect rect;
+    PixelView *viewPtr;
+    Tcl_Obj *objPtr;
+    int x1, y1;
+
+    if (objc < 2 || objc > 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?rect?");
+        return TCL_ERROR;
+    }
+
+    rect.x = rect.y = 0;
+    rect.w = surface->w;
+    rect.h = surface->h;
+    if (objc == 3) {
+        if (TclsdlGetRectFromObj(interp, objv[2], &rect) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        x1 = rect.x + rect.w;
+        y1 = rect.y + rect.h;
+        if (rect.x < 0) rect.x = 0;
+        if (rect.y < 0) rect.y = 0;
+        if (x1 > surface->w) x1 = surface->w;
+        if (y1 > surface->h) y1 = surface->h;
+        rect.w = (x1 > rect.x) ? x1 - rect.x : 0;
+        rect.h = (y1 > rect.y) ? y1 - rect.y : 0;
+    }
+
+    viewPtr = (PixelView *)ckalloc(sizeof(PixelView));
+    memset(viewPtr, 0, sizeof(PixelView));
+    viewPtr->refCount = 1;
+    viewPtr->dataPtr = dataPtr;
+    viewPtr->rect = rect;
+    viewPtr->bpp = surface->format->BytesPerPixel;
+    viewPtr->nextPtr = dataPtr->views;
+    dataPtr->views = viewPtr;
+
+    objPtr = Tcl_NewObj();
+    Tcl_InvalidateStringRep(objPtr);
+    objPtr->internalRep.otherValuePtr = viewPtr;
+    objPtr->typePtr = &sdlPixelViewType;
+    Tcl_SetObjResult(interp, objPtr);
+    return TCL_OK;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
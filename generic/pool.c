@@ -0,0 +1,338 @@
+/*
+ * sdl::config -threads n
+ *
+ * A pool of worker threads for software rendering. A job is a number
+ * of independent tasks, usually bands of rows, which the caller and the
+ * workers run between them. Each participant starts with a contiguous
+ * share of the tasks in its own queue and takes from the front of it;
+ * once that is empty it steals from the back of the others, so uneven
+ * tasks still keep every thread busy.
+ *
+ * Tasks must only write pixels of their own band, so the result does not
+ * depend on which thread ran what and matches a serial run exactly. Jobs
+ * are run serially when the package is built without threads, when the
+ * pool is set to one thread or when there is only one task.
+ */
+
+#include "tclsdlInt.h"
+
+/*
+ * Row bands are sized to stay in cache and jobs smaller than
+ * POOL_MIN_BYTES are not worth waking the workers for.
+ */
+#define POOL_BAND_BYTES  (64 * 1024)
+#define POOL_MIN_BYTES   (256 * 1024)
+
+static int poolThreads = 0;     /* 0 until configured or first used */
+
+#ifdef TCL_THREADS
+
+typedef struct TaskQueue {
+    Tcl_Mutex lock;
+    int       head, tail;       /* tasks head .. tail-1 remain */
+} TaskQueue;
+
+typedef struct Job {
+    TclsdlTaskProc *proc;
+    ClientData      clientData;
+    int             nqueues;
+    int             pending;    /* workers still running */
+} Job;
+
+static TaskQueue   queues[TCLSDL_MAX_THREADS];
+static Tcl_ThreadId workerIds[TCLSDL_MAX_THREADS];
+static int         nworkers = 0;
+static int         poolShutdown = 0;
+static Job        *currentJob = NULL;
+static unsigned long generation = 0;
+static Tcl_Mutex   poolMutex;   /* protects the fields above */
+static Tcl_Condition workCond;
+static Tcl_Condition doneCond;
+static Tcl_Mutex   jobMutex;    /* one job at a time */
+
+static int
+NextTask(Job *jobPtr, int slot)
+{
+    TaskQueue *q = &queues[slot];
+    int n, task = -1;
+
+    Tcl_MutexLock(&q->lock);
+    if (q->head < q->tail) {
+        task = q->head++;
+    }
+    Tcl_MutexUnlock(&q->lock);
+
+    for (n = 1; task < 0 && n < jobPtr->nqueues; n++) {
+        q = &queues[(slot + n) % jobPtr->nqueues];
+        Tcl_MutexLock(&q->lock);
+        if (q->head < q->tail) {
+            task = --q->tail;
+        }
+        Tcl_MutexUnlock(&q->lock);
+    }
+    return task;
+}
+
+static void
+RunTasks(Job *jobPtr, int slot)
+{
+    int task;
+
+    while ((task = NextTask(jobPtr, slot)) >= 0) {
+        jobPtr->proc(jobPtr->clientData, task);
+    }
+}
+
+static Tcl_ThreadCreateType
+WorkerThread(ClientData clientData)
+{
+    int slot = PTR2INT(clientData);
+    unsigned long seen = 0;     /* a worker started for a job joins it */
+    Job *jobPtr;
+
+    Tcl_MutexLock(&poolMutex);
+    for (;;) {
+        while (!poolShutdown && generation == seen) {
+            Tcl_ConditionWait(&workCond, &poolMutex, NULL);
+        }
+        if (poolShutdown) {
+            break;
+        }
+        seen = generation;
+        jobPtr = currentJob;
+        if (jobPtr == NULL || slot >= jobPtr->nqueues) {
+            continue;
+        }
+        Tcl_MutexUnlock(&poolMutex);
+        RunTasks(jobPtr, slot);
+        Tcl_MutexLock(&poolMutex);
+        if (--jobPtr->pending == 0) {
+            Tcl_ConditionNotify(&doneCond);
+        }
+    }
+    Tcl_MutexUnlock(&poolMutex);
+    TCL_THREAD_CREATE_RETURN;
+}
+
+static void
+StopWorkers(void)
+{
+    int n, result;
+
+    Tcl_MutexLock(&poolMutex);
+    poolShutdown = 1;
+    Tcl_ConditionNotify(&workCond);
+    Tcl_MutexUnlock(&poolMutex);
+    for (n = 1; n <= nworkers; n++) {
+        Tcl_JoinThread(workerIds[n], &result);
+    }
+    Tcl_MutexLock(&poolMutex);
+    nworkers = 0;
+    poolShutdown = 0;
+    Tcl_MutexUnlock(&poolMutex);
+}
+
+static void
+PoolExitHandler(ClientData clientData)
+{
+    Tcl_MutexLock(&jobMutex);
+    StopWorkers();
+    Tcl_MutexUnlock(&jobMutex);
+}
+
+/*
+ * Start workers up to the configured count. Called with jobMutex held.
+ * The caller is worker 0 so n threads need n-1 workers.
+ */
+static void
+StartWorkers(int nthreads)
+{
+    static int exitHandler = 0;
+
+    if (!exitHandler) {
+        Tcl_CreateExitHandler(PoolExitHandler, NULL);
+        exitHandler = 1;
+    }
+    while (nworkers + 1 < nthreads) {
+        if (Tcl_CreateThread(&workerIds[nworkers + 1], WorkerThread,
+                INT2PTR(nworkers + 1), TCL_THREAD_STACK_DEFAULT,
+                TCL_THREAD_JOINABLE) != TCL_OK) {
+            break;
+        }
+        ++nworkers;
+    }
+}
+
+#endif /* TCL_THREADS */
+
+int
+TclsdlPoolThreads(void)
+{
+#ifndef TCL_THREADS
+    poolThreads = 1;
+#endif
+    if (poolThreads == 0) {
+        poolThreads = TclsdlCpuCount();
+    }
+    return poolThreads;
+}
+
+/*
+ * Set the number of threads used for rendering, 0 meaning one per
+ * processor. Fewer workers are stopped straight away.
+ */
+void
+TclsdlSetPoolThreads(int nthreads)
+{
+    if (nthreads <= 0) {
+        nthreads = TclsdlCpuCount();
+    }
+    if (nthreads > TCLSDL_MAX_THREADS) {
+        nthreads = TCLSDL_MAX_THREADS;
+    }
+#ifdef TCL_THREADS
+    Tcl_MutexLock(&jobMutex);
+    if (nworkers + 1 > nthreads) {
+        StopWorkers();
+    }
+    poolThreads = nthreads;
+    Tcl_MutexUnlock(&jobMutex);
+#else
+    poolThreads = 1;
+#endif
+}
+
+#ifdef TCL_THREADS
+/*
+ * Share the tasks between the caller and the workers. Returns 0 if no
+ * workers could be started.
+ */
+static int
+RunParallel(int ntasks, int nthreads, TclsdlTaskProc *proc,
+            ClientData clientData)
+{
+    Job job;
+    int n;
+
+    Tcl_MutexLock(&jobMutex);
+    StartWorkers(nthreads);
+    if (nworkers == 0) {
+        Tcl_MutexUnlock(&jobMutex);
+        return 0;
+    }
+    if (nthreads > nworkers + 1) {
+        nthreads = nworkers + 1;
+    }
+
+    job.proc = proc;
+    job.clientData = clientData;
+    job.nqueues = nthreads;
+    job.pending = nthreads - 1;
+    for (n = 0; n < nthreads; n++) {
+        queues[n].head = (int)((Tcl_WideInt)ntasks * n / nthreads);
+        queues[n].tail = (int)((Tcl_WideInt)ntasks * (n + 1) / nthreads);
+    }
+
+    Tcl_MutexLock(&poolMutex);
+    currentJob = &job;
+    ++generation;
+    Tcl_ConditionNotify(&workCond);
+    Tcl_MutexUnlock(&poolMutex);
+
+    RunTasks(&job, 0);
+
+    Tcl_MutexLock(&poolMutex);
+    while (job.pending > 0) {
+        Tcl_ConditionWait(&doneCond, &poolMutex, NULL);
+    }
+    currentJob = NULL;
+    Tcl_MutexUnlock(&poolMutex);
+    Tcl_MutexUnlock(&jobMutex);
+    return 1;
+}
+#endif /* TCL_THREADS */
+
+/*
+ * Run proc for each task 0 .. ntasks-1 and wait for them all. Tasks
+ * must not start jobs of their own.
+ */
+void
+TclsdlParallelFor(int ntasks, TclsdlTaskProc *proc, ClientData clientData)
+{
+    int task, nthreads = TclsdlPoolThreads();
+
+    if (nthreads > ntasks) {
+        nthreads = ntasks;
+    }
+#ifdef TCL_THREADS
+    if (nthreads > 1 && RunParallel(ntasks, nthreads, proc, clientData)) {
+        return;
+    }
+#endif
+    for (task = 0; task < ntasks; task++) {
+        proc(clientData, task);
+    }
+}
+
+/*
+ * Rows
+ */
+
+typedef struct RowJob {
+    TclsdlRowsProc *proc;
+    ClientData      clientData;
+    int             rows;
+    int             band;
+} RowJob;
+
+static void
+RowTask(ClientData clientData, int task)
+{
+    RowJob *jobPtr = clientData;
+    int y0 = task * jobPtr->band, y1 = y0 + jobPtr->band;
+
+    if (y1 > jobPtr->rows) {
+        y1 = jobPtr->rows;
+    }
+    jobPtr->proc(jobPtr->clientData, y0, y1);
+}
+
+/*
+ * Split rows 0 .. rows-1 into bands of about POOL_BAND_BYTES and share
+ * them out. rowBytes is the memory touched per row.
+ */
+void
+TclsdlParallelRows(int rows, int rowBytes, TclsdlRowsProc *proc,
+                   ClientData clientData)
+{
+    RowJob job;
+
+    if (rows <= 0) {
+        return;
+    }
+    if (rowBytes < 1) {
+        rowBytes = 1;
+    }
+    if ((Tcl_WideInt)rows * rowBytes < POOL_MIN_BYTES
+        || TclsdlPoolThreads() == 1) {
+        proc(clientData, 0, rows);
+        return;
+    }
+    job.proc = proc;
+    job.clientData = clientData;
+    job.rows = rows;
+    job.band = POOL_BAND_BYTES / rowBytes;
+    if (job.band < 1) {
+        job.band = 1;
+    }
+    TclsdlParallelFor((rows + job.band - 1) / job.band, RowTask, &job);
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
@@ -0,0 +1,739 @@
+/*
+ * set sprites [sdl::spriteset ?-bounds {x y w h}?]
+ * $sprites spawn surface ?-x n? ?-y n? ?-vx n? ?-vy n? ?-regions list?
+ *                        ?-region index? ?-bounds bounce|wrap|clamp|none?
+ * $sprites sprite id ?-option ?value ...??  ;# query or modify one sprite
+ * $sprites kill id
+ * $sprites step dt              ;# move all sprites, returns bounced ids
+ * $sprites render $screen       ;# blit all sprites onto a surface
+ * $sprites ids
+ * $sprites configure ?-bounds rect?
+ * $sprites delete
+ *
+ * Sprite state is held in a contiguous C array so that the per frame
+ * integration, wall collision and drawing never touch the interpreter.
+ */
+
+#include "tclsdlInt.h"
+
+enum { BOUNDS_BOUNCE, BOUNDS_WRAP, BOUNDS_CLAMP, BOUNDS_NONE };
+static const char *boundsNames[] = {
+    "bounce", "wrap", "clamp", "none", NULL
+};
+
+/*
+ * Sprites sharing a source surface and region list share an image so
+ * that the surface lookup happens once per render rather than once
+ * per sprite. An image lasts while sprites use it; free slots in the
+ * image array have a zero refCount and are reused.
+ */
+typedef struct SpriteImage {
+    Tcl_Obj  *surfaceObj;
+    SDL_Rect *regions;
+    int       nregions;
+    int       refCount;        /* sprites using this image */
+    Tcl_HashEntry *entryPtr;   /* in SpriteSet.imageIndex */
+} SpriteImage;
+
+typedef struct Sprite {
+    int    id;
+    int    image;          /* index into SpriteSet.images */
+    int    region;         /* index into the image region list */
+    int    bounds;         /* BOUNDS_* behaviour at the set bounds */
+    double x, y;
+    double vx, vy;
+} Sprite;
+
+typedef struct SpriteSet {
+    Tcl_Command   token;
+    SDL_Rect      bounds;
+    Sprite       *sprites;
+    int           count;
+    int           size;
+    SpriteImage  *images;
+    int           nimages;
+    int           uid;
+    Tcl_HashTable index;   /* sprite id -> position in sprites */
+    Tcl_HashTable imageIndex;  /* {surface regions} -> image slot */
+} SpriteSet;
+
+/* ---------------------------------------------------------------------- */
+
+/*
+ * Find or make the image for a surface and region list and take a
+ * reference to it for a new sprite.
+ */
+static int
+GetImage(Tcl_Interp *interp, SpriteSet *setPtr,
+         Tcl_Obj *surfaceObj, Tcl_Obj *regionsObj, int *imagePtr)
+{
+    SurfaceData *dataPtr;
+    SpriteImage *imgPtr;
+    Tcl_HashEntry *entryPtr;
+    Tcl_DString key;
+    Tcl_Obj **objv;
+    int objc, n, slot, isNew;
+
+    Tcl_DStringInit(&key);
+    Tcl_DStringAppendElement(&key, Tcl_GetString(surfaceObj));
+    Tcl_DStringAppendElement(&key,
+        regionsObj ? Tcl_GetString(regionsObj) : "");
+    entryPtr = Tcl_FindHashEntry(&setPtr->imageIndex,
+                                 Tcl_DStringValue(&key));
+    if (entryPtr != NULL) {
+        Tcl_DStringFree(&key);
+        *imagePtr = PTR2INT(Tcl_GetHashValue(entryPtr));
+        setPtr->images[*imagePtr].refCount++;
+        return TCL_OK;
+    }
+
+    objc = 0;
+    if (TclsdlGetSurfaceFromObj(interp, surfaceObj, &dataPtr) != TCL_OK
+        || (regionsObj != NULL && Tcl_ListObjGetElements(interp, regionsObj,
+                &objc, &objv) != TCL_OK)) {
+        Tcl_DStringFree(&key);
+        return TCL_ERROR;
+    }
+
+    for (slot = 0; slot < setPtr->nimages; slot++) {
+        if (setPtr->images[slot].refCount == 0) {
+            break;
+        }
+    }
+    if (slot == setPtr->nimages) {
+        setPtr->images = (SpriteImage *)ckrealloc((char *)setPtr->images,
+            (setPtr->nimages + 1) * sizeof(SpriteImage));
+        setPtr->nimages++;
+    }
+    imgPtr = &setPtr->images[slot];
+    imgPtr->nregions = objc;
+    imgPtr->regions = NULL;
+    if (objc > 0) {
+        imgPtr->regions = (SDL_Rect *)ckalloc(objc * sizeof(SDL_Rect));
+        for (n = 0; n < objc; n++) {
+            if (TclsdlGetRectFromObj(interp, objv[n],
+                                     &imgPtr->regions[n]) != TCL_OK) {
+                ckfree((char *)imgPtr->regions);
+                imgPtr->refCount = 0;
+                Tcl_DStringFree(&key);
+                return TCL_ERROR;
+            }
+        }
+    }
+    imgPtr->surfaceObj = Tcl_NewStringObj(Tcl_GetString(surfaceObj), -1);
+    Tcl_IncrRefCount(imgPtr->surfaceObj);
+    imgPtr->refCount = 1;
+    imgPtr->entryPtr = Tcl_CreateHashEntry(&setPtr->imageIndex,
+        Tcl_DStringValue(&key), &isNew);
+    Tcl_SetHashValue(imgPtr->entryPtr, INT2PTR(slot));
+    Tcl_DStringFree(&key);
+    *imagePtr = slot;
+    return TCL_OK;
+}
+
+/*
+ * Drop a sprite's reference to its image, freeing the image when no
+ * sprite uses it any more.
+ */
+static void
+ReleaseImage(SpriteSet *setPtr, int image)
+{
+    SpriteImage *imgPtr = &setPtr->images[image];
+
+    if (--imgPtr->refCount > 0) {
+        return;
+    }
+    Tcl_DeleteHashEntry(imgPtr->entryPtr);
+    Tcl_DecrRefCount(imgPtr->surfaceObj);
+    if (imgPtr->regions)
+        ckfree((char *)imgPtr->regions);
+    imgPtr->surfaceObj = NULL;
+    imgPtr->regions = NULL;
+}
+
+/*
+ * Look up the surfaces of the images in use. A deleted surface is left
+ * as NULL so callers can treat it as zero sized or skip its sprites.
+ * Returns a ckalloc'd array indexed by image slot.
+ */
+static SurfaceData **
+ResolveImages(Tcl_Interp *interp, SpriteSet *setPtr)
+{
+    SurfaceData **surfaces;
+    int n;
+
+    surfaces = (SurfaceData **)ckalloc((setPtr->nimages + 1)
+                                       * sizeof(SurfaceData *));
+    for (n = 0; n < setPtr->nimages; n++) {
+        surfaces[n] = NULL;
+        if (setPtr->images[n].refCount > 0
+            && TclsdlGetSurfaceFromObj(interp, setPtr->images[n].surfaceObj,
+                                       &surfaces[n]) != TCL_OK) {
+            surfaces[n] = NULL;
+            Tcl_ResetResult(interp);
+        }
+    }
+    return surfaces;
+}
+
+/*
+ * Return the source rectangle for a sprite and its size. A sprite with
+ * no regions uses the whole of its surface.
+ */
+static SDL_Rect *
+SpriteRegion(SpriteSet *setPtr, Sprite *spritePtr, SurfaceData *dataPtr,
+             int *wPtr, int *hPtr)
+{
+    SpriteImage *imgPtr = &setPtr->images[spritePtr->image];
+    SDL_Rect *rectPtr = NULL;
+
+    if (spritePtr->region >= 0 && spritePtr->region < imgPtr->nregions) {
+        rectPtr = &imgPtr->regions[spritePtr->region];
+        *wPtr = rectPtr->w;
+        *hPtr = rectPtr->h;
+    } else if (dataPtr) {
+        *wPtr = dataPtr->surface->w;
+        *hPtr = dataPtr->surface->h;
+    } else {
+        *wPtr = *hPtr = 0;
+    }
+    return rectPtr;
+}
+
+static Sprite *
+FindSprite(Tcl_Interp *interp, SpriteSet *setPtr, Tcl_Obj *idObj)
+{
+    Tcl_HashEntry *entryPtr;
+    int id;
+
+    if (Tcl_GetIntFromObj(interp, idObj, &id) != TCL_OK) {
+        return NULL;
+    }
+    entryPtr = Tcl_FindHashEntry(&setPtr->index, INT2PTR(id));
+    if (entryPtr == NULL) {
+        Tcl_AppendResult(interp, "no sprite \"", Tcl_GetString(idObj),
+                         "\"", NULL);
+        return NULL;
+    }
+    return &setPtr->sprites[PTR2INT(Tcl_GetHashValue(entryPtr))];
+}
+
+enum { SPR_X, SPR_Y, SPR_VX, SPR_VY, SPR_REGION, SPR_BOUNDS };
+static const char *spriteOptions[] = {
+    "-x", "-y", "-vx", "-vy", "-region", "-bounds", NULL
+};
+
+static Tcl_Obj *
+SpriteCget(Sprite *spritePtr, int index)
+{
+    switch (index) {
+        case SPR_X:      return Tcl_NewDoubleObj(spritePtr->x);
+        case SPR_Y:      return Tcl_NewDoubleObj(spritePtr->y);
+        case SPR_VX:     return Tcl_NewDoubleObj(spritePtr->vx);
+        case SPR_VY:     return Tcl_NewDoubleObj(spritePtr->vy);
+        case SPR_REGION: return Tcl_NewIntObj(spritePtr->region);
+        case SPR_BOUNDS:
+            return Tcl_NewStringObj(boundsNames[spritePtr->bounds], -1);
+    }
+    return NULL;
+}
+
+static int
+SpriteConfigure(Tcl_Interp *interp, Sprite *spritePtr,
+                int objc, Tcl_Obj *const objv[])
+{
+    int opt, index, r = TCL_OK;
+
+    if (objc & 1) {
+        Tcl_AppendResult(interp, "value for \"", Tcl_GetString(objv[objc-1]),
+                         "\" missing", NULL);
+        return TCL_ERROR;
+    }
+    for (opt = 0; r == TCL_OK && opt < objc; opt += 2) {
+        if (Tcl_GetIndexFromObj(interp, objv[opt], spriteOptions,
+                                "option", 0, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        switch (index) {
+            case SPR_X:
+                r = Tcl_GetDoubleFromObj(interp, objv[opt+1], &spritePtr->x);
+                break;
+            case SPR_Y:
+                r = Tcl_GetDoubleFromObj(interp, objv[opt+1], &spritePtr->y);
+                break;
+            case SPR_VX:
+                r = Tcl_GetDoubleFromObj(interp, objv[opt+1], &spritePtr->vx);
+                break;
+            case SPR_VY:
+                r = Tcl_GetDoubleFromObj(interp, objv[opt+1], &spritePtr->vy);
+                break;
+            case SPR_REGION:
+                r = Tcl_GetIntFromObj(interp, objv[opt+1], &spritePtr->region);
+                break;
+            case SPR_BOUNDS:
+                r = Tcl_GetIndexFromObj(interp, objv[opt+1], boundsNames,
+                                        "bounds", 0, &spritePtr->bounds);
+                break;
+        }
+    }
+    return r;
+}
+
+/* ---------------------------------------------------------------------- */
+
+static int
+SpriteSpawnCmd(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    SpriteSet *setPtr = clientData;
+    Tcl_Obj *regionsObj = NULL;
+    Tcl_Obj **optv;
+    Sprite sprite;
+    Tcl_HashEntry *entryPtr;
+    int n, optc = 0, isNew;
+
+    if (objc < 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "surface ?-option value ...?");
+        return TCL_ERROR;
+    }
+
+    /*
+     * Pick out -regions as it selects the image, the rest are
+     * ordinary sprite options.
+     */
+
+    optv = (Tcl_Obj **)ckalloc(objc * sizeof(Tcl_Obj *));
+    for (n = 3; n < objc; n++) {
+        if (strcmp(Tcl_GetString(objv[n]), "-regions") == 0 && n+1 < objc) {
+            regionsObj = objv[++n];
+        } else {
+            optv[optc++] = objv[n];
+        }
+    }
+
+    memset(&sprite, 0, sizeof(sprite));
+    sprite.bounds = BOUNDS_BOUNCE;
+    if (SpriteConfigure(interp, &sprite, optc, optv) != TCL_OK
+        || GetImage(interp, setPtr, objv[2], regionsObj,
+                    &sprite.image) != TCL_OK) {
+        ckfree((char *)optv);
+        return TCL_ERROR;
+    }
+    ckfree((char *)optv);
+
+    if (setPtr->count == setPtr->size) {
+        setPtr->size = setPtr->size ? setPtr->size * 2 : 16;
+        setPtr->sprites = (Sprite *)ckrealloc((char *)setPtr->sprites,
+            setPtr->size * sizeof(Sprite));
+    }
+    sprite.id = setPtr->uid++;
+    setPtr->sprites[setPtr->count] = sprite;
+    entryPtr = Tcl_CreateHashEntry(&setPtr->index, INT2PTR(sprite.id), &isNew);
+    Tcl_SetHashValue(entryPtr, INT2PTR(setPtr->count));
+    setPtr->count++;
+
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(sprite.id));
+    return TCL_OK;
+}
+
+static int
+SpriteKillCmd(ClientData clientData, Tcl_Interp *interp,
+              int objc, Tcl_Obj *const objv[])
+{
+    SpriteSet *setPtr = clientData;
+    Sprite *spritePtr;
+    Tcl_HashEntry *entryPtr;
+    int pos;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "id");
+        return TCL_ERROR;
+    }
+    spritePtr = FindSprite(interp, setPtr, objv[2]);
+    if (spritePtr == NULL) {
+        return TCL_ERROR;
+    }
+
+    /*
+     * Keep the array dense by moving the last sprite into the hole.
+     */
+
+    pos = spritePtr - setPtr->sprites;
+    ReleaseImage(setPtr, spritePtr->image);
+    entryPtr = Tcl_FindHashEntry(&setPtr->index, INT2PTR(spritePtr->id));
+    Tcl_DeleteHashEntry(entryPtr);
+    if (--setPtr->count != pos) {
+        *spritePtr = setPtr->sprites[setPtr->count];
+        entryPtr = Tcl_FindHashEntry(&setPtr->index, INT2PTR(spritePtr->id));
+        Tcl_SetHashValue(entryPtr, INT2PTR(pos));
+    }
+    return TCL_OK;
+}
+
+static int
+SpriteSpriteCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    SpriteSet *setPtr = clientData;
+    Sprite *spritePtr;
+    int index;
+
+    if (objc < 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "id ?-option ?value ...??");
+        return TCL_ERROR;
+    }
+    spritePtr = FindSprite(interp, setPtr, objv[2]);
+    if (spritePtr == NULL) {
+        return TCL_ERROR;
+    }
+
+    if (objc == 3) {
+        Tcl_Obj *listObj = Tcl_NewListObj(0, NULL);
+        for (index = 0; spriteOptions[index] != NULL; index++) {
+            Tcl_ListObjAppendElement(interp, listObj,
+                Tcl_NewStringObj(spriteOptions[index], -1));
+            Tcl_ListObjAppendElement(interp, listObj,
+                SpriteCget(spritePtr, index));
+        }
+        Tcl_SetObjResult(interp, listObj);
+        return TCL_OK;
+    }
+    if (objc == 4) {
+        if (Tcl_GetIndexFromObj(interp, objv[3], spriteOptions,
+                                "option", 0, &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult(interp, SpriteCget(spritePtr, index));
+        return TCL_OK;
+    }
+    return SpriteConfigure(interp, spritePtr, objc - 3, objv + 3);
+}
+
+/*
+ * $sprites step dt
+ *
+ * Integrate every sprite position over dt and apply the bounds
+ * behaviour. Returns the ids of the sprites that hit the bounds so the
+ * script can react to collisions without iterating the whole set.
+ */
+static int
+SpriteStepCmd(ClientData clientData, Tcl_Interp *interp,
+              int objc, Tcl_Obj *const objv[])
+{
+    SpriteSet *setPtr = clientData;
+    Sprite *spritePtr, *endPtr;
+    SurfaceData **surfaces;
+    Tcl_Obj *resultObj;
+    double dt, minx, miny, maxx, maxy;
+    int w, h, hit;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "dt");
+        return TCL_ERROR;
+    }
+    if (Tcl_GetDoubleFromObj(interp, objv[2], &dt) != TCL_OK) {
+        return TCL_ERROR;
+    }
+
+    /*
+     * Sprites without regions take their size from the surface. A
+     * deleted surface is treated as zero sized.
+     */
+
+    surfaces = ResolveImages(interp, setPtr);
+
+    resultObj = Tcl_NewListObj(0, NULL);
+    endPtr = setPtr->sprites + setPtr->count;
+    for (spritePtr = setPtr->sprites; spritePtr < endPtr; spritePtr++) {
+        spritePtr->x += spritePtr->vx * dt;
+        spritePtr->y += spritePtr->vy * dt;
+        if (spritePtr->bounds == BOUNDS_NONE) {
+            continue;
+        }
+
+        SpriteRegion(setPtr, spritePtr, surfaces[spritePtr->image], &w, &h);
+        minx = setPtr->bounds.x;
+        miny = setPtr->bounds.y;
+        maxx = minx + setPtr->bounds.w - w;
+        maxy = miny + setPtr->bounds.h - h;
+        hit = 0;
+
+        switch (spritePtr->bounds) {
+            case BOUNDS_BOUNCE:
+                if (spritePtr->x < minx) {
+                    spritePtr->x = minx + (minx - spritePtr->x);
+                    spritePtr->vx = -spritePtr->vx;
+                    hit = 1;
+                } else if (spritePtr->x > maxx) {
+                    spritePtr->x = maxx - (spritePtr->x - maxx);
+                    spritePtr->vx = -spritePtr->vx;
+                    hit = 1;
+                }
+                if (spritePtr->y < miny) {
+                    spritePtr->y = miny + (miny - spritePtr->y);
+                    spritePtr->vy = -spritePtr->vy;
+                    hit = 1;
+                } else if (spritePtr->y > maxy) {
+                    spritePtr->y = maxy - (spritePtr->y - maxy);
+                    spritePtr->vy = -spritePtr->vy;
+                    hit = 1;
+                }
+                break;
+            case BOUNDS_WRAP:
+                if (spritePtr->x < minx - w) {
+                    spritePtr->x += setPtr->bounds.w + w;
+                    hit = 1;
+                } else if (spritePtr->x > minx + setPtr->bounds.w) {
+                    spritePtr->x -= setPtr->bounds.w + w;
+                    hit = 1;
+                }
+                if (spritePtr->y < miny - h) {
+                    spritePtr->y += setPtr->bounds.h + h;
+                    hit = 1;
+                } else if (spritePtr->y > miny + setPtr->bounds.h) {
+                    spritePtr->y -= setPtr->bounds.h + h;
+                    hit = 1;
+                }
+                break;
+            case BOUNDS_CLAMP:
+                if (spritePtr->x < minx || spritePtr->x > maxx) {
+                    spritePtr->x = (spritePtr->x < minx) ? minx : maxx;
+                    spritePtr->vx = 0;
+                    hit = 1;
+                }
+                if (spritePtr->y < miny || spritePtr->y > maxy) {
+                    spritePtr->y = (spritePtr->y < miny) ? miny : maxy;
+                    spritePtr->vy = 0;
+                    hit = 1;
+                }
+                break;
+        }
+        if (hit) {
+            Tcl_ListObjAppendElement(interp, resultObj,
+                                     Tcl_NewIntObj(spritePtr->id));
+        }
+    }
+    ckfree((char *)surfaces);
+
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+static int
+SpriteRenderCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    SpriteSet *setPtr = clientData;
+    SurfaceData *dstPtr, **surfaces;
+    Sprite *spritePtr, *endPtr;
+    SDL_Rect rc, *srcRectPtr;
+    int w, h, r = TCL_OK;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "surface");
+        return TCL_ERROR;
+    }
+    if (TclsdlGetSurfaceFromObj(interp, objv[2], &dstPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+
+    /* Sprites whose surface has been deleted are not drawn */
+    surfaces = ResolveImages(interp, setPtr);
+
+    endPtr = setPtr->sprites + setPtr->count;
+    for (spritePtr = setPtr->sprites;
+         r == TCL_OK && spritePtr < endPtr; spritePtr++) {
+        SurfaceData *srcPtr = surfaces[spritePtr->image];
+        if (srcPtr == NULL) {
+            continue;
+        }
+        srcRectPtr = SpriteRegion(setPtr, spritePtr, srcPtr, &w, &h);
+        rc.x = (Sint16)spritePtr->x;
+        rc.y = (Sint16)spritePtr->y;
+        if (SDL_BlitSurface(srcPtr->surface, srcRectPtr,
+                            dstPtr->surface, &rc) < 0) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+            r = TCL_ERROR;
+        } else {
+            TclsdlSurfaceDamage(dstPtr, &rc);
+        }
+    }
+    ckfree((char *)surfaces);
+    return r;
+}
+
+static int
+SpriteIdsCmd(ClientData clientData, Tcl_Interp *interp,
+             int objc, Tcl_Obj *const objv[])
+{
+    SpriteSet *setPtr = clientData;
+    Tcl_Obj *listObj;
+    int n;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, NULL);
+        return TCL_ERROR;
+    }
+    listObj = Tcl_NewListObj(0, NULL);
+    for (n = 0; n < setPtr->count; n++) {
+        Tcl_ListObjAppendElement(interp, listObj,
+                                 Tcl_NewIntObj(setPtr->sprites[n].id));
+    }
+    Tcl_SetObjResult(interp, listObj);
+    return TCL_OK;
+}
+
+static int
+SpriteConfigureCmd(ClientData clientData, Tcl_Interp *interp,
+                   int objc, Tcl_Obj *const objv[])
+{
+    SpriteSet *setPtr = clientData;
+    Tcl_Obj *resObj;
+    int index;
+    enum { OPT_BOUNDS };
+    const char *options[] = { "-bounds", NULL };
+
+    if (objc != 2 && objc != 3 && objc != 4) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-bounds ?rect??");
+        return TCL_ERROR;
+    }
+    if (objc > 2 && Tcl_GetIndexFromObj(interp, objv[2], options,
+                                        "option", 0, &index) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (objc == 4) {
+        return TclsdlGetRectFromObj(interp, objv[3], &setPtr->bounds);
+    }
+
+    resObj = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(interp, resObj, Tcl_NewIntObj(setPtr->bounds.x));
+    Tcl_ListObjAppendElement(interp, resObj, Tcl_NewIntObj(setPtr->bounds.y));
+    Tcl_ListObjAppendElement(interp, resObj, Tcl_NewIntObj(setPtr->bounds.w));
+    Tcl_ListObjAppendElement(interp, resObj, Tcl_NewIntObj(setPtr->bounds.h));
+    if (objc == 2) {
+        Tcl_Obj *listObj = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(interp, listObj,
+                                 Tcl_NewStringObj(options[OPT_BOUNDS], -1));
+        Tcl_ListObjAppendElement(interp, listObj, resObj);
+        resObj = listObj;
+    }
+    Tcl_SetObjResult(interp, resObj);
+    return TCL_OK;
+}
+
+static int
+SpriteDeleteCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    SpriteSet *setPtr = clientData;
+    Tcl_DeleteCommandFromToken(interp, setPtr->token);
+    return TCL_OK;
+}
+
+struct Ensemble spriteEnsemble[] = {
+    { "spawn", SpriteSpawnCmd, NULL },
+    { "kill", SpriteKillCmd, NULL },
+    { "sprite", SpriteSpriteCmd, NULL },
+    { "step", SpriteStepCmd, NULL },
+    { "render", SpriteRenderCmd, NULL },
+    { "ids", SpriteIdsCmd, NULL },
+    { "configure", SpriteConfigureCmd, NULL },
+    { "delete", SpriteDeleteCmd, NULL },
+    { NULL, NULL, NULL },
+};
+
+static int
+SpriteEnsemble(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    struct Ensemble *ensemble = spriteEnsemble;
+    int option = 1, index;
+
+    while (option < objc) {
+        if (Tcl_GetIndexFromObjStruct(interp, objv[option],
+		ensemble, sizeof(ensemble[0]), "command", 0, &index) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+
+        if (ensemble[index].command) {
+            return ensemble[index].command(clientData, interp, objc, objv);
+        }
+        ensemble = ensemble[index].ensemble;
+        ++option;
+    }
+    Tcl_WrongNumArgs(interp, option, objv, "command ?arg arg...?");
+    return TCL_ERROR;
+}
+
+static void
+SpriteCleanup(ClientData clientData)
+{
+    SpriteSet *setPtr = clientData;
+    int n;
+
+    for (n = 0; n < setPtr->nimages; n++) {
+        if (setPtr->images[n].refCount == 0) {
+            continue;
+        }
+        Tcl_DecrRefCount(setPtr->images[n].surfaceObj);
+        if (setPtr->images[n].regions)
+            ckfree((char *)setPtr->images[n].regions);
+    }
+    if (setPtr->images)
+        ckfree((char *)setPtr->images);
+    if (setPtr->sprites)
+        ckfree((char *)setPtr->sprites);
+    Tcl_DeleteHashTable(&setPtr->index);
+    Tcl_DeleteHashTable(&setPtr->imageIndex);
+    ckfree((char *)setPtr);
+}
+
+/*export*/ int
+SpriteSetObjCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    SpriteSet *setPtr;
+    SDL_Surface *screen;
+    SDL_Rect bounds = {0, 0, 640, 480};
+    static int uid = 0;
+    char name[10 + TCL_INTEGER_SPACE];
+
+    if (objc != 1 && objc != 3) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-bounds rect?");
+        return TCL_ERROR;
+    }
+    screen = SDL_GetVideoSurface();
+    if (screen) {
+        bounds.w = screen->w;
+        bounds.h = screen->h;
+    }
+    if (objc == 3) {
+        if (strcmp(Tcl_GetString(objv[1]), "-bounds") != 0) {
+            Tcl_AppendResult(interp, "bad option \"", Tcl_GetString(objv[1]),
+                             "\": must be -bounds", NULL);
+            return TCL_ERROR;
+        }
+        if (TclsdlGetRectFromObj(interp, objv[2], &bounds) != TCL_OK) {
+            return TCL_ERROR;
+        }
+    }
+
+    setPtr = (SpriteSet *)ckalloc(sizeof(SpriteSet));
+    memset(setPtr, 0, sizeof(SpriteSet));
+    setPtr->bounds = bounds;
+    Tcl_InitHashTable(&setPtr->index, TCL_ONE_WORD_KEYS);
+    Tcl_InitHashTable(&setPtr->imageIndex, TCL_STRING_KEYS);
+    sprintf(name, "sdlsprites%u", uid++);
+    setPtr->token = Tcl_CreateObjCommand(interp, name, SpriteEnsemble,
+                                         setPtr, SpriteCleanup);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+    return TCL_OK;
+}
+
+/*
+ * Local variables:
+ *   indent-tabs-mode: t
+ *   tab-width: 8
+ * End:
+ */
@@ -1,30 +1,39 @@
 /*
  * set surface [sdl::surface create -width 800 -height 600 -bpp 32 -hardware 1]
+ * set surface [sdl::surface -bitmap filename]  ;# BMP, QOI, TGA or PNG
+ * sdl::surface load ?-async? ?-command script? filename  ;# see loader.c
  * $surface delete               ;# call SDL_FreeSurface
  * $surface flip $surface        ;# swap two surfaces
+ * $surface update               ;# push only the dirty rectangles
+ * $surface configure -dirty     ;# list the dirty rectangles
+ * $surface collide other dx dy ?rect? ?otherrect?  ;# pixel overlap test
  * $surface blit dest x y
+ * $surface blitmany {src x y rect ...}     ;# many blits in one call
+ * $surface blitmany -packed src bytes     ;# int16 {x y sx sy sw sh} records
+ * $surface blend dest x y ?rect? ?-mode avg|add|sub|mul|screen|alpha?
+ * $surface generate ?-time t? ?-rect rect? expr ?gexpr bexpr ?aexpr??
+ * $surface line|hline|rect|circle|ellipse|triangle|polygon \
+ *     ?-fill? ?-packed? ?-colors bytes? color coords   ;# see draw.c
+ * $surface plot coords colors  ;# packed int16 x,y and uint32 0xRRGGBB
+ * $surface sample coords       ;# returns packed uint32 0xRRGGBB
+ * $surface export ?-format rgba8888|bgra8888|rgb565|gray8? ?rect?
+ * $surface import ?-format fmt? bytes ?rect?
+ * $surface view ?rect?         ;# zero copy view of the pixels
+ * $surface setrawbuffer bytes|view ?rect?
+ * $surface lock | unlock        ;# hold the pixels locked across commands
+ * $surface withlock script      ;# evaluate script with the pixels locked
+ * $surface palette cycle first count step  ;# rotate 8 bit palette entries
+ * $surface palette get ?first count?
  * $surface loadbmp filename     ;# load a bitmap from file to surface.
  *
  */
 
-#include "tclsdl.h"
-#include <SDL/SDL.h>
+#include "tclsdlInt.h"
 #include <SDL/SDL_version.h>
 #include <SDL/SDL_getenv.h>
 
-typedef struct SurfaceData {
-    SDL_Surface  *surface;
-    Tcl_Command   token;
-    unsigned long windowid;
-} SurfaceData;
-
-struct Ensemble {
-    const char *name;          /* subcommand name */
-    Tcl_ObjCmdProc *command;   /* subcommand implementation OR */
-    struct Ensemble *ensemble; /* subcommand ensemble */
-};
-
 Tcl_ObjCmdProc SurfaceObjCmd;
+static Tcl_ObjCmdProc SurfaceEnsemble;
 
 /* ----------------------------------------------------------------------
  * SDL Color object wrapper
@@ -84,6 +93,12 @@ SDLColor_SetFromAny(Tcl_Interp *interp, Tcl_Obj *objPtr)
             return TCL_ERROR;
         }
     }
+    /* keep the string rep, our type cannot regenerate it */
+    Tcl_GetString(objPtr);
+    if (objPtr->typePtr != NULL && objPtr->typePtr->freeIntRepProc != NULL) {
+        (*objPtr->typePtr->freeIntRepProc)(objPtr);
+    }
+
     colorPtr = (SDL_Color *)ckalloc(sizeof(SDL_Color));
     colorPtr->r = (Uint8)r;
     colorPtr->g = (Uint8)g;
@@ -108,6 +123,12 @@ GetSDLColorFromObj(Tcl_Interp *interp, SDL_Surface *surface,
     *colorPtr = SDL_MapRGB(surface->format, p->r, p->g, p->b);
     return TCL_OK;
 }
+int
+TclsdlGetColorFromObj(Tcl_Interp *interp, SDL_Surface *surface,
+                      Tcl_Obj *objPtr, Uint32 *colorPtr)
+{
+    return GetSDLColorFromObj(interp, surface, objPtr, colorPtr);
+}
 
 /* ----------------------------------------------------------------------
  * SDL_Rect object wrapper
@@ -170,6 +191,8 @@ SDLRect_SetFromAny(Tcl_Interp *interp, Tcl_Obj *objPtr)
         }
     }
     
+    /* keep the string rep, our type cannot regenerate it */
+    Tcl_GetString(objPtr);
     if (objPtr->typePtr != NULL && objPtr->typePtr->freeIntRepProc != NULL) {
         (*objPtr->typePtr->freeIntRepProc)(objPtr);
     }
@@ -197,6 +220,262 @@ GetSDLRectFromObj(Tcl_Interp *interp, Tcl_Obj *objPtr, SDL_Rect *rectPtr)
     memcpy(rectPtr, SDLRECT_INTREP(objPtr), sizeof(SDL_Rect));
     return TCL_OK;
 }
+int
+TclsdlGetRectFromObj(Tcl_Interp *interp, Tcl_Obj *objPtr, SDL_Rect *rectPtr)
+{
+    return GetSDLRectFromObj(interp, objPtr, rectPtr);
+}
+
+/*
+ * Create a rect object that already holds its internal rep, for rects
+ * that are handed out repeatedly and should never need parsing.
+ */
+Tcl_Obj *
+TclsdlNewRectObj(const SDL_Rect *rectPtr)
+{
+    char buf[4 * TCL_INTEGER_SPACE];
+    Tcl_Obj *objPtr;
+
+    sprintf(buf, "%d %d %d %d", rectPtr->x, rectPtr->y, rectPtr->w, rectPtr->h);
+    objPtr = Tcl_NewStringObj(buf, -1);
+    objPtr->typePtr = &sdlRectType;
+    SDLRECT_INTREP(objPtr) = (void *)ckalloc(sizeof(SDL_Rect));
+    memcpy(SDLRECT_INTREP(objPtr), rectPtr, sizeof(SDL_Rect));
+    return objPtr;
+}
+
+/* ----------------------------------------------------------------------
+ * Dirty rectangle tracking
+ *
+ * Drawing operations on the video surface record the area they touched
+ * so that "update" can push just those parts of the screen. Overlapping
+ * or touching rectangles are merged as they are added.
+ */
+
+static void
+RectUnion(SDL_Rect *aPtr, const SDL_Rect *bPtr)
+{
+    int x1 = (aPtr->x < bPtr->x) ? aPtr->x : bPtr->x;
+    int y1 = (aPtr->y < bPtr->y) ? aPtr->y : bPtr->y;
+    int x2 = (aPtr->x + aPtr->w > bPtr->x + bPtr->w)
+        ? aPtr->x + aPtr->w : bPtr->x + bPtr->w;
+    int y2 = (aPtr->y + aPtr->h > bPtr->y + bPtr->h)
+        ? aPtr->y + aPtr->h : bPtr->y + bPtr->h;
+    aPtr->x = (Sint16)x1;
+    aPtr->y = (Sint16)y1;
+    aPtr->w = (Uint16)(x2 - x1);
+    aPtr->h = (Uint16)(y2 - y1);
+}
+
+static int
+RectTouches(const SDL_Rect *aPtr, const SDL_Rect *bPtr)
+{
+    return aPtr->x <= bPtr->x + bPtr->w && bPtr->x <= aPtr->x + aPtr->w
+        && aPtr->y <= bPtr->y + bPtr->h && bPtr->y <= aPtr->y + aPtr->h;
+}
+
+/*
+ * Called whenever the pixels of a surface are written. This drops any
+ * cached collision mask and, for the video surface, records the area
+ * as dirty.
+ */
+void
+TclsdlSurfaceDamage(SurfaceData *dataPtr, const SDL_Rect *rectPtr)
+{
+    SDL_Surface *surface = dataPtr->surface;
+    SDL_Rect rect;
+    int n, x2, y2, best = 0;
+    long area, bestArea = -1;
+
+    if (dataPtr->mask) {
+        dataPtr->mask->valid = 0;
+    }
+    if (surface == NULL || surface != SDL_GetVideoSurface()) {
+        return;
+    }
+
+    /* Clip to the surface, ignoring empty results. */
+    if (rectPtr == NULL) {
+        rect.x = rect.y = 0;
+        rect.w = (Uint16)surface->w;
+        rect.h = (Uint16)surface->h;
+    } else {
+        x2 = rectPtr->x + rectPtr->w;
+        y2 = rectPtr->y + rectPtr->h;
+        if (x2 > surface->w) x2 = surface->w;
+        if (y2 > surface->h) y2 = surface->h;
+        rect.x = (rectPtr->x < 0) ? 0 : rectPtr->x;
+        rect.y = (rectPtr->y < 0) ? 0 : rectPtr->y;
+        if (x2 <= rect.x || y2 <= rect.y) {
+            return;
+        }
+        rect.w = (Uint16)(x2 - rect.x);
+        rect.h = (Uint16)(y2 - rect.y);
+    }
+
+    if (dataPtr->dirty == NULL) {
+        dataPtr->dirty = (SDL_Rect *)
+            ckalloc(TCLSDL_MAX_DIRTY * sizeof(SDL_Rect));
+    }
+
+    for (;;) {
+        /*
+         * Absorb every rectangle the new one touches. Each merge can grow
+         * the rectangle so we rescan from the start until nothing changes.
+         */
+
+        n = 0;
+        while (n < dataPtr->ndirty) {
+            if (RectTouches(&dataPtr->dirty[n], &rect)) {
+                RectUnion(&rect, &dataPtr->dirty[n]);
+                dataPtr->dirty[n] = dataPtr->dirty[--dataPtr->ndirty];
+                n = 0;
+            } else {
+                n++;
+            }
+        }
+        if (dataPtr->ndirty < TCLSDL_MAX_DIRTY) {
+            break;
+        }
+
+        /*
+         * When the list is full, take in the rectangle whose bounding
+         * box grows the least. The result may now touch others, so go
+         * round again to absorb them.
+         */
+
+        for (n = 0; n < dataPtr->ndirty; n++) {
+            SDL_Rect u = dataPtr->dirty[n];
+            RectUnion(&u, &rect);
+            area = (long)u.w * u.h - (long)dataPtr->dirty[n].w
+                * dataPtr->dirty[n].h;
+            if (bestArea < 0 || area < bestArea) {
+                bestArea = area;
+                best = n;
+            }
+        }
+        RectUnion(&rect, &dataPtr->dirty[best]);
+        dataPtr->dirty[best] = dataPtr->dirty[--dataPtr->ndirty];
+    }
+    dataPtr->dirty[dataPtr->ndirty++] = rect;
+}
+
+/* ----------------------------------------------------------------------
+ * Surface locking
+ *
+ * Commands that touch the pixels directly bracket their work with
+ * TclsdlLockSurface and TclsdlUnlockSurface. These do nothing for
+ * surfaces that SDL says need no locking, or while a script holds the
+ * surface locked with lock or withlock, so a batch of pixel commands
+ * pays for one lock rather than one each.
+ */
+
+int
+TclsdlLockSurface(Tcl_Interp *interp, SurfaceData *dataPtr)
+{
+    if (dataPtr->lockCount > 0 || !SDL_MUSTLOCK(dataPtr->surface)) {
+        return TCL_OK;
+    }
+    if (SDL_LockSurface(dataPtr->surface) < 0) {
+        if (interp) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+        }
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+void
+TclsdlUnlockSurface(SurfaceData *dataPtr)
+{
+    if (dataPtr->lockCount == 0 && SDL_MUSTLOCK(dataPtr->surface)) {
+        SDL_UnlockSurface(dataPtr->surface);
+    }
+}
+
+/*
+ * SDL must not blit to, from or update a surface that is locked.
+ */
+static int
+CheckUnlocked(Tcl_Interp *interp, SurfaceData *dataPtr)
+{
+    if (dataPtr->lockCount > 0 && SDL_MUSTLOCK(dataPtr->surface)) {
+        Tcl_AppendResult(interp, "surface is locked", NULL);
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+static int
+SurfaceLockCmd(ClientData clientData, Tcl_Interp *interp, 
+               int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, NULL);
+        return TCL_ERROR;
+    }
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(++dataPtr->lockCount));
+    return TCL_OK;
+}
+
+static int
+SurfaceUnlockCmd(ClientData clientData, Tcl_Interp *interp, 
+                 int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, NULL);
+        return TCL_ERROR;
+    }
+    if (dataPtr->lockCount == 0) {
+        Tcl_AppendResult(interp, "surface is not locked", NULL);
+        return TCL_ERROR;
+    }
+    --dataPtr->lockCount;
+    TclsdlUnlockSurface(dataPtr);
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(dataPtr->lockCount));
+    return TCL_OK;
+}
+
+/*
+ * $surface withlock script
+ *
+ * The surface may be deleted by the script so the data is preserved
+ * until the lock has been released.
+ */
+static int
+SurfaceWithLockCmd(ClientData clientData, Tcl_Interp *interp, 
+                   int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    int r;
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "script");
+        return TCL_ERROR;
+    }
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    ++dataPtr->lockCount;
+    Tcl_Preserve(dataPtr);
+    r = Tcl_EvalObjEx(interp, objv[2], 0);
+    if (dataPtr->surface != NULL) {
+        --dataPtr->lockCount;
+        TclsdlUnlockSurface(dataPtr);
+    }
+    Tcl_Release(dataPtr);
+    if (r == TCL_ERROR) {
+        Tcl_AddErrorInfo(interp, "\n    (\"withlock\" script)");
+    }
+    return r;
+}
 
 /* ----------------------------------------------------------------------
  * Direct pixel access functions
@@ -221,7 +500,7 @@ static int GetPixel8(Tcl_Interp * interp, SDL_Surface * surface, int x, int y, T
 }
 
 static int SetPixel32(Tcl_Interp * interp, SDL_Surface * surface, int x, int y, Tcl_Obj * colorObj) {
-    Uint32 * pixels = (Uint8 *)surface->pixels;
+    Uint32 * pixels = (Uint32 *)surface->pixels;
     int objc, r, g, b;
     Tcl_Obj ** objv;
     unsigned long color;
@@ -250,9 +529,9 @@ static int GetPixel32(Tcl_Interp * interp, SDL_Surface * surface, int x, int y,
     unsigned int r, g, b ;
     color = pixels[y*surface->pitch/4+x] ;
 
-    r = ( color >> 0 ) && 0xFF;
-    g = ( color >> 8 ) && 0xFF;
-    b = ( color >> 16 ) && 0xFF;
+    r = ( color >> 0 ) & 0xFF;
+    g = ( color >> 8 ) & 0xFF;
+    b = ( color >> 16 ) & 0xFF;
     rgb = Tcl_NewListObj(0,NULL);
     Tcl_ListObjAppendElement(interp,rgb, Tcl_NewIntObj(r));
     Tcl_ListObjAppendElement(interp,rgb, Tcl_NewIntObj(g));
@@ -281,10 +560,60 @@ SurfaceFlipCmd(ClientData clientData, Tcl_Interp *interp,
         Tcl_WrongNumArgs(interp, 1, objv, "");
         return TCL_ERROR;
     }
+    if (CheckUnlocked(interp, dataPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
     if (SDL_Flip(dataPtr->surface) < 0) {
         Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
         return TCL_ERROR;
     }
+    dataPtr->ndirty = 0;
+    return TCL_OK;
+}
+
+/*
+ * $screen update
+ *
+ * Push only the dirty rectangles of the video surface to the display.
+ * A double buffered hardware surface cannot be partially updated so
+ * this falls back to a flip. Returns the number of pixels pushed.
+ */
+static int
+SurfaceUpdateCmd(ClientData clientData, Tcl_Interp *interp, 
+                 int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    SDL_Surface *surface = dataPtr->surface;
+    Tcl_WideInt pixels = 0;
+    int n;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, NULL);
+        return TCL_ERROR;
+    }
+    if (surface != SDL_GetVideoSurface()) {
+        Tcl_AppendResult(interp, "only the video surface can be updated",
+                         NULL);
+        return TCL_ERROR;
+    }
+    if (CheckUnlocked(interp, dataPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if ((surface->flags & (SDL_HWSURFACE | SDL_DOUBLEBUF))
+        == (SDL_HWSURFACE | SDL_DOUBLEBUF)) {
+        if (SDL_Flip(surface) < 0) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+            return TCL_ERROR;
+        }
+        pixels = (Tcl_WideInt)surface->w * surface->h;
+    } else if (dataPtr->ndirty > 0) {
+        SDL_UpdateRects(surface, dataPtr->ndirty, dataPtr->dirty);
+        for (n = 0; n < dataPtr->ndirty; n++) {
+            pixels += (Tcl_WideInt)dataPtr->dirty[n].w * dataPtr->dirty[n].h;
+        }
+    }
+    dataPtr->ndirty = 0;
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj(pixels));
     return TCL_OK;
 }
 
@@ -320,15 +649,30 @@ SurfacePixelCmd(ClientData clientData, Tcl_Interp *interp,
     if (Tcl_GetIntFromObj(interp,objv[2],&x)!=TCL_OK || Tcl_GetIntFromObj(interp,objv[3],&y)!=TCL_OK) {
         return TCL_ERROR;
     }
+    if (x < 0 || y < 0 || x >= dataPtr->surface->w || y >= dataPtr->surface->h) {
+        Tcl_AppendResult(interp,"coordinates outside the surface",NULL);
+        return TCL_ERROR;
+    }
 
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
     if (objc == 5) {
         rc = setPixelProcPtr(interp, dataPtr->surface, x, y, objv[4]);
+        if (rc == TCL_OK) {
+            SDL_Rect rect;
+            rect.x = (Sint16)x;
+            rect.y = (Sint16)y;
+            rect.w = rect.h = 1;
+            TclsdlSurfaceDamage(dataPtr, &rect);
+        }
     } else {
         rc = getPixelProcPtr(interp, dataPtr->surface, x, y, &res);
         if (rc==TCL_OK) {
             Tcl_SetObjResult(interp,res);
         }
     }
+    TclsdlUnlockSurface(dataPtr);
     return rc;
 }
 
@@ -337,14 +681,9 @@ SurfaceSetColorsCmd(ClientData clientData, Tcl_Interp *interp,
                   int objc, Tcl_Obj *const objv[])
 {
     SurfaceData *dataPtr = clientData;
-    unsigned long firstcolor = 0;
-    int i;
-    int listObjc, colorObjc;
-    int col;
+    int firstcolor = 0, count;
     int res = TCL_OK;
     SDL_Color * colors;
-    Tcl_Obj ** listObjv;
-    Tcl_Obj ** colorObjv ;
 
     if (objc != 4) {
         Tcl_WrongNumArgs(interp, 2, objv, "colors firstcolor");
@@ -356,24 +695,11 @@ SurfaceSetColorsCmd(ClientData clientData, Tcl_Interp *interp,
         return TCL_ERROR;
     }
     
-    if (Tcl_GetLongFromObj(interp, objv[3], (long *)&firstcolor) != TCL_OK || 
-            Tcl_ListObjGetElements(interp,objv[2],&listObjc,&listObjv)!=TCL_OK) {
+    if (Tcl_GetIntFromObj(interp, objv[3], &firstcolor) != TCL_OK
+        || TclsdlGetColorsFromObj(interp, objv[2], &colors, &count) != TCL_OK) {
         return TCL_ERROR;
     }
-    colors = (SDL_Color *)ckalloc(listObjc*sizeof(SDL_Color));
-    for (i = 0 ; i < listObjc; i++) {
-        if (Tcl_ListObjGetElements(interp,listObjv[i],&colorObjc,&colorObjv)!=TCL_OK || colorObjc != 3) {
-            Tcl_AppendResult(interp,"invalid color",NULL);
-            return TCL_ERROR;
-        }
-        Tcl_GetIntFromObj(interp,colorObjv[0],&col);
-        colors[i].r = (Uint8)col;
-        Tcl_GetIntFromObj(interp,colorObjv[1],&col);
-        colors[i].g = (Uint8)col;
-        Tcl_GetIntFromObj(interp,colorObjv[2],&col);
-        colors[i].b = (Uint8)col;
-    }
-    if (SDL_SetColors(dataPtr->surface,colors,firstcolor,listObjc)!=1) {
+    if (SDL_SetColors(dataPtr->surface,colors,firstcolor,count)!=1) {
         Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
         res = TCL_ERROR;
     }
@@ -404,6 +730,9 @@ SurfaceSetColorKeyCmd(ClientData clientData, Tcl_Interp *interp,
         Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
         return TCL_ERROR;
     }
+    if (dataPtr->mask) {
+        dataPtr->mask->valid = 0;
+    }
     return TCL_OK;
 }
 
@@ -427,136 +756,221 @@ SurfaceMustLockCmd(ClientData clientData, Tcl_Interp *interp,
 }
 
 static int
-SurfaceGetBufferCmd(ClientData clientData, Tcl_Interp *interp, 
+SurfaceGetRawBufferCmd(ClientData clientData, Tcl_Interp *interp, 
                   int objc, Tcl_Obj *const objv[])
 {
-    SurfaceData *dataPtr = clientData;    
-    Uint32* pixels ;
-    int color ;
-    int x , y;
-    Tcl_Obj * row;
+    SurfaceData *dataPtr = clientData;
+    void * pixels ;
+    int w;
+    int h;
     Tcl_Obj * buffer;
 
     if (objc != 2) {
         Tcl_WrongNumArgs(interp, 2, objv, NULL);
         return TCL_ERROR;
     }
-    
-    pixels = (Uint32*)dataPtr->surface->pixels;
 
-    buffer = Tcl_NewListObj(0,NULL);
-    
-    for (y = 0 ; y < dataPtr->surface->h; y++) {
-        row = Tcl_NewListObj(0,NULL);
-        for (x = 0 ; x < dataPtr->surface->w; x++) {
-            color = pixels[y*dataPtr->surface->w+x];
-            Tcl_ListObjAppendElement(interp,row,Tcl_NewIntObj(color));
-        }
-        Tcl_ListObjAppendElement(interp,buffer,row);
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        return TCL_ERROR;
     }
+    pixels = dataPtr->surface->pixels;
+    w = dataPtr->surface->w;
+    h = dataPtr->surface->h;
+    buffer = Tcl_NewByteArrayObj(pixels,h*dataPtr->surface->pitch);
+    TclsdlUnlockSurface(dataPtr);
+    
     Tcl_SetObjResult(interp,buffer);
     return TCL_OK;
 }
 
+/*
+ * $surface setrawbuffer data ?rect?
+ *
+ * Copy pixels in the surface format into a rectangle of the surface,
+ * by default the whole surface. The data is either a pixel view of the
+ * same size and depth, which is copied directly, or a byte array of
+ * packed rows. Without a rectangle the padded rows returned by
+ * getrawbuffer are also accepted.
+ */
 static int
-SurfaceSetBufferCmd(ClientData clientData, Tcl_Interp *interp, 
+SurfaceSetRawBufferCmd(ClientData clientData, Tcl_Interp *interp, 
                   int objc, Tcl_Obj *const objv[])
 {
     SurfaceData *dataPtr = clientData;
-    int (*pixelProcPtr)(Tcl_Interp *, SDL_Surface *, int, int, Tcl_Obj *) = NULL ; 
-    int x , y;
-    int res = TCL_OK;
-    Tcl_Obj ** xObjv ;
-    Tcl_Obj ** yObjv ;
-    int nr_x, nr_y ;
-
+    SurfaceData *srcPtr = NULL;
+    SDL_Surface *surface = dataPtr->surface;
+    Tclsdl_PixelView view;
+    SDL_Rect rect;
+    unsigned char *pixels;
+    int bpp = surface->format->BytesPerPixel;
+    int y, length, rowBytes;
 
-    if (objc != 3) {
-        Tcl_WrongNumArgs(interp, 2, objv, "buffer");
-        return TCL_ERROR;
-    }
-    
-    if (Tcl_ListObjGetElements(interp,objv[2],&nr_y,&yObjv)!=TCL_OK) {
-        Tcl_AppendResult(interp,"buffer is not a valid list",NULL);
+    if (objc < 3 || objc > 4) {
+        Tcl_WrongNumArgs(interp, 2, objv, "rawbuffer ?rect?");
         return TCL_ERROR;
     }
 
-    switch (dataPtr->surface->format->BitsPerPixel) {
-        case 8:
-            pixelProcPtr = SetPixel8;
-            break;
-        default:
-            Tcl_AppendResult(interp,"operation not supported for this surface format",NULL);
+    rect.x = rect.y = 0;
+    rect.w = surface->w;
+    rect.h = surface->h;
+    if (objc == 4) {
+        if (GetSDLRectFromObj(interp, objv[3], &rect) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        if (rect.x < 0 || rect.y < 0 || rect.x + rect.w > surface->w
+            || rect.y + rect.h > surface->h) {
+            Tcl_AppendResult(interp, "rectangle lies outside the surface",
+                             NULL);
             return TCL_ERROR;
+        }
     }
+    rowBytes = rect.w * bpp;
 
-    for (y = 0 ; y < nr_y && y < dataPtr->surface->h; y++) {
-        if (Tcl_ListObjGetElements(interp,yObjv[y],&nr_x,&xObjv)!=TCL_OK) {
-            Tcl_AppendResult(interp,"invalid row list",NULL);
+    if (Tclsdl_GetPixelViewFromObj(NULL, objv[2], &view) == TCL_OK) {
+        if (view.width != rect.w || view.height != rect.h
+            || view.bytesPerPixel != bpp) {
+            Tcl_AppendResult(interp,
+                "pixel view does not match the target rectangle", NULL);
             return TCL_ERROR;
         }
-        for (x = 0 ; x < nr_x && x < dataPtr->surface->w; x++) {
-            if (pixelProcPtr(interp, dataPtr->surface, x, y, xObjv[x])!=TCL_OK) {
-                return TCL_ERROR;
-            }
+        /* the source pixels may only be read while their surface is locked */
+        if (TclsdlLockPixelView(interp, objv[2], &view, &srcPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+    } else {
+        view.pixels = Tcl_GetByteArrayFromObj(objv[2], &length);
+        view.pitch = rowBytes;
+        if (objc == 3 && length >= surface->h * surface->pitch) {
+            view.pitch = surface->pitch;
+        }
+        if (length < rect.h * view.pitch) {
+            Tcl_AppendResult(interp, "rawbuffer not big enough for this surface",NULL);
+            return TCL_ERROR;
         }
     }
+
+    if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+        if (srcPtr) {
+            TclsdlUnlockSurface(srcPtr);
+        }
+        return TCL_ERROR;
+    }
+    pixels = (unsigned char *)surface->pixels
+        + rect.y * surface->pitch + rect.x * bpp;
+    if (pixels > view.pixels) {
+        /* a view of this same surface may overlap: copy bottom up */
+        for (y = rect.h - 1; y >= 0; y--) {
+            memmove(pixels + y * surface->pitch, view.pixels + y * view.pitch,
+                    rowBytes);
+        }
+    } else {
+        for (y = 0; y < rect.h; y++) {
+            memmove(pixels + y * surface->pitch, view.pixels + y * view.pitch,
+                    rowBytes);
+        }
+    }
+    TclsdlUnlockSurface(dataPtr);
+    if (srcPtr) {
+        TclsdlUnlockSurface(srcPtr);
+    }
+    TclsdlSurfaceDamage(dataPtr, &rect);
     return TCL_OK;
 }
 
-static int
-SurfaceGetRawBufferCmd(ClientData clientData, Tcl_Interp *interp, 
-                  int objc, Tcl_Obj *const objv[])
-{
-    SurfaceData *dataPtr = clientData;
-    void * pixels ;
-    int w;
-    int h;
-    Tcl_Obj * buffer;
 
-    if (objc != 2) {
-        Tcl_WrongNumArgs(interp, 2, objv, NULL);
-        return TCL_ERROR;
-    }
 
-    pixels = dataPtr->surface->pixels;
-    w = dataPtr->surface->w;
-    h = dataPtr->surface->h;
-    buffer = Tcl_NewByteArrayObj(pixels,h*dataPtr->surface->pitch);
-    
-    Tcl_SetObjResult(interp,buffer);
-    return TCL_OK;
+/* ----------------------------------------------------------------------
+ * Surface handle object
+ *
+ * Caches the SurfaceData for a surface command name so that commands
+ * taking a surface argument do not look the name up in the command
+ * table on every call. A handle holds a Tcl_Preserve reference on the
+ * SurfaceData and the rename count it was made at; once that surface
+ * command is deleted or renamed the handle falls back to a fresh lookup.
+ */
+
+static int SDLSurface_SetFromAny(Tcl_Interp *interp, Tcl_Obj *objPtr);
+static void SDLSurface_FreeIntRep(Tcl_Obj *objPtr);
+static void SDLSurface_DupIntRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr);
+
+static Tcl_ObjType sdlSurfaceType = {
+    "sdlsurface",
+    SDLSurface_FreeIntRep,      /* freeIntRepProc */
+    SDLSurface_DupIntRep,       /* dupIntRepProc*/
+    NULL,                       /* updateStringProc */
+    SDLSurface_SetFromAny,      /* setFromAnyProc */
+};
+
+#define SDLSURFACE_DATA(objPtr) \
+    ((SurfaceData *)(objPtr)->internalRep.twoPtrValue.ptr1)
+#define SDLSURFACE_RENAMES(objPtr) \
+    ((unsigned long)(size_t)(objPtr)->internalRep.twoPtrValue.ptr2)
+
+static void
+SDLSurface_FreeIntRep(Tcl_Obj *objPtr)
+{
+    Tcl_Release(SDLSURFACE_DATA(objPtr));
+    objPtr->typePtr = NULL;
 }
 
-static int
-SurfaceSetRawBufferCmd(ClientData clientData, Tcl_Interp *interp, 
-                  int objc, Tcl_Obj *const objv[])
+static void
+SDLSurface_DupIntRep(Tcl_Obj *srcPtr, Tcl_Obj *dupPtr)
 {
-    SurfaceData *dataPtr = clientData;
-    Uint32 * pixels ;
-    char * bytes;
-    int w;
-    int h;
-    int length;
+    Tcl_Preserve(SDLSURFACE_DATA(srcPtr));
+    dupPtr->internalRep.twoPtrValue = srcPtr->internalRep.twoPtrValue;
+    dupPtr->typePtr = &sdlSurfaceType;
+}
 
-    if (objc != 3) {
-        Tcl_WrongNumArgs(interp, 2, objv, "rawbuffer");
-        return TCL_ERROR;
-    }
+int
+SDLSurface_SetFromAny(Tcl_Interp *interp, Tcl_Obj *objPtr)
+{
+    Tcl_CmdInfo info;
+    SurfaceData *dataPtr;
 
-    pixels = (Uint32 *)dataPtr->surface->pixels;
-    w = dataPtr->surface->w;
-    h = dataPtr->surface->h;
-    bytes = Tcl_GetByteArrayFromObj(objv[2],&length);
-    if (length < h*w) {
-        Tcl_AppendResult(interp, "rawbuffer not big enough for this surface",NULL);
+    if (!Tcl_GetCommandInfo(interp, Tcl_GetString(objPtr), &info)
+        || !info.isNativeObjectProc || info.objProc != SurfaceEnsemble) {
+        if (interp) {
+            Tcl_AppendResult(interp, "\"", Tcl_GetString(objPtr),
+                             "\" is not a surface", NULL);
+        }
         return TCL_ERROR;
     }
-    memcpy((char *)pixels,bytes,h*w);
+    dataPtr = info.objClientData;
+    Tcl_Preserve(dataPtr);
+    if (objPtr->typePtr != NULL && objPtr->typePtr->freeIntRepProc != NULL) {
+        (*objPtr->typePtr->freeIntRepProc)(objPtr);
+    }
+    objPtr->typePtr = &sdlSurfaceType;
+    objPtr->internalRep.twoPtrValue.ptr1 = dataPtr;
+    objPtr->internalRep.twoPtrValue.ptr2 = (void *)(size_t)dataPtr->renames;
     return TCL_OK;
 }
 
+/*
+ * Resolve a surface command name to its SurfaceData.
+ */
+int
+TclsdlGetSurfaceFromObj(Tcl_Interp *interp, Tcl_Obj *objPtr,
+                        SurfaceData **dataPtrPtr)
+{
+    if (objPtr->typePtr != &sdlSurfaceType
+        || SDLSURFACE_DATA(objPtr)->deleted
+        || SDLSURFACE_RENAMES(objPtr) != SDLSURFACE_DATA(objPtr)->renames) {
+        if (SDLSurface_SetFromAny(interp, objPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+    }
+    *dataPtrPtr = SDLSURFACE_DATA(objPtr);
+    return TCL_OK;
+}
 
+static void
+SurfaceRenameTrace(ClientData clientData, Tcl_Interp *interp,
+                   const char *oldName, const char *newName, int flags)
+{
+    SurfaceData *dataPtr = clientData;
+    ++dataPtr->renames;
+}
 
 /*
  * $surface blit $surface x y ?sourcerect?
@@ -568,42 +982,138 @@ SurfaceBlitCmd(ClientData clientData, Tcl_Interp *interp,
     SurfaceData *dataPtr = clientData;
     SurfaceData *dstPtr = NULL;
     SDL_Rect rc = {0, 0, 0, 0}, srcRect = {0, 0, 0, 0}, *srcRectPtr = NULL;
-    Tcl_CmdInfo info;
-    int r = TCL_OK;
+    int x = 0, y = 0, r = TCL_OK;
 
     if (objc < 5 || objc > 6) {
         Tcl_WrongNumArgs(interp, 2, objv, "surface x y ?source_rect?");
         return TCL_ERROR;
     }
 
-    if (!Tcl_GetCommandInfo(interp, Tcl_GetString(objv[2]), &info)) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("argh!", -1));
-        r = TCL_ERROR;
-    }
-    if (TCL_OK == r && info.isNativeObjectProc != 1 
-        && info.objProc == SurfaceObjCmd) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj("not a surface", -1));
-        return TCL_ERROR;
-    }
+    r = TclsdlGetSurfaceFromObj(interp, objv[2], &dstPtr);
     if (TCL_OK == r)
-        r = Tcl_GetIntFromObj(interp, objv[3], (int *)&rc.x);
+        r = CheckUnlocked(interp, dataPtr);
     if (TCL_OK == r)
-        r = Tcl_GetIntFromObj(interp, objv[4], (int *)&rc.y);
+        r = CheckUnlocked(interp, dstPtr);
+    if (TCL_OK == r)
+        r = Tcl_GetIntFromObj(interp, objv[3], &x);
+    if (TCL_OK == r)
+        r = Tcl_GetIntFromObj(interp, objv[4], &y);
     if (TCL_OK == r && objc == 6) {
         srcRectPtr = &srcRect;
         r = GetSDLRectFromObj(interp, objv[5], &srcRect);
     }
     if (TCL_OK == r) {
-        dstPtr = (SurfaceData *)info.objClientData;
+        rc.x = (Sint16)x;
+        rc.y = (Sint16)y;
         if (SDL_BlitSurface(dataPtr->surface, srcRectPtr, dstPtr->surface, &rc) < 0) {
             Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
             r = TCL_ERROR;
+        } else {
+            TclsdlSurfaceDamage(dstPtr, &rc);
         }
     }
 
     return r;
 }
 
+/*
+ * $surface blitmany {src x y rect src x y rect ...}
+ * $surface blitmany -packed src bytes
+ *
+ * Blit many sources onto this surface in one call. The list form takes
+ * flat groups of four elements where the rect may be empty to blit
+ * the whole source. The packed form takes a byte array of BlitRecords
+ * all drawn from a single source surface.
+ */
+static int
+SurfaceBlitManyCmd(ClientData clientData, Tcl_Interp *interp, 
+                   int objc, Tcl_Obj *const objv[])
+{
+    SurfaceData *dataPtr = clientData;
+    SurfaceData *srcPtr = NULL;
+    SDL_Rect rc, srcRect, *srcRectPtr;
+    Tcl_Obj **listv;
+    int listc, n, len, x, y;
+
+    if (objc == 5 && strcmp(Tcl_GetString(objv[2]), "-packed") == 0) {
+        const unsigned char *bytes;
+        BlitRecord rec;
+
+        if (TclsdlGetSurfaceFromObj(interp, objv[3], &srcPtr) != TCL_OK
+            || CheckUnlocked(interp, srcPtr) != TCL_OK
+            || CheckUnlocked(interp, dataPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        bytes = Tcl_GetByteArrayFromObj(objv[4], &len);
+        if (len % sizeof(BlitRecord) != 0) {
+            Tcl_AppendResult(interp, "packed blit data must be a multiple"
+                             " of 12 bytes", NULL);
+            return TCL_ERROR;
+        }
+        for (n = 0; n < len; n += sizeof(BlitRecord)) {
+            memcpy(&rec, bytes + n, sizeof(BlitRecord));
+            rc.x = rec.x;
+            rc.y = rec.y;
+            srcRectPtr = NULL;
+            if (rec.sw != 0 || rec.sh != 0) {
+                srcRect.x = rec.sx;
+                srcRect.y = rec.sy;
+                srcRect.w = rec.sw;
+                srcRect.h = rec.sh;
+                srcRectPtr = &srcRect;
+            }
+            if (SDL_BlitSurface(srcPtr->surface, srcRectPtr,
+                                dataPtr->surface, &rc) < 0) {
+                Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+                return TCL_ERROR;
+            }
+            TclsdlSurfaceDamage(dataPtr, &rc);
+        }
+        return TCL_OK;
+    }
+
+    if (objc != 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?-packed source? records");
+        return TCL_ERROR;
+    }
+    if (Tcl_ListObjGetElements(interp, objv[2], &listc, &listv) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (listc % 4 != 0) {
+        Tcl_AppendResult(interp, "blit list must contain groups of"
+                         " \"surface x y rect\"", NULL);
+        return TCL_ERROR;
+    }
+    if (CheckUnlocked(interp, dataPtr) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    for (n = 0; n < listc; n += 4) {
+        if (TclsdlGetSurfaceFromObj(interp, listv[n], &srcPtr) != TCL_OK
+            || CheckUnlocked(interp, srcPtr) != TCL_OK
+            || Tcl_GetIntFromObj(interp, listv[n+1], &x) != TCL_OK
+            || Tcl_GetIntFromObj(interp, listv[n+2], &y) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        srcRectPtr = NULL;
+        Tcl_GetStringFromObj(listv[n+3], &len);
+        if (len > 0) {
+            if (GetSDLRectFromObj(interp, listv[n+3], &srcRect) != TCL_OK) {
+                return TCL_ERROR;
+            }
+            srcRectPtr = &srcRect;
+        }
+        rc.x = (Sint16)x;
+        rc.y = (Sint16)y;
+        if (SDL_BlitSurface(srcPtr->surface, srcRectPtr,
+                            dataPtr->surface, &rc) < 0) {
+            Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+            return TCL_ERROR;
+        }
+        TclsdlSurfaceDamage(dataPtr, &rc);
+    }
+    return TCL_OK;
+}
+
 /*
  * $surface fill rgb ?{0 0 100 100}?
  */
@@ -613,11 +1123,13 @@ SurfaceFillCmd(ClientData clientData, Tcl_Interp *interp,
                int objc, Tcl_Obj *const objv[])
 {
     SurfaceData *dataPtr = clientData;
+    SDL_Surface *surface = dataPtr->surface;
     SDL_Rect rect = {0, 0, 0, 0}, *rectPtr = NULL;
     Uint32 color;
 
     if (objc < 3 || objc > 4) {
         Tcl_WrongNumArgs(interp, 2, objv, "color ?rectangle?");
+        return TCL_ERROR;
     }
 
     if (GetSDLColorFromObj(interp, dataPtr->surface, objv[2], &color)
@@ -631,28 +1143,283 @@ SurfaceFillCmd(ClientData clientData, Tcl_Interp *interp,
             return TCL_ERROR;
         }
     }
-    
-    if (SDL_FillRect(dataPtr->surface, rectPtr, color) < 0) {
-        Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
 
+    /*
+     * Software surfaces are filled by the render pool when it has more
+     * than one thread. SDL_FillRect clips the rectangle in place so this
+     * does too.
+     */
+    if (TclsdlPoolThreads() > 1 && !(surface->flags & SDL_HWSURFACE)) {
+        SDL_Rect clip = surface->clip_rect;
+
+        if (rectPtr) {
+            int x0 = rectPtr->x, y0 = rectPtr->y;
+            int x1 = x0 + rectPtr->w, y1 = y0 + rectPtr->h;
+
+            if (x0 < clip.x) x0 = clip.x;
+            if (y0 < clip.y) y0 = clip.y;
+            if (x1 > clip.x + clip.w) x1 = clip.x + clip.w;
+            if (y1 > clip.y + clip.h) y1 = clip.y + clip.h;
+            if (x1 <= x0 || y1 <= y0) {
+                return TCL_OK;
+            }
+            clip.x = (Sint16)x0;
+            clip.y = (Sint16)y0;
+            clip.w = (Uint16)(x1 - x0);
+            clip.h = (Uint16)(y1 - y0);
+        }
+        if (TclsdlLockSurface(interp, dataPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        TclsdlFillRect(surface, &clip, color);
+        TclsdlUnlockSurface(dataPtr);
+        if (rectPtr) {
+            *rectPtr = clip;
+        }
+    } else if (SDL_FillRect(surface, rectPtr, color) < 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+        return TCL_ERROR;
     }
+    TclsdlSurfaceDamage(dataPtr, rectPtr);
     return TCL_OK;
 }
 
+/* ----------------------------------------------------------------------
+ * Collision masks
+ *
+ * Each surface gets a lazily built one bit per pixel mask of its solid
+ * pixels. A pixel is transparent if it matches the colorkey or, for
+ * surfaces blended with per-pixel alpha, if its alpha is below half.
+ * Overlap tests then AND 64 pixels at a time.
+ */
+
+static CollisionMask *
+GetCollisionMask(SurfaceData *dataPtr)
+{
+    SDL_Surface *surface = dataPtr->surface;
+    SDL_PixelFormat *fmt = surface->format;
+    CollisionMask *maskPtr = dataPtr->mask;
+    Uint32 pixel, key = 0, keyMask = 0, alphaMask = 0, alphaMin = 0;
+    Tcl_WideUInt *row;
+    Uint8 *p;
+    int x, y, bpp = fmt->BytesPerPixel, stride = (surface->w + 63) / 64;
+
+    if (maskPtr && maskPtr->valid
+        && maskPtr->w == surface->w && maskPtr->h == surface->h) {
+        return maskPtr;
+    }
+    if (maskPtr == NULL || maskPtr->w != surface->w
+        || maskPtr->h != surface->h) {
+        if (maskPtr) {
+            ckfree((char *)maskPtr);
+        }
+        maskPtr = (CollisionMask *)ckalloc(sizeof(CollisionMask)
+            + (stride * (surface->h ? surface->h : 1) - 1)
+            * sizeof(Tcl_WideUInt));
+        maskPtr->w = surface->w;
+        maskPtr->h = surface->h;
+        maskPtr->stride = stride;
+        dataPtr->mask = maskPtr;
+    }
+    memset(maskPtr->bits, 0, stride * surface->h * sizeof(Tcl_WideUInt));
+
+    if (surface->flags & SDL_SRCCOLORKEY) {
+        keyMask = (bpp == 1) ? 0xff : (fmt->Rmask | fmt->Gmask | fmt->Bmask);
+        key = fmt->colorkey & keyMask;
+    } else if ((surface->flags & SDL_SRCALPHA) && fmt->Amask) {
+        alphaMask = fmt->Amask;
+        alphaMin = (0x80 >> fmt->Aloss) << fmt->Ashift;
+    }
+
+    if (TclsdlLockSurface(NULL, dataPtr) != TCL_OK) {
+        return NULL;
+    }
+    for (y = 0; y < surface->h; y++) {
+        row = maskPtr->bits + y * stride;
+        p = (Uint8 *)surface->pixels + y * surface->pitch;
+        for (x = 0; x < surface->w; x++, p += bpp) {
+            switch (bpp) {
+                case 1: pixel = *p; break;
+                case 2: pixel = *(Uint16 *)p; break;
+                case 3:
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+                    pixel = (p[0] << 16) | (p[1] << 8) | p[2];
+#else
+                    pixel = p[0] | (p[1] << 8) | (p[2] << 16);
+#endif
+                    break;
+                default: pixel = *(Uint32 *)p; break;
+            }
+            if (keyMask ? ((pixel & keyMask) != key)
+                : alphaMask ? ((pixel & alphaMask) >= alphaMin) : 1) {
+                row[x >> 6] |= (Tcl_WideUInt)1 << (x & 63);
+            }
+        }
+    }
+    TclsdlUnlockSurface(dataPtr);
+    maskPtr->valid = 1;
+    return maskPtr;
+}
+
+/*
+ * Fetch 64 mask bits from a row starting at any bit offset, reading
+ * zeros outside the row.
+ */
+static Tcl_WideUInt
+MaskBits(const Tcl_WideUInt *row, int stride, int bit)
+{
+    int word = (bit >= 0) ? bit / 64 : -((63 - bit) / 64);
+    int shift = bit - word * 64;
+    Tcl_WideUInt lo, hi;
+
+    lo = (word >= 0 && word < stride) ? row[word] : 0;
+    if (shift == 0) {
+        return lo;
+    }
+    hi = (word + 1 >= 0 && word + 1 < stride) ? row[word + 1] : 0;
+    return (lo >> shift) | (hi << (64 - shift));
+}
+
+/*
+ * Clip a source region to a surface. A NULL or zero sized region
+ * selects everything from its origin to the surface edge.
+ */
+static void
+ClipRegion(SDL_Surface *surface, const SDL_Rect *rectPtr, int *r)
+{
+    int x2, y2;
+
+    r[0] = rectPtr ? rectPtr->x : 0;
+    r[1] = rectPtr ? rectPtr->y : 0;
+    x2 = (rectPtr && rectPtr->w) ? r[0] + rectPtr->w : surface->w;
+    y2 = (rectPtr && rectPtr->h) ? r[1] + rectPtr->h : surface->h;
+    if (r[0] < 0) r[0] = 0;
+    if (r[1] < 0) r[1] = 0;
+    if (x2 > surface->w) x2 = surface->w;
+    if (y2 > surface->h) y2 = surface->h;
+    r[2] = (x2 > r[0]) ? x2 - r[0] : 0;
+    r[3] = (y2 > r[1]) ? y2 - r[1] : 0;
+}
+
+/*
+ * Test whether region aRect of surface a drawn at the origin and
+ * region bRect of surface b drawn at dx,dy have a solid pixel in
+ * common. Returns 1 on overlap, 0 if none and -1 if a mask could not
+ * be built.
+ */
+int
+TclsdlMaskOverlap(SurfaceData *aPtr, const SDL_Rect *aRectPtr,
+                  SurfaceData *bPtr, const SDL_Rect *bRectPtr, int dx, int dy)
+{
+    CollisionMask *ma, *mb;
+    const Tcl_WideUInt *rowA, *rowB;
+    Tcl_WideUInt bits;
+    int ra[4], rb[4], x1, y1, x2, y2, x, y, n;
+
+    ClipRegion(aPtr->surface, aRectPtr, ra);
+    ClipRegion(bPtr->surface, bRectPtr, rb);
+
+    /* Overlap of the two regions in the space of region a. */
+    x1 = (dx > 0) ? dx : 0;
+    y1 = (dy > 0) ? dy : 0;
+    x2 = (ra[2] < dx + rb[2]) ? ra[2] : dx + rb[2];
+    y2 = (ra[3] < dy + rb[3]) ? ra[3] : dy + rb[3];
+    if (x2 <= x1 || y2 <= y1) {
+        return 0;
+    }
+
+    ma = GetCollisionMask(aPtr);
+    mb = (bPtr == aPtr) ? ma : GetCollisionMask(bPtr);
+    if (ma == NULL || mb == NULL) {
+        return -1;
+    }
+
+    for (y = y1; y < y2; y++) {
+        rowA = ma->bits + (ra[1] + y) * ma->stride;
+        rowB = mb->bits + (rb[1] + y - dy) * mb->stride;
+        for (x = x1; x < x2; x += 64) {
+            n = x2 - x;
+            bits = MaskBits(rowA, ma->stride, ra[0] + x)
+                & MaskBits(rowB, mb->stride, rb[0] + x - dx);
+            if (n < 64) {
+                bits &= ((Tcl_WideUInt)1 << n) - 1;
+            }
+            if (bits) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
 /*
  * Look for a collision between two images. What we are looking
  * for is non-transparent pixels in both regions at the same point
  * 
- * $surface collide 
+ * $surface collide other dx dy ?rect? ?otherrect?
+ *
+ * The other surface is placed at dx,dy relative to this one. Each
+ * rect selects the source region as used with blit.
  */
 static int
 SurfaceCollisionCmd(ClientData clientData, Tcl_Interp *interp, 
                     int objc, Tcl_Obj *const objv[])
 {
-    /* SurfaceData *dataPtr = clientData; */
+    SurfaceData *dataPtr = clientData;
+    SurfaceData *otherPtr = NULL;
+    SDL_Rect rect, otherRect, *rectPtr = NULL, *otherRectPtr = NULL;
+    int dx, dy, r;
 
-    Tcl_SetResult(interp, "e-notimpl", TCL_STATIC);
-    return TCL_ERROR;
+    if (objc < 5 || objc > 7) {
+        Tcl_WrongNumArgs(interp, 2, objv, "surface dx dy ?rect? ?otherrect?");
+        return TCL_ERROR;
+    }
+    if (TclsdlGetSurfaceFromObj(interp, objv[2], &otherPtr) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[3], &dx) != TCL_OK
+        || Tcl_GetIntFromObj(interp, objv[4], &dy) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    if (objc > 5) {
+        rectPtr = &rect;
+        if (GetSDLRectFromObj(interp, objv[5], rectPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+    }
+    if (objc > 6) {
+        otherRectPtr = &otherRect;
+        if (GetSDLRectFromObj(interp, objv[6], otherRectPtr) != TCL_OK) {
+            return TCL_ERROR;
+        }
+    }
+
+    r = TclsdlMaskOverlap(dataPtr, rectPtr, otherPtr, otherRectPtr, dx, dy);
+    if (r < 0) {
+        Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+        return TCL_ERROR;
+    }
+    Tcl_SetObjResult(interp, Tcl_NewBooleanObj(r));
+    return TCL_OK;
+}
+
+static Tcl_Obj *
+DirtyListObj(SurfaceData *dataPtr)
+{
+    Tcl_Obj *listObj = Tcl_NewListObj(0, NULL), *rectObj;
+    int n;
+
+    for (n = 0; n < dataPtr->ndirty; n++) {
+        rectObj = Tcl_NewListObj(0, NULL);
+        Tcl_ListObjAppendElement(NULL, rectObj,
+                                 Tcl_NewIntObj(dataPtr->dirty[n].x));
+        Tcl_ListObjAppendElement(NULL, rectObj,
+                                 Tcl_NewIntObj(dataPtr->dirty[n].y));
+        Tcl_ListObjAppendElement(NULL, rectObj,
+                                 Tcl_NewIntObj(dataPtr->dirty[n].w));
+        Tcl_ListObjAppendElement(NULL, rectObj,
+                                 Tcl_NewIntObj(dataPtr->dirty[n].h));
+        Tcl_ListObjAppendElement(NULL, listObj, rectObj);
+    }
+    return listObj;
 }
 
 static int
@@ -664,10 +1431,10 @@ SurfaceConfigureCmd(ClientData clientData, Tcl_Interp *interp,
     int width = 0, height = 0, bpp = 0, flags = 0, pitch = 0;
     Tcl_Obj *resObj = NULL;
     enum { OPT_HEIGHT, OPT_WIDTH, OPT_BPP, OPT_FULLSCREEN, OPT_PITCH, OPT_RESIZE, 
-	   OPT_WINDOWID };
+	   OPT_WINDOWID, OPT_DIRTY };
     const char *options[] = {
 	"-height", "-width", "-bpp", "-fullscreen",  "-pitch", "-resizable", 
-	"-windowid", NULL
+	"-windowid", "-dirty", NULL
     };
     
     height = dataPtr->surface->h;
@@ -699,6 +1466,9 @@ SurfaceConfigureCmd(ClientData clientData, Tcl_Interp *interp,
 	    Tcl_NewStringObj(options[OPT_WINDOWID], -1));
 	Tcl_ListObjAppendElement(interp, listObj, 
 	    Tcl_NewLongObj((long)dataPtr->windowid));
+	Tcl_ListObjAppendElement(interp, listObj,
+	    Tcl_NewStringObj(options[OPT_DIRTY], -1));
+	Tcl_ListObjAppendElement(interp, listObj, DirtyListObj(dataPtr));
 	Tcl_SetObjResult(interp, listObj);
 	return TCL_OK;
     }
@@ -761,6 +1531,15 @@ SurfaceConfigureCmd(ClientData clientData, Tcl_Interp *interp,
 		}
 		break;
 	    }
+	    case OPT_DIRTY:
+		if (cget) {
+		    resObj = DirtyListObj(dataPtr);
+		} else {
+		    Tcl_AppendResult(interp, "option \"-dirty\" is read-only",
+			NULL);
+		    return TCL_ERROR;
+		}
+		break;
 	    case OPT_FULLSCREEN:
 		if (cget) {
 		    resObj = Tcl_NewBooleanObj(flags & SDL_FULLSCREEN);
@@ -788,9 +1567,16 @@ SurfaceConfigureCmd(ClientData clientData, Tcl_Interp *interp,
     if (cget) {
 	Tcl_SetObjResult(interp, resObj);
     } else if (r == TCL_OK) {
-	SDL_Surface *surface = SDL_SetVideoMode(width, height, bpp, flags);
+	SDL_Surface *surface;
+	/* the old pixels go with the old mode */
+	TclsdlDetachPixelViews(dataPtr);
+	surface = SDL_SetVideoMode(width, height, bpp, flags);
 	if (surface) {
 	    dataPtr->surface = surface;
+	    dataPtr->ndirty = 0;
+	    if (dataPtr->mask) {
+		dataPtr->mask->valid = 0;
+	    }
 	} else {
 	    Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
 	    r = TCL_ERROR;
@@ -800,17 +1586,36 @@ SurfaceConfigureCmd(ClientData clientData, Tcl_Interp *interp,
 }
 
 struct Ensemble surfaceEnsemble[] = {
-    { "getbuffer", SurfaceGetBufferCmd, NULL },
     { "getrawbuffer", SurfaceGetRawBufferCmd, NULL },
-    { "setbuffer", SurfaceSetBufferCmd, NULL },
     { "setrawbuffer", SurfaceSetRawBufferCmd, NULL },
     { "delete", SurfaceDeleteCmd, NULL },
+    { "export", TclsdlSurfaceExportCmd, NULL },
+    { "import", TclsdlSurfaceImportCmd, NULL },
     { "flip",   SurfaceFlipCmd, NULL },
+    { "update", SurfaceUpdateCmd, NULL },
+    { "view",   TclsdlSurfaceViewCmd, NULL },
     { "blit",   SurfaceBlitCmd, NULL },
+    { "blitmany", SurfaceBlitManyCmd, NULL },
+    { "blend",  TclsdlSurfaceBlendCmd, NULL },
     { "pixel",   SurfacePixelCmd, NULL },
+    { "plot",   TclsdlSurfacePlotCmd, NULL },
+    { "sample", TclsdlSurfaceSampleCmd, NULL },
     { "fill",   SurfaceFillCmd, NULL },
+    { "line",   TclsdlSurfaceLineCmd, NULL },
+    { "hline",  TclsdlSurfaceHLineCmd, NULL },
+    { "rect",   TclsdlSurfaceRectCmd, NULL },
+    { "circle", TclsdlSurfaceCircleCmd, NULL },
+    { "ellipse", TclsdlSurfaceEllipseCmd, NULL },
+    { "triangle", TclsdlSurfaceTriangleCmd, NULL },
+    { "polygon", TclsdlSurfacePolygonCmd, NULL },
+    { "generate", TclsdlSurfaceGenerateCmd, NULL },
+    { "collide", SurfaceCollisionCmd, NULL },
     { "configure", SurfaceConfigureCmd, NULL },
     { "mustlock", SurfaceMustLockCmd, NULL },
+    { "lock",   SurfaceLockCmd, NULL },
+    { "unlock", SurfaceUnlockCmd, NULL },
+    { "withlock", SurfaceWithLockCmd, NULL },
+    { "palette", NULL, surfacePaletteEnsemble },
     { "setcolors", SurfaceSetColorsCmd, NULL},
     { "setcolorkey", SurfaceSetColorKeyCmd, NULL},
     { NULL, NULL, NULL },
@@ -844,24 +1649,54 @@ static void
 SurfaceCleanup(ClientData clientData)
 {
     SurfaceData *dataPtr = clientData;
-    printf("cleanup - deleting surface\n");
+    dataPtr->deleted = 1;
+    TclsdlDetachPixelViews(dataPtr);
     if (dataPtr->surface)
-        SDL_FreeSurface(dataPtr->surface);
-    ckfree((char *)dataPtr);
+        TclsdlFreeSurface(dataPtr->surface);
+    if (dataPtr->dirty)
+        ckfree((char *)dataPtr->dirty);
+    if (dataPtr->mask)
+        ckfree((char *)dataPtr->mask);
+    /* SDL_FreeSurface has dropped any lock; withlock may still refer */
+    dataPtr->surface = NULL;
+    dataPtr->lockCount = 0;
+    Tcl_EventuallyFree(dataPtr, TCL_DYNAMIC);
+}
+
+/*
+ * Wrap an SDL surface in a new surface command which takes ownership
+ * of it. The command name is left in the interpreter result.
+ */
+SurfaceData *
+TclsdlNewSurfaceCommand(Tcl_Interp *interp, SDL_Surface *surface,
+                        unsigned long windowid)
+{
+    SurfaceData *dataPtr;
+    static int uid = 0;
+    char name[4 + TCL_INTEGER_SPACE];
+
+    dataPtr = (SurfaceData *)ckalloc(sizeof(SurfaceData));
+    memset(dataPtr, 0, sizeof(SurfaceData));
+    dataPtr->surface = surface;
+    dataPtr->windowid = windowid;
+    sprintf(name, "sdl%u", uid++);
+    dataPtr->token = Tcl_CreateObjCommand(interp, name, SurfaceEnsemble,
+                                          dataPtr, SurfaceCleanup);
+    Tcl_TraceCommand(interp, name, TCL_TRACE_RENAME, SurfaceRenameTrace,
+                     dataPtr);
+    Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+    return dataPtr;
 }
 
 /*export*/ int
 SurfaceObjCmd(ClientData clientData, Tcl_Interp *interp, 
                   int objc, Tcl_Obj *const objv[])
 {
-    SurfaceData *dataPtr;
     int width = 800, height = 600, bpp = 32;
     int flags = SDL_HWSURFACE | SDL_ANYFORMAT | SDL_DOUBLEBUF | SDL_HWPALETTE;
     int index, option = 1, r = TCL_OK;
     unsigned long windowid = 0;
     const char *bmpfile = NULL;
-    static int uid = 0;
-    char name[4 + TCL_INTEGER_SPACE];
 
     enum {SURF_WIDTH, SURF_HEIGHT, SURF_BPP, SURF_BITMAP, SURF_FULLSCREEN, 
     SURF_RESIZE, SURF_WINDOWID};
@@ -870,6 +1705,10 @@ SurfaceObjCmd(ClientData clientData, Tcl_Interp *interp,
         "-windowid", NULL
     };
 
+    if (objc > 1 && strcmp(Tcl_GetString(objv[1]), "load") == 0) {
+        return TclsdlSurfaceLoadCmd(clientData, interp, objc, objv);
+    }
+
     for (option = 1; option < objc; ++option) {
         if (Tcl_GetIndexFromObj(interp, objv[option], cmds, 
                                 "option", 0, &index) != TCL_OK) {
@@ -916,54 +1755,34 @@ SurfaceObjCmd(ClientData clientData, Tcl_Interp *interp,
             
     if (r == TCL_OK) {
         if (bmpfile == NULL) {
-            SDL_Surface *surface = NULL;
-            if (SDL_GetVideoSurface()) {
-                surface = SDL_CreateRGBSurface(flags, width, height, bpp,
-#if SDL_BYTEORDER == SDL_BIG_ENDIAN
-		    0xff000000, 0x00ff0000, 0x0000ff00, 0x000000ff
-#else
-		    0x000000ff, 0x0000ff00, 0x00ff0000, 0xff000000
-#endif
-					       );
-		if (surface) {
-		    surface = SDL_DisplayFormat(surface);
-		}
-		if (!surface) {
-		    Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
-		    return TCL_ERROR;
-		}
-		dataPtr = (SurfaceData *)ckalloc(sizeof(SurfaceData));
-		dataPtr->surface = surface;
-		dataPtr->windowid = windowid;
-		sprintf(name, "sdl%u", uid++);
-		dataPtr->token  = Tcl_CreateObjCommand(interp, 
-		    name, SurfaceEnsemble, dataPtr, SurfaceCleanup);
-		Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+            SDL_Surface *screen = SDL_GetVideoSurface(), *surface = NULL;
+            if (screen) {
+                /* a new surface in the display format, as SDL_DisplayFormat
+                 * would make, taken from the surface pool if possible */
+                SDL_PixelFormat *fmt = screen->format;
+                surface = TclsdlAcquireSurface(screen->flags & SDL_HWSURFACE,
+                    width, height, fmt->BitsPerPixel,
+                    fmt->Rmask, fmt->Gmask, fmt->Bmask, fmt->Amask);
+                if (surface && fmt->palette) {
+                    SDL_SetColors(surface, fmt->palette->colors, 0,
+                                  fmt->palette->ncolors);
+                }
 	    } else {
-		dataPtr = (SurfaceData *)ckalloc(sizeof(SurfaceData));
-		dataPtr->windowid = windowid;
-		dataPtr->surface = SDL_SetVideoMode(width, height, bpp, flags);
-		sprintf(name, "sdl%u", uid++);
-		dataPtr->token  = Tcl_CreateObjCommand(interp, 
-		    name, SurfaceEnsemble, dataPtr, SurfaceCleanup);
-		Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+		surface = SDL_SetVideoMode(width, height, bpp, flags);
 	    }
+	    if (!surface) {
+		Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
+		return TCL_ERROR;
+	    }
+	    TclsdlNewSurfaceCommand(interp, surface, windowid);
         } else {
-            SDL_Surface *tmp = NULL;
-            dataPtr = (SurfaceData *)ckalloc(sizeof(SurfaceData));
-            dataPtr->surface = NULL;
-	    dataPtr->windowid = windowid;
-            tmp = SDL_LoadBMP(bmpfile);
-            if (tmp) {
-                dataPtr->surface = SDL_DisplayFormat(tmp);
-                SDL_FreeSurface(tmp);
-            }
-            if (tmp && dataPtr->surface) {
-                sprintf(name, "sdl%u", uid++);
-                dataPtr->token  = Tcl_CreateObjCommand(interp, 
-                                                       name, SurfaceEnsemble,
-                                                       dataPtr, SurfaceCleanup);
-                Tcl_SetObjResult(interp, Tcl_NewStringObj(name, -1));
+            TclsdlDisplay display;
+            SDL_Surface *surface;
+
+            TclsdlGetDisplay(&display);
+            surface = TclsdlLoadImage(bmpfile, &display);
+            if (surface) {
+                TclsdlNewSurfaceCommand(interp, surface, windowid);
             } else {
                 Tcl_SetObjResult(interp, Tcl_NewStringObj(SDL_GetError(), -1));
                 r = TCL_ERROR;
@@ -0,0 +1,358 @@
+/*
+ * sdl::config -poolbytes n
+ * sdl::pool stats
+ * sdl::pool trim ?bytes?
+ *
+ * Freed software surfaces are kept in a pool keyed by their size and
+ * pixel format instead of being handed back to the allocator, and new
+ * surfaces of the same size and format take their pixel buffers from it.
+ * Scratch surfaces created and deleted every frame then cost a clear of
+ * the pixels rather than a large allocation and the page faults that go
+ * with it.
+ *
+ * The pool holds at most -poolbytes bytes of pixels, 32MB by default and
+ * 0 to turn pooling off. When it is full the surfaces freed longest ago
+ * are released first. "trim" releases pooled surfaces until no more than
+ * the given number of bytes, by default none, are held.
+ *
+ * "stats" returns the number of surfaces taken from the pool (hits) and
+ * allocated afresh (misses), the number returned to it (recycled) and
+ * released from it (released), and the surfaces and bytes it now holds.
+ *
+ * Video, hardware, paletted and preallocated surfaces are never pooled.
+ */
+
+#include "tclsdlInt.h"
+
+#define POOL_DEFAULT_BYTES (32 * 1024 * 1024)
+
+typedef struct PoolKey {
+    int    w, h;
+    Uint32 depth, rmask, gmask, bmask, amask;
+} PoolKey;
+
+#define POOL_KEY_WORDS (sizeof(PoolKey) / sizeof(int))
+
+typedef struct PoolEntry {
+    SDL_Surface      *surface;
+    long              bytes;
+    Tcl_HashEntry    *bucket;       /* the stack of surfaces of this key */
+    struct PoolEntry *nextPtr;      /* next in the bucket stack */
+    struct PoolEntry *olderPtr;     /* neighbours in the order freed */
+    struct PoolEntry *newerPtr;
+} PoolEntry;
+
+typedef struct PoolStats {
+    Tcl_WideInt hits, misses, recycled, released;
+    long        surfaces, bytes;
+} PoolStats;
+
+static long          poolBudget = POOL_DEFAULT_BYTES;
+static PoolStats     stats;
+static PoolEntry    *oldest = NULL, *newest = NULL;
+static Tcl_HashTable buckets;       /* PoolKey -> newest PoolEntry */
+static int           bucketsInit = 0;
+static Tcl_Mutex     surfPoolMutex; /* protects all of the above */
+
+static void
+MakeKey(PoolKey *keyPtr, int w, int h, int depth,
+        Uint32 rmask, Uint32 gmask, Uint32 bmask, Uint32 amask)
+{
+    memset(keyPtr, 0, sizeof(PoolKey));
+    keyPtr->w = w;
+    keyPtr->h = h;
+    keyPtr->depth = depth;
+    keyPtr->rmask = rmask;
+    keyPtr->gmask = gmask;
+    keyPtr->bmask = bmask;
+    keyPtr->amask = amask;
+}
+
+/*
+ * Take an entry out of the pool. Called with surfPoolMutex held.
+ */
+static void
+Unlink(PoolEntry *entryPtr)
+{
+    PoolEntry **prevPtrPtr;
+
+    prevPtrPtr = (PoolEntry **)&Tcl_GetHashValue(entryPtr->bucket);
+    while (*prevPtrPtr != entryPtr) {
+        prevPtrPtr = &(*prevPtrPtr)->nextPtr;
+    }
+    *prevPtrPtr = entryPtr->nextPtr;
+    if (Tcl_GetHashValue(entryPtr->bucket) == NULL) {
+        Tcl_DeleteHashEntry(entryPtr->bucket);
+    }
+
+    if (entryPtr->olderPtr) {
+        entryPtr->olderPtr->newerPtr = entryPtr->newerPtr;
+    } else {
+        oldest = entryPtr->newerPtr;
+    }
+    if (entryPtr->newerPtr) {
+        entryPtr->newerPtr->olderPtr = entryPtr->olderPtr;
+    } else {
+        newest = entryPtr->olderPtr;
+    }
+    stats.surfaces--;
+    stats.bytes -= entryPtr->bytes;
+}
+
+/*
+ * Release the surfaces freed longest ago until the pool holds no more
+ * than limit bytes. The surfaces are returned for freeing once the
+ * mutex is dropped.
+ */
+static PoolEntry *
+Evict(long limit)
+{
+    PoolEntry *entryPtr, *evicted = NULL;
+
+    while (stats.bytes > limit && (entryPtr = oldest) != NULL) {
+        Unlink(entryPtr);
+        stats.released++;
+        entryPtr->nextPtr = evicted;
+        evicted = entryPtr;
+    }
+    return evicted;
+}
+
+static void
+FreeEvicted(PoolEntry *entryPtr)
+{
+    PoolEntry *nextPtr;
+
+    for (; entryPtr; entryPtr = nextPtr) {
+        nextPtr = entryPtr->nextPtr;
+        SDL_FreeSurface(entryPtr->surface);
+        ckfree((char *)entryPtr);
+    }
+}
+
+static void
+SurfPoolExitHandler(ClientData clientData)
+{
+    PoolEntry *evicted;
+
+    Tcl_MutexLock(&surfPoolMutex);
+    evicted = Evict(0);
+    Tcl_MutexUnlock(&surfPoolMutex);
+    FreeEvicted(evicted);
+}
+
+/* ---------------------------------------------------------------------- */
+
+/*
+ * Create a surface as SDL_CreateRGBSurface does, with its pixels cleared,
+ * taking it from the pool if one of this size and format is there.
+ */
+SDL_Surface *
+TclsdlAcquireSurface(Uint32 flags, int w, int h, int depth,
+                     Uint32 rmask, Uint32 gmask, Uint32 bmask, Uint32 amask)
+{
+    PoolEntry *entryPtr = NULL;
+    Tcl_HashEntry *hPtr;
+    SDL_Surface *surface;
+    PoolKey key;
+
+    if (!(flags & SDL_HWSURFACE) && depth > 8) {
+        MakeKey(&key, w, h, depth, rmask, gmask, bmask, amask);
+        Tcl_MutexLock(&surfPoolMutex);
+        if (bucketsInit
+            && (hPtr = Tcl_FindHashEntry(&buckets, (char *)&key)) != NULL) {
+            entryPtr = (PoolEntry *)Tcl_GetHashValue(hPtr);
+            Unlink(entryPtr);
+            stats.hits++;
+        } else {
+            stats.misses++;
+        }
+        Tcl_MutexUnlock(&surfPoolMutex);
+    }
+    if (entryPtr == NULL) {
+        return SDL_CreateRGBSurface(flags, w, h, depth,
+                                    rmask, gmask, bmask, amask);
+    }
+
+    surface = entryPtr->surface;
+    ckfree((char *)entryPtr);
+    memset(surface->pixels, 0, (size_t)surface->pitch * surface->h);
+    return surface;
+}
+
+/*
+ * Put a surface that is no longer used into the pool, or free it if it
+ * cannot be pooled. The surface is returned to the state a new one has.
+ */
+void
+TclsdlRecycleSurface(SDL_Surface *surface)
+{
+    PoolEntry *entryPtr, *evicted;
+    Tcl_HashEntry *hPtr;
+    PoolKey key;
+    long bytes;
+    int isNew;
+
+    bytes = (long)surface->pitch * surface->h;
+    if (surface == SDL_GetVideoSurface() || surface->refcount != 1
+        || (surface->flags & (SDL_HWSURFACE | SDL_PREALLOC))
+        || surface->format->palette != NULL || surface->pixels == NULL
+        || bytes > poolBudget) {
+        SDL_FreeSurface(surface);
+        return;
+    }
+
+    while (surface->locked > 0) {
+        SDL_UnlockSurface(surface);
+    }
+    SDL_SetColorKey(surface, 0, 0);
+    SDL_SetAlpha(surface, surface->format->Amask ? SDL_SRCALPHA : 0,
+                 SDL_ALPHA_OPAQUE);
+    SDL_SetClipRect(surface, NULL);
+
+    entryPtr = (PoolEntry *)ckalloc(sizeof(PoolEntry));
+    entryPtr->surface = surface;
+    entryPtr->bytes = bytes;
+    MakeKey(&key, surface->w, surface->h, surface->format->BitsPerPixel,
+            surface->format->Rmask, surface->format->Gmask,
+            surface->format->Bmask, surface->format->Amask);
+
+    Tcl_MutexLock(&surfPoolMutex);
+    if (!bucketsInit) {
+        Tcl_InitHashTable(&buckets, POOL_KEY_WORDS);
+        Tcl_CreateExitHandler(SurfPoolExitHandler, NULL);
+        bucketsInit = 1;
+    }
+    hPtr = Tcl_CreateHashEntry(&buckets, (char *)&key, &isNew);
+    entryPtr->bucket = hPtr;
+    entryPtr->nextPtr = isNew ? NULL : (PoolEntry *)Tcl_GetHashValue(hPtr);
+    Tcl_SetHashValue(hPtr, entryPtr);
+    entryPtr->olderPtr = newest;
+    entryPtr->newerPtr = NULL;
+    if (newest) {
+        newest->newerPtr = entryPtr;
+    } else {
+        oldest = entryPtr;
+    }
+    newest = entryPtr;
+    stats.surfaces++;
+    stats.bytes += bytes;
+    stats.recycled++;
+    evicted = Evict(poolBudget);
+    Tcl_MutexUnlock(&surfPoolMutex);
+
+    FreeEvicted(evicted);
+}
+
+long
+TclsdlSurfacePoolBudget(void)
+{
+    return poolBudget;
+}
+
+void
+TclsdlSetSurfacePoolBudget(long bytes)
+{
+    PoolEntry *evicted;
+
+    Tcl_MutexLock(&surfPoolMutex);
+    poolBudget = bytes;
+    evicted = Evict(bytes);
+    Tcl_MutexUnlock(&surfPoolMutex);
+    FreeEvicted(evicted);
+}
+
+static int
+SurfPoolStatsCmd(ClientData clientData, Tcl_Interp *interp,
+                 int objc, Tcl_Obj *const objv[])
+{
+    PoolStats s;
+    Tcl_Obj *resultObj;
+
+    if (objc != 2) {
+        Tcl_WrongNumArgs(interp, 2, objv, "");
+        return TCL_ERROR;
+    }
+    Tcl_MutexLock(&surfPoolMutex);
+    s = stats;
+    Tcl_MutexUnlock(&surfPoolMutex);
+
+    resultObj = Tcl_NewListObj(0, NULL);
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("hits", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(s.hits));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("misses", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(s.misses));
+    Tcl_ListObjAppendElement(interp, resultObj,
+                             Tcl_NewStringObj("recycled", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(s.recycled));
+    Tcl_ListObjAppendElement(interp, resultObj,
+                             Tcl_NewStringObj("released", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewWideIntObj(s.released));
+    Tcl_ListObjAppendElement(interp, resultObj,
+                             Tcl_NewStringObj("surfaces", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewLongObj(s.surfaces));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewStringObj("bytes", -1));
+    Tcl_ListObjAppendElement(interp, resultObj, Tcl_NewLongObj(s.bytes));
+    Tcl_SetObjResult(interp, resultObj);
+    return TCL_OK;
+}
+
+static int
+SurfPoolTrimCmd(ClientData clientData, Tcl_Interp *interp,
+                int objc, Tcl_Obj *const objv[])
+{
+    PoolEntry *evicted;
+    long limit = 0;
+
+    if (objc < 2 || objc > 3) {
+        Tcl_WrongNumArgs(interp, 2, objv, "?bytes?");
+        return TCL_ERROR;
+    }
+    if (objc == 3 && Tcl_GetLongFromObj(interp, objv[2], &limit) != TCL_OK) {
+        return TCL_ERROR;
+    }
+    Tcl_MutexLock(&surfPoolMutex);
+    evicted = Evict(limit);
+    Tcl_MutexUnlock(&surfPoolMutex);
+    FreeEvicted(evicted);
+    return TCL_OK;
+}
+
+struct Ensemble surfPoolEnsemble[] = {
+    { "stats", SurfPoolStatsCmd, NULL },
+    { "trim", SurfPoolTrimCmd, NULL },
+    { NULL, NULL, NULL },
+};
+
+/*export*/ int
+SurfPoolObjCmd(ClientData clientData, Tcl_Interp *interp,
+               int objc, Tcl_Obj *const objv[])
+{
+    struct Ensemble *ensemble = surfPoolEnsemble;
+    int option = 1, index;
+
+    while (option < objc) {
+        if (Tcl_GetIndexFromObjStruct(interp, objv[option],
+                ensemble, sizeof(ensemble[0]), "command", 0, &index) != TCL_OK)
+        {
+            return TCL_ERROR;
+        }
+
+        if (ensemble[index].command) {
+            return ensemble[index].command(clientData, interp, objc, objv);
+        }
+        ensemble = ensemble[index].ensemble;
+        ++option;
+    }
+    Tcl_WrongNumArgs(interp, option, objv, "command ?arg arg...?");
+    return TCL_ERROR;
+}
+
+/*
+ * Local variables:
+ *   mode: c
+ *   c-basic-offset: 4
+ *   fill-column: 78
+ *   indent-tabs-mode: nil
+ * End:
+ */
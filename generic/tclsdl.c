@@ -2,154 +2,9 @@
  *
  */
 
-#include "tclsdl.h"
-#include <SDL/SDL.h>
+#include "tclsdlInt.h"
 #include <SDL/SDL_version.h>
 
-#define TCLSDLEVENT (SDL_NUMEVENTS - 2)
-
-typedef struct Tclsdl_Event {
-    struct Tcl_Event ev;
-    Tcl_Interp *interp;
-} Tclsdl_Event;
-
-static void
-BgEvalObjv(Tcl_Interp *interp, int objc, Tcl_Obj *const *objv)
-{
-    int n = 0;
-    for (n = 0; n < objc; n++)
-	Tcl_IncrRefCount(objv[n]);
-    Tclsdl_BackgroundEvalObjv(interp, objc, objv, 0);
-    for (n = 0; n < objc; n++)
-	Tcl_DecrRefCount(objv[n]);
-}
-
-static int
-EventProc(Tcl_Event *eventPtr, int flags)
-{
-    Tclsdl_Event *evPtr = (Tclsdl_Event *)eventPtr;
-    Tcl_Interp *interp = evPtr->interp;
-    SDL_Event sdl_event;
-
-    if (!(flags & TCL_WINDOW_EVENTS)) {
-        return 0;
-    }
-    while (SDL_PollEvent(&sdl_event)) {
-	/* call registered function */
-        switch (sdl_event.type) {
-	    case SDL_QUIT: {
-		Tcl_Obj *objv[2];
-		objv[0] = Tcl_NewStringObj("sdl::onEvent", -1);
-		objv[1] = Tcl_NewStringObj("Quit", -1);
-		BgEvalObjv(interp, ARRAYSIZEOF(objv), objv);
-                break;
-	    }
-	    case SDL_ACTIVEEVENT: {
-		SDL_ActiveEvent *e = (SDL_ActiveEvent *)&sdl_event;
-		Tcl_Obj *objv[2];
-		if (e->state & SDL_APPACTIVE) {
-		    objv[0] = Tcl_NewStringObj("sdl::onEvent", -1);
-		    objv[1] = Tcl_NewStringObj(e->gain 
-			? "Activate" : "Deactivate", -1);
-		    BgEvalObjv(interp, ARRAYSIZEOF(objv), objv);
-		}
-		if (e->state & SDL_APPMOUSEFOCUS) {
-		    objv[0] = Tcl_NewStringObj("sdl::onEvent", -1);
-		    objv[1] = Tcl_NewStringObj(e->gain 
-			? "Enter" : "Leave", -1);
-		    BgEvalObjv(interp, ARRAYSIZEOF(objv), objv);
-		}
-		if (e->state & SDL_APPINPUTFOCUS) {
-		    objv[0] = Tcl_NewStringObj("sdl::onEvent", -1);
-		    objv[1] = Tcl_NewStringObj(e->gain 
-			? "FocusIn" : "FocusOut", -1);
-		    BgEvalObjv(interp, ARRAYSIZEOF(objv), objv);
-		}
-		break;
-	    }
-	    case SDL_VIDEORESIZE: {
-		SDL_ResizeEvent *e = (SDL_ResizeEvent *)&sdl_event;
-		Tcl_Obj *objv[4];
-		objv[0] = Tcl_NewStringObj("sdl::onEvent", -1);
-		objv[1] = Tcl_NewStringObj("Configure", -1);
-		objv[2] = Tcl_NewIntObj(e->w);
-		objv[3] = Tcl_NewIntObj(e->h);
-		BgEvalObjv(interp, ARRAYSIZEOF(objv), objv);
-		break;
-	    }
-	    case SDL_MOUSEBUTTONUP:
-	    case SDL_MOUSEBUTTONDOWN: {
-		Tcl_Obj *objv[5];
-		SDL_MouseButtonEvent *e = (SDL_MouseButtonEvent *)&sdl_event;
-		objv[0] = Tcl_NewStringObj("sdl::onEvent", -1);
-		objv[1] = Tcl_NewStringObj(e->state == SDL_PRESSED 
-		    ? "ButtonPress" : "ButtonRelease", -1);
-		objv[2] = Tcl_NewIntObj(e->button);
-		objv[3] = Tcl_NewIntObj(e->x);
-		objv[4] = Tcl_NewIntObj(e->y);
-		BgEvalObjv(interp, ARRAYSIZEOF(objv), objv);
-                break;
-	    }
-		
-	    case SDL_MOUSEMOTION: {
-		Tcl_Obj *objv[7];
-		SDL_MouseMotionEvent *e = (SDL_MouseMotionEvent *)&sdl_event;
-		objv[0] = Tcl_NewStringObj("sdl::onEvent", -1);
-		objv[1] = Tcl_NewStringObj("Motion", -1);
-		objv[2] = Tcl_NewIntObj(e->state);
-		objv[3] = Tcl_NewIntObj(e->x);
-		objv[4] = Tcl_NewIntObj(e->y);
-		objv[5] = Tcl_NewIntObj(e->xrel);
-		objv[6] = Tcl_NewIntObj(e->yrel);
-		BgEvalObjv(interp, ARRAYSIZEOF(objv), objv);
-                break;
-	    }
-	    case TCLSDLEVENT: {
-		SDL_UserEvent *e = (SDL_UserEvent *)&sdl_event;
-		Tcl_Obj *objv[4];
-		objv[0] = Tcl_NewStringObj("sdl::onEvent", -1);
-		objv[1] = Tcl_NewStringObj("User", -1);
-		objv[2] = (Tcl_Obj *)e->data1;
-		objv[3] = (Tcl_Obj *)e->data2;
-		BgEvalObjv(interp, ARRAYSIZEOF(objv), objv);
-		Tcl_DecrRefCount((Tcl_Obj *)e->data1);
-		Tcl_DecrRefCount((Tcl_Obj *)e->data2);
-                break;
-	    }
-        }
-    }
-    return 1;
-}
-
-static void
-SetupProc(ClientData clientData, int flags) {
-    Tcl_Time block_time = {0, 0};
-    if (!(flags & TCL_WINDOW_EVENTS)) {
-        return;
-    }
-    /* If there are no events to process then set a wait */
-    if (!SDL_PollEvent(NULL)) {
-        block_time.usec = 10000;
-    }
-    Tcl_SetMaxBlockTime(&block_time);
-    return;
-}
-
-static void
-CheckProc(ClientData clientData, int flags) {
-    if (!(flags & TCL_WINDOW_EVENTS)) {
-        return;
-    }
-    /* if there are SDL events, fire a Tk event to get them processed */
-    if (SDL_PollEvent(NULL)) {
-        Tclsdl_Event *event = (Tclsdl_Event *)ckalloc(sizeof(Tclsdl_Event));
-        event->ev.proc = EventProc;
-	event->interp = (Tcl_Interp *)clientData;
-        Tcl_QueueEvent((Tcl_Event *)event, TCL_QUEUE_TAIL);
-    }
-    return;
-}
-
 static int
 WarpObjCmd(ClientData clientData, Tcl_Interp *interp, 
                   int objc, Tcl_Obj *const objv[])
@@ -221,38 +76,129 @@ InfoObjCmd(ClientData clientData, Tcl_Interp *interp,
     return TCL_OK;
 }
 
-static int
-EventObjCmd(ClientData clientData, Tcl_Interp *interp, 
-                  int objc, Tcl_Obj *const objv[])
-{
-    SDL_UserEvent event;
-    Tcl_Obj *tmpObj = NULL;
+/*
+ * sdl::config ?-option? ?value -option value ...?
+ *
+ * Package wide settings. With no arguments all the options and their
+ * values are returned.
+ *
+ *   -cachedir dir directory for the loaded image cache, empty for none
+ *   -eventmode m  poll to check for SDL events every 10ms, or thread to
+ *                 have SDL's event thread wake the event loop for each
+ *                 one; set before the first surface (see event.c)
+ *   -loaders n    most images decoded at once by sdl::surface load
+ *                 -async, 0 for one per processor
+ *   -poolbytes n  bytes of freed surfaces kept for reuse, 0 for none
+ *   -threads n    threads used for software rendering, 0 for one per
+ *                 processor
+ */
 
-    if (objc < 2 || objc > 3) {
-	Tcl_WrongNumArgs(interp, 1, objv, "eventname ?value?");
-	return TCL_ERROR;
+static const char *configOptions[] = {
+    "-cachedir", "-eventmode", "-loaders", "-poolbytes", "-threads", NULL
+};
+enum {
+    CONFIG_CACHEDIR, CONFIG_EVENTMODE, CONFIG_LOADERS, CONFIG_POOLBYTES,
+    CONFIG_THREADS
+};
+
+static Tcl_Obj *
+ConfigGet(int index)
+{
+    switch (index) {
+        case CONFIG_CACHEDIR:
+            return Tcl_NewStringObj(TclsdlCacheDir(), -1);
+        case CONFIG_EVENTMODE:
+            return Tcl_NewStringObj(TclsdlGetEventMode(), -1);
+        case CONFIG_LOADERS:
+            return Tcl_NewIntObj(TclsdlLoaderLimit());
+        case CONFIG_POOLBYTES:
+            return Tcl_NewLongObj(TclsdlSurfacePoolBudget());
+        case CONFIG_THREADS:
+            return Tcl_NewIntObj(TclsdlPoolThreads());
     }
+    return Tcl_NewObj();
+}
 
-    event.type = TCLSDLEVENT;
-    event.code = (int)0;
-    event.data2 = NULL;
+static int
+ConfigSet(Tcl_Interp *interp, int index, Tcl_Obj *valueObj)
+{
+    int n;
+
+    switch (index) {
+        case CONFIG_CACHEDIR:
+            return TclsdlSetCacheDir(interp, Tcl_GetString(valueObj));
+        case CONFIG_EVENTMODE:
+            return TclsdlSetEventMode(interp, valueObj);
+        case CONFIG_POOLBYTES: {
+            long bytes;
+
+            if (Tcl_GetLongFromObj(interp, valueObj, &bytes) != TCL_OK) {
+                return TCL_ERROR;
+            }
+            if (bytes < 0) {
+                Tcl_AppendResult(interp, "-poolbytes must not be negative",
+                                 NULL);
+                return TCL_ERROR;
+            }
+            TclsdlSetSurfacePoolBudget(bytes);
+            break;
+        }
+        case CONFIG_LOADERS:
+        case CONFIG_THREADS:
+            if (Tcl_GetIntFromObj(interp, valueObj, &n) != TCL_OK) {
+                return TCL_ERROR;
+            }
+            if (n < 0) {
+                Tcl_AppendResult(interp, configOptions[index],
+                                 " must not be negative", NULL);
+                return TCL_ERROR;
+            }
+            if (index == CONFIG_LOADERS) {
+                TclsdlSetLoaderLimit(n);
+            } else {
+                TclsdlSetPoolThreads(n);
+            }
+            break;
+    }
+    return TCL_OK;
+}
 
-    /* copy objv[1] into the event */
-    tmpObj = objv[1];
-    if (Tcl_IsShared(tmpObj)) {
-	tmpObj = Tcl_DuplicateObj(tmpObj);
+static int
+ConfigObjCmd(ClientData clientData, Tcl_Interp *interp,
+             int objc, Tcl_Obj *const objv[])
+{
+    Tcl_Obj *resultObj;
+    int n, index;
+
+    if (objc == 1) {
+        resultObj = Tcl_NewListObj(0, NULL);
+        for (n = 0; configOptions[n] != NULL; n++) {
+            Tcl_ListObjAppendElement(interp, resultObj,
+                Tcl_NewStringObj(configOptions[n], -1));
+            Tcl_ListObjAppendElement(interp, resultObj, ConfigGet(n));
+        }
+        Tcl_SetObjResult(interp, resultObj);
+        return TCL_OK;
     }
-    Tcl_IncrRefCount(tmpObj);
-    event.data1 = (void *)tmpObj;
-    
-    tmpObj = (objc == 3) ? objv[2] : Tcl_NewStringObj("", -1);
-    if (Tcl_IsShared(tmpObj)) {
-	tmpObj = Tcl_DuplicateObj(tmpObj);
+    if (objc == 2) {
+        if (Tcl_GetIndexFromObj(interp, objv[1], configOptions, "option", 0,
+                                &index) != TCL_OK) {
+            return TCL_ERROR;
+        }
+        Tcl_SetObjResult(interp, ConfigGet(index));
+        return TCL_OK;
+    }
+    if (objc % 2 == 0) {
+        Tcl_WrongNumArgs(interp, 1, objv, "?-option value ...?");
+        return TCL_ERROR;
+    }
+    for (n = 1; n < objc; n += 2) {
+        if (Tcl_GetIndexFromObj(interp, objv[n], configOptions, "option", 0,
+                                &index) != TCL_OK
+            || ConfigSet(interp, index, objv[n+1]) != TCL_OK) {
+            return TCL_ERROR;
+        }
     }
-    Tcl_IncrRefCount(tmpObj);
-    event.data2 = (void *)tmpObj;
-    
-    SDL_PushEvent((SDL_Event *)&event);
     return TCL_OK;
 }
 
@@ -272,6 +218,7 @@ WmObjCmd(ClientData clientData, Tcl_Interp *interp,
 static void
 InterpDeleteProc(ClientData clientData, Tcl_Interp *interp)
 {
+    TclsdlStopEvents(interp);
     SDL_Quit();
 }
         
@@ -299,15 +246,28 @@ Tclsdl_Init(Tcl_Interp *interp)
     Tcl_CallWhenDeleted(interp, InterpDeleteProc, NULL);
 
     /* Register our eventloop integration */
-    Tcl_CreateEventSource(SetupProc, CheckProc, interp);
+    TclsdlInitEvents(interp);
 
     Tcl_CreateObjCommand(interp, "sdl::surface", SurfaceObjCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "sdl::mixer", MixerObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::spriteset", SpriteSetObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::collider", ColliderObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::palette", PaletteObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::atlas", AtlasObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::cache", CacheObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::pool", SurfPoolObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::config", ConfigObjCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "sdl::warp", WarpObjCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "sdl::version", VersionObjCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "sdl::videoinfo", InfoObjCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "sdl::wm", WmObjCmd, NULL, NULL);
     Tcl_CreateObjCommand(interp, "sdl::event", EventObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::bind", BindObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::batch", BatchObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::coalesce", CoalesceObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::keystate", KeyStateObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::joystick", JoystickObjCmd, NULL, NULL);
+    Tcl_CreateObjCommand(interp, "sdl::viewbytes", ViewBytesObjCmd, NULL, NULL);
 
     if (Tcl_Eval(interp, initScript) != TCL_OK)
 	return TCL_ERROR;
@@ -40,10 +40,37 @@ extern "C" {
 /* Package scope */
 Tcl_ObjCmdProc SurfaceObjCmd;
 Tcl_ObjCmdProc MixerObjCmd;
+Tcl_ObjCmdProc SpriteSetObjCmd;
+Tcl_ObjCmdProc ColliderObjCmd;
+Tcl_ObjCmdProc PaletteObjCmd;
+Tcl_ObjCmdProc AtlasObjCmd;
+Tcl_ObjCmdProc CacheObjCmd;
+Tcl_ObjCmdProc SurfPoolObjCmd;
+Tcl_ObjCmdProc EventObjCmd;
+Tcl_ObjCmdProc BindObjCmd;
+Tcl_ObjCmdProc BatchObjCmd;
+Tcl_ObjCmdProc CoalesceObjCmd;
+Tcl_ObjCmdProc KeyStateObjCmd;
+Tcl_ObjCmdProc JoystickObjCmd;
+Tcl_ObjCmdProc ViewBytesObjCmd;
+
+/*
+ * Pixels behind a value returned by "$surface view". The rows are pitch
+ * bytes apart and each holds width pixels of bytesPerPixel bytes in the
+ * surface's own pixel format.
+ */
+typedef struct Tclsdl_PixelView {
+    unsigned char *pixels;      /* top left pixel of the view */
+    int width, height;
+    int pitch;
+    int bytesPerPixel;
+} Tclsdl_PixelView;
 
 /* API Functions */
 PKGAPI int  Tclsdl_BackgroundEvalObjv(Tcl_Interp *interp, 
     int objc, Tcl_Obj *const *objv, int flags);
+PKGAPI int  Tclsdl_GetPixelViewFromObj(Tcl_Interp *interp,
+    Tcl_Obj *objPtr, Tclsdl_PixelView *viewPtr);
 
 
 #ifdef __cplusplus
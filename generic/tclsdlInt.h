@@ -0,0 +1,226 @@
+/*
+ * Definitions shared between the tclsdl source files but not part of
+ * the public package interface.
+ */
+
+#ifndef TCLSDLINT_H_INCLUDE
+#define TCLSDLINT_H_INCLUDE 1
+
+#include "tclsdl.h"
+#include <SDL/SDL.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef INT2PTR
+#define INT2PTR(p) ((void *)(ptrdiff_t)(p))
+#define PTR2INT(p) ((int)(ptrdiff_t)(p))
+#endif
+
+/*
+ * Maximum number of separate dirty rectangles recorded for the video
+ * surface before further damage is merged into the nearest one.
+ */
+#define TCLSDL_MAX_DIRTY 64
+
+/*
+ * One bit per pixel collision mask, rows packed into 64 bit words with
+ * the leftmost pixel in the least significant bit.
+ */
+typedef struct CollisionMask {
+    int           w, h;
+    int           stride;       /* words per row */
+    int           valid;        /* cleared when the pixels are written */
+    Tcl_WideUInt  bits[1];
+} CollisionMask;
+
+typedef struct PixelView PixelView;
+
+typedef struct SurfaceData {
+    SDL_Surface  *surface;
+    Tcl_Command   token;
+    unsigned long windowid;
+    SDL_Rect     *dirty;        /* damaged areas of the video surface */
+    int           ndirty;
+    CollisionMask *mask;        /* built on demand by collide */
+    PixelView    *views;        /* live views of the pixels */
+    int           lockCount;    /* nesting of lock and withlock */
+    int           deleted;      /* command deleted, handles are stale */
+    unsigned long renames;      /* bumped when the command is renamed */
+} SurfaceData;
+
+struct Ensemble {
+    const char *name;          /* subcommand name */
+    Tcl_ObjCmdProc *command;   /* subcommand implementation OR */
+    struct Ensemble *ensemble; /* subcommand ensemble */
+};
+
+/*
+ * Packed blit record as accepted by "blitmany -packed": six native
+ * endian 16 bit integers per blit. A zero sw and sh blits the whole
+ * source surface.
+ */
+typedef struct BlitRecord {
+    Sint16 x, y, sx, sy;
+    Uint16 sw, sh;
+} BlitRecord;
+
+/*
+ * Processor features reported by TclsdlCpuFeatures.
+ */
+#define TCLSDL_CPU_SSE2  0x01
+#define TCLSDL_CPU_SSSE3 0x02
+#define TCLSDL_CPU_AVX2  0x04
+
+/* most threads the render pool will use */
+#define TCLSDL_MAX_THREADS 64
+
+/*
+ * Remembers recent nearest colour lookups when mapping RGB values onto
+ * a palette.
+ */
+#define TCLSDL_MAPCACHE_SIZE 4096
+
+typedef struct MapCache {
+    Uint32 rgb[TCLSDL_MAPCACHE_SIZE];
+    Uint8  index[TCLSDL_MAPCACHE_SIZE];
+} MapCache;
+
+/* cpu.c */
+int TclsdlCpuFeatures(void);
+int TclsdlCpuCount(void);
+
+/* surface.c */
+SurfaceData *TclsdlNewSurfaceCommand(Tcl_Interp *interp,
+    SDL_Surface *surface, unsigned long windowid);
+int TclsdlGetSurfaceFromObj(Tcl_Interp *interp, Tcl_Obj *objPtr,
+    SurfaceData **dataPtrPtr);
+int TclsdlGetColorFromObj(Tcl_Interp *interp, SDL_Surface *surface,
+    Tcl_Obj *objPtr, Uint32 *colorPtr);
+int TclsdlGetRectFromObj(Tcl_Interp *interp, Tcl_Obj *objPtr,
+    SDL_Rect *rectPtr);
+Tcl_Obj *TclsdlNewRectObj(const SDL_Rect *rectPtr);
+void TclsdlSurfaceDamage(SurfaceData *dataPtr, const SDL_Rect *rectPtr);
+int  TclsdlLockSurface(Tcl_Interp *interp, SurfaceData *dataPtr);
+void TclsdlUnlockSurface(SurfaceData *dataPtr);
+int  TclsdlMaskOverlap(SurfaceData *aPtr, const SDL_Rect *aRectPtr,
+    SurfaceData *bPtr, const SDL_Rect *bRectPtr, int dx, int dy);
+
+/* convert.c */
+Tcl_ObjCmdProc TclsdlSurfaceExportCmd;
+Tcl_ObjCmdProc TclsdlSurfaceImportCmd;
+Uint32 TclsdlReadPixel(const Uint8 *p, int bpp);
+void   TclsdlWritePixel(Uint8 *p, int bpp, Uint32 pixel);
+void   TclsdlUnpackPixel(SDL_PixelFormat *fmt, Uint32 pixel, Uint32 c[4]);
+void   TclsdlInitMapCache(MapCache *cachePtr);
+Uint32 TclsdlMapColor(SDL_PixelFormat *fmt, MapCache *cachePtr,
+    Uint32 r, Uint32 g, Uint32 b);
+
+/* blend.c */
+Tcl_ObjCmdProc TclsdlSurfaceBlendCmd;
+
+/* pixview.c */
+Tcl_ObjCmdProc TclsdlSurfaceViewCmd;
+void TclsdlDetachPixelViews(SurfaceData *dataPtr);
+int  TclsdlLockPixelView(Tcl_Interp *interp, Tcl_Obj *objPtr,
+    Tclsdl_PixelView *viewPtr, SurfaceData **lockedPtr);
+
+/* generate.c */
+Tcl_ObjCmdProc TclsdlSurfaceGenerateCmd;
+
+/* draw.c */
+Tcl_ObjCmdProc TclsdlSurfaceLineCmd;
+Tcl_ObjCmdProc TclsdlSurfaceHLineCmd;
+Tcl_ObjCmdProc TclsdlSurfaceRectCmd;
+Tcl_ObjCmdProc TclsdlSurfaceCircleCmd;
+Tcl_ObjCmdProc TclsdlSurfaceEllipseCmd;
+Tcl_ObjCmdProc TclsdlSurfaceTriangleCmd;
+Tcl_ObjCmdProc TclsdlSurfacePolygonCmd;
+Tcl_ObjCmdProc TclsdlSurfacePlotCmd;
+Tcl_ObjCmdProc TclsdlSurfaceSampleCmd;
+void TclsdlFillRect(SDL_Surface *surface, const SDL_Rect *rectPtr,
+    Uint32 pixel);
+
+/* pool.c */
+typedef void (TclsdlTaskProc)(ClientData clientData, int task);
+typedef void (TclsdlRowsProc)(ClientData clientData, int y0, int y1);
+int  TclsdlPoolThreads(void);
+void TclsdlSetPoolThreads(int nthreads);
+void TclsdlParallelFor(int ntasks, TclsdlTaskProc *proc,
+    ClientData clientData);
+void TclsdlParallelRows(int rows, int rowBytes, TclsdlRowsProc *proc,
+    ClientData clientData);
+
+/* image.c */
+typedef struct TclsdlMappedFile {
+    const Uint8 *data;
+    size_t       size;
+    void        *handle;        /* platform mapping handle */
+} TclsdlMappedFile;
+
+int  TclsdlMapFile(const char *path, int copyOnWrite,
+    TclsdlMappedFile *mapPtr);
+void TclsdlUnmapFile(TclsdlMappedFile *mapPtr);
+
+/*
+ * The display format that images are decoded to, taken on the thread
+ * that sets the video mode so decoding threads never look at the video
+ * surface. format points into the structure, which must not be copied.
+ */
+typedef struct TclsdlDisplay {
+    SDL_PixelFormat *format;    /* NULL before a video mode is set */
+    SDL_PixelFormat  pixelFormat;
+    SDL_Palette      palette;
+    SDL_Color        colors[256];
+} TclsdlDisplay;
+
+void TclsdlGetDisplay(TclsdlDisplay *dispPtr);
+SDL_Surface *TclsdlDecodeImage(const Uint8 *data, size_t size,
+    const TclsdlDisplay *dispPtr);
+SDL_Surface *TclsdlLoadImage(const char *path, const TclsdlDisplay *dispPtr);
+SDL_Surface *TclsdlNewImageSurface(int w, int h, int alpha);
+
+/* loader.c */
+Tcl_ObjCmdProc TclsdlSurfaceLoadCmd;
+int  TclsdlLoaderLimit(void);
+void TclsdlSetLoaderLimit(int limit);
+
+/* cache.c */
+int  TclsdlCacheEnabled(void);
+SDL_Surface *TclsdlCacheLoadImage(const char *path,
+    const TclsdlDisplay *dispPtr);
+void TclsdlFreeSurface(SDL_Surface *surface);
+const char *TclsdlCacheDir(void);
+int  TclsdlSetCacheDir(Tcl_Interp *interp, const char *dir);
+
+/* surfpool.c */
+SDL_Surface *TclsdlAcquireSurface(Uint32 flags, int w, int h, int depth,
+    Uint32 rmask, Uint32 gmask, Uint32 bmask, Uint32 amask);
+void TclsdlRecycleSurface(SDL_Surface *surface);
+long TclsdlSurfacePoolBudget(void);
+void TclsdlSetSurfacePoolBudget(long bytes);
+
+/* event.c */
+void TclsdlInitEvents(Tcl_Interp *interp);
+void TclsdlStopEvents(Tcl_Interp *interp);
+const char *TclsdlGetEventMode(void);
+int TclsdlSetEventMode(Tcl_Interp *interp, Tcl_Obj *modeObj);
+
+/* palette.c */
+extern struct Ensemble surfacePaletteEnsemble[];
+int TclsdlGetColorsFromObj(Tcl_Interp *interp, Tcl_Obj *listObj,
+    SDL_Color **colorsPtr, int *countPtr);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TCLSDLINT_H_INCLUDE */
+
+/*
+ * Local variables:
+ *   indent-tabs-mode: t
+ *   tab-width: 8
+ * End:
+ */
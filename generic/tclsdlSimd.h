@@ -0,0 +1,29 @@
+/*
+ * Compiler support for the x86 vector code paths. Functions using the
+ * intrinsics are marked with TCLSDL_TARGET so the rest of the package
+ * can still be built for the baseline processor, and callers must check
+ * TclsdlCpuFeatures before using them.
+ */
+
+#ifndef TCLSDLSIMD_H_INCLUDE
+#define TCLSDLSIMD_H_INCLUDE 1
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TCLSDL_X86 1
+#define TCLSDL_TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define TCLSDL_X86 1
+#define TCLSDL_TARGET(isa)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+#endif /* TCLSDLSIMD_H_INCLUDE */
+
+/*
+ * Local variables:
+ *   indent-tabs-mode: t
+ *   tab-width: 8
+ * End:
+ */